@@ -0,0 +1,208 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CIO_BACKEND_SET_H
+#define CIO_BACKEND_SET_H
+
+#include <stdint.h>
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * @brief This file contains the interface of a set of outbound connections
+ * requests are balanced across.
+ *
+ * For every request, two members of the set are picked at random and the
+ * one with the lower expected cost is chosen. The cost of a member is its
+ * number of outstanding requests weighted with an exponentially weighted
+ * moving average of its request latency. A slow member therefore quickly
+ * gets less traffic without a single global scan over all members.
+ *
+ * A member whose request failed is ejected from the selection for a
+ * configurable time. If all members are ejected, requests are spread over
+ * the ejected members instead of failing.
+ */
+
+struct cio_backend_set;
+
+/**
+ * @brief The cio_backend struct describes a member of a cio_backend_set.
+ *
+ * The storage is owned by the caller and must stay valid until the member
+ * was @ref cio_backend_set_remove "removed" and all requests
+ * @ref cio_backend_set_select "selected" for it were
+ * @ref cio_backend_set_complete "completed".
+ */
+struct cio_backend {
+	/**
+	 * @privatesection
+	 */
+	struct cio_backend_set *set;
+	struct cio_socket *socket;
+	uint64_t latency_ns;
+	uint64_t ejected_until_ns;
+	unsigned int outstanding;
+	unsigned int index;
+};
+
+/**
+ * @brief The cio_backend_request struct describes a request that is
+ * in flight on a member of a cio_backend_set.
+ */
+struct cio_backend_request {
+	/**
+	 * @brief The member selected for the request.
+	 */
+	struct cio_backend *backend;
+
+	/**
+	 * @brief The outbound connection the request shall be sent on.
+	 */
+	struct cio_socket *socket;
+
+	/**
+	 * @privatesection
+	 */
+	uint64_t start_ns;
+};
+
+/**
+ * @brief The cio_backend_set struct describes a set of outbound connections.
+ */
+struct cio_backend_set {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * specified below.
+	 */
+	void *context;
+
+	/**
+	 * @anchor cio_backend_set_add
+	 * @brief Adds a member to the set.
+	 *
+	 * @param context The cio_backend_set::context.
+	 * @param backend The member to be added.
+	 * @param socket The connected outbound socket of the member.
+	 *
+	 * @return ::cio_success for success, ::cio_no_buffer_space if the
+	 * set already contains the maximum number of members.
+	 */
+	enum cio_error (*add)(void *context, struct cio_backend *backend, struct cio_socket *socket);
+
+	/**
+	 * @anchor cio_backend_set_remove
+	 * @brief Removes a member from the set.
+	 *
+	 * The member is not selected anymore. Requests that are still in
+	 * flight on the member must nevertheless be completed.
+	 *
+	 * @param context The cio_backend_set::context.
+	 * @param backend The member to be removed.
+	 */
+	void (*remove)(void *context, struct cio_backend *backend);
+
+	/**
+	 * @anchor cio_backend_set_select
+	 * @brief Selects the member a request shall be sent to.
+	 *
+	 * On success, cio_backend_request::backend and
+	 * cio_backend_request::socket are set and the request is counted as
+	 * outstanding on the member until it is
+	 * @ref cio_backend_set_complete "completed".
+	 *
+	 * @param context The cio_backend_set::context.
+	 * @param request Storage for the request while it is in flight.
+	 *
+	 * @return ::cio_success for success, ::cio_address_not_available if the
+	 * set has no members.
+	 */
+	enum cio_error (*select)(void *context, struct cio_backend_request *request);
+
+	/**
+	 * @anchor cio_backend_set_complete
+	 * @brief Reports that a request has finished.
+	 *
+	 * The time since the request was selected is fed into the latency
+	 * average of the member. If @p err indicates a failed read or write,
+	 * the member is ejected from the selection.
+	 *
+	 * @param context The cio_backend_set::context.
+	 * @param request The request that was passed to
+	 * @ref cio_backend_set_select "select".
+	 * @param err The outcome of the request. ::cio_operation_aborted
+	 * doesn't eject the member, because the request was cancelled locally.
+	 */
+	void (*complete)(void *context, struct cio_backend_request *request, enum cio_error err);
+
+	/**
+	 * @anchor cio_backend_set_close
+	 * @brief Frees all resources of the set.
+	 *
+	 * The sockets of the members are not closed.
+	 *
+	 * @param context The cio_backend_set::context.
+	 */
+	void (*close)(void *context);
+
+	/**
+	 * @privatesection
+	 */
+	struct cio_eventloop *loop;
+	struct cio_backend **members;
+	unsigned int num_members;
+	unsigned int num_healthy;
+	unsigned int max_members;
+	uint64_t eject_time_ns;
+	uint32_t random_state;
+};
+
+/**
+ * @brief Initializes a cio_backend_set.
+ *
+ * @param set The cio_backend_set that should be initialized.
+ * @param loop The event loop the members operate on. Its time is used
+ * to measure the request latencies.
+ * @param max_members The maximum number of members of the set.
+ * @param eject_time_ns The time in nanoseconds a member is ejected after a
+ * failed request. If @p 0, members are never ejected.
+ *
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_backend_set_init(struct cio_backend_set *set, struct cio_eventloop *loop,
+                                    unsigned int max_members, uint64_t eject_time_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
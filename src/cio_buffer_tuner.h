@@ -0,0 +1,126 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CIO_BUFFER_TUNER_H
+#define CIO_BUFFER_TUNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * @brief This file contains the interface of a tuner that sizes the kernel
+ * buffers of TCP sockets.
+ *
+ * The tuner periodically samples the round trip time, the delivery rate
+ * and the congestion window of the @ref cio_socket_use_buffer_tuner "attached"
+ * sockets and sizes their send and receive buffers towards twice the
+ * bandwidth-delay product of the connection. Fast connections over long
+ * distances get the buffers they need to fill the link, while idle or
+ * slow connections keep small buffers.
+ *
+ * The sum of all buffer sizes the tuner configured is kept below a global
+ * limit. If the limit is reached, buffers only grow after others shrank.
+ *
+ * All sizes the tuner works with are the sizes the kernel really reserves
+ * for a buffer, i.e. the values getsockopt() reports for SO_SNDBUF and
+ * SO_RCVBUF. Linux doubles the value passed to setsockopt() to make room
+ * for its bookkeeping, so the tuner requests half of the size it wants.
+ * The kernel caps the sizes at twice net.core.wmem_max and
+ * net.core.rmem_max, the tuner accounts for the capped sizes then.
+ *
+ * Please note that the kernel doesn't auto-tune the buffers of a socket
+ * anymore once they were sized explicitly.
+ */
+
+struct cio_socket;
+
+/**
+ * @brief The cio_buffer_tuner struct describes a tuner for socket buffers.
+ */
+struct cio_buffer_tuner {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * specified below.
+	 */
+	void *context;
+
+	/**
+	 * @anchor cio_buffer_tuner_close
+	 * @brief Stops tuning the buffers of all attached sockets.
+	 *
+	 * The sockets keep their current buffer sizes.
+	 *
+	 * @param context The cio_buffer_tuner::context.
+	 */
+	void (*close)(void *context);
+
+	/**
+	 * @privatesection
+	 */
+	struct cio_eventloop *loop;
+	struct cio_linux_deadline tick;
+	struct cio_socket *sockets;
+	struct cio_socket *cursor;
+	uint64_t interval_ns;
+	size_t min_buffer_size;
+	size_t max_buffer_size;
+	size_t memory_limit;
+	size_t memory_used;
+	unsigned int num_sockets;
+};
+
+/**
+ * @brief Initializes a cio_buffer_tuner.
+ *
+ * @param tuner The cio_buffer_tuner that should be initialized.
+ * @param loop The event loop the attached sockets operate on.
+ * @param interval_ns The time in nanoseconds between two samples of
+ * the same socket. If @p 0, a platform specific default is used.
+ * @param min_buffer_size The smallest size of a send or receive buffer in bytes.
+ * @param max_buffer_size The largest size of a send or receive buffer in bytes.
+ * @param memory_limit The maximum sum of the send and receive buffer
+ * sizes of all attached sockets in bytes, including the share the kernel
+ * reserves for its bookkeeping.
+ *
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_buffer_tuner_init(struct cio_buffer_tuner *tuner, struct cio_eventloop *loop,
+                                     uint64_t interval_ns, size_t min_buffer_size,
+                                     size_t max_buffer_size, size_t memory_limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CIO_CONNECTION_POOL_H
+#define CIO_CONNECTION_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * @brief This file contains the interface of a pool of outbound connections.
+ *
+ * A connection pool keeps established connections to remote endpoints
+ * open after they were used, so subsequent requests to the same endpoint
+ * don't have to pay for a new connection setup. The most recently used
+ * idle connection is always reused first.
+ *
+ * Idle connections are watched by the event loop. If the peer closes an
+ * idle connection or sends unexpected data, the connection is closed and
+ * removed from the pool.
+ */
+
+struct cio_pool_endpoint;
+
+/**
+ * @brief The type of a function that is called when a connection was
+ * @ref cio_connection_pool_borrow "borrowed" from a pool.
+ *
+ * @param endpoint The endpoint the connection was borrowed for.
+ * @param handler_context The context the functions works on.
+ * @param err If err != ::cio_success, no connection could be established.
+ * @param socket The borrowed connection. Must be given back via
+ * @ref cio_connection_pool_release "release".
+ */
+typedef void (*cio_pool_borrow_handler)(struct cio_pool_endpoint *endpoint, void *handler_context, enum cio_error err, struct cio_socket *socket);
+
+/**
+ * @brief The cio_pool_request struct describes a pending borrow request.
+ *
+ * The request is owned by the caller and must stay valid until its
+ * handler was called.
+ */
+struct cio_pool_request {
+	/**
+	 * @privatesection
+	 */
+	cio_pool_borrow_handler handler;
+	void *handler_context;
+	struct cio_pool_request *next;
+};
+
+/**
+ * @privatesection
+ */
+struct cio_pool_connection {
+	struct cio_socket socket;
+	struct cio_socket_connect_state *connect_state;
+	struct cio_pool_endpoint *endpoint;
+	struct cio_pool_request *request;
+	struct cio_pool_connection *next;
+	struct cio_pool_connection **pprev;
+	bool idle;
+};
+
+/**
+ * @brief The cio_pool_endpoint struct describes a remote endpoint
+ * connections are pooled for.
+ */
+struct cio_pool_endpoint {
+	/**
+	 * @privatesection
+	 */
+	struct cio_connection_pool *pool;
+	struct addrinfo *addresses;
+	struct cio_pool_connection *connections;
+	struct cio_pool_connection *free_connections;
+	struct cio_pool_connection *idle_connections;
+	struct cio_pool_request *waiters;
+	struct cio_pool_request **waiters_tail;
+	unsigned int num_open;
+	unsigned int num_idle;
+	bool removed;
+};
+
+/**
+ * @brief The cio_connection_pool struct describes a pool of outbound connections.
+ */
+struct cio_connection_pool {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * specified below.
+	 */
+	void *context;
+
+	/**
+	 * @anchor cio_connection_pool_add_endpoint
+	 * @brief Adds an endpoint to the pool.
+	 *
+	 * The endpoint is resolved and all memory the pool needs for the
+	 * connections to this endpoint is allocated here, so borrowing and
+	 * releasing connections neither blocks nor allocates. Resolving a host
+	 * name is done synchronously, so endpoints should be added outside of
+	 * the hot path.
+	 *
+	 * @param context The cio_connection_pool::context.
+	 * @param endpoint The endpoint to be added.
+	 * @param address The host name or IP address of the endpoint.
+	 * @param port The TCP port of the endpoint.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*add_endpoint)(void *context, struct cio_pool_endpoint *endpoint, const char *address, uint16_t port);
+
+	/**
+	 * @anchor cio_connection_pool_remove_endpoint
+	 * @brief Removes an endpoint from the pool.
+	 *
+	 * All idle connections are closed and pending borrow requests are
+	 * completed with ::cio_operation_aborted. Connections that are
+	 * currently borrowed are closed when they are released. The endpoint
+	 * must not be used anymore after calling this function.
+	 *
+	 * @param context The cio_connection_pool::context.
+	 * @param endpoint The endpoint to be removed.
+	 */
+	void (*remove_endpoint)(void *context, struct cio_pool_endpoint *endpoint);
+
+	/**
+	 * @anchor cio_connection_pool_borrow
+	 * @brief Borrows a connection to an endpoint.
+	 *
+	 * If an idle connection is available, @p handler is called immediately.
+	 * Otherwise a new connection is established if the endpoint has less
+	 * than the maximum number of connections open. If not, the request
+	 * waits until a connection is released.
+	 *
+	 * @param context The cio_connection_pool::context.
+	 * @param endpoint The endpoint a connection is requested for.
+	 * @param request Storage for the request while it is pending.
+	 * @param handler The function to be called when the connection is available.
+	 * @param handler_context The context passed to the @a handler function.
+	 */
+	void (*borrow)(void *context, struct cio_pool_endpoint *endpoint, struct cio_pool_request *request, cio_pool_borrow_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_connection_pool_release
+	 * @brief Gives a borrowed connection back to the pool.
+	 *
+	 * No read or write operation must be pending on the connection.
+	 *
+	 * @param context The cio_connection_pool::context.
+	 * @param socket The borrowed connection.
+	 * @param reuse If @p false, the connection is closed, e.g. because the
+	 * protocol state of the connection is unknown.
+	 */
+	void (*release)(void *context, struct cio_socket *socket, bool reuse);
+
+	/**
+	 * @privatesection
+	 */
+	struct cio_eventloop *loop;
+	unsigned int max_total;
+	unsigned int max_idle;
+	uint64_t idle_timeout_ns;
+	uint64_t connect_timeout_ns;
+};
+
+/**
+ * @brief Initializes a cio_connection_pool.
+ *
+ * @param pool The cio_connection_pool that should be initialized.
+ * @param loop The event loop the connections shall operate on.
+ * @param max_total The maximum number of open connections per endpoint,
+ * including connections that are borrowed or being established.
+ * @param max_idle The maximum number of idle connections kept open per endpoint.
+ * @param idle_timeout_ns Idle connections are closed after this time in
+ * nanoseconds. If @p 0, idle connections are kept open until the peer closes them.
+ * @param connect_timeout_ns The timeout for establishing a new connection
+ * in nanoseconds. If @p 0, the connect doesn't time out.
+ */
+void cio_connection_pool_init(struct cio_connection_pool *pool, struct cio_eventloop *loop,
+                              unsigned int max_total, unsigned int max_idle,
+                              uint64_t idle_timeout_ns, uint64_t connect_timeout_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -47,6 +47,7 @@ enum cio_error {
 	cio_bad_file_descriptor = EBADF,                 /*!< Bad file descriptor. */
 	cio_file_exists = EEXIST,                        /*!< File exists. */
 	cio_filename_too_long = ENAMETOOLONG,            /*!< File name too long. */
+	cio_input_output_error = EIO,                    /*!< Input/output error. */
 	cio_invalid_argument = EINVAL,                   /*!< Invalid argument. */
 	cio_no_buffer_space = ENOBUFS,                   /*!< No buffer space. */
 	cio_no_protocol_option = ENOPROTOOPT,            /*!< No protocol option. */
@@ -59,6 +60,8 @@ enum cio_error {
 	cio_permission_denied = EACCES,                  /*!< Permission denied. */
 	cio_protocol_not_supported = EPROTONOSUPPORT,    /*!< Protocol not supported. */
 	cio_read_only_file_system = EROFS,               /*!< Read only file system. */
+	cio_resource_temporarily_unavailable = EAGAIN,   /*!< Resource temporarily unavailable. */
+	cio_timed_out = ETIMEDOUT,                       /*!< Operation timed out. */
 	cio_too_many_files_open = EMFILE,                /*!< Too many files open. */
 	cio_too_many_symbolic_link_levels = ELOOP,       /*!< Too many symbolic link levels. */
 	cio_operation_aborted = ECANCELED                /*!< Operation cancelled. */
@@ -27,6 +27,9 @@
 #ifndef CIO_EVENTLOOP_H
 #define CIO_EVENTLOOP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "cio_error_code.h"
 #include "cio_eventloop_impl.h"
 
@@ -41,6 +44,31 @@ void cio_eventloop_destroy(const struct cio_eventloop *loop);
 enum cio_error cio_eventloop_run(struct cio_eventloop *loop);
 void cio_eventloop_cancel(struct cio_eventloop *loop);
 
+/**
+ * @brief Gets the histogram of the time received data waited in the
+ * kernel before a socket of the loop read it.
+ *
+ * Only sockets with @ref cio_socket_set_receive_timestamps "receive timestamps"
+ * enabled contribute to the histogram. A growing delay means the loop is
+ * saturated and can't keep up with the incoming data.
+ *
+ * @param loop The event loop.
+ * @param histogram Filled with the delays recorded so far.
+ * @param reset If @p true, the histogram of the loop is cleared afterwards.
+ */
+void cio_eventloop_get_receive_delays(struct cio_eventloop *loop, struct cio_delay_histogram *histogram, bool reset);
+
+/**
+ * @brief Estimates a percentile of the delays in a histogram.
+ *
+ * @param histogram The histogram.
+ * @param permille The percentile in permille, e.g. @p 990 for the 99th percentile.
+ *
+ * @return The upper bound in nanoseconds of the bucket containing the
+ * percentile, @p 0 if the histogram is empty.
+ */
+uint64_t cio_delay_histogram_percentile(const struct cio_delay_histogram *histogram, unsigned int permille);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,7 +28,9 @@
 #define CIO_IO_STREAM_H
 
 #include <stddef.h>
+#include <sys/uio.h>
 
+#include "cio_buffer_allocator.h"
 #include "cio_stream_handler.h"
 
 #ifdef __cplusplus
@@ -44,14 +46,10 @@ extern "C" {
 /**
  * @brief This structure describes the interface all implementations
  * have to fulfill.
+ *
+ * See ::CIO_SOCKET_ABI_VERSION for how the table is shared and extended.
  */
-struct cio_io_stream {
-	/**
-	 * @brief The context pointer which is passed to the
-	 * cio_io_stream::read and cio_io_stream::close functions.
-	 */
-	void *context;
-
+struct cio_io_stream_ops {
 	/**
 	 * @brief Read upto @p count bytes into the buffer @p buf starting
 	 * with offset @p offset.
@@ -81,6 +79,67 @@ struct cio_io_stream {
 	 */
 	void (*write_some)(void *context, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context);
 
+	/**
+	 * @brief Read into a vector of buffers (scatter read).
+	 *
+	 * The buffers are filled in order. The handler is called as soon as
+	 * some data was read, so the vector might be filled only partly.
+	 *
+	 * @param context A pointer to the cio_io_stream::context of the
+	 * implementation implementing this interface.
+	 * @param iov The buffer vector to be filled. The vector must stay
+	 * valid until @p handler is called.
+	 * @param iovcnt The number of elements in @p iov.
+	 * @param handler The callback function to be called when the read
+	 * request is (partly) fulfilled.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 */
+	void (*readv_some)(void *context, struct iovec *iov, unsigned int iovcnt, cio_stream_readv_handler handler, void *handler_context);
+
+	/**
+	 * @brief Waits until the stream is readable and reads into a buffer
+	 * that is allocated only then.
+	 *
+	 * In contrast to cio_io_stream_ops::read_some, no buffer is bound to the
+	 * stream while waiting for data, so a stream waiting for data that
+	 * arrives rarely doesn't hold any read buffer.
+	 *
+	 * If @p bytes_transferred passed to @p handler is greater than zero, @p handler
+	 * takes ownership of @p buf and has to release it via @p allocator.
+	 * Otherwise @p buf is @p NULL.
+	 *
+	 * @param context A pointer to the cio_io_stream::context of the
+	 * implementation implementing this interface.
+	 * @param allocator The allocator the read buffer is obtained from. The
+	 * allocator must stay valid until @p handler is called.
+	 * @param size The requested size of the read buffer.
+	 * @param handler The callback function to be called when the read
+	 * request is (partly) fulfilled.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 */
+	void (*read_some_allocated)(void *context, const struct cio_buffer_allocator *allocator, size_t size, cio_stream_read_handler handler, void *handler_context);
+
+	/**
+	 * @brief Writes a vector of buffers to the stream (gather write).
+	 *
+	 * All buffers are handed to the operating system in a single call.
+	 * The handler gets the total number of bytes written, which might be
+	 * less than the sum of all buffer lengths.
+	 *
+	 * @param context A pointer to the cio_io_stream::context of the
+	 * implementation implementing this interface.
+	 * @param iov The buffer vector where the data is written from. The vector
+	 * must stay valid until @p handler is called.
+	 * @param iovcnt The number of elements in @p iov.
+	 * @param handler The callback function to be called when the write
+	 * request is (partly) fulfilled.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 */
+	void (*writev_some)(void *context, const struct iovec *iov, unsigned int iovcnt, cio_stream_write_handler handler, void *handler_context);
+
 	/**
 	 * @brief Closes the stream.
 	 *
@@ -89,16 +148,39 @@ struct cio_io_stream {
 	 * associated with this stream.
 	 */
 	void (*close)(void *context);
+};
+
+/**
+ * @brief An I/O stream.
+ */
+struct cio_io_stream {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * in cio_io_stream::ops.
+	 */
+	void *context;
+
+	/**
+	 * @brief The operations of this stream.
+	 */
+	const struct cio_io_stream_ops *ops;
 
 	/**
 	 * @privatesection
 	 */
 	cio_stream_read_handler read_handler;
+	cio_stream_readv_handler readv_handler;
 	void *read_handler_context;
 	size_t read_count;
 	void *read_buffer;
+	const struct cio_buffer_allocator *read_allocator;
+	struct iovec *read_iov;
 	cio_stream_write_handler write_handler;
 	void *write_handler_context;
+	const struct iovec *write_iov;
+	struct iovec write_buffer;
+	unsigned int read_iovcnt;
+	unsigned int write_iovcnt;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,171 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CIO_RELAY_H
+#define CIO_RELAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cio_error_code.h"
+#include "cio_socket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * @brief This file contains the interface of a relay between two sockets.
+ *
+ * A relay forwards all data received on one socket to the other socket
+ * and vice versa. The data is moved inside the kernel and never copied
+ * to user space. If one side can't keep up, the relay stops reading from
+ * the other side until the data could be forwarded.
+ */
+
+struct cio_relay;
+
+/**
+ * @brief The type of a function that is called when a relay finished.
+ *
+ * @param relay The relay that finished.
+ * @param handler_context The context the functions works on.
+ * @param err If err == ::cio_success, both sockets signalled the end of
+ * their data streams and all data was forwarded. Otherwise forwarding
+ * failed on one of the sockets.
+ */
+typedef void (*cio_relay_handler)(struct cio_relay *relay, void *handler_context, enum cio_error err);
+
+/**
+ * @brief The type of close hook function.
+ *
+ * @param relay The cio_relay the close hook was called on.
+ */
+typedef void (*cio_relay_close_hook)(struct cio_relay *relay);
+
+/**
+ * @privatesection
+ */
+struct cio_relay_endpoint {
+	struct cio_socket *socket;
+	struct cio_relay *relay;
+	int pipe_fds[2];
+	size_t pipe_fill;
+	uint64_t bytes_forwarded;
+	void (*saved_read_callback)(void *context);
+	void (*saved_write_callback)(void *context);
+	void (*saved_error_callback)(void *context);
+	void *saved_context;
+	bool eof;
+	bool shut_down;
+};
+
+/**
+ * @brief The cio_relay struct describes a bidirectional relay between two sockets.
+ */
+struct cio_relay {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * specified below.
+	 */
+	void *context;
+
+	/**
+	 * @anchor cio_relay_start
+	 * @brief Starts forwarding data between the two sockets.
+	 *
+	 * After the relay was started, no other operations must be performed
+	 * on the I/O streams of the sockets until @p handler was called.
+	 * Once the relay stopped, the sockets behave as before the relay was
+	 * started. Sockets with @ref cio_socket_set_zerocopy "zero-copy"
+	 * transmission enabled can't be relayed.
+	 *
+	 * @param context The cio_relay::context.
+	 * @param handler The function to be called when the relay finished.
+	 * @param handler_context The context passed to the @a handler function.
+	 *
+	 * @return ::cio_success for success, ::cio_invalid_argument if one of
+	 * the sockets has zero-copy transmission enabled.
+	 */
+	enum cio_error (*start)(void *context, cio_relay_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_relay_get_bytes_forwarded
+	 * @brief Gets the number of bytes forwarded from a socket to its peer.
+	 *
+	 * @param context The cio_relay::context.
+	 * @param from The socket the data was read from.
+	 *
+	 * @return The number of bytes forwarded.
+	 */
+	uint64_t (*get_bytes_forwarded)(void *context, const struct cio_socket *from);
+
+	/**
+	 * @anchor cio_relay_close
+	 * @brief Stops the relay and frees its resources.
+	 *
+	 * The sockets are not closed, they can be used for I/O again.
+	 *
+	 * @param context The cio_relay::context.
+	 */
+	void (*close)(void *context);
+
+	/**
+	 * @privatesection
+	 */
+	struct cio_relay_endpoint endpoints[2];
+	size_t pipe_size;
+	cio_relay_handler handler;
+	void *handler_context;
+	cio_relay_close_hook close_hook;
+	bool running;
+};
+
+/**
+ * @brief Initializes a cio_relay.
+ *
+ * @param relay The cio_relay that should be initialized.
+ * @param a The first socket.
+ * @param b The second socket.
+ * @param close_hook A close hook function. If this parameter is non @p NULL,
+ * the function will be called directly after
+ * @ref cio_relay_close "closing" the cio_relay.
+ * It is guaranteed the the cio library will not access any memory of
+ * cio_relay that is passed to the close hook. Therefore
+ * the hook could be used to free the memory of the relay.
+ *
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_relay_init(struct cio_relay *relay, struct cio_socket *a, struct cio_socket *b,
+                              cio_relay_close_hook close_hook);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,6 +28,7 @@
 #define CIO_SERVER_SOCKET_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "cio_error_code.h"
@@ -49,6 +50,26 @@ extern "C" {
 
 struct cio_server_socket;
 
+/**
+ * @brief The cio_socket_options struct describes the options every
+ * socket accepted by a cio_server_socket is set up with.
+ *
+ * A zero-initialized profile leaves all options at their defaults.
+ */
+struct cio_socket_options {
+	bool tcp_no_delay; /*!< Disables the Nagle algorithm. */
+	bool keep_alive; /*!< Enables TCP keepalive messages. */
+	unsigned int keep_idle_s; /*!< Idle time in seconds before keepalive probes are sent. */
+	unsigned int keep_intvl_s; /*!< Time in seconds between keepalive probes. */
+	unsigned int keep_cnt; /*!< The number of unanswered probes before the connection is dropped. */
+	size_t receive_buffer_size; /*!< The size of the receive buffer in bytes. @p 0 keeps the default. */
+	size_t send_buffer_size; /*!< The size of the send buffer in bytes. @p 0 keeps the default. */
+	bool tcp_quick_ack; /*!< Sends TCP acknowledgements immediately. The kernel doesn't keep TCP_QUICKACK set, so it is applied to each accepted socket. */
+	uint64_t read_timeout_ns; /*!< See @ref cio_socket_set_read_timeout "set_read_timeout". */
+	uint64_t write_timeout_ns; /*!< See @ref cio_socket_set_write_timeout "set_write_timeout". */
+	uint64_t idle_timeout_ns; /*!< See @ref cio_socket_set_idle_timeout "set_idle_timeout". */
+};
+
 /**
  * @brief The type of a function that is called when
  * @ref cio_server_socket_accept "accept task" succeeds or fails.
@@ -60,6 +81,19 @@ struct cio_server_socket;
  */
 typedef void (*cio_accept_handler)(struct cio_server_socket *ss, void *handler_context, enum cio_error err, struct cio_socket *socket);
 
+/**
+ * @brief The type of a function that is called when
+ * @ref cio_server_socket_accept_batch "batched accept" delivers sockets.
+ *
+ * @param ss The cio_server_socket the sockets were accepted on.
+ * @param handler_context The context the functions works on.
+ * @param err If err != ::cio_success, accepting further sockets failed.
+ * @param sockets The accepted sockets. The array is only valid during the call.
+ * @param count The number of sockets in @p sockets. Might be @p 0 if @p err
+ * != ::cio_success.
+ */
+typedef void (*cio_accept_batch_handler)(struct cio_server_socket *ss, void *handler_context, enum cio_error err, struct cio_socket **sockets, unsigned int count);
+
 /**
  * @brief The type of close hook function.
  *
@@ -93,6 +127,24 @@ struct cio_server_socket {
 	 */
 	enum cio_error (*init)(void *context, unsigned int backlog);
 
+	/**
+	 * @anchor cio_server_socket_init_unix
+	 * @brief Initializes a cio_server_socket as a Unix domain socket.
+	 *
+	 * Use @ref cio_server_socket_bind_unix "bind_unix" instead of
+	 * @ref cio_server_socket_bind "bind" on such a server socket.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param backlog The minimal length of the listen queue.
+	 * @param type The type of the accepted sockets. Only ::cio_unix_stream
+	 * and ::cio_unix_seqpacket are connection oriented and can be accepted.
+	 * Bound ::cio_unix_datagram sockets are provided by
+	 * cio_udp_socket_init_unix().
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*init_unix)(void *context, unsigned int backlog, enum cio_unix_socket_type type);
+
 	/**
 	 * @anchor cio_server_socket_accept
 	 * @brief Accepts an incoming socket connection.
@@ -105,6 +157,36 @@ struct cio_server_socket {
 	 */
 	enum cio_error (*accept)(void *context, cio_accept_handler handler, void *handler_context);
 
+	/**
+	 * @anchor cio_server_socket_accept_batch
+	 * @brief Accepts incoming socket connections and delivers them in batches.
+	 *
+	 * Works like @ref cio_server_socket_accept "accept", but all connections
+	 * accepted in one go are handed to @p handler together, up to
+	 * @p CONFIG_ACCEPT_BATCH_SIZE sockets per call.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param handler The function to be called if the accept failes or succeeds.
+	 * @param handler_context The context passed the the @a handler function.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*accept_batch)(void *context, cio_accept_batch_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_server_socket_set_accept_budget
+	 * @brief Limits the number of connections accepted per event loop iteration.
+	 *
+	 * If more connections are pending, accepting is resumed in the next
+	 * event loop iteration, so a connect storm can't starve other event
+	 * sources. The default is @p CONFIG_ACCEPT_BUDGET.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param budget The maximum number of connections accepted per iteration.
+	 * @p 0 accepts until no connection is pending.
+	 */
+	void (*set_accept_budget)(void *context, unsigned int budget);
+
 	/**
 	 * @anchor cio_server_socket_close
 	 * @brief Closes the cio_server_socket.
@@ -125,6 +207,18 @@ struct cio_server_socket {
 	 */
 	enum cio_error (*bind)(void *context, const char *bind_address, uint16_t port);
 
+	/**
+	 * @anchor cio_server_socket_bind_unix
+	 * @brief Binds a Unix domain cio_server_socket to a path.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param path The path the socket shall be bound to. If @p path starts
+	 * with @p '@', the remainder is an address in the abstract namespace.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*bind_unix)(void *context, const char *path);
+
 	/**
 	 * @anchor cio_server_socket_set_reuse_address
 	 * @brief Sets the SO_REUSEADDR socket option.
@@ -136,6 +230,61 @@ struct cio_server_socket {
 	 */
 	enum cio_error (*set_reuse_address)(void *context, bool on);
 
+	/**
+	 * @anchor cio_server_socket_set_tcp_fast_open
+	 * @brief Enables TCP Fast Open on the server socket.
+	 *
+	 * Clients that connected before may then send data within the SYN,
+	 * which is delivered to the accepted socket without waiting for
+	 * the handshake to complete. Must be called before
+	 * @ref cio_server_socket_accept "accept".
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param queue_length The maximum number of pending Fast Open requests.
+	 * @p 0 disables TCP Fast Open.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_tcp_fast_open)(void *context, unsigned int queue_length);
+
+	/**
+	 * @anchor cio_server_socket_set_tcp_defer_accept
+	 * @brief Accepts connections only when data arrived on them.
+	 *
+	 * The accept handler is called only for connections that already
+	 * carry data, so reading the first request doesn't need another
+	 * event loop iteration. Connections not sending any data are dropped
+	 * by the kernel after roughly @p timeout_s seconds.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param timeout_s The time in seconds to wait for data. @p 0 disables
+	 * deferred accepts.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_tcp_defer_accept)(void *context, unsigned int timeout_s);
+
+	/**
+	 * @anchor cio_server_socket_set_socket_options
+	 * @brief Sets the options all accepted sockets are set up with.
+	 *
+	 * Options the kernel passes from the listening socket to accepted
+	 * sockets (Nagle algorithm, keepalive and buffer sizes) are set once
+	 * on the server socket instead of on every accepted socket. Only
+	 * the remaining options are applied to each accepted socket.
+	 * Inherited options are set with their values, so calling this again
+	 * with a profile that switches them off switches them off.
+	 * Must be called after @ref cio_server_socket_init "init" and
+	 * before @ref cio_server_socket_accept "accept".
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param options The option profile. The profile is copied, so it
+	 * doesn't need to stay valid after the call.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_socket_options)(void *context, const struct cio_socket_options *options);
+
 	/**
 	 * @privatesection
 	 */
@@ -144,7 +293,14 @@ struct cio_server_socket {
 	cio_server_socket_close_hook close_hook;
 	struct cio_event_notifier ev;
 	cio_accept_handler handler;
+	cio_accept_batch_handler batch_handler;
 	void *handler_context;
+	unsigned int accept_budget;
+	struct cio_linux_deferred accept_resume;
+	struct cio_socket_options socket_options;
+	unsigned int handler_depth;
+	bool per_socket_options;
+	bool closed;
 };
 
 /**
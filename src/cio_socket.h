@@ -28,6 +28,7 @@
 #define CIO_SOCKET_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "cio_error_code.h"
 #include "cio_eventloop.h"
@@ -46,7 +47,12 @@ extern "C" {
  * several socket options.
  */
 
+struct addrinfo;
+struct cio_buffer_tuner;
 struct cio_socket;
+struct cio_socket_connect_state;
+struct cio_socket_ext;
+struct cio_uring;
 
 /**
  * @brief The type of close hook function.
@@ -55,13 +61,135 @@ struct cio_socket;
  */
 typedef void (*cio_socket_close_hook)(struct cio_socket *s);
 
-struct cio_socket {
+/**
+ * @brief Specifies the type of a Unix domain socket.
+ */
+enum cio_unix_socket_type {
+	cio_unix_stream, /*!< A reliable byte stream. */
+	cio_unix_seqpacket, /*!< A reliable, connection oriented datagram socket that preserves message boundaries. */
+	cio_unix_datagram /*!< A connectionless datagram socket that preserves message boundaries. */
+};
+
+/**
+ * @brief The credentials of the process on the other side of a Unix domain socket.
+ */
+struct cio_peer_credentials {
+	int32_t pid; /*!< The process ID of the peer. */
+	uint32_t uid; /*!< The user ID of the peer. */
+	uint32_t gid; /*!< The group ID of the peer. */
+};
+
+/**
+ * @brief The type of a function that is called when
+ * @ref cio_socket_connect "connecting" a socket succeeds or fails.
+ *
+ * @param s The cio_socket that was connected. If @p err != ::cio_success,
+ * the socket was not initialized and must not be used.
+ * @param handler_context The context the functions works on.
+ * @param err If err != ::cio_success, the connect failed.
+ */
+typedef void (*cio_socket_connect_handler)(struct cio_socket *s, void *handler_context, enum cio_error err);
+
+/**
+ * @brief The type of a function that is called when the unsent data of a
+ * socket crosses one of its @ref cio_socket_set_write_watermarks "write watermarks".
+ *
+ * @param s The cio_socket the watermark was crossed on.
+ * @param handler_context The context the functions works on.
+ * @param err If err != ::cio_success, the unsent data of the socket can't
+ * be watched anymore. The watermarks are disabled and @p paused is @p false.
+ * @param paused @p true if the high watermark was reached and producers
+ * should stop queueing data, @p false if the unsent data fell to the
+ * low watermark and producers may continue.
+ */
+typedef void (*cio_socket_watermark_handler)(struct cio_socket *s, void *handler_context, enum cio_error err, bool paused);
+
+/**
+ * @brief The I/O counters of a socket.
+ *
+ * The counters are only maintained if the library was compiled with
+ * @p CONFIG_IO_ACCOUNTING defined. They are kept outside of cio_socket,
+ * so neither its layout nor its size depend on the setting.
+ */
+struct cio_socket_stats {
+	uint64_t bytes_read; /*!< The number of bytes read from the socket. */
+	uint64_t bytes_written; /*!< The number of bytes written to the socket. */
+	uint64_t read_calls; /*!< The number of read system calls. */
+	uint64_t write_calls; /*!< The number of write system calls. */
+	uint64_t would_block; /*!< The number of read and write system calls that returned EAGAIN. */
+	uint64_t handler_time_ns; /*!< An estimate of the time spent in read handlers in nanoseconds. */
+};
+
+/**
+ * @brief Specifies the counter sockets are ranked by in cio_socket_top().
+ */
+enum cio_socket_stats_key {
+	cio_stats_bytes_read, /*!< Rank by cio_socket_stats::bytes_read. */
+	cio_stats_bytes_written, /*!< Rank by cio_socket_stats::bytes_written. */
+	cio_stats_read_calls, /*!< Rank by cio_socket_stats::read_calls. */
+	cio_stats_write_calls, /*!< Rank by cio_socket_stats::write_calls. */
+	cio_stats_would_block, /*!< Rank by cio_socket_stats::would_block. */
+	cio_stats_handler_time /*!< Rank by cio_socket_stats::handler_time_ns. */
+};
+
+/**
+ * @brief The type of a function that is called for each socket by cio_socket_for_each().
+ *
+ * @param s The socket.
+ * @param context The context passed to cio_socket_for_each().
+ */
+typedef void (*cio_socket_visitor)(struct cio_socket *s, void *context);
+
+/**
+ * @brief Specifies how data received into a file is flushed to disk.
+ */
+enum cio_file_sync {
+	cio_file_sync_none, /*!< Leave flushing to the kernel. The received data stays in the page cache. */
+	cio_file_sync_data, /*!< Flush the file data (fdatasync) before completion. Blocks the event loop. */
+	cio_file_sync_all /*!< Flush the file data and metadata (fsync) before completion. Blocks the event loop. */
+};
+
+/**
+ * @brief The cio_write_request struct describes a write queued on a
+ * socket's output queue.
+ *
+ * The request is owned by the caller and must stay valid until its
+ * handler was called.
+ */
+struct cio_write_request {
 	/**
-	 * @brief The context pointer which is passed to the functions
-	 * specified below.
+	 * @privatesection
 	 */
-	void *context;
+	const void *buf;
+	size_t count;
+	size_t sent;
+	cio_stream_write_handler handler;
+	void *handler_context;
+	struct cio_write_request *next;
+};
 
+/**
+ * @brief The version of the layout of cio_socket and cio_socket_ops.
+ *
+ * All sockets and all I/O streams of an implementation share a single,
+ * constant table of operations (cio_socket_ops, cio_io_stream_ops), so
+ * an operation costs no memory per object. New operations are only
+ * ever appended to these tables, so the layout of existing members
+ * stays stable.
+ *
+ * The version is incremented whenever the layout of either struct
+ * changes in a way that breaks applications compiled against an older
+ * header. Applications linking the library dynamically should compare
+ * it with cio_socket_abi_version() at startup.
+ */
+#define CIO_SOCKET_ABI_VERSION 2
+
+/**
+ * @brief The operations of a cio_socket.
+ *
+ * See ::CIO_SOCKET_ABI_VERSION for how the table is shared and extended.
+ */
+struct cio_socket_ops {
 	/**
 	 * @anchor cio_socket_get_io_stream
 	 * @brief Gets an I/O stream from the socket.
@@ -112,6 +240,380 @@ struct cio_socket {
 	 */
 	enum cio_error (*set_keep_alive)(void *context, bool on, unsigned int keep_idle_s, unsigned int keep_intvl_s, unsigned int keep_cnt);
 
+	/**
+	 * @anchor cio_socket_get_peer_credentials
+	 * @brief Gets the credentials of the peer of a Unix domain socket.
+	 *
+	 * The credentials are the ones that were in effect when the
+	 * connection was established.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param credentials Filled with the credentials of the peer.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*get_peer_credentials)(void *context, struct cio_peer_credentials *credentials);
+
+	/**
+	 * @anchor cio_socket_set_read_timeout
+	 * @brief Sets a deadline for each subsequent read operation.
+	 *
+	 * If a @ref cio_io_stream_ops::read_some "read" on the socket's I/O stream
+	 * is not fulfilled within @p timeout_ns, the read handler is called
+	 * with ::cio_timed_out.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param timeout_ns The timeout in nanoseconds. @p 0 disables the timeout.
+	 */
+	void (*set_read_timeout)(void *context, uint64_t timeout_ns);
+
+	/**
+	 * @anchor cio_socket_set_write_timeout
+	 * @brief Sets a deadline for each subsequent write operation.
+	 *
+	 * If a @ref cio_io_stream_ops::write_some "write" on the socket's I/O stream
+	 * is not fulfilled within @p timeout_ns, the write handler is called
+	 * with ::cio_timed_out.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param timeout_ns The timeout in nanoseconds. @p 0 disables the timeout.
+	 */
+	void (*set_write_timeout)(void *context, uint64_t timeout_ns);
+
+	/**
+	 * @anchor cio_socket_set_idle_timeout
+	 * @brief Sets the time a connection might stay without any data transferred.
+	 *
+	 * When the idle timeout expires, a pending read or write handler is called
+	 * with ::cio_timed_out. If no operation is pending, the socket is
+	 * @ref cio_socket_close "closed".
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param timeout_ns The timeout in nanoseconds. @p 0 disables the timeout.
+	 */
+	void (*set_idle_timeout)(void *context, uint64_t timeout_ns);
+
+	/**
+	 * @anchor cio_socket_set_zerocopy
+	 * @brief Enables/disables zero-copy transmission for large writes.
+	 *
+	 * If enabled, writes of at least @p threshold bytes are sent without
+	 * copying the data into the kernel. The write handler of such a write is
+	 * called only after the kernel signalled that it no longer needs the
+	 * buffer, so the buffer must not be modified or freed before.
+	 * If the socket is @ref cio_socket_close "closed" before, the
+	 * handler is called with ::cio_operation_aborted during the close.
+	 * Smaller writes are copied as usual. If the kernel reports that
+	 * it had to copy the data anyway (e.g. on loopback), zero-copy is
+	 * switched off for this socket.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param on Whether zero-copy transmission should be enabled or not.
+	 * @param threshold The minimal number of bytes for which zero-copy is used.
+	 *        If @p 0, a platform specific default is used.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_zerocopy)(void *context, bool on, size_t threshold);
+
+	/**
+	 * @anchor cio_socket_sendfile
+	 * @brief Transmits data from a file directly to the socket.
+	 *
+	 * The data is copied by the kernel without passing through user space.
+	 * Partial transmissions are resumed as soon as the socket becomes
+	 * writable again, so @p handler is called only after @p count bytes
+	 * were sent, the end of the file was reached or an error occured.
+	 * A write timeout (see @ref cio_socket_set_write_timeout "set_write_timeout")
+	 * applies to each stall of the transmission, not to the transmission as a whole.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param file_fd The file descriptor of the file to be sent. The file
+	 * descriptor must stay open until @p handler is called.
+	 * @param offset The file offset where the transmission starts.
+	 * @param count The number of bytes to transmit.
+	 * @param handler The callback function to be called when the transmission
+	 * is finished. It gets the total number of bytes transferred.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 */
+	void (*sendfile)(void *context, int file_fd, uint64_t offset, size_t count, cio_stream_write_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_socket_receive_file
+	 * @brief Receives data from the socket directly into a file.
+	 *
+	 * The data is moved by the kernel without passing through user space.
+	 * The transfer is resumed whenever the socket becomes readable, so
+	 * @p handler is called only after @p count bytes were written to the
+	 * file, the peer closed the connection or an error occured.
+	 * A read timeout (see @ref cio_socket_set_read_timeout "set_read_timeout")
+	 * applies to each stall of the transfer, not to the transfer as a whole.
+	 *
+	 * If @p sync is not ::cio_file_sync_none, the writeback of the data is
+	 * started while receiving. The written range is flushed to disk before
+	 * @p handler is called and afterwards dropped from the page cache.
+	 * Please note that the flush is done synchronously, so it blocks the
+	 * event loop until the data not yet written back is on disk. With
+	 * ::cio_file_sync_none, the received data stays in the page cache,
+	 * because dirty pages can't be dropped.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param file_fd The file descriptor of the file to be written. The file
+	 * descriptor must stay open until @p handler is called.
+	 * @param offset The file offset where the data is written to.
+	 * @param count The number of bytes to receive.
+	 * @param sync The flush policy for the written data.
+	 * @param handler The callback function to be called when the transfer
+	 * is finished. It gets the total number of bytes written to the file.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 */
+	void (*receive_file)(void *context, int file_fd, uint64_t offset, size_t count, enum cio_file_sync sync, cio_stream_write_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_socket_queue_write
+	 * @brief Appends a write request to the output queue of the socket.
+	 *
+	 * In contrast to cio_io_stream_ops::write_some, @p handler
+	 * is called only after all @p count bytes were sent or an error occured.
+	 * All requests queued during one event loop iteration are sent together
+	 * with as few system calls as possible at the end of the iteration.
+	 * Handlers are called in the order the requests were queued.
+	 *
+	 * Requests that are still queued when the socket is closed are completed
+	 * with ::cio_operation_aborted. While requests are queued, no other write
+	 * operation must be performed on the socket.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param request The request to be queued.
+	 * @param buf The buffer to be sent. The buffer must stay valid until
+	 * @p handler is called.
+	 * @param count The number of bytes to send.
+	 * @param handler The callback function to be called when the request
+	 * is finished.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 */
+	void (*queue_write)(void *context, struct cio_write_request *request, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_socket_set_read_budget
+	 * @brief Limits the number of bytes read from the socket per event loop iteration.
+	 *
+	 * As long as data is available, read handlers that issue a new read
+	 * are served immediately. Once @p budget bytes were read, the remaining
+	 * data is read in the next event loop iteration, so a fast sender
+	 * can't starve other connections.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param budget The number of bytes read per event loop iteration.
+	 * @p 0 reads until no more data is available.
+	 */
+	void (*set_read_budget)(void *context, size_t budget);
+
+	/**
+	 * @anchor cio_socket_set_tcp_quick_ack
+	 * @brief Enables/disables sending TCP acknowledgements immediately.
+	 *
+	 * Delayed acknowledgements add latency to request/response protocols
+	 * whose responses don't piggyback the acknowledgement. Please note
+	 * that the kernel might switch back to delayed acknowledgements
+	 * on its own, so the option might need to be set again.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param on Whether acknowledgements should be sent immediately.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_tcp_quick_ack)(void *context, bool on);
+
+	/**
+	 * @anchor cio_socket_set_write_watermarks
+	 * @brief Reports when a slow peer lets unsent data pile up.
+	 *
+	 * The unsent data are the bytes in the @ref cio_socket_queue_write "output queue"
+	 * plus the bytes the kernel did not send yet. When they reach @p high,
+	 * @p handler is called with @p paused set to @p true. Once they
+	 * fell to @p low, @p handler is called with @p paused set to @p false.
+	 * Additionally, the kernel keeps at most about @p low unsent bytes
+	 * in its send buffer (TCP_NOTSENT_LOWAT), so data waits in the output
+	 * queue instead of inflating the latency of the connection.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param low The low watermark in bytes.
+	 * @param high The high watermark in bytes. Must be greater than @p low.
+	 * @param handler The function to be called when a watermark was crossed.
+	 * @p NULL disables the watermarks.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_write_watermarks)(void *context, size_t low, size_t high, cio_socket_watermark_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_socket_use_uring
+	 * @brief Moves the data path of the socket's I/O stream to an io_uring.
+	 *
+	 * From now on, the socket receives data with a single multishot
+	 * receive into the buffers of @p ring. Reads on the I/O stream copy the
+	 * received data out of these buffers and return them to the ring.
+	 * Writes on the I/O stream are submitted together with all other
+	 * operations of the ring at the end of the event loop iteration.
+	 *
+	 * Read, write and idle timeouts keep applying to the I/O stream. The
+	 * buffer of a timed out write stays with the kernel until the cancelled
+	 * send returned it, only then the write handler is called with
+	 * ::cio_timed_out. The read budget doesn't apply anymore. The other
+	 * operations of the socket, e.g. @ref cio_socket_queue_write
+	 * "queue_write" or @ref cio_socket_sendfile "sendfile", must not be
+	 * used afterwards.
+	 * No read or write must be pending and
+	 * @ref cio_socket_set_receive_timestamps "receive timestamps" must be
+	 * disabled when the data path is switched.
+	 * If the socket is closed while the kernel still uses it, the close
+	 * hook is called once the kernel released the socket.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param ring The ring the socket shall use.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*use_uring)(void *context, struct cio_uring *ring);
+
+	/**
+	 * @anchor cio_socket_enable_post_write
+	 * @brief Allows other threads to @ref cio_socket_post_write "post writes" to the socket.
+	 *
+	 * Must be called on the event loop thread before any other thread
+	 * posts a write.
+	 *
+	 * @param context The cio_server_socket::context.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*enable_post_write)(void *context);
+
+	/**
+	 * @anchor cio_socket_post_write
+	 * @brief Appends a write request to the output queue of the socket from any thread.
+	 *
+	 * In contrast to all other operations, this function might be called
+	 * from any thread once @ref cio_socket_enable_post_write "enable_post_write"
+	 * was called. The requests of all threads are collected in a lock-free
+	 * queue. The event loop is woken up once per batch of requests and
+	 * moves the whole batch to the @ref cio_socket_queue_write "output queue",
+	 * so the batch is sent with as few system calls as possible.
+	 *
+	 * @p handler is called on the event loop thread after all @p count
+	 * bytes were sent or an error occured. From then on, the caller owns
+	 * @p buf and @p request again. Requests posted before the socket is
+	 * closed are completed with ::cio_operation_aborted. No thread must
+	 * post a write after the socket was closed.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param request The request to be queued.
+	 * @param buf The buffer to be sent. The buffer must stay valid until
+	 * @p handler is called.
+	 * @param count The number of bytes to send.
+	 * @param handler The callback function to be called when the request
+	 * is finished.
+	 * @param handler_context A pointer to a context which might be
+	 * useful inside @p handler
+	 */
+	void (*post_write)(void *context, struct cio_write_request *request, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_socket_set_buffer_sizes
+	 * @brief Sets the sizes of the kernel receive and send buffers.
+	 *
+	 * Explicitly sized buffers are not auto-tuned by the kernel anymore.
+	 * If the socket was attached to a @ref cio_socket_use_buffer_tuner "buffer tuner",
+	 * it is detached.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param receive_size The size of the receive buffer in bytes. @p 0 keeps the current size.
+	 * @param send_size The size of the send buffer in bytes. @p 0 keeps the current size.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_buffer_sizes)(void *context, size_t receive_size, size_t send_size);
+
+	/**
+	 * @anchor cio_socket_use_buffer_tuner
+	 * @brief Lets a cio_buffer_tuner size the kernel buffers of the socket.
+	 *
+	 * The socket starts with the smallest buffers of the tuner. If they
+	 * don't fit into the memory limit of the tuner anymore, the socket is
+	 * not attached and keeps its buffers.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param tuner The tuner the socket shall be attached to. @p NULL
+	 * detaches the socket from its tuner and keeps the current buffer sizes.
+	 *
+	 * @return ::cio_success for success, ::cio_no_buffer_space if the
+	 * memory limit of the tuner is reached.
+	 */
+	enum cio_error (*use_buffer_tuner)(void *context, struct cio_buffer_tuner *tuner);
+
+	/**
+	 * @anchor cio_socket_get_stats
+	 * @brief Gets the I/O counters of the socket.
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param stats Filled with the counters.
+	 *
+	 * @return ::cio_success for success, ::cio_protocol_not_supported if
+	 * the library was compiled without @p CONFIG_IO_ACCOUNTING.
+	 */
+	enum cio_error (*get_stats)(void *context, struct cio_socket_stats *stats);
+
+	/**
+	 * @anchor cio_socket_set_receive_timestamps
+	 * @brief Lets the kernel timestamp received data.
+	 *
+	 * While enabled, the socket reads with recvmsg and takes the software
+	 * receive timestamp (SO_TIMESTAMPING) of the data. The time between the
+	 * timestamp and reading the data is recorded in the
+	 * @ref cio_eventloop_get_receive_delays "receive delay histogram"
+	 * of the event loop. Not supported on sockets that
+	 * @ref cio_socket_use_uring "use an io_uring".
+	 *
+	 * @param context The cio_server_socket::context.
+	 * @param on Whether received data shall be timestamped.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*set_receive_timestamps)(void *context, bool on);
+
+	/**
+	 * @anchor cio_socket_get_receive_timestamp
+	 * @brief Gets the kernel receive timestamp of the data passed to the
+	 * current read handler.
+	 *
+	 * Must be called from within the read handler.
+	 *
+	 * @param context The cio_server_socket::context.
+	 *
+	 * @return The time the kernel received the data in nanoseconds since
+	 * the epoch (CLOCK_REALTIME), @p 0 if no timestamp is available.
+	 */
+	uint64_t (*get_receive_timestamp)(void *context);
+};
+
+struct cio_socket {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * in cio_socket::ops.
+	 */
+	void *context;
+
+	/**
+	 * @brief The operations of this socket.
+	 */
+	const struct cio_socket_ops *ops;
+
 	/**
 	 * @privatesection
 	 */
@@ -119,8 +621,28 @@ struct cio_socket {
 	cio_socket_close_hook close_hook;
 	struct cio_event_notifier ev;
 	struct cio_eventloop *loop;
+	struct cio_linux_deadline deadline;
+	uint64_t read_timeout_ns;
+	uint64_t write_timeout_ns;
+	uint64_t idle_timeout_ns;
+	uint64_t read_expires_ns;
+	uint64_t write_expires_ns;
+	uint64_t idle_expires_ns;
+	size_t read_budget;
+	struct cio_socket_ext *ext;
+	struct cio_linux_deferred read_resume;
+	bool read_ready;
+	bool draining;
+	bool closed;
 };
 
+/**
+ * @brief Gets the layout version of cio_socket the library was compiled with.
+ *
+ * @return The ::CIO_SOCKET_ABI_VERSION of the library.
+ */
+unsigned int cio_socket_abi_version(void);
+
 /**
  * @brief Initializes a cio_socket.
  *
@@ -138,6 +660,193 @@ enum cio_error cio_socket_init(struct cio_socket *s, int client_fd,
                                struct cio_eventloop *loop,
                                cio_socket_close_hook close_hook);
 
+/**
+ * @brief Calls a function for each open socket of an event loop.
+ *
+ * Only sockets that are accounted are visited, so nothing is visited if
+ * the library was compiled without @p CONFIG_IO_ACCOUNTING.
+ * @p visitor must not close any socket.
+ *
+ * @param loop The event loop.
+ * @param visitor The function to be called for each socket.
+ * @param context A pointer passed to @p visitor.
+ *
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_socket_for_each(struct cio_eventloop *loop, cio_socket_visitor visitor, void *context);
+
+/**
+ * @brief Finds the open sockets of an event loop with the highest value of a counter.
+ *
+ * @param loop The event loop.
+ * @param key The counter the sockets are ranked by.
+ * @param top Filled with the sockets, the socket with the highest value first.
+ * @param n The number of elements of @p top.
+ *
+ * @return The number of sockets written to @p top. Always @p 0 if the
+ * library was compiled without @p CONFIG_IO_ACCOUNTING.
+ */
+unsigned int cio_socket_top(struct cio_eventloop *loop, enum cio_socket_stats_key key, struct cio_socket **top, unsigned int n);
+
+/**
+ * @anchor cio_socket_connect
+ * @brief Connects a cio_socket to a remote peer without blocking the event loop.
+ *
+ * If @p address resolves to several addresses, connection attempts are
+ * started one after another with a short delay, alternating between IPv6
+ * and IPv4 addresses (happy eyeballs). The first attempt that succeeds
+ * wins and all other attempts are cancelled. A failed attempt immediately
+ * starts the next one.
+ *
+ * Please note that resolving a host name is done synchronously. Pass
+ * numeric addresses to never block the event loop.
+ *
+ * @param s The cio_socket that is initialized when the connection is established.
+ * @param loop The event loop the socket shall operate on.
+ * @param address The host name or IP address of the peer.
+ * @param port The TCP port of the peer.
+ * @param timeout_ns The time in nanoseconds after which the connect fails with
+ * ::cio_timed_out. If @p 0, the connect doesn't time out.
+ * @param close_hook The close hook the socket is initialized with,
+ * see cio_socket_init().
+ * @param handler The function to be called when the connect succeeded or failed.
+ * @param handler_context The context passed to the @a handler function.
+ *
+ * @return ::cio_success if connecting was started. Otherwise, @p handler
+ * will not be called.
+ */
+enum cio_error cio_socket_connect(struct cio_socket *s, struct cio_eventloop *loop,
+                                  const char *address, uint16_t port, uint64_t timeout_ns,
+                                  cio_socket_close_hook close_hook,
+                                  cio_socket_connect_handler handler, void *handler_context);
+
+/**
+ * @anchor cio_socket_connect_fast_open
+ * @brief Connects a cio_socket using TCP Fast Open.
+ *
+ * Works like @ref cio_socket_connect "cio_socket_connect", but the
+ * handshake is deferred until the first write on the socket, whose data
+ * is then sent within the SYN if the peer supports TCP Fast Open. This
+ * saves a round trip for the first request on a connection.
+ *
+ * Because no packet is sent before the first write, @p handler is called
+ * almost immediately with the first address that could be used. Errors
+ * like a refused connection are reported by the first read or write.
+ * If the kernel doesn't support TCP Fast Open, a regular connect is done.
+ *
+ * @param s The cio_socket that is initialized when the connection is established.
+ * @param loop The event loop the socket shall operate on.
+ * @param address The host name or IP address of the peer.
+ * @param port The TCP port of the peer.
+ * @param timeout_ns The time in nanoseconds after which the connect fails with
+ * ::cio_timed_out. If @p 0, the connect doesn't time out.
+ * @param close_hook The close hook the socket is initialized with,
+ * see cio_socket_init().
+ * @param handler The function to be called when the connect succeeded or failed.
+ * @param handler_context The context passed to the @a handler function.
+ *
+ * @return ::cio_success if connecting was started. Otherwise, @p handler
+ * will not be called.
+ */
+enum cio_error cio_socket_connect_fast_open(struct cio_socket *s, struct cio_eventloop *loop,
+                                            const char *address, uint16_t port, uint64_t timeout_ns,
+                                            cio_socket_close_hook close_hook,
+                                            cio_socket_connect_handler handler, void *handler_context);
+
+/**
+ * @anchor cio_socket_resolve
+ * @brief Resolves the addresses of a TCP peer.
+ *
+ * Resolving a host name is done synchronously, so this function should
+ * be called outside of the hot path, e.g. once at startup.
+ *
+ * @param address The host name or IP address of the peer.
+ * @param port The TCP port of the peer.
+ * @param addresses Filled with the resolved addresses, which must be
+ * freed with @p freeaddrinfo().
+ *
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_socket_resolve(const char *address, uint16_t port, struct addrinfo **addresses);
+
+/**
+ * @anchor cio_socket_connect_state_alloc
+ * @brief Allocates the state of a connect to already resolved addresses.
+ *
+ * The state can be used for any number of
+ * @ref cio_socket_connect_resolved "connects", one at a time.
+ *
+ * @param addresses The addresses of the peer, e.g. from
+ * @ref cio_socket_resolve "cio_socket_resolve". They must stay valid
+ * until the state is freed.
+ *
+ * @return The state, or @p NULL if out of memory.
+ */
+struct cio_socket_connect_state *cio_socket_connect_state_alloc(const struct addrinfo *addresses);
+
+/**
+ * @brief Frees a state allocated with cio_socket_connect_state_alloc().
+ *
+ * No connect must be running on the state.
+ *
+ * @param connect_state The state to be freed.
+ */
+void cio_socket_connect_state_free(struct cio_socket_connect_state *connect_state);
+
+/**
+ * @anchor cio_socket_connect_resolved
+ * @brief Connects a cio_socket to already resolved addresses.
+ *
+ * Works like @ref cio_socket_connect "cio_socket_connect", but neither
+ * resolves a host name nor allocates memory, so it can be used on the
+ * hot path.
+ *
+ * @param s The cio_socket that is initialized when the connection is established.
+ * @param loop The event loop the socket shall operate on.
+ * @param connect_state A state from cio_socket_connect_state_alloc()
+ * which is not used by another connect. It is handed back when
+ * @p handler is called or this function fails.
+ * @param timeout_ns The time in nanoseconds after which the connect fails with
+ * ::cio_timed_out. If @p 0, the connect doesn't time out.
+ * @param close_hook The close hook the socket is initialized with,
+ * see cio_socket_init().
+ * @param handler The function to be called when the connect succeeded or failed.
+ * @param handler_context The context passed to the @a handler function.
+ *
+ * @return ::cio_success if connecting was started. Otherwise, @p handler
+ * will not be called.
+ */
+enum cio_error cio_socket_connect_resolved(struct cio_socket *s, struct cio_eventloop *loop,
+                                           struct cio_socket_connect_state *connect_state, uint64_t timeout_ns,
+                                           cio_socket_close_hook close_hook,
+                                           cio_socket_connect_handler handler, void *handler_context);
+
+/**
+ * @anchor cio_socket_connect_unix
+ * @brief Connects a cio_socket to a Unix domain socket.
+ *
+ * The connect doesn't block the event loop. A Unix domain socket is
+ * either connected when this function returns, or, if the listen backlog
+ * of the peer is full, the function fails with
+ * ::cio_resource_temporarily_unavailable and the connect can be retried
+ * later.
+ *
+ * @param s The cio_socket that is initialized with the connected socket.
+ * @param loop The event loop the socket shall operate on.
+ * @param path The path of the peer socket. If @p path starts with @p '@',
+ * the remainder is an address in the abstract namespace.
+ * @param type The type of the Unix domain socket.
+ * @param close_hook The close hook the socket is initialized with,
+ * see cio_socket_init().
+ *
+ * @return ::cio_success for success,
+ * ::cio_resource_temporarily_unavailable if the peer doesn't accept
+ * connections at the moment.
+ */
+enum cio_error cio_socket_connect_unix(struct cio_socket *s, struct cio_eventloop *loop,
+                                       const char *path, enum cio_unix_socket_type type,
+                                       cio_socket_close_hook close_hook);
+
 #ifdef __cplusplus
 }
 #endif
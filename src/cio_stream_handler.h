@@ -27,6 +27,7 @@
 #ifndef CIO_STREAM_HANDLER_H
 #define CIO_STREAM_HANDLER_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "cio_error_code.h"
@@ -52,6 +53,21 @@ extern "C" {
 typedef void (*cio_stream_read_handler)(void *handler_context, enum cio_error err, uint8_t *buf, size_t bytes_transferred);
 typedef void (*cio_stream_write_handler)(void *handler_context, enum cio_error err, size_t bytes_transferred);
 
+struct iovec;
+
+/**
+ * @brief The type of a function called when a vectored read completes.
+ *
+ * @param handler_context The context the functions works on.
+ * @param err If err != ::cio_success, the read failed.
+ * @param iov The buffer vector the data was read in.
+ * @param iovcnt The number of elements in @p iov.
+ * @param bytes_transferred The total number of bytes transferred into @p iov.
+ * The buffers are filled in order, so only the first @p bytes_transferred
+ * bytes of the vector are valid.
+ */
+typedef void (*cio_stream_readv_handler)(void *handler_context, enum cio_error err, struct iovec *iov, unsigned int iovcnt, size_t bytes_transferred);
+
 #ifdef __cplusplus
 }
 #endif
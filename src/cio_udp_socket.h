@@ -0,0 +1,301 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CIO_UDP_SOCKET_H
+#define CIO_UDP_SOCKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "cio_buffer_allocator.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * @brief This file contains the interface of a UDP socket.
+ *
+ * A UDP socket receives and sends datagrams in batches, so a single
+ * system call transfers many datagrams.
+ */
+
+/**
+ * @brief The maximum number of datagrams received with a single system call.
+ */
+#define CONFIG_UDP_BATCH_SIZE 64
+
+/**
+ * @brief The minimal size of the receive buffers while receive offload is enabled.
+ *
+ * The kernel coalesces up to this many bytes into a single buffer and
+ * drops the coalesced datagrams if they don't fit.
+ */
+#define CONFIG_UDP_GRO_BUFFER_SIZE 65535
+
+struct cio_udp_socket;
+
+/**
+ * @brief The cio_datagram struct describes a single datagram.
+ */
+struct cio_datagram {
+	/**
+	 * @brief The buffer holding the payload of the datagram.
+	 */
+	struct cio_buffer buffer;
+
+	/**
+	 * @brief The number of payload bytes in cio_datagram::buffer.
+	 */
+	size_t length;
+
+	/**
+	 * @brief The address of the peer the datagram was received from or shall be sent to.
+	 */
+	struct sockaddr_storage peer;
+
+	/**
+	 * @brief The length of cio_datagram::peer.
+	 */
+	socklen_t peer_length;
+
+	/**
+	 * @brief Set if a received datagram was larger than cio_datagram::buffer
+	 * and was truncated.
+	 */
+	bool truncated;
+
+	/**
+	 * @brief If not @p 0 when sending, the kernel splits the payload into
+	 * datagrams of this size. The last datagram might be shorter.
+	 *
+	 * This reduces the per datagram cost of the network stack. A single
+	 * payload must not be split into more than 64 datagrams. Always @p 0 for
+	 * received datagrams.
+	 */
+	uint16_t segment_size;
+};
+
+/**
+ * @brief The type of a function that is called when a batch of datagrams was received.
+ *
+ * @param s The cio_udp_socket the datagrams were received on.
+ * @param handler_context The context the functions works on.
+ * @param err If err != ::cio_success, receiving failed.
+ * @param datagrams The received datagrams. The datagrams and their buffers
+ * are only valid until the handler returns.
+ * @param count The number of datagrams in @p datagrams.
+ */
+typedef void (*cio_udp_receive_handler)(struct cio_udp_socket *s, void *handler_context, enum cio_error err, struct cio_datagram *datagrams, unsigned int count);
+
+/**
+ * @brief The type of a function that is called when a batch of datagrams was sent.
+ *
+ * @param s The cio_udp_socket the datagrams were sent on.
+ * @param handler_context The context the functions works on.
+ * @param err If err != ::cio_success, sending failed.
+ * @param count The number of datagrams that were sent.
+ */
+typedef void (*cio_udp_send_handler)(struct cio_udp_socket *s, void *handler_context, enum cio_error err, unsigned int count);
+
+/**
+ * @brief The type of close hook function.
+ *
+ * @param s The cio_udp_socket the close hook was called on.
+ */
+typedef void (*cio_udp_socket_close_hook)(struct cio_udp_socket *s);
+
+/**
+ * @brief The cio_udp_socket struct describes a UDP socket or a Unix
+ * domain datagram socket.
+ */
+struct cio_udp_socket {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * specified below.
+	 */
+	void *context;
+
+	/**
+	 * @anchor cio_udp_socket_bind
+	 * @brief Binds the cio_udp_socket to a specific address.
+	 *
+	 * @param context The cio_udp_socket::context.
+	 * @param bind_address The IP address the socket shall be bound to.
+	 * If @p NULL, the socket will bind to any interface.
+	 * @param port The UDP port the socket shall be bound to.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*bind)(void *context, const char *bind_address, uint16_t port);
+
+	/**
+	 * @anchor cio_udp_socket_bind_unix
+	 * @brief Binds a cio_udp_socket initialized with
+	 * cio_udp_socket_init_unix() to a Unix domain socket path.
+	 *
+	 * @param context The cio_udp_socket::context.
+	 * @param path The path the socket shall be bound to. A leading
+	 * @p '@' binds to the abstract namespace.
+	 *
+	 * @return ::cio_success for success.
+	 */
+	enum cio_error (*bind_unix)(void *context, const char *path);
+
+	/**
+	 * @anchor cio_udp_socket_receive
+	 * @brief Starts receiving datagrams.
+	 *
+	 * A batch of ::CONFIG_UDP_BATCH_SIZE receive buffers is allocated once
+	 * and reused for every batch. @p handler is called for every batch of
+	 * datagrams until the socket is closed.
+	 *
+	 * @param context The cio_udp_socket::context.
+	 * @param allocator The allocator the receive buffers are obtained from.
+	 * The allocator must stay valid until the socket is closed.
+	 * @param buffer_size The size of each receive buffer. Larger datagrams
+	 * are truncated. Must be at least ::CONFIG_UDP_GRO_BUFFER_SIZE if
+	 * @ref cio_udp_socket_set_gro "receive offload" is enabled.
+	 * @param handler The function to be called for every received batch.
+	 * @param handler_context The context passed to the @a handler function.
+	 *
+	 * @return ::cio_success for success, ::cio_invalid_argument if
+	 * @p buffer_size is too small for receive offload.
+	 */
+	enum cio_error (*receive)(void *context, const struct cio_buffer_allocator *allocator, size_t buffer_size, cio_udp_receive_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_udp_socket_send
+	 * @brief Sends a batch of datagrams.
+	 *
+	 * The datagrams are handed to the kernel with as few system calls as
+	 * possible. @p handler is called when all datagrams were sent or an
+	 * error occured.
+	 *
+	 * @param context The cio_udp_socket::context.
+	 * @param datagrams The datagrams to be sent. cio_datagram::length bytes
+	 * of each buffer are sent to cio_datagram::peer. The datagrams must
+	 * stay valid until @p handler is called.
+	 * @param count The number of datagrams in @p datagrams.
+	 * @param handler The function to be called when the batch was sent.
+	 * @param handler_context The context passed to the @a handler function.
+	 */
+	void (*send)(void *context, const struct cio_datagram *datagrams, unsigned int count, cio_udp_send_handler handler, void *handler_context);
+
+	/**
+	 * @anchor cio_udp_socket_set_gro
+	 * @brief Enables or disables receive offload (UDP_GRO).
+	 *
+	 * With receive offload enabled, the kernel coalesces consecutive
+	 * datagrams of the same flow into a single buffer. The socket splits
+	 * them again, so the receive handler still gets one cio_datagram per
+	 * datagram, pointing into the shared receive buffer. Because the kernel
+	 * drops coalesced datagrams that don't fit into a receive buffer, the
+	 * receive buffers must be at least ::CONFIG_UDP_GRO_BUFFER_SIZE large.
+	 *
+	 * @param context The cio_udp_socket::context.
+	 * @param on Whether receive offload should be enabled or disabled.
+	 *
+	 * Not available on Unix domain sockets.
+	 *
+	 * @return ::cio_success for success, ::cio_invalid_argument if
+	 * receiving already started with smaller buffers.
+	 */
+	enum cio_error (*set_gro)(void *context, bool on);
+
+	/**
+	 * @anchor cio_udp_socket_close
+	 * @brief Closes the cio_udp_socket.
+	 *
+	 * @param context The cio_udp_socket::context.
+	 */
+	void (*close)(void *context);
+
+	/**
+	 * @privatesection
+	 */
+	struct cio_eventloop *loop;
+	struct cio_event_notifier ev;
+	cio_udp_socket_close_hook close_hook;
+	const struct cio_buffer_allocator *allocator;
+	cio_udp_receive_handler receive_handler;
+	void *receive_handler_context;
+	size_t receive_buffer_size;
+	struct cio_datagram receive_batch[CONFIG_UDP_BATCH_SIZE];
+	struct cio_datagram segments[CONFIG_UDP_BATCH_SIZE];
+	bool gro;
+	cio_udp_send_handler send_handler;
+	void *send_handler_context;
+	const struct cio_datagram *send_datagrams;
+	unsigned int send_count;
+	unsigned int send_done;
+	unsigned int handler_depth;
+	bool closed;
+};
+
+/**
+ * @brief Initializes a cio_udp_socket.
+ *
+ * @param s The cio_udp_socket that should be initialized.
+ * @param loop The event loop the socket shall operate on.
+ * @param close_hook A close hook function. If this parameter is non @p NULL,
+ * the function will be called directly after
+ * @ref cio_udp_socket_close "closing" the cio_udp_socket.
+ * It is guaranteed the the cio library will not access any memory of
+ * cio_udp_socket that is passed to the close hook. Therefore
+ * the hook could be used to free the memory of the socket.
+ *
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_udp_socket_init(struct cio_udp_socket *s, struct cio_eventloop *loop,
+                                   cio_udp_socket_close_hook close_hook);
+
+/**
+ * @brief Initializes a cio_udp_socket as a Unix domain datagram socket.
+ *
+ * Use @ref cio_udp_socket_bind_unix "bind_unix" instead of
+ * @ref cio_udp_socket_bind "bind" on such a socket. cio_datagram::peer
+ * holds a @p sockaddr_un.
+ *
+ * @param s The cio_udp_socket that should be initialized.
+ * @param loop The event loop the socket shall operate on.
+ * @param close_hook A close hook function, see cio_udp_socket_init().
+ *
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_udp_socket_init_unix(struct cio_udp_socket *s, struct cio_eventloop *loop,
+                                        cio_udp_socket_close_hook close_hook);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
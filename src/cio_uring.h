@@ -0,0 +1,155 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CIO_URING_H
+#define CIO_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * @brief This file contains the interface of an io_uring instance that
+ * sockets can use for their data path.
+ *
+ * A cio_uring is driven by the event loop like any other event source.
+ * Sockets @ref cio_socket_use_uring "attached" to it receive data with a
+ * single multishot receive into buffers owned by the ring, so no read
+ * buffer is pinned for an idle connection. Writes are queued as
+ * submission entries and all entries of an event loop iteration are
+ * submitted with a single system call at the end of the iteration.
+ */
+
+struct cio_uring;
+struct cio_uring_stream;
+struct io_uring_buf_ring;
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+/**
+ * @brief The type of close hook function.
+ *
+ * @param ring The cio_uring the close hook was called on.
+ */
+typedef void (*cio_uring_close_hook)(struct cio_uring *ring);
+
+struct cio_uring {
+	/**
+	 * @brief The context pointer which is passed to the functions
+	 * specified below.
+	 */
+	void *context;
+
+	/**
+	 * @anchor cio_uring_close
+	 * @brief Closes the cio_uring and frees its resources.
+	 *
+	 * All sockets attached to the ring must have been closed and their
+	 * close hooks must have been called before. The ring might be closed
+	 * from within such a close hook.
+	 *
+	 * @param context The cio_uring::context.
+	 */
+	void (*close)(void *context);
+
+	/**
+	 * @privatesection
+	 */
+	cio_uring_close_hook close_hook;
+	struct cio_eventloop *loop;
+	struct cio_event_notifier ev;
+	struct cio_linux_deferred submit;
+	void *sq_ring;
+	void *cq_ring;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	struct io_uring_buf_ring *buffer_ring;
+	uint8_t *buffers;
+	uint16_t *buffer_next;
+	uint32_t *buffer_lengths;
+	struct cio_uring_stream *stalled;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int *sq_flags;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	size_t buffer_ring_size;
+	size_t buffer_size;
+	unsigned int sq_mask;
+	unsigned int cq_mask;
+	unsigned int sq_entries;
+	unsigned int sqe_tail;
+	unsigned int buffer_count;
+	unsigned int buffers_held;
+	uint16_t buffer_tail;
+	bool reaping;
+	bool closed;
+};
+
+/**
+ * @brief Initializes a cio_uring.
+ *
+ * @param ring The cio_uring that should be initialized.
+ * @param loop The event loop the ring shall operate on.
+ * @param entries The number of submission queue entries. If @p 0, a
+ * platform specific default is used.
+ * @param buffer_size The size of each receive buffer in bytes. If @p 0,
+ * a platform specific default is used.
+ * @param buffer_count The number of receive buffers shared by all sockets
+ * attached to the ring. Must be a power of two not greater than 32768.
+ * If @p 0, a platform specific default is used.
+ * @param close_hook A close hook function. If this parameter is non @p NULL,
+ * the function will be called directly after
+ * @ref cio_uring_close "closing" the cio_uring.
+ * It is guaranteed the the cio library will not access any memory of
+ * cio_uring that is passed to the close hook. Therefore
+ * the hook could be used to free the memory of the ring.
+ *
+ * @return ::cio_success for success. If the kernel doesn't support
+ * io_uring with provided buffer rings, an error is returned and the
+ * sockets keep using their regular data path.
+ */
+enum cio_error cio_uring_init(struct cio_uring *ring, struct cio_eventloop *loop,
+                              unsigned int entries, size_t buffer_size, unsigned int buffer_count,
+                              cio_uring_close_hook close_hook);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -42,11 +42,31 @@ extern "C" {
  * @brief Implementation of an event loop running on Linux using epoll.
  */
 
+struct cio_socket;
+
 /**
  * @private
  */
 #define CONFIG_MAX_EPOLL_EVENTS 100
 
+/**
+ * @private
+ * Number of slots of the deadline wheel. Must be a power of two.
+ */
+#define CONFIG_DEADLINE_WHEEL_SLOTS 512
+
+/**
+ * @private
+ * Granularity of the deadline wheel in nanoseconds.
+ */
+#define CONFIG_DEADLINE_WHEEL_TICK_NS 10000000ULL
+
+/**
+ * @private
+ * Number of buckets of a cio_delay_histogram.
+ */
+#define CONFIG_DELAY_HISTOGRAM_BUCKETS 64
+
 /**
  * @brief The cio_linux_event_notifier struct bundles the information
  * necessary to register I/O events.
@@ -67,6 +87,9 @@ struct cio_event_notifier {
 	/**
 	 * @anchor cio_linux_event_notifier_error_callback
 	 * @brief The function to be called when a file descriptor got an error.
+	 *
+	 * This is also called when the socket's error queue is readable.
+	 * Might be @p NULL if the user is not interested in errors.
 	 */
 	void (*error_callback)(void *context);
 
@@ -83,6 +106,104 @@ struct cio_event_notifier {
 	uint32_t registered_events;
 };
 
+/**
+ * @brief The cio_linux_deadline struct describes a point in time at which
+ * a callback shall be called by the event loop.
+ *
+ * Deadlines are intrusive, so they are typically embedded in the
+ * structure they time out. Arming or disarming a deadline never allocates
+ * memory and is O(1). A deadline must be zero-initialized before it is
+ * armed for the first time.
+ */
+struct cio_linux_deadline {
+	/**
+	 * @brief The function to be called when the deadline expired.
+	 */
+	void (*expired)(void *context);
+
+	/**
+	 * @brief The context that is given to the callback function.
+	 */
+	void *context;
+
+	/**
+	 * @privatesection
+	 */
+	uint64_t expires_ns;
+	struct cio_linux_deadline *next;
+	struct cio_linux_deadline **pprev;
+};
+
+/**
+ * @brief The cio_linux_deferred struct describes work that shall be done
+ * at the end of the current event loop iteration.
+ *
+ * Like deadlines, deferred work is intrusive and must be zero-initialized
+ * before it is scheduled for the first time.
+ */
+struct cio_linux_deferred {
+	/**
+	 * @brief The function to be called at the end of the loop iteration.
+	 */
+	void (*callback)(void *context);
+
+	/**
+	 * @brief The context that is given to the callback function.
+	 */
+	void *context;
+
+	/**
+	 * @privatesection
+	 */
+	struct cio_linux_deferred *next;
+	struct cio_linux_deferred **pprev;
+};
+
+/**
+ * @brief The cio_linux_remote struct describes work that other threads
+ * hand over to the event loop thread.
+ *
+ * Posting the same work several times before the loop ran it results
+ * in a single call. Remote work must be zero-initialized before it is
+ * posted for the first time.
+ */
+struct cio_linux_remote {
+	/**
+	 * @brief The function to be called on the event loop thread.
+	 */
+	void (*callback)(void *context);
+
+	/**
+	 * @brief The context that is given to the callback function.
+	 */
+	void *context;
+
+	/**
+	 * @privatesection
+	 */
+	struct cio_linux_remote *next;
+	bool queued;
+};
+
+/**
+ * @brief The cio_delay_histogram struct counts delays in buckets of
+ * powers of two.
+ *
+ * Bucket @p i counts the delays from 2^i up to 2^(i+1) - 1 nanoseconds,
+ * bucket @p 0 additionally counts delays of @p 0.
+ */
+struct cio_delay_histogram {
+	/**
+	 * @brief The number of delays in the histogram.
+	 */
+	uint64_t count;
+
+	/**
+	 * @brief The number of delays per bucket.
+	 */
+	uint64_t buckets[CONFIG_DELAY_HISTOGRAM_BUCKETS];
+};
+
 struct cio_eventloop {
 	/**
 	 * @privatesection
@@ -93,6 +214,18 @@ struct cio_eventloop {
 	unsigned int num_events;
 	struct cio_event_notifier *current_ev;
 	struct epoll_event epoll_events[CONFIG_MAX_EPOLL_EVENTS];
+	uint64_t now_ns;
+	uint64_t wheel_tick;
+	unsigned int armed_deadlines;
+	uint64_t next_expiry_ns;
+	struct cio_linux_deadline *deadline_wheel[CONFIG_DEADLINE_WHEEL_SLOTS];
+	struct cio_linux_deferred *deferred;
+	struct cio_event_notifier wakeup;
+	struct cio_linux_remote *remote_posted;
+	struct cio_linux_remote *remote_ready;
+	struct cio_linux_remote **remote_ready_tail;
+	struct cio_delay_histogram receive_delays;
+	struct cio_socket *sockets;
 };
 
 enum cio_error cio_linux_eventloop_add(const struct cio_eventloop *loop, struct cio_event_notifier *ev);
@@ -102,6 +235,112 @@ enum cio_error cio_linux_eventloop_unregister_read(const struct cio_eventloop *l
 enum cio_error cio_linux_eventloop_register_write(const struct cio_eventloop *loop, struct cio_event_notifier *ev);
 enum cio_error cio_linux_eventloop_unregister_write(const struct cio_eventloop *loop, struct cio_event_notifier *ev);
 
+/**
+ * @brief Gets the time of the current event loop iteration.
+ *
+ * The time is sampled from a monotonic clock once per loop iteration,
+ * so calling this function is cheap.
+ *
+ * @param loop The event loop.
+ * @return The current loop time in nanoseconds.
+ */
+uint64_t cio_linux_eventloop_get_time_ns(const struct cio_eventloop *loop);
+
+/**
+ * @brief Arms a deadline.
+ *
+ * If the deadline is already armed, it is rescheduled.
+ *
+ * @param loop The event loop the deadline shall be armed on.
+ * @param deadline The deadline to arm. cio_linux_deadline::expired and
+ * cio_linux_deadline::context must be set by the caller.
+ * @param expires_ns The absolute loop time (see cio_linux_eventloop_get_time_ns())
+ * when the deadline expires. The event loop sleeps until the earliest
+ * armed deadline expires, so deadlines far in the future don't wake it up.
+ */
+void cio_linux_eventloop_arm_deadline(struct cio_eventloop *loop, struct cio_linux_deadline *deadline, uint64_t expires_ns);
+
+/**
+ * @brief Disarms a deadline.
+ *
+ * Disarming a deadline that is not armed is a no-op.
+ *
+ * @param loop The event loop the deadline was armed on.
+ * @param deadline The deadline to disarm.
+ */
+void cio_linux_eventloop_disarm_deadline(struct cio_eventloop *loop, struct cio_linux_deadline *deadline);
+
+/**
+ * @brief Schedules work for the end of the current loop iteration.
+ *
+ * The callback is called after all I/O events and expired deadlines of
+ * the current iteration were handled. Scheduling work that is already
+ * scheduled is a no-op. Work scheduled from within a deferred callback
+ * runs at the end of the next iteration, which is started without waiting
+ * for I/O events.
+ *
+ * @param loop The event loop.
+ * @param deferred The work to schedule. cio_linux_deferred::callback and
+ * cio_linux_deferred::context must be set by the caller.
+ */
+void cio_linux_eventloop_defer(struct cio_eventloop *loop, struct cio_linux_deferred *deferred);
+
+/**
+ * @brief Cancels scheduled work.
+ *
+ * Cancelling work that is not scheduled is a no-op.
+ *
+ * @param loop The event loop the work was scheduled on.
+ * @param deferred The work to cancel.
+ */
+void cio_linux_eventloop_cancel_deferred(struct cio_eventloop *loop, struct cio_linux_deferred *deferred);
+
+/**
+ * @brief Prepares the event loop to receive work from other threads.
+ *
+ * Must be called on the event loop thread before any other thread
+ * @ref cio_linux_eventloop_post "posts" work. Calling it again is a no-op.
+ *
+ * @param loop The event loop.
+ * @return ::cio_success for success.
+ */
+enum cio_error cio_linux_eventloop_enable_remote(struct cio_eventloop *loop);
+
+/**
+ * @anchor cio_linux_eventloop_post
+ * @brief Hands work over to the event loop thread.
+ *
+ * This is the only event loop function that might be called from any
+ * thread. The event loop is woken up only if no other work was pending,
+ * so a burst of posts costs a single wakeup.
+ *
+ * @param loop The event loop.
+ * @param remote The work to post. cio_linux_remote::callback and
+ * cio_linux_remote::context must be set by the caller.
+ */
+void cio_linux_eventloop_post(struct cio_eventloop *loop, struct cio_linux_remote *remote);
+
+/**
+ * @brief Cancels posted work.
+ *
+ * Must be called on the event loop thread. Cancelling work that is not
+ * posted is a no-op.
+ *
+ * @param loop The event loop the work was posted to.
+ * @param remote The work to cancel.
+ */
+void cio_linux_eventloop_cancel_remote(struct cio_eventloop *loop, struct cio_linux_remote *remote);
+
+/**
+ * @brief Records how long received data waited in the kernel before it
+ * was read.
+ *
+ * @param loop The event loop the data was read on.
+ * @param delay_ns The time between the kernel receive timestamp of the
+ * data and reading it, in nanoseconds.
+ */
+void cio_linux_eventloop_record_receive_delay(struct cio_eventloop *loop, uint64_t delay_ns);
+
 #ifdef __cplusplus
 }
 #endif
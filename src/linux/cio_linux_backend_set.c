@@ -0,0 +1,257 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cio_backend_set.h"
+#include "cio_compiler.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+#include "linux/cio_linux_alloc.h"
+
+/*
+ * Each completed request contributes 1/2^CONFIG_BACKEND_LATENCY_SHIFT
+ * to the latency average of its member.
+ */
+#define CONFIG_BACKEND_LATENCY_SHIFT 3
+
+/*
+ * The members are kept in a single array. The healthy members occupy
+ * the front of the array, the ejected members follow them.
+ */
+static void swap_members(struct cio_backend_set *set, unsigned int a, unsigned int b)
+{
+	struct cio_backend *tmp = set->members[a];
+
+	set->members[a] = set->members[b];
+	set->members[a]->index = a;
+	set->members[b] = tmp;
+	set->members[b]->index = b;
+}
+
+static void eject(struct cio_backend_set *set, struct cio_backend *backend)
+{
+	backend->ejected_until_ns = cio_linux_eventloop_get_time_ns(set->loop) + set->eject_time_ns;
+	if (backend->index < set->num_healthy) {
+		set->num_healthy--;
+		swap_members(set, backend->index, set->num_healthy);
+	}
+}
+
+static void reinstate_expired(struct cio_backend_set *set)
+{
+	uint64_t now = cio_linux_eventloop_get_time_ns(set->loop);
+	unsigned int i;
+
+	for (i = set->num_healthy; i < set->num_members; i++) {
+		if (set->members[i]->ejected_until_ns <= now) {
+			/*
+			 * The latency measured before the ejection is stale. Forget it, so
+			 * the member isn't starved by members with a fresh average.
+			 */
+			set->members[i]->latency_ns = 0;
+			swap_members(set, i, set->num_healthy);
+			set->num_healthy++;
+		}
+	}
+}
+
+static uint32_t next_random(struct cio_backend_set *set)
+{
+	uint32_t x = set->random_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	set->random_state = x;
+	return x;
+}
+
+/*
+ * A member without a latency sample is assumed to be as fast as the member
+ * it is compared with, so only the outstanding requests decide.
+ */
+static bool cheaper(const struct cio_backend *a, const struct cio_backend *b)
+{
+	uint64_t latency_a = (a->latency_ns != 0) ? a->latency_ns : b->latency_ns;
+	uint64_t latency_b = (b->latency_ns != 0) ? b->latency_ns : a->latency_ns;
+
+	if (latency_a == 0) {
+		return a->outstanding < b->outstanding;
+	}
+
+	return ((uint64_t)a->outstanding + 1) * latency_a < ((uint64_t)b->outstanding + 1) * latency_b;
+}
+
+static enum cio_error backend_set_add(void *context, struct cio_backend *backend, struct cio_socket *socket)
+{
+	struct cio_backend_set *set = context;
+
+	if (unlikely(set->num_members == set->max_members)) {
+		return cio_no_buffer_space;
+	}
+
+	backend->set = set;
+	backend->socket = socket;
+	backend->latency_ns = 0;
+	backend->ejected_until_ns = 0;
+	backend->outstanding = 0;
+	backend->index = set->num_members;
+	set->members[set->num_members] = backend;
+	set->num_members++;
+	swap_members(set, backend->index, set->num_healthy);
+	set->num_healthy++;
+
+	return cio_success;
+}
+
+static void backend_set_remove(void *context, struct cio_backend *backend)
+{
+	struct cio_backend_set *set = context;
+
+	if (backend->index < set->num_healthy) {
+		set->num_healthy--;
+		swap_members(set, backend->index, set->num_healthy);
+	}
+
+	set->num_members--;
+	swap_members(set, backend->index, set->num_members);
+	backend->set = NULL;
+}
+
+static enum cio_error backend_set_select(void *context, struct cio_backend_request *request)
+{
+	struct cio_backend_set *set = context;
+	struct cio_backend *backend;
+	unsigned int candidates;
+
+	if (unlikely(set->num_members == 0)) {
+		return cio_address_not_available;
+	}
+
+	if (set->num_healthy < set->num_members) {
+		reinstate_expired(set);
+	}
+
+	/*
+	 * If all members are ejected, spreading the load over them is better
+	 * than failing every request until the first one is reinstated.
+	 */
+	candidates = set->num_healthy;
+	if (unlikely(candidates == 0)) {
+		candidates = set->num_members;
+	}
+
+	if (candidates == 1) {
+		backend = set->members[0];
+	} else {
+		unsigned int a = next_random(set) % candidates;
+		unsigned int b = next_random(set) % (candidates - 1);
+
+		if (b >= a) {
+			b++;
+		}
+
+		backend = set->members[a];
+		if (cheaper(set->members[b], backend)) {
+			backend = set->members[b];
+		}
+	}
+
+	backend->outstanding++;
+	request->backend = backend;
+	request->socket = backend->socket;
+	request->start_ns = cio_linux_eventloop_get_time_ns(set->loop);
+	return cio_success;
+}
+
+static void backend_set_complete(void *context, struct cio_backend_request *request, enum cio_error err)
+{
+	struct cio_backend_set *set = context;
+	struct cio_backend *backend = request->backend;
+	uint64_t latency;
+
+	backend->outstanding--;
+	if (unlikely(backend->set != set)) {
+		return;
+	}
+
+	if (unlikely(err != cio_success)) {
+		if ((err != cio_operation_aborted) && (set->eject_time_ns != 0)) {
+			eject(set, backend);
+		}
+
+		return;
+	}
+
+	latency = cio_linux_eventloop_get_time_ns(set->loop) - request->start_ns;
+	if (backend->latency_ns == 0) {
+		backend->latency_ns = latency;
+	} else {
+		backend->latency_ns -= backend->latency_ns >> CONFIG_BACKEND_LATENCY_SHIFT;
+		backend->latency_ns += latency >> CONFIG_BACKEND_LATENCY_SHIFT;
+	}
+}
+
+static void backend_set_close(void *context)
+{
+	struct cio_backend_set *set = context;
+
+	cio_free(set->members);
+	set->members = NULL;
+	set->num_members = 0;
+	set->num_healthy = 0;
+}
+
+enum cio_error cio_backend_set_init(struct cio_backend_set *set, struct cio_eventloop *loop,
+                                    unsigned int max_members, uint64_t eject_time_ns)
+{
+	if (unlikely(max_members == 0)) {
+		return cio_invalid_argument;
+	}
+
+	set->members = cio_malloc(max_members * sizeof(*set->members));
+	if (unlikely(set->members == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	set->context = set;
+	set->add = backend_set_add;
+	set->remove = backend_set_remove;
+	set->select = backend_set_select;
+	set->complete = backend_set_complete;
+	set->close = backend_set_close;
+	set->loop = loop;
+	set->num_members = 0;
+	set->num_healthy = 0;
+	set->max_members = max_members;
+	set->eject_time_ns = eject_time_ns;
+	set->random_state = 2463534242U;
+
+	return cio_success;
+}
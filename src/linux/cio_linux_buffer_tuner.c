@@ -0,0 +1,322 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <linux/tcp.h>
+
+#include "cio_buffer_tuner.h"
+#include "cio_compiler.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+#include "linux/cio_linux_buffer_tuner.h"
+#include "linux/cio_linux_socket.h"
+#include "linux/cio_linux_socket_utils.h"
+
+/*
+ * The time between two samples of the same socket if not given when
+ * initializing the tuner.
+ */
+#define CONFIG_BUFFER_TUNER_INTERVAL_NS 1000000000ULL
+
+/*
+ * Maximum number of sockets sampled per tick. With many attached sockets,
+ * the samples are spread over the interval instead of stalling the loop.
+ */
+#define CONFIG_BUFFER_TUNER_BATCH 256
+
+/*
+ * A buffer is only resized if its size changes by more than 1/2^CONFIG_BUFFER_TUNER_HYSTERESIS_SHIFT,
+ * so noisy samples don't cause a system call each time.
+ */
+#define CONFIG_BUFFER_TUNER_HYSTERESIS_SHIFT 2
+
+/*
+ * Linux doubles the size passed with SO_SNDBUF/SO_RCVBUF to make room for
+ * its bookkeeping and caps it at twice net.core.wmem_max/rmem_max. The
+ * tuner deals with the sizes the kernel really reserves, so it requests
+ * half of @p size and reads back what the kernel made of it.
+ */
+static enum cio_error set_kernel_buffer_size(int fd, int option, size_t *size)
+{
+	int value;
+	socklen_t length = sizeof(value);
+	enum cio_error err = set_buffer_size(fd, option, *size / 2);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	if (likely(getsockopt(fd, SOL_SOCKET, option, &value, &length) == 0)) {
+		*size = (size_t)value;
+	}
+
+	return cio_success;
+}
+
+/*
+ * The kernel might reserve more than was granted, e.g. when it rounds a
+ * small size up to its minimum, so memory_used can exceed the limit.
+ */
+static size_t available_memory(const struct cio_buffer_tuner *tuner)
+{
+	if (tuner->memory_used >= tuner->memory_limit) {
+		return 0;
+	}
+
+	return tuner->memory_limit - tuner->memory_used;
+}
+
+/*
+ * Accounts a buffer changing its size from current to wanted and returns
+ * the size that fits into the memory limit.
+ */
+static size_t grant(struct cio_buffer_tuner *tuner, size_t current, size_t wanted)
+{
+	size_t available;
+
+	if (wanted <= current) {
+		tuner->memory_used -= current - wanted;
+		return wanted;
+	}
+
+	available = available_memory(tuner);
+	if (wanted - current > available) {
+		wanted = current + available;
+	}
+
+	tuner->memory_used += wanted - current;
+	return wanted;
+}
+
+static void resize(struct cio_buffer_tuner *tuner, struct cio_socket *s, int option, size_t *current, uint64_t target)
+{
+	size_t difference;
+	size_t granted;
+	size_t size;
+
+	if (target < tuner->min_buffer_size) {
+		target = tuner->min_buffer_size;
+	} else if (target > tuner->max_buffer_size) {
+		target = tuner->max_buffer_size;
+	}
+
+	if (target > *current) {
+		difference = (size_t)target - *current;
+	} else {
+		difference = *current - (size_t)target;
+	}
+
+	if (difference <= (*current >> CONFIG_BUFFER_TUNER_HYSTERESIS_SHIFT)) {
+		return;
+	}
+
+	size = grant(tuner, *current, (size_t)target);
+	if (size == *current) {
+		return;
+	}
+
+	granted = size;
+	if (unlikely(set_kernel_buffer_size(s->ev.fd, option, &size) != cio_success)) {
+		grant(tuner, granted, *current);
+		return;
+	}
+
+	tuner->memory_used = tuner->memory_used - granted + size;
+	*current = size;
+}
+
+/*
+ * The send buffer must hold all data in flight plus the data for the next
+ * round trip, so it is sized to twice the bandwidth-delay product. The
+ * same applies to the receive buffer with the amount of data the kernel
+ * expects to receive per round trip.
+ */
+static void sample(struct cio_buffer_tuner *tuner, struct cio_socket *s)
+{
+	struct tcp_info info;
+	socklen_t length = sizeof(info);
+	uint64_t bdp;
+
+	if (getsockopt(s->ev.fd, IPPROTO_TCP, TCP_INFO, &info, &length) < 0) {
+		return;
+	}
+
+	if (info.tcpi_rtt == 0) {
+		return;
+	}
+
+	bdp = (uint64_t)info.tcpi_snd_cwnd * info.tcpi_snd_mss;
+	if (length >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate)) {
+		uint64_t delivered = info.tcpi_delivery_rate * info.tcpi_rtt / 1000000;
+		if (delivered > bdp) {
+			bdp = delivered;
+		}
+	}
+
+	resize(tuner, s, SO_SNDBUF, &s->ext->tuned_send_size, 2 * bdp);
+	resize(tuner, s, SO_RCVBUF, &s->ext->tuned_receive_size, 2 * (uint64_t)info.tcpi_rcv_space);
+}
+
+static void arm_tick(struct cio_buffer_tuner *tuner)
+{
+	uint64_t ticks = (tuner->num_sockets + CONFIG_BUFFER_TUNER_BATCH - 1) / CONFIG_BUFFER_TUNER_BATCH;
+	uint64_t now = cio_linux_eventloop_get_time_ns(tuner->loop);
+
+	cio_linux_eventloop_arm_deadline(tuner->loop, &tuner->tick, now + (tuner->interval_ns / ticks));
+}
+
+static void tick_expired(void *context)
+{
+	struct cio_buffer_tuner *tuner = context;
+	unsigned int samples = tuner->num_sockets;
+	unsigned int i;
+
+	if (samples > CONFIG_BUFFER_TUNER_BATCH) {
+		samples = CONFIG_BUFFER_TUNER_BATCH;
+	}
+
+	for (i = 0; i < samples; i++) {
+		if (tuner->cursor == NULL) {
+			tuner->cursor = tuner->sockets;
+		}
+
+		sample(tuner, tuner->cursor);
+		tuner->cursor = tuner->cursor->ext->tuner_next;
+	}
+
+	arm_tick(tuner);
+}
+
+enum cio_error cio_linux_buffer_tuner_attach(struct cio_buffer_tuner *tuner, struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = s->ext;
+	size_t receive_size = tuner->min_buffer_size;
+	size_t send_size = tuner->min_buffer_size;
+	enum cio_error err;
+
+	if (unlikely(available_memory(tuner) < 2 * tuner->min_buffer_size)) {
+		return cio_no_buffer_space;
+	}
+
+	err = set_kernel_buffer_size(s->ev.fd, SO_RCVBUF, &receive_size);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	err = set_kernel_buffer_size(s->ev.fd, SO_SNDBUF, &send_size);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	tuner->memory_used += receive_size + send_size;
+	ext->tuner = tuner;
+	ext->tuned_receive_size = receive_size;
+	ext->tuned_send_size = send_size;
+	ext->tuner_next = tuner->sockets;
+	if (ext->tuner_next != NULL) {
+		ext->tuner_next->ext->tuner_pprev = &ext->tuner_next;
+	}
+
+	tuner->sockets = s;
+	ext->tuner_pprev = &tuner->sockets;
+	tuner->num_sockets++;
+	if (tuner->num_sockets == 1) {
+		arm_tick(tuner);
+	}
+
+	return cio_success;
+}
+
+void cio_linux_buffer_tuner_detach(struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = s->ext;
+	struct cio_buffer_tuner *tuner = ext->tuner;
+
+	if (tuner->cursor == s) {
+		tuner->cursor = ext->tuner_next;
+	}
+
+	*ext->tuner_pprev = ext->tuner_next;
+	if (ext->tuner_next != NULL) {
+		ext->tuner_next->ext->tuner_pprev = ext->tuner_pprev;
+	}
+
+	tuner->memory_used -= ext->tuned_receive_size + ext->tuned_send_size;
+	tuner->num_sockets--;
+	if (tuner->num_sockets == 0) {
+		cio_linux_eventloop_disarm_deadline(tuner->loop, &tuner->tick);
+	}
+
+	ext->tuner = NULL;
+	ext->tuner_next = NULL;
+	ext->tuner_pprev = NULL;
+	ext->tuned_receive_size = 0;
+	ext->tuned_send_size = 0;
+}
+
+static void tuner_close(void *context)
+{
+	struct cio_buffer_tuner *tuner = context;
+
+	while (tuner->sockets != NULL) {
+		cio_linux_buffer_tuner_detach(tuner->sockets);
+	}
+}
+
+enum cio_error cio_buffer_tuner_init(struct cio_buffer_tuner *tuner, struct cio_eventloop *loop,
+                                     uint64_t interval_ns, size_t min_buffer_size,
+                                     size_t max_buffer_size, size_t memory_limit)
+{
+	if (unlikely((min_buffer_size == 0) || (min_buffer_size > max_buffer_size))) {
+		return cio_invalid_argument;
+	}
+
+	if (interval_ns == 0) {
+		interval_ns = CONFIG_BUFFER_TUNER_INTERVAL_NS;
+	}
+
+	tuner->context = tuner;
+	tuner->close = tuner_close;
+	tuner->loop = loop;
+	tuner->tick.expired = tick_expired;
+	tuner->tick.context = tuner;
+	tuner->tick.next = NULL;
+	tuner->tick.pprev = NULL;
+	tuner->sockets = NULL;
+	tuner->cursor = NULL;
+	tuner->interval_ns = interval_ns;
+	tuner->min_buffer_size = min_buffer_size;
+	tuner->max_buffer_size = max_buffer_size;
+	tuner->memory_limit = memory_limit;
+	tuner->memory_used = 0;
+	tuner->num_sockets = 0;
+
+	return cio_success;
+}
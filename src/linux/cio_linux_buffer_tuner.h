@@ -0,0 +1,53 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CIO_LINUX_BUFFER_TUNER_H
+#define CIO_LINUX_BUFFER_TUNER_H
+
+#include "cio_buffer_tuner.h"
+#include "cio_error_code.h"
+#include "cio_socket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Gives a socket the smallest buffers and starts sampling it. The
+ * extension of the socket must be allocated.
+ */
+enum cio_error cio_linux_buffer_tuner_attach(struct cio_buffer_tuner *tuner, struct cio_socket *s);
+
+/*
+ * Stops sampling a socket and returns its buffers to the memory limit.
+ */
+void cio_linux_buffer_tuner_detach(struct cio_socket *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
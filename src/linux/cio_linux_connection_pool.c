@@ -0,0 +1,364 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "cio_compiler.h"
+#include "cio_connection_pool.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+#include "linux/cio_linux_alloc.h"
+#include "linux/cio_linux_socket.h"
+
+static void connection_closed(struct cio_socket *s);
+static void open_connection(struct cio_pool_endpoint *endpoint, struct cio_pool_request *request);
+
+static void push_connection(struct cio_pool_connection **head, struct cio_pool_connection *conn)
+{
+	conn->next = *head;
+	if (conn->next != NULL) {
+		conn->next->pprev = &conn->next;
+	}
+
+	*head = conn;
+	conn->pprev = head;
+}
+
+static struct cio_pool_connection *pop_connection(struct cio_pool_connection **head)
+{
+	struct cio_pool_connection *conn = *head;
+	*head = conn->next;
+	if (conn->next != NULL) {
+		conn->next->pprev = head;
+	}
+
+	conn->next = NULL;
+	conn->pprev = NULL;
+	return conn;
+}
+
+static struct cio_pool_request *pop_waiter(struct cio_pool_endpoint *endpoint)
+{
+	struct cio_pool_request *request = endpoint->waiters;
+	if (request != NULL) {
+		endpoint->waiters = request->next;
+		if (endpoint->waiters == NULL) {
+			endpoint->waiters_tail = &endpoint->waiters;
+		}
+
+		request->next = NULL;
+	}
+
+	return request;
+}
+
+static void free_connections(struct cio_pool_endpoint *endpoint, unsigned int num_connections)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_connections; i++) {
+		cio_socket_connect_state_free(endpoint->connections[i].connect_state);
+	}
+
+	cio_free(endpoint->connections);
+	endpoint->connections = NULL;
+	freeaddrinfo(endpoint->addresses);
+	endpoint->addresses = NULL;
+}
+
+static void free_endpoint(struct cio_pool_endpoint *endpoint)
+{
+	free_connections(endpoint, endpoint->pool->max_total);
+}
+
+static void connected(struct cio_socket *s, void *handler_context, enum cio_error err)
+{
+	struct cio_pool_connection *conn = handler_context;
+	struct cio_pool_endpoint *endpoint = conn->endpoint;
+	struct cio_pool_request *request = conn->request;
+
+	conn->request = NULL;
+	if (unlikely(err != cio_success)) {
+		struct cio_pool_request *waiter;
+
+		push_connection(&endpoint->free_connections, conn);
+		endpoint->num_open--;
+		if (endpoint->removed && (endpoint->num_open == 0)) {
+			free_endpoint(endpoint);
+		}
+
+		request->handler(endpoint, request->handler_context, err, NULL);
+
+		/*
+		 * The failed attempt freed a slot, so a waiting request gets its own try.
+		 */
+		waiter = pop_waiter(endpoint);
+		if (waiter != NULL) {
+			open_connection(endpoint, waiter);
+		}
+
+		return;
+	}
+
+	if (unlikely(endpoint->removed)) {
+		s->ops->close(s);
+		request->handler(endpoint, request->handler_context, cio_operation_aborted, NULL);
+		return;
+	}
+
+	request->handler(endpoint, request->handler_context, cio_success, s);
+}
+
+static void open_connection(struct cio_pool_endpoint *endpoint, struct cio_pool_request *request)
+{
+	struct cio_connection_pool *pool = endpoint->pool;
+	struct cio_pool_connection *conn = pop_connection(&endpoint->free_connections);
+	enum cio_error err;
+
+	endpoint->num_open++;
+	conn->request = request;
+	err = cio_socket_connect_resolved(&conn->socket, pool->loop, conn->connect_state, pool->connect_timeout_ns,
+	                                  connection_closed, connected, conn);
+	if (unlikely(err != cio_success)) {
+		conn->request = NULL;
+		push_connection(&endpoint->free_connections, conn);
+		endpoint->num_open--;
+		request->handler(endpoint, request->handler_context, err, NULL);
+	}
+}
+
+static void connection_closed(struct cio_socket *s)
+{
+	struct cio_pool_connection *conn = (struct cio_pool_connection *)s;
+	struct cio_pool_endpoint *endpoint = conn->endpoint;
+	struct cio_pool_request *request;
+
+	if (conn->idle) {
+		*conn->pprev = conn->next;
+		if (conn->next != NULL) {
+			conn->next->pprev = conn->pprev;
+		}
+
+		conn->idle = false;
+		endpoint->num_idle--;
+	}
+
+	push_connection(&endpoint->free_connections, conn);
+	endpoint->num_open--;
+	if (endpoint->removed) {
+		if (endpoint->num_open == 0) {
+			free_endpoint(endpoint);
+		}
+
+		return;
+	}
+
+	request = pop_waiter(endpoint);
+	if (request != NULL) {
+		open_connection(endpoint, request);
+	}
+}
+
+/*
+ * An idle connection must not receive anything, so readability means
+ * the peer closed the connection, reset it or violated the protocol.
+ */
+static void idle_readable(void *context)
+{
+	struct cio_pool_connection *conn = context;
+	uint8_t c;
+	ssize_t ret;
+
+	if (!conn->idle) {
+		return;
+	}
+
+	ret = recv(conn->socket.ev.fd, &c, sizeof(c), MSG_PEEK | MSG_DONTWAIT);
+	if ((ret == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+		return;
+	}
+
+	conn->socket.ops->close(&conn->socket);
+}
+
+static enum cio_error pool_add_endpoint(void *context, struct cio_pool_endpoint *endpoint, const char *address, uint16_t port)
+{
+	struct cio_connection_pool *pool = context;
+	unsigned int i;
+	enum cio_error err;
+
+	if (unlikely((address == NULL) || (pool->max_total == 0))) {
+		return cio_invalid_argument;
+	}
+
+	err = cio_socket_resolve(address, port, &endpoint->addresses);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	endpoint->connections = cio_malloc(pool->max_total * sizeof(*endpoint->connections));
+	if (unlikely(endpoint->connections == NULL)) {
+		freeaddrinfo(endpoint->addresses);
+		return cio_not_enough_memory;
+	}
+
+	endpoint->pool = pool;
+	endpoint->free_connections = NULL;
+	endpoint->idle_connections = NULL;
+	endpoint->waiters = NULL;
+	endpoint->waiters_tail = &endpoint->waiters;
+	endpoint->num_open = 0;
+	endpoint->num_idle = 0;
+	endpoint->removed = false;
+
+	for (i = 0; i < pool->max_total; i++) {
+		struct cio_pool_connection *conn = &endpoint->connections[i];
+		conn->connect_state = cio_socket_connect_state_alloc(endpoint->addresses);
+		if (unlikely(conn->connect_state == NULL)) {
+			free_connections(endpoint, i);
+			return cio_not_enough_memory;
+		}
+
+		conn->endpoint = endpoint;
+		conn->request = NULL;
+		conn->idle = false;
+		push_connection(&endpoint->free_connections, conn);
+	}
+
+	return cio_success;
+}
+
+static void pool_remove_endpoint(void *context, struct cio_pool_endpoint *endpoint)
+{
+	struct cio_pool_request *request;
+	(void)context;
+
+	endpoint->removed = true;
+	while ((request = pop_waiter(endpoint)) != NULL) {
+		request->handler(endpoint, request->handler_context, cio_operation_aborted, NULL);
+	}
+
+	if (endpoint->num_open == 0) {
+		free_endpoint(endpoint);
+		return;
+	}
+
+	/*
+	 * Closing the last open connection frees the endpoint.
+	 */
+	while (endpoint->idle_connections != NULL) {
+		struct cio_socket *s = &endpoint->idle_connections->socket;
+		s->ops->close(s);
+	}
+}
+
+static void pool_borrow(void *context, struct cio_pool_endpoint *endpoint, struct cio_pool_request *request, cio_pool_borrow_handler handler, void *handler_context)
+{
+	(void)context;
+
+	request->handler = handler;
+	request->handler_context = handler_context;
+	request->next = NULL;
+
+	if (unlikely(endpoint->removed)) {
+		handler(endpoint, handler_context, cio_operation_aborted, NULL);
+		return;
+	}
+
+	if (endpoint->idle_connections != NULL) {
+		struct cio_pool_connection *conn = pop_connection(&endpoint->idle_connections);
+		conn->idle = false;
+		endpoint->num_idle--;
+		conn->socket.ops->set_idle_timeout(conn->socket.context, 0);
+		handler(endpoint, handler_context, cio_success, &conn->socket);
+		return;
+	}
+
+	if (endpoint->free_connections != NULL) {
+		open_connection(endpoint, request);
+		return;
+	}
+
+	*endpoint->waiters_tail = request;
+	endpoint->waiters_tail = &request->next;
+}
+
+static void pool_release(void *context, struct cio_socket *socket, bool reuse)
+{
+	struct cio_connection_pool *pool = context;
+	struct cio_pool_connection *conn = (struct cio_pool_connection *)socket;
+	struct cio_pool_endpoint *endpoint = conn->endpoint;
+	struct cio_pool_request *request;
+
+	if (!reuse || endpoint->removed) {
+		socket->ops->close(socket);
+		return;
+	}
+
+	request = pop_waiter(endpoint);
+	if (request != NULL) {
+		request->handler(endpoint, request->handler_context, cio_success, socket);
+		return;
+	}
+
+	if (endpoint->num_idle >= pool->max_idle) {
+		socket->ops->close(socket);
+		return;
+	}
+
+	if (unlikely(cio_linux_socket_watch_idle(socket, idle_readable, conn) != cio_success)) {
+		socket->ops->close(socket);
+		return;
+	}
+
+	conn->idle = true;
+	push_connection(&endpoint->idle_connections, conn);
+	endpoint->num_idle++;
+	socket->ops->set_idle_timeout(socket->context, pool->idle_timeout_ns);
+}
+
+void cio_connection_pool_init(struct cio_connection_pool *pool, struct cio_eventloop *loop,
+                              unsigned int max_total, unsigned int max_idle,
+                              uint64_t idle_timeout_ns, uint64_t connect_timeout_ns)
+{
+	pool->context = pool;
+	pool->add_endpoint = pool_add_endpoint;
+	pool->remove_endpoint = pool_remove_endpoint;
+	pool->borrow = pool_borrow;
+	pool->release = pool_release;
+	pool->loop = loop;
+	pool->max_total = max_total;
+	pool->max_idle = max_idle;
+	pool->idle_timeout_ns = idle_timeout_ns;
+	pool->connect_timeout_ns = connect_timeout_ns;
+}
@@ -25,8 +25,12 @@
  */
 
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "cio_compiler.h"
@@ -46,6 +50,233 @@ static void erase_pending_event(struct cio_eventloop *loop, const struct cio_eve
 	}
 }
 
+static void update_time(struct cio_eventloop *loop)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	loop->now_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void deadline_link(struct cio_linux_deadline **head, struct cio_linux_deadline *deadline)
+{
+	deadline->next = *head;
+	if (deadline->next != NULL) {
+		deadline->next->pprev = &deadline->next;
+	}
+
+	*head = deadline;
+	deadline->pprev = head;
+}
+
+static void deadline_unlink(struct cio_linux_deadline *deadline)
+{
+	*deadline->pprev = deadline->next;
+	if (deadline->next != NULL) {
+		deadline->next->pprev = deadline->pprev;
+	}
+
+	deadline->next = NULL;
+	deadline->pprev = NULL;
+}
+
+static void deferred_unlink(struct cio_linux_deferred *deferred)
+{
+	*deferred->pprev = deferred->next;
+	if (deferred->next != NULL) {
+		deferred->next->pprev = deferred->pprev;
+	}
+
+	deferred->next = NULL;
+	deferred->pprev = NULL;
+}
+
+static int get_epoll_timeout(const struct cio_eventloop *loop)
+{
+	uint64_t timeout_ms;
+
+	if (loop->deferred != NULL) {
+		return 0;
+	}
+
+	if (loop->armed_deadlines == 0) {
+		return -1;
+	}
+
+	if (loop->next_expiry_ns <= loop->now_ns) {
+		return 0;
+	}
+
+	timeout_ms = (loop->next_expiry_ns - loop->now_ns + 999999) / 1000000;
+	if (timeout_ms > INT_MAX) {
+		return INT_MAX;
+	}
+
+	return (int)timeout_ms;
+}
+
+/*
+ * Finds the earliest expiry of all armed deadlines within one lap of the
+ * wheel. A slot also holds deadlines of later laps, so only deadlines
+ * expiring within the tick of the slot are taken into account. If no
+ * deadline expires within the lap, the loop wakes up after one lap and
+ * searches again.
+ */
+static uint64_t find_next_expiry(const struct cio_eventloop *loop)
+{
+	uint64_t tick = loop->wheel_tick;
+	unsigned int slots;
+
+	for (slots = 0; slots < CONFIG_DEADLINE_WHEEL_SLOTS; slots++) {
+		const struct cio_linux_deadline *deadline = loop->deadline_wheel[tick & (CONFIG_DEADLINE_WHEEL_SLOTS - 1)];
+		uint64_t tick_end_ns = (tick + 1) * CONFIG_DEADLINE_WHEEL_TICK_NS;
+		uint64_t next_expiry_ns = UINT64_MAX;
+
+		while (deadline != NULL) {
+			if ((deadline->expires_ns < tick_end_ns) && (deadline->expires_ns < next_expiry_ns)) {
+				next_expiry_ns = deadline->expires_ns;
+			}
+
+			deadline = deadline->next;
+		}
+
+		if (next_expiry_ns != UINT64_MAX) {
+			return next_expiry_ns;
+		}
+
+		tick++;
+	}
+
+	return tick * CONFIG_DEADLINE_WHEEL_TICK_NS;
+}
+
+static void expire_deadlines(struct cio_eventloop *loop)
+{
+	struct cio_linux_deadline *expired = NULL;
+	uint64_t now_tick = loop->now_ns / CONFIG_DEADLINE_WHEEL_TICK_NS;
+	uint64_t tick = loop->wheel_tick;
+	unsigned int slots = 0;
+
+	if (loop->armed_deadlines == 0) {
+		loop->wheel_tick = now_tick;
+		loop->next_expiry_ns = UINT64_MAX;
+		return;
+	}
+
+	/*
+	 * Deadlines are only armed later than next_expiry_ns or lower it, so
+	 * nothing expired before. Disarmed deadlines might leave it too early,
+	 * which just costs an unnecessary wakeup.
+	 */
+	if (loop->next_expiry_ns > loop->now_ns) {
+		loop->wheel_tick = now_tick;
+		return;
+	}
+
+	/*
+	 * The slot of the current tick is scanned again in the next iteration,
+	 * because deadlines expiring later in this tick might be linked there.
+	 */
+	while ((tick <= now_tick) && (slots < CONFIG_DEADLINE_WHEEL_SLOTS)) {
+		struct cio_linux_deadline *deadline = loop->deadline_wheel[tick & (CONFIG_DEADLINE_WHEEL_SLOTS - 1)];
+		while (deadline != NULL) {
+			struct cio_linux_deadline *next = deadline->next;
+			if (deadline->expires_ns <= loop->now_ns) {
+				deadline_unlink(deadline);
+				deadline_link(&expired, deadline);
+			}
+
+			deadline = next;
+		}
+
+		tick++;
+		slots++;
+	}
+
+	loop->wheel_tick = now_tick;
+	loop->next_expiry_ns = find_next_expiry(loop);
+
+	/*
+	 * An expired callback might disarm other expired deadlines, so the
+	 * list head is re-read after every callback.
+	 */
+	while (expired != NULL) {
+		struct cio_linux_deadline *deadline = expired;
+		deadline_unlink(deadline);
+		loop->armed_deadlines--;
+		deadline->expired(deadline->context);
+	}
+}
+
+static void run_deferred(struct cio_eventloop *loop)
+{
+	struct cio_linux_deferred *pending = loop->deferred;
+
+	if (pending == NULL) {
+		return;
+	}
+
+	/*
+	 * Work deferred by a callback is collected in the now empty loop list
+	 * and runs in the next iteration, so a callback rescheduling itself
+	 * can't starve I/O.
+	 */
+	pending->pprev = &pending;
+	loop->deferred = NULL;
+	while (pending != NULL) {
+		struct cio_linux_deferred *deferred = pending;
+		deferred_unlink(deferred);
+		deferred->callback(deferred->context);
+	}
+}
+
+/*
+ * Moves the work posted by other threads to the ready list. The posted
+ * work is a stack, so it is reversed to keep the order of the posts.
+ */
+static void take_remote(struct cio_eventloop *loop)
+{
+	struct cio_linux_remote *posted = __atomic_exchange_n(&loop->remote_posted, NULL, __ATOMIC_ACQUIRE);
+	struct cio_linux_remote *reversed = NULL;
+
+	while (posted != NULL) {
+		struct cio_linux_remote *next = posted->next;
+		posted->next = reversed;
+		reversed = posted;
+		posted = next;
+	}
+
+	*loop->remote_ready_tail = reversed;
+	while (reversed != NULL) {
+		loop->remote_ready_tail = &reversed->next;
+		reversed = reversed->next;
+	}
+}
+
+static void run_remote(void *context)
+{
+	struct cio_eventloop *loop = context;
+	uint64_t value;
+
+	if (unlikely(read(loop->wakeup.fd, &value, sizeof(value)) < 0)) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			return;
+		}
+	}
+
+	take_remote(loop);
+	while (loop->remote_ready != NULL) {
+		struct cio_linux_remote *remote = loop->remote_ready;
+		loop->remote_ready = remote->next;
+		if (loop->remote_ready == NULL) {
+			loop->remote_ready_tail = &loop->remote_ready;
+		}
+
+		remote->next = NULL;
+		__atomic_store_n(&remote->queued, false, __ATOMIC_RELEASE);
+		remote->callback(remote->context);
+	}
+}
+
 enum cio_error cio_eventloop_init(struct cio_eventloop *loop)
 {
 	loop->epoll_fd = epoll_create(1);
@@ -58,11 +289,29 @@ enum cio_error cio_eventloop_init(struct cio_eventloop *loop)
 	loop->go_ahead = true;
 	loop->current_ev = NULL;
 
+	update_time(loop);
+	loop->wheel_tick = loop->now_ns / CONFIG_DEADLINE_WHEEL_TICK_NS;
+	loop->armed_deadlines = 0;
+	loop->next_expiry_ns = UINT64_MAX;
+	memset(loop->deadline_wheel, 0, sizeof(loop->deadline_wheel));
+	loop->deferred = NULL;
+
+	loop->wakeup.fd = -1;
+	loop->remote_posted = NULL;
+	loop->remote_ready = NULL;
+	loop->remote_ready_tail = &loop->remote_ready;
+	memset(&loop->receive_delays, 0, sizeof(loop->receive_delays));
+	loop->sockets = NULL;
+
 	return cio_success;
 }
 
 void cio_eventloop_destroy(const struct cio_eventloop *loop)
 {
+	if (loop->wakeup.fd != -1) {
+		close(loop->wakeup.fd);
+	}
+
 	close(loop->epoll_fd);
 }
 
@@ -126,13 +375,165 @@ void cio_linux_eventloop_remove(struct cio_eventloop *loop, const struct cio_eve
 	}
 }
 
+uint64_t cio_linux_eventloop_get_time_ns(const struct cio_eventloop *loop)
+{
+	return loop->now_ns;
+}
+
+void cio_linux_eventloop_arm_deadline(struct cio_eventloop *loop, struct cio_linux_deadline *deadline, uint64_t expires_ns)
+{
+	uint64_t tick = expires_ns / CONFIG_DEADLINE_WHEEL_TICK_NS;
+
+	if (deadline->pprev != NULL) {
+		deadline_unlink(deadline);
+	} else {
+		loop->armed_deadlines++;
+	}
+
+	if (tick < loop->wheel_tick) {
+		tick = loop->wheel_tick;
+	}
+
+	deadline->expires_ns = expires_ns;
+	deadline_link(&loop->deadline_wheel[tick & (CONFIG_DEADLINE_WHEEL_SLOTS - 1)], deadline);
+	if (expires_ns < loop->next_expiry_ns) {
+		loop->next_expiry_ns = expires_ns;
+	}
+}
+
+void cio_linux_eventloop_disarm_deadline(struct cio_eventloop *loop, struct cio_linux_deadline *deadline)
+{
+	if (deadline->pprev != NULL) {
+		deadline_unlink(deadline);
+		loop->armed_deadlines--;
+	}
+}
+
+void cio_linux_eventloop_defer(struct cio_eventloop *loop, struct cio_linux_deferred *deferred)
+{
+	if (deferred->pprev != NULL) {
+		return;
+	}
+
+	deferred->next = loop->deferred;
+	if (deferred->next != NULL) {
+		deferred->next->pprev = &deferred->next;
+	}
+
+	loop->deferred = deferred;
+	deferred->pprev = &loop->deferred;
+}
+
+void cio_linux_eventloop_cancel_deferred(struct cio_eventloop *loop, struct cio_linux_deferred *deferred)
+{
+	(void)loop;
+	if (deferred->pprev != NULL) {
+		deferred_unlink(deferred);
+	}
+}
+
+/*
+ * The wakeup file descriptor is created only when needed, so loops that
+ * never get work from other threads don't spend a file descriptor on it.
+ */
+enum cio_error cio_linux_eventloop_enable_remote(struct cio_eventloop *loop)
+{
+	enum cio_error err;
+	int fd;
+
+	if (loop->wakeup.fd != -1) {
+		return cio_success;
+	}
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (unlikely(fd == -1)) {
+		return errno;
+	}
+
+	loop->wakeup.fd = fd;
+	loop->wakeup.read_callback = run_remote;
+	loop->wakeup.write_callback = NULL;
+	loop->wakeup.error_callback = NULL;
+	loop->wakeup.context = loop;
+
+	err = cio_linux_eventloop_add(loop, &loop->wakeup);
+	if (unlikely(err != cio_success)) {
+		close(fd);
+		loop->wakeup.fd = -1;
+		return err;
+	}
+
+	err = cio_linux_eventloop_register_read(loop, &loop->wakeup);
+	if (unlikely(err != cio_success)) {
+		cio_linux_eventloop_remove(loop, &loop->wakeup);
+		close(fd);
+		loop->wakeup.fd = -1;
+		return err;
+	}
+
+	return cio_success;
+}
+
+void cio_linux_eventloop_post(struct cio_eventloop *loop, struct cio_linux_remote *remote)
+{
+	struct cio_linux_remote *head;
+
+	if (__atomic_exchange_n(&remote->queued, true, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	head = __atomic_load_n(&loop->remote_posted, __ATOMIC_RELAXED);
+	do {
+		remote->next = head;
+	} while (!__atomic_compare_exchange_n(&loop->remote_posted, &head, remote, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/*
+	 * Only the post finding no other work wakes up the loop. The loop
+	 * takes all work posted until then with that wakeup.
+	 */
+	if (head == NULL) {
+		uint64_t one = 1;
+		ssize_t ret = write(loop->wakeup.fd, &one, sizeof(one));
+		(void)ret;
+	}
+}
+
+void cio_linux_eventloop_cancel_remote(struct cio_eventloop *loop, struct cio_linux_remote *remote)
+{
+	struct cio_linux_remote **pp;
+
+	if (!__atomic_load_n(&remote->queued, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	/*
+	 * Posted work can't be removed from the stack other threads push to,
+	 * so the stack is moved to the ready list first. The wakeup that
+	 * belongs to it is still pending and runs the rest of the list.
+	 */
+	take_remote(loop);
+	for (pp = &loop->remote_ready; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == remote) {
+			*pp = remote->next;
+			if (*pp == NULL) {
+				loop->remote_ready_tail = pp;
+			}
+
+			break;
+		}
+	}
+
+	remote->next = NULL;
+	__atomic_store_n(&remote->queued, false, __ATOMIC_RELEASE);
+}
+
 enum cio_error cio_eventloop_run(struct cio_eventloop *loop)
 {
 	struct epoll_event *events = loop->epoll_events;
 
 	while (likely(loop->go_ahead)) {
 		int num_events =
-		    epoll_wait(loop->epoll_fd, events, CONFIG_MAX_EPOLL_EVENTS, -1);
+		    epoll_wait(loop->epoll_fd, events, CONFIG_MAX_EPOLL_EVENTS, get_epoll_timeout(loop));
 
 		if (unlikely(num_events < 0)) {
 			if (errno == EINTR) {
@@ -142,6 +543,8 @@ enum cio_error cio_eventloop_run(struct cio_eventloop *loop)
 			return errno;
 		}
 
+		update_time(loop);
+
 		loop->num_events = (unsigned int)num_events;
 		for (loop->event_counter = 0; loop->event_counter < loop->num_events; loop->event_counter++) {
 			struct cio_event_notifier *ev = events[loop->event_counter].data.ptr;
@@ -160,7 +563,16 @@ enum cio_error cio_eventloop_run(struct cio_eventloop *loop)
 					ev->write_callback(ev->context);
 				}
 			}
+
+			if (likely(loop->current_ev != NULL)) {
+				if (((events_type & EPOLLERR) != 0) && (ev->error_callback != NULL)) {
+					ev->error_callback(ev->context);
+				}
+			}
 		}
+
+		expire_deadlines(loop);
+		run_deferred(loop);
 	}
 
 	return cio_success;
@@ -170,3 +582,48 @@ void cio_eventloop_cancel(struct cio_eventloop *loop)
 {
 	loop->go_ahead = false;
 }
+
+void cio_linux_eventloop_record_receive_delay(struct cio_eventloop *loop, uint64_t delay_ns)
+{
+	unsigned int bucket = 0;
+
+	if (delay_ns > 1) {
+		bucket = 63 - (unsigned int)__builtin_clzll(delay_ns);
+	}
+
+	loop->receive_delays.buckets[bucket]++;
+	loop->receive_delays.count++;
+}
+
+void cio_eventloop_get_receive_delays(struct cio_eventloop *loop, struct cio_delay_histogram *histogram, bool reset)
+{
+	*histogram = loop->receive_delays;
+	if (reset) {
+		memset(&loop->receive_delays, 0, sizeof(loop->receive_delays));
+	}
+}
+
+uint64_t cio_delay_histogram_percentile(const struct cio_delay_histogram *histogram, unsigned int permille)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	rank = (histogram->count * permille + 999) / 1000;
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	for (i = 0; i < CONFIG_DELAY_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			return (2ULL << i) - 1;
+		}
+	}
+
+	return UINT64_MAX;
+}
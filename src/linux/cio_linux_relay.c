@@ -0,0 +1,331 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cio_compiler.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_relay.h"
+#include "cio_socket.h"
+#include "linux/cio_linux_socket.h"
+
+static struct cio_relay_endpoint *get_peer(struct cio_relay_endpoint *ep)
+{
+	struct cio_relay *relay = ep->relay;
+	if (ep == &relay->endpoints[0]) {
+		return &relay->endpoints[1];
+	}
+
+	return &relay->endpoints[0];
+}
+
+static void save_callbacks(struct cio_relay_endpoint *ep)
+{
+	struct cio_socket *s = ep->socket;
+
+	ep->saved_read_callback = s->ev.read_callback;
+	ep->saved_write_callback = s->ev.write_callback;
+	ep->saved_error_callback = s->ev.error_callback;
+	ep->saved_context = s->ev.context;
+}
+
+static void restore_callbacks(struct cio_relay_endpoint *ep)
+{
+	struct cio_socket *s = ep->socket;
+
+	s->ev.read_callback = ep->saved_read_callback;
+	s->ev.write_callback = ep->saved_write_callback;
+	s->ev.error_callback = ep->saved_error_callback;
+	s->ev.context = ep->saved_context;
+}
+
+static void stop_relay(struct cio_relay *relay)
+{
+	unsigned int i;
+
+	relay->running = false;
+	for (i = 0; i < 2; i++) {
+		struct cio_socket *s = relay->endpoints[i].socket;
+		cio_linux_eventloop_unregister_read(s->loop, &s->ev);
+		cio_linux_eventloop_unregister_write(s->loop, &s->ev);
+		restore_callbacks(&relay->endpoints[i]);
+	}
+}
+
+static void finish(struct cio_relay *relay, enum cio_error err)
+{
+	stop_relay(relay);
+	relay->handler(relay, relay->handler_context, err);
+}
+
+/*
+ * Moves data from the socket of @p from through its pipe to the socket
+ * of the peer until either the source is drained or the destination
+ * would block.
+ */
+static enum cio_error pump(struct cio_relay_endpoint *from)
+{
+	struct cio_relay_endpoint *to = get_peer(from);
+	size_t pipe_size = from->relay->pipe_size;
+	bool progress;
+
+	do {
+		progress = false;
+
+		if (!from->eof && (from->pipe_fill < pipe_size)) {
+			ssize_t ret = splice(from->socket->ev.fd, NULL, from->pipe_fds[1], NULL, pipe_size - from->pipe_fill, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret > 0) {
+				from->pipe_fill += (size_t)ret;
+				progress = true;
+			} else if (ret == 0) {
+				from->eof = true;
+			} else if (unlikely((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+				return errno;
+			}
+		}
+
+		if (from->pipe_fill > 0) {
+			ssize_t ret = splice(from->pipe_fds[0], NULL, to->socket->ev.fd, NULL, from->pipe_fill, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret > 0) {
+				from->pipe_fill -= (size_t)ret;
+				from->bytes_forwarded += (uint64_t)ret;
+				progress = true;
+			} else if (unlikely((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+				return errno;
+			}
+		}
+	} while (progress);
+
+	if (from->eof && (from->pipe_fill == 0) && !from->shut_down) {
+		from->shut_down = true;
+		if (unlikely(shutdown(to->socket->ev.fd, SHUT_WR) < 0)) {
+			return errno;
+		}
+	}
+
+	return cio_success;
+}
+
+static void run_pump(struct cio_relay_endpoint *from)
+{
+	struct cio_relay *relay = from->relay;
+	enum cio_error err;
+
+	if (unlikely(!relay->running)) {
+		return;
+	}
+
+	err = pump(from);
+	if (unlikely(err != cio_success)) {
+		finish(relay, err);
+		return;
+	}
+
+	if (relay->endpoints[0].shut_down && relay->endpoints[1].shut_down) {
+		finish(relay, cio_success);
+	}
+}
+
+static void relay_read_callback(void *context)
+{
+	struct cio_relay_endpoint *ep = context;
+	run_pump(ep);
+}
+
+static void relay_write_callback(void *context)
+{
+	struct cio_relay_endpoint *ep = context;
+	run_pump(get_peer(ep));
+}
+
+static void relay_error_callback(void *context)
+{
+	struct cio_relay_endpoint *ep = context;
+	struct cio_relay *relay = ep->relay;
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (unlikely(!relay->running)) {
+		return;
+	}
+
+	if (unlikely(getsockopt(ep->socket->ev.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)) {
+		err = errno;
+	}
+
+	if (err != 0) {
+		finish(relay, err);
+	}
+}
+
+static enum cio_error relay_start(void *context, cio_relay_handler handler, void *handler_context)
+{
+	struct cio_relay *relay = context;
+	unsigned int i;
+
+	if (unlikely(handler == NULL)) {
+		return cio_invalid_argument;
+	}
+
+	for (i = 0; i < 2; i++) {
+		const struct cio_socket *s = relay->endpoints[i].socket;
+		if (unlikely((s->ext != NULL) && (s->ext->zerocopy || s->ext->zerocopy_pending))) {
+			return cio_invalid_argument;
+		}
+	}
+
+	relay->handler = handler;
+	relay->handler_context = handler_context;
+
+	for (i = 0; i < 2; i++) {
+		struct cio_relay_endpoint *ep = &relay->endpoints[i];
+		struct cio_socket *s = ep->socket;
+
+		save_callbacks(ep);
+		s->ev.context = ep;
+		s->ev.read_callback = relay_read_callback;
+		s->ev.write_callback = relay_write_callback;
+		s->ev.error_callback = relay_error_callback;
+	}
+
+	for (i = 0; i < 2; i++) {
+		struct cio_socket *s = relay->endpoints[i].socket;
+		enum cio_error err;
+
+		err = cio_linux_eventloop_register_read(s->loop, &s->ev);
+		if (unlikely(err != cio_success)) {
+			stop_relay(relay);
+			return err;
+		}
+
+		err = cio_linux_eventloop_register_write(s->loop, &s->ev);
+		if (unlikely(err != cio_success)) {
+			stop_relay(relay);
+			return err;
+		}
+	}
+
+	relay->running = true;
+	run_pump(&relay->endpoints[0]);
+	run_pump(&relay->endpoints[1]);
+	return cio_success;
+}
+
+static uint64_t relay_get_bytes_forwarded(void *context, const struct cio_socket *from)
+{
+	struct cio_relay *relay = context;
+	if (from == relay->endpoints[0].socket) {
+		return relay->endpoints[0].bytes_forwarded;
+	}
+
+	return relay->endpoints[1].bytes_forwarded;
+}
+
+static void close_pipes(struct cio_relay_endpoint *ep)
+{
+	if (ep->pipe_fds[0] != -1) {
+		close(ep->pipe_fds[0]);
+		close(ep->pipe_fds[1]);
+		ep->pipe_fds[0] = -1;
+		ep->pipe_fds[1] = -1;
+	}
+}
+
+static void relay_close(void *context)
+{
+	struct cio_relay *relay = context;
+
+	if (relay->running) {
+		stop_relay(relay);
+	}
+
+	close_pipes(&relay->endpoints[0]);
+	close_pipes(&relay->endpoints[1]);
+	if (relay->close_hook != NULL) {
+		relay->close_hook(relay);
+	}
+}
+
+static enum cio_error init_endpoint(struct cio_relay *relay, struct cio_relay_endpoint *ep, struct cio_socket *s)
+{
+	ep->socket = s;
+	ep->relay = relay;
+	ep->pipe_fill = 0;
+	ep->bytes_forwarded = 0;
+	ep->eof = false;
+	ep->shut_down = false;
+	if (unlikely(pipe2(ep->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0)) {
+		ep->pipe_fds[0] = -1;
+		ep->pipe_fds[1] = -1;
+		return errno;
+	}
+
+	return cio_success;
+}
+
+enum cio_error cio_relay_init(struct cio_relay *relay, struct cio_socket *a, struct cio_socket *b,
+                              cio_relay_close_hook close_hook)
+{
+	enum cio_error err;
+	int pipe_size;
+
+	relay->context = relay;
+	relay->start = relay_start;
+	relay->get_bytes_forwarded = relay_get_bytes_forwarded;
+	relay->close = relay_close;
+	relay->close_hook = close_hook;
+	relay->running = false;
+
+	err = init_endpoint(relay, &relay->endpoints[0], a);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	err = init_endpoint(relay, &relay->endpoints[1], b);
+	if (unlikely(err != cio_success)) {
+		close_pipes(&relay->endpoints[0]);
+		return err;
+	}
+
+	pipe_size = fcntl(relay->endpoints[0].pipe_fds[0], F_GETPIPE_SZ);
+	if (unlikely(pipe_size <= 0)) {
+		err = errno;
+		close_pipes(&relay->endpoints[0]);
+		close_pipes(&relay->endpoints[1]);
+		return err;
+	}
+
+	relay->pipe_size = (size_t)pipe_size;
+	return cio_success;
+}
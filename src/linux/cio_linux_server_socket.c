@@ -24,8 +24,11 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -33,6 +36,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "cio_compiler.h"
@@ -41,14 +45,29 @@
 #include "cio_server_socket.h"
 #include "cio_socket.h"
 #include "linux/cio_linux_alloc.h"
+#include "linux/cio_linux_socket.h"
 #include "linux/cio_linux_socket_utils.h"
 
-static enum cio_error socket_init(void *context, unsigned int backlog)
+/*
+ * The number of connections accepted per event loop iteration if not
+ * changed via set_accept_budget.
+ */
+#ifndef CONFIG_ACCEPT_BUDGET
+#define CONFIG_ACCEPT_BUDGET 64
+#endif
+
+/*
+ * The maximum number of sockets handed to a batch accept handler at once.
+ */
+#ifndef CONFIG_ACCEPT_BATCH_SIZE
+#define CONFIG_ACCEPT_BATCH_SIZE 16
+#endif
+
+static enum cio_error create_listen_socket(struct cio_server_socket *ss, int domain, int type, unsigned int backlog)
 {
 	enum cio_error err;
-	struct cio_server_socket *ss = context;
 
-	int listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+	int listen_fd = socket(domain, type, 0);
 	if (listen_fd == -1) {
 		return errno;
 	}
@@ -65,14 +84,42 @@ static enum cio_error socket_init(void *context, unsigned int backlog)
 	return cio_success;
 }
 
+static enum cio_error socket_init(void *context, unsigned int backlog)
+{
+	struct cio_server_socket *ss = context;
+	return create_listen_socket(ss, AF_INET6, SOCK_STREAM, backlog);
+}
+
+static enum cio_error socket_init_unix(void *context, unsigned int backlog, enum cio_unix_socket_type type)
+{
+	struct cio_server_socket *ss = context;
+
+	switch (type) {
+	case cio_unix_stream:
+		return create_listen_socket(ss, AF_UNIX, SOCK_STREAM, backlog);
+	case cio_unix_seqpacket:
+		return create_listen_socket(ss, AF_UNIX, SOCK_SEQPACKET, backlog);
+	case cio_unix_datagram:
+	default:
+		return cio_invalid_argument;
+	}
+}
+
 static void socket_close(void *context)
 {
 	struct cio_server_socket *ss = context;
 
 	cio_linux_eventloop_remove(ss->loop, &ss->ev);
+	cio_linux_eventloop_cancel_deferred(ss->loop, &ss->accept_resume);
 
 	close(ss->ev.fd);
-	if (ss->close_hook != NULL) {
+	ss->closed = true;
+
+	/*
+	 * If the server socket is closed from within an accept handler, the
+	 * close hook is called only after the handler returned.
+	 */
+	if ((ss->handler_depth == 0) && (ss->close_hook != NULL)) {
 		ss->close_hook(ss);
 	}
 }
@@ -82,48 +129,147 @@ static void free_linux_socket(struct cio_socket *s)
 	cio_free(s);
 }
 
+/*
+ * Options the kernel doesn't inherit from the listening socket.
+ * TCP_QUICKACK isn't even sticky on a single socket: the kernel drops
+ * back to delayed acknowledgements on its own, so it can't be set once
+ * on the listener and is reapplied to every accepted socket. Switching
+ * it off would force delayed acknowledgements, which isn't the kernel
+ * default, so it is only ever switched on.
+ */
+static void apply_socket_options(const struct cio_server_socket *ss, struct cio_socket *s)
+{
+	const struct cio_socket_options *options = &ss->socket_options;
+
+	if (options->tcp_quick_ack) {
+		s->ops->set_tcp_quick_ack(s, true);
+	}
+
+	s->ops->set_read_timeout(s, options->read_timeout_ns);
+	s->ops->set_write_timeout(s, options->write_timeout_ns);
+	s->ops->set_idle_timeout(s, options->idle_timeout_ns);
+}
+
+/*
+ * Returns false if the server socket was closed by the handler and must
+ * not be touched anymore.
+ */
+static bool call_handler(struct cio_server_socket *ss, enum cio_error err, struct cio_socket *s)
+{
+	ss->handler_depth++;
+	ss->handler(ss, ss->handler_context, err, s);
+	ss->handler_depth--;
+	if (unlikely(ss->closed)) {
+		if ((ss->handler_depth == 0) && (ss->close_hook != NULL)) {
+			ss->close_hook(ss);
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+static bool deliver_batch(struct cio_server_socket *ss, enum cio_error err, struct cio_socket **sockets, unsigned int count)
+{
+	if ((count == 0) && (err == cio_success)) {
+		return true;
+	}
+
+	ss->handler_depth++;
+	ss->batch_handler(ss, ss->handler_context, err, sockets, count);
+	ss->handler_depth--;
+	if (unlikely(ss->closed)) {
+		if ((ss->handler_depth == 0) && (ss->close_hook != NULL)) {
+			ss->close_hook(ss);
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
 static void accept_callback(void *context)
 {
-	struct sockaddr_storage addr;
 	struct cio_server_socket *ss = context;
+	struct cio_socket *batch[CONFIG_ACCEPT_BATCH_SIZE];
+	struct cio_eventloop *loop = ss->loop;
+	unsigned int budget = ss->accept_budget;
+	bool batched_accept = (ss->batch_handler != NULL);
+	unsigned int batched = 0;
+	unsigned int accepted = 0;
 	int fd = ss->ev.fd;
-	socklen_t addrlen;
 
-	while (1) {
-		int client_fd;
-		memset(&addr, 0, sizeof(addr));
-		addrlen = sizeof(addr);
-		client_fd = accept(fd, (struct sockaddr *)&addr, &addrlen);
+	while ((budget == 0) || (accepted < budget)) {
+		struct cio_socket *s;
+		int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
 		if (unlikely(client_fd == -1)) {
+			enum cio_error err = cio_success;
 			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EBADF)) {
-				ss->handler(ss, ss->handler_context, errno, NULL);
+				err = errno;
+			}
+
+			if (batched_accept) {
+				deliver_batch(ss, err, batch, batched);
+			} else if (err != cio_success) {
+				call_handler(ss, err, NULL);
 			}
 
 			return;
+		}
+
+		/*
+		 * Because the listening socket is edge triggered, pending
+		 * connections won't be reported again once the budget is
+		 * exhausted, so accepting continues in the next event loop
+		 * iteration. The resumption is scheduled before calling the
+		 * handler, which might close the server socket.
+		 */
+		accepted++;
+		if (accepted == budget) {
+			cio_linux_eventloop_defer(loop, &ss->accept_resume);
+		}
+
+		s = cio_malloc(sizeof(*s));
+		if (unlikely(s == NULL)) {
+			close(client_fd);
+			continue;
+		}
+
+		cio_linux_socket_init(s, client_fd, loop, free_linux_socket);
+		if (ss->per_socket_options) {
+			apply_socket_options(ss, s);
+		}
+
+		if (!batched_accept) {
+			if (!call_handler(ss, cio_success, s)) {
+				return;
+			}
 		} else {
-			struct cio_socket *s = cio_malloc(sizeof(*s));
-			if (likely(s != NULL)) {
-				enum cio_error err = cio_socket_init(s, client_fd, ss->loop, free_linux_socket);
-				ss->handler(ss, ss->handler_context, err, s);
-			} else {
-				close(client_fd);
+			batch[batched++] = s;
+			if (batched == CONFIG_ACCEPT_BATCH_SIZE) {
+				if (!deliver_batch(ss, cio_success, batch, batched)) {
+					return;
+				}
+
+				batched = 0;
 			}
 		}
 	}
+
+	if (batched_accept) {
+		deliver_batch(ss, cio_success, batch, batched);
+	}
 }
 
-static enum cio_error socket_accept(void *context, cio_accept_handler handler, void *handler_context)
+static enum cio_error start_accept(struct cio_server_socket *ss)
 {
 	enum cio_error err;
-	struct cio_server_socket *ss = context;
-	if (unlikely(handler == NULL)) {
-		return cio_invalid_argument;
-	}
 
-	ss->handler = handler;
-	ss->handler_context = handler_context;
 	ss->ev.read_callback = accept_callback;
-	ss->ev.context = context;
+	ss->ev.error_callback = NULL;
+	ss->ev.context = ss;
 
 	if (unlikely(listen(ss->ev.fd, ss->backlog) < 0)) {
 		return errno;
@@ -139,10 +285,42 @@ static enum cio_error socket_accept(void *context, cio_accept_handler handler, v
 		return err;
 	}
 
-	accept_callback(context);
+	accept_callback(ss);
 	return cio_success;
 }
 
+static enum cio_error socket_accept(void *context, cio_accept_handler handler, void *handler_context)
+{
+	struct cio_server_socket *ss = context;
+	if (unlikely(handler == NULL)) {
+		return cio_invalid_argument;
+	}
+
+	ss->handler = handler;
+	ss->batch_handler = NULL;
+	ss->handler_context = handler_context;
+	return start_accept(ss);
+}
+
+static enum cio_error socket_accept_batch(void *context, cio_accept_batch_handler handler, void *handler_context)
+{
+	struct cio_server_socket *ss = context;
+	if (unlikely(handler == NULL)) {
+		return cio_invalid_argument;
+	}
+
+	ss->handler = NULL;
+	ss->batch_handler = handler;
+	ss->handler_context = handler_context;
+	return start_accept(ss);
+}
+
+static void socket_set_accept_budget(void *context, unsigned int budget)
+{
+	struct cio_server_socket *ss = context;
+	ss->accept_budget = budget;
+}
+
 static enum cio_error socket_set_reuse_address(void *context, bool on)
 {
 	struct cio_server_socket *ss = context;
@@ -161,6 +339,75 @@ static enum cio_error socket_set_reuse_address(void *context, bool on)
 	return cio_success;
 }
 
+static enum cio_error socket_set_tcp_fast_open(void *context, unsigned int queue_length)
+{
+	struct cio_server_socket *ss = context;
+	int qlen = (int)queue_length;
+
+	if (unlikely(setsockopt(ss->ev.fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen,
+	                        sizeof(qlen)) < 0)) {
+		return errno;
+	}
+
+	return cio_success;
+}
+
+static enum cio_error socket_set_tcp_defer_accept(void *context, unsigned int timeout_s)
+{
+	struct cio_server_socket *ss = context;
+	int timeout = (int)timeout_s;
+
+	if (unlikely(setsockopt(ss->ev.fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout,
+	                        sizeof(timeout)) < 0)) {
+		return errno;
+	}
+
+	return cio_success;
+}
+
+/*
+ * Accepted sockets inherit TCP_NODELAY, the keepalive settings and the
+ * buffer sizes from the listening socket, so these options cost no
+ * system call per connection. They are applied with their values, so a
+ * later profile also switches off what an earlier one switched on.
+ */
+static enum cio_error socket_set_socket_options(void *context, const struct cio_socket_options *options)
+{
+	struct cio_server_socket *ss = context;
+	enum cio_error err;
+
+	if (unlikely(options == NULL)) {
+		return cio_invalid_argument;
+	}
+
+	err = set_tcp_no_delay(ss->ev.fd, options->tcp_no_delay);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	err = set_keep_alive(ss->ev.fd, options->keep_alive, options->keep_idle_s, options->keep_intvl_s, options->keep_cnt);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	err = set_buffer_size(ss->ev.fd, SO_RCVBUF, options->receive_buffer_size);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	err = set_buffer_size(ss->ev.fd, SO_SNDBUF, options->send_buffer_size);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	ss->socket_options = *options;
+	ss->per_socket_options = options->tcp_quick_ack ||
+	                         (options->read_timeout_ns != 0) ||
+	                         (options->write_timeout_ns != 0) ||
+	                         (options->idle_timeout_ns != 0);
+	return cio_success;
+}
+
 static enum cio_error socket_bind(void *context, const char *bind_address, uint16_t port)
 {
 	struct cio_server_socket *ss = context;
@@ -207,17 +454,50 @@ static enum cio_error socket_bind(void *context, const char *bind_address, uint1
 	return cio_success;
 }
 
+static enum cio_error socket_bind_unix(void *context, const char *path)
+{
+	struct cio_server_socket *ss = context;
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+
+	enum cio_error err = fill_unix_address(&addr, &addrlen, path);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	if (unlikely(bind(ss->ev.fd, (struct sockaddr *)&addr, addrlen) < 0)) {
+		return errno;
+	}
+
+	return cio_success;
+}
+
 void cio_server_socket_init(struct cio_server_socket *ss,
                             struct cio_eventloop *loop,
                             cio_server_socket_close_hook hook)
 {
 	ss->context = ss;
 	ss->init = socket_init;
+	ss->init_unix = socket_init_unix;
 	ss->close = socket_close;
 	ss->accept = socket_accept;
+	ss->accept_batch = socket_accept_batch;
+	ss->set_accept_budget = socket_set_accept_budget;
 	ss->set_reuse_address = socket_set_reuse_address;
+	ss->set_tcp_fast_open = socket_set_tcp_fast_open;
+	ss->set_tcp_defer_accept = socket_set_tcp_defer_accept;
+	ss->set_socket_options = socket_set_socket_options;
 	ss->bind = socket_bind;
+	ss->bind_unix = socket_bind_unix;
 	ss->loop = loop;
 	ss->close_hook = hook;
 	ss->backlog = 0;
+	ss->accept_budget = CONFIG_ACCEPT_BUDGET;
+	ss->accept_resume.callback = accept_callback;
+	ss->accept_resume.context = ss;
+	ss->accept_resume.next = NULL;
+	ss->accept_resume.pprev = NULL;
+	ss->per_socket_options = false;
+	ss->handler_depth = 0;
+	ss->closed = false;
 }
@@ -24,184 +24,1939 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+
 #include "cio_compiler.h"
 #include "cio_error_code.h"
 #include "cio_eventloop.h"
 #include "cio_io_stream.h"
 #include "cio_socket.h"
+#include "linux/cio_linux_alloc.h"
+#include "linux/cio_linux_buffer_tuner.h"
+#include "linux/cio_linux_socket.h"
 #include "linux/cio_linux_socket_utils.h"
+#include "linux/cio_linux_uring.h"
+
+/*
+ * Zero-copy transmission only pays off for larger writes, because
+ * pinning the pages and handling the completion notification has
+ * its own costs.
+ */
+#define CONFIG_ZEROCOPY_THRESHOLD 10240
+
+/*
+ * Maximum number of queued write requests sent with a single
+ * sendmsg call when the output queue is flushed.
+ */
+#define CONFIG_OUTPUT_QUEUE_MAX_IOV 64
+
+/*
+ * The number of bytes read from a socket per event loop iteration if not
+ * changed via set_read_budget.
+ */
+#define CONFIG_READ_BUDGET (256 * 1024)
+
+/*
+ * Only every 2^CONFIG_IO_ACCOUNTING_SAMPLE_SHIFT-th read handler is timed
+ * and its time is scaled up accordingly. Reading the clock around every
+ * handler would cost more than maintaining all other counters.
+ */
+#define CONFIG_IO_ACCOUNTING_SAMPLE_SHIFT 4
+
+#ifdef CONFIG_IO_ACCOUNTING
+static void account_call(struct cio_socket_stats *stats, uint64_t *calls, uint64_t *bytes, ssize_t ret)
+{
+	(*calls)++;
+	if (ret > 0) {
+		*bytes += (uint64_t)ret;
+	} else if ((ret == -1) && ((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+		stats->would_block++;
+	}
+}
+
+static void account_read(struct cio_socket *s, ssize_t ret)
+{
+	struct cio_socket_ext *ext = s->ext;
+	if (likely(ext != NULL)) {
+		account_call(&ext->stats, &ext->stats.read_calls, &ext->stats.bytes_read, ret);
+	}
+}
+
+static void account_write(struct cio_socket *s, ssize_t ret)
+{
+	struct cio_socket_ext *ext = s->ext;
+	if (likely(ext != NULL)) {
+		account_call(&ext->stats, &ext->stats.write_calls, &ext->stats.bytes_written, ret);
+	}
+}
+
+static uint64_t handler_started(struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = s->ext;
+	struct timespec now;
+
+	if (unlikely(ext == NULL)) {
+		return 0;
+	}
+
+	ext->handler_calls++;
+	if ((ext->handler_calls & ((1U << CONFIG_IO_ACCOUNTING_SAMPLE_SHIFT) - 1)) != 0) {
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void handler_finished(struct cio_socket *s, uint64_t start_ns)
+{
+	struct timespec now;
+
+	/*
+	 * The extension is gone if the handler closed the socket.
+	 */
+	if ((start_ns == 0) || (s->ext == NULL)) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	s->ext->stats.handler_time_ns += (((uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec) - start_ns) << CONFIG_IO_ACCOUNTING_SAMPLE_SHIFT;
+}
+#else
+static inline void account_read(struct cio_socket *s, ssize_t ret)
+{
+	(void)s;
+	(void)ret;
+}
+
+static inline void account_write(struct cio_socket *s, ssize_t ret)
+{
+	(void)s;
+	(void)ret;
+}
+
+static inline uint64_t handler_started(struct cio_socket *s)
+{
+	(void)s;
+	return 0;
+}
+
+static inline void handler_finished(struct cio_socket *s, uint64_t start_ns)
+{
+	(void)s;
+	(void)start_ns;
+}
+#endif
+
+static void flush_output_queue(void *context);
+static void posted_writes_arrived(void *context);
+
+/*
+ * Most connections never use the features kept in the extension, so it
+ * is only allocated when one of them is used first.
+ */
+static struct cio_socket_ext *get_ext(struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = s->ext;
+
+	if (likely(ext != NULL)) {
+		return ext;
+	}
+
+	ext = cio_malloc(sizeof(*ext));
+	if (unlikely(ext == NULL)) {
+		return NULL;
+	}
+
+	ext->zerocopy = false;
+	ext->zerocopy_pending = false;
+	ext->zerocopy_threshold = CONFIG_ZEROCOPY_THRESHOLD;
+	ext->zerocopy_next_id = 0;
+
+	ext->pipe_fds[0] = -1;
+	ext->pipe_fds[1] = -1;
+	ext->receive_handler = NULL;
+
+	ext->output_head = NULL;
+	ext->output_tail = &ext->output_head;
+	ext->output_flush.callback = flush_output_queue;
+	ext->output_flush.context = s;
+	ext->output_flush.next = NULL;
+	ext->output_flush.pprev = NULL;
+	ext->output_waiting = false;
+	ext->output_bytes = 0;
+
+	ext->watermark_handler = NULL;
+	ext->write_paused = false;
+
+	ext->uring = NULL;
+
+	ext->tuner = NULL;
+	ext->tuner_next = NULL;
+	ext->tuner_pprev = NULL;
+	ext->tuned_receive_size = 0;
+	ext->tuned_send_size = 0;
+
+	ext->posted = NULL;
+	ext->post_remote.callback = posted_writes_arrived;
+	ext->post_remote.context = s;
+	ext->post_remote.next = NULL;
+	ext->post_remote.queued = false;
+
+	ext->receive_timestamps = false;
+	ext->receive_timestamp_ns = 0;
+
+	memset(&ext->stats, 0, sizeof(ext->stats));
+	ext->stats_next = NULL;
+	ext->stats_pprev = NULL;
+	ext->handler_calls = 0;
+
+	s->ext = ext;
+	return ext;
+}
+
+#ifdef CONFIG_IO_ACCOUNTING
+/*
+ * The counters live in the extension, so with accounting enabled every
+ * socket gets one right away. A socket whose extension can't be
+ * allocated is simply not accounted.
+ */
+static void link_socket(struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = get_ext(s);
+	if (unlikely(ext == NULL)) {
+		return;
+	}
+
+	ext->stats_next = s->loop->sockets;
+	if (ext->stats_next != NULL) {
+		ext->stats_next->ext->stats_pprev = &ext->stats_next;
+	}
+
+	s->loop->sockets = s;
+	ext->stats_pprev = &s->loop->sockets;
+}
+
+static void unlink_socket(struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = s->ext;
+	if ((ext == NULL) || (ext->stats_pprev == NULL)) {
+		return;
+	}
+
+	*ext->stats_pprev = ext->stats_next;
+	if (ext->stats_next != NULL) {
+		ext->stats_next->ext->stats_pprev = ext->stats_pprev;
+	}
+}
+#else
+static inline void link_socket(struct cio_socket *s)
+{
+	(void)s;
+}
+
+static inline void unlink_socket(struct cio_socket *s)
+{
+	(void)s;
+}
+#endif
+
+static bool zerocopy_pending(const struct cio_socket *s)
+{
+	return (s->ext != NULL) && s->ext->zerocopy_pending;
+}
+
+static bool receive_timestamps(const struct cio_socket *s)
+{
+	return (s->ext != NULL) && s->ext->receive_timestamps;
+}
+
+static uint64_t min_expires(uint64_t a, uint64_t b)
+{
+	if (a == 0) {
+		return b;
+	}
+
+	if ((b == 0) || (a < b)) {
+		return a;
+	}
+
+	return b;
+}
+
+static void rearm_deadline(struct cio_socket *s)
+{
+	uint64_t expires_ns = min_expires(min_expires(s->read_expires_ns, s->write_expires_ns), s->idle_expires_ns);
+	if (expires_ns == 0) {
+		cio_linux_eventloop_disarm_deadline(s->loop, &s->deadline);
+	} else {
+		cio_linux_eventloop_arm_deadline(s->loop, &s->deadline, expires_ns);
+	}
+}
+
+static void touch_idle_deadline(struct cio_socket *s)
+{
+	if (s->idle_timeout_ns != 0) {
+		s->idle_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + s->idle_timeout_ns;
+	}
+}
+
+void cio_linux_socket_touch_idle(struct cio_socket *s)
+{
+	if (s->idle_timeout_ns != 0) {
+		touch_idle_deadline(s);
+		rearm_deadline(s);
+	}
+}
+
+enum cio_error cio_linux_socket_watch_idle(struct cio_socket *s, cio_linux_socket_idle_callback callback, void *context)
+{
+	s->ev.context = context;
+	s->ev.read_callback = callback;
+
+	/*
+	 * A socket that read before is still registered, start_read()
+	 * takes the read callback back.
+	 */
+	if ((s->ev.registered_events & EPOLLIN) == 0) {
+		return cio_linux_eventloop_register_read(s->loop, &s->ev);
+	}
+
+	return cio_success;
+}
+
+void cio_linux_socket_read_started(struct cio_socket *s)
+{
+	if (s->read_timeout_ns != 0) {
+		s->read_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + s->read_timeout_ns;
+		rearm_deadline(s);
+	}
+}
+
+void cio_linux_socket_read_completed(struct cio_socket *s, size_t bytes_transferred)
+{
+	s->read_expires_ns = 0;
+	if (bytes_transferred > 0) {
+		touch_idle_deadline(s);
+	}
+
+	if ((s->deadline.pprev != NULL) || (s->idle_expires_ns != 0)) {
+		rearm_deadline(s);
+	}
+}
+
+void cio_linux_socket_write_started(struct cio_socket *s)
+{
+	if (s->write_timeout_ns != 0) {
+		s->write_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + s->write_timeout_ns;
+		rearm_deadline(s);
+	}
+}
+
+void cio_linux_socket_write_completed(struct cio_socket *s, size_t bytes_transferred)
+{
+	s->write_expires_ns = 0;
+	if (bytes_transferred > 0) {
+		touch_idle_deadline(s);
+	}
+
+	if ((s->deadline.pprev != NULL) || (s->idle_expires_ns != 0)) {
+		rearm_deadline(s);
+	}
+}
+
+static void complete_read(struct cio_socket *s, enum cio_error err, size_t bytes_transferred)
+{
+	cio_stream_read_handler handler = s->stream.read_handler;
+	cio_stream_readv_handler readv_handler = s->stream.readv_handler;
+	s->stream.read_handler = NULL;
+	s->stream.readv_handler = NULL;
+	s->stream.read_allocator = NULL;
+	cio_linux_socket_read_completed(s, bytes_transferred);
+
+	if (readv_handler != NULL) {
+		readv_handler(s->stream.read_handler_context, err, s->stream.read_iov, s->stream.read_iovcnt, bytes_transferred);
+	} else {
+		handler(s->stream.read_handler_context, err, s->stream.read_buffer, bytes_transferred);
+	}
+}
+
+static void complete_write(struct cio_socket *s, enum cio_error err, size_t bytes_transferred)
+{
+	cio_stream_write_handler handler = s->stream.write_handler;
+	s->stream.write_handler = NULL;
+	cio_linux_socket_write_completed(s, bytes_transferred);
+
+	/*
+	 * The write owned the write callback while the producer was paused,
+	 * so the watermarks are checked again at the end of the iteration.
+	 */
+	if (unlikely((s->ext != NULL) && s->ext->write_paused)) {
+		cio_linux_eventloop_defer(s->loop, &s->ext->output_flush);
+	}
+
+	handler(s->stream.write_handler_context, err, bytes_transferred);
+}
+
+static void complete_receive(struct cio_socket *s, enum cio_error err, size_t bytes_transferred)
+{
+	struct cio_socket_ext *ext = s->ext;
+	cio_stream_write_handler handler = ext->receive_handler;
+	ext->receive_handler = NULL;
+	s->read_expires_ns = 0;
+	if ((s->deadline.pprev != NULL) || (s->idle_expires_ns != 0)) {
+		rearm_deadline(s);
+	}
+
+	handler(ext->receive_handler_context, err, bytes_transferred);
+}
+
+static void close_pipe(struct cio_socket_ext *ext)
+{
+	if (ext->pipe_fds[0] != -1) {
+		close(ext->pipe_fds[0]);
+		close(ext->pipe_fds[1]);
+		ext->pipe_fds[0] = -1;
+		ext->pipe_fds[1] = -1;
+	}
+}
+
+static struct cio_write_request *take_output_queue(struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = s->ext;
+	struct cio_write_request *requests = ext->output_head;
+	ext->output_head = NULL;
+	ext->output_tail = &ext->output_head;
+	ext->output_bytes = 0;
+	ext->output_waiting = false;
+	cio_linux_eventloop_cancel_deferred(s->loop, &ext->output_flush);
+	return requests;
+}
+
+/*
+ * Does not touch the socket, because a handler might close it.
+ */
+static void complete_requests(struct cio_write_request *request, enum cio_error err)
+{
+	while (request != NULL) {
+		struct cio_write_request *next = request->next;
+		request->next = NULL;
+		request->handler(request->handler_context, err, request->sent);
+		request = next;
+	}
+}
+
+static void fail_output_queue(struct cio_socket *s, enum cio_error err)
+{
+	struct cio_write_request *requests = take_output_queue(s);
+	s->write_expires_ns = 0;
+	if ((s->deadline.pprev != NULL) || (s->idle_expires_ns != 0)) {
+		rearm_deadline(s);
+	}
+
+	complete_requests(requests, err);
+}
+
+/*
+ * Takes the writes posted by other threads in the order they were posted.
+ */
+static struct cio_write_request *take_posted_writes(struct cio_socket *s)
+{
+	struct cio_write_request *posted = __atomic_exchange_n(&s->ext->posted, NULL, __ATOMIC_ACQUIRE);
+	struct cio_write_request *requests = NULL;
+
+	while (posted != NULL) {
+		struct cio_write_request *next = posted->next;
+		posted->next = requests;
+		requests = posted;
+		posted = next;
+	}
+
+	return requests;
+}
+
+static void socket_close(void *context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
+	struct cio_write_request *requests = NULL;
+	struct cio_write_request *posted = NULL;
+	struct cio_uring_stream *uring = NULL;
+	cio_stream_write_handler zerocopy_handler = NULL;
+
+	if (ext != NULL) {
+		requests = take_output_queue(s);
+		cio_linux_eventloop_cancel_remote(s->loop, &ext->post_remote);
+		posted = take_posted_writes(s);
+
+		/*
+		 * The completion of a zero-copy write can't be received
+		 * anymore once the socket is closed. The kernel keeps its own
+		 * references to the pages, so the buffer is handed back to the
+		 * user right away.
+		 */
+		if (ext->zerocopy_pending) {
+			ext->zerocopy_pending = false;
+			zerocopy_handler = s->stream.write_handler;
+			s->stream.write_handler = NULL;
+		}
+	}
+
+	cio_linux_eventloop_disarm_deadline(s->loop, &s->deadline);
+	cio_linux_eventloop_cancel_deferred(s->loop, &s->read_resume);
+	cio_linux_eventloop_remove(s->loop, &s->ev);
+	unlink_socket(s);
+	if (ext != NULL) {
+		if (ext->tuner != NULL) {
+			cio_linux_buffer_tuner_detach(s);
+		}
+
+		close_pipe(ext);
+		uring = ext->uring;
+		s->ext = NULL;
+		cio_free(ext);
+	}
+
+	close(s->ev.fd);
+	complete_requests(requests, cio_operation_aborted);
+	complete_requests(posted, cio_operation_aborted);
+	if (zerocopy_handler != NULL) {
+		zerocopy_handler(s->stream.write_handler_context, cio_operation_aborted, 0);
+	}
+
+	/*
+	 * If the kernel still uses the socket, the ring calls the close hook
+	 * once the kernel released it.
+	 */
+	if ((uring != NULL) && cio_linux_uring_detach(uring)) {
+		return;
+	}
+
+	/*
+	 * If the socket is closed from within a read handler, the close hook
+	 * is called only after the read loop was left.
+	 */
+	if (s->draining) {
+		s->closed = true;
+	} else if (s->close_hook != NULL) {
+		s->close_hook(s);
+	}
+}
+
+static enum cio_error socket_tcp_no_delay(void *context, bool on)
+{
+	struct cio_socket *s = context;
+	return set_tcp_no_delay(s->ev.fd, on);
+}
+
+static enum cio_error socket_tcp_quick_ack(void *context, bool on)
+{
+	struct cio_socket *s = context;
+	int quick_ack;
+
+	if (on) {
+		quick_ack = 1;
+	} else {
+		quick_ack = 0;
+	}
+
+	if (setsockopt(s->ev.fd, IPPROTO_TCP, TCP_QUICKACK, &quick_ack,
+	               sizeof(quick_ack)) < 0) {
+		return errno;
+	}
+
+	return cio_success;
+}
+
+static enum cio_error socket_keepalive(void *context, bool on, unsigned int keep_idle_s,
+                                       unsigned int keep_intvl_s, unsigned int keep_cnt)
+{
+	struct cio_socket *s = context;
+	return set_keep_alive(s->ev.fd, on, keep_idle_s, keep_intvl_s, keep_cnt);
+}
+
+static enum cio_error socket_get_peer_credentials(void *context, struct cio_peer_credentials *credentials)
+{
+	struct cio_socket *s = context;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(s->ev.fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		return errno;
+	}
+
+	credentials->pid = (int32_t)cred.pid;
+	credentials->uid = (uint32_t)cred.uid;
+	credentials->gid = (uint32_t)cred.gid;
+	return cio_success;
+}
+
+static void socket_set_read_timeout(void *context, uint64_t timeout_ns)
+{
+	struct cio_socket *s = context;
+	s->read_timeout_ns = timeout_ns;
+}
+
+static void socket_set_write_timeout(void *context, uint64_t timeout_ns)
+{
+	struct cio_socket *s = context;
+	s->write_timeout_ns = timeout_ns;
+}
+
+static void socket_set_idle_timeout(void *context, uint64_t timeout_ns)
+{
+	struct cio_socket *s = context;
+	s->idle_timeout_ns = timeout_ns;
+	if (timeout_ns == 0) {
+		s->idle_expires_ns = 0;
+	} else {
+		s->idle_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + timeout_ns;
+	}
+
+	rearm_deadline(s);
+}
+
+static void sendfile_callback(void *context);
+
+static void deadline_expired(void *context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
+	uint64_t now = cio_linux_eventloop_get_time_ns(s->loop);
+	bool idle_expired = (s->idle_expires_ns != 0) && (s->idle_expires_ns <= now);
+
+	if (idle_expired) {
+		s->idle_expires_ns = now + s->idle_timeout_ns;
+	}
+
+	/*
+	 * Only one handler is called per expiry, because the handler might
+	 * close the socket. Other expired operations are rescheduled and fire
+	 * in the next event loop iteration.
+	 */
+	if (((s->stream.read_handler != NULL) || (s->stream.readv_handler != NULL)) && (idle_expired || ((s->read_expires_ns != 0) && (s->read_expires_ns <= now)))) {
+		complete_read(s, cio_timed_out, 0);
+	} else if ((ext != NULL) && (ext->receive_handler != NULL) && (idle_expired || ((s->read_expires_ns != 0) && (s->read_expires_ns <= now)))) {
+		complete_receive(s, cio_timed_out, (size_t)(ext->receive_offset - ext->receive_start));
+	} else if ((s->stream.write_handler != NULL) && (ext != NULL) && (ext->uring != NULL) && (idle_expired || ((s->write_expires_ns != 0) && (s->write_expires_ns <= now)))) {
+		/*
+		 * The kernel owns the buffer until the send completed, so the
+		 * send is cancelled and the ring completes the write.
+		 */
+		s->write_expires_ns = 0;
+		cio_linux_uring_cancel_send(ext->uring);
+		rearm_deadline(s);
+	} else if ((s->stream.write_handler != NULL) && !zerocopy_pending(s) && (idle_expired || ((s->write_expires_ns != 0) && (s->write_expires_ns <= now)))) {
+		/*
+		 * A stalled sendfile reports what was already sent, so the
+		 * caller can resume the transmission at the right offset.
+		 */
+		size_t transferred = 0;
+		if (s->ev.write_callback == sendfile_callback) {
+			transferred = ext->file_transferred;
+		}
+
+		complete_write(s, cio_timed_out, transferred);
+	} else if ((ext != NULL) && ext->output_waiting && (idle_expired || ((s->write_expires_ns != 0) && (s->write_expires_ns <= now)))) {
+		fail_output_queue(s, cio_timed_out);
+	} else if (idle_expired) {
+		socket_close(s);
+	} else {
+		rearm_deadline(s);
+	}
+}
+
+static struct cio_io_stream *socket_get_io_stream(void *context)
+{
+	struct cio_socket *s = context;
+	return &s->stream;
+}
+
+/*
+ * The time between the kernel receive timestamp and reading the data is
+ * the time the data waited for the event loop.
+ */
+static ssize_t receive_timestamped(struct cio_socket *s, struct iovec *iov, unsigned int iovcnt)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+		struct cmsghdr align;
+	} control;
+	struct cio_socket_ext *ext = s->ext;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ext->receive_timestamp_ns = 0;
+	ret = recvmsg(s->ev.fd, &msg, 0);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPING)) {
+			struct scm_timestamping timestamping;
+			struct timespec now;
+			uint64_t now_ns;
+
+			memcpy(&timestamping, CMSG_DATA(cmsg), sizeof(timestamping));
+			ext->receive_timestamp_ns = (uint64_t)timestamping.ts[0].tv_sec * 1000000000ULL + (uint64_t)timestamping.ts[0].tv_nsec;
+
+			clock_gettime(CLOCK_REALTIME, &now);
+			now_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+			if (now_ns < ext->receive_timestamp_ns) {
+				now_ns = ext->receive_timestamp_ns;
+			}
+
+			cio_linux_eventloop_record_receive_delay(s->loop, now_ns - ext->receive_timestamp_ns);
+		}
+	}
+
+	return ret;
+}
+
+static ssize_t read_into(struct cio_socket *s, void *buf, size_t count)
+{
+	struct iovec iov;
+
+	if (likely(!receive_timestamps(s))) {
+		return read(s->ev.fd, buf, count);
+	}
+
+	iov.iov_base = buf;
+	iov.iov_len = count;
+	return receive_timestamped(s, &iov, 1);
+}
+
+/*
+ * Performs a single read for the pending read request. A buffer for an
+ * allocated read is obtained only here, i.e. when the socket is known
+ * to be readable.
+ */
+static ssize_t read_request(struct cio_socket *s)
+{
+	const struct cio_buffer_allocator *allocator = s->stream.read_allocator;
+	struct cio_buffer buffer;
+	ssize_t ret;
+
+	if (s->stream.readv_handler != NULL) {
+		if (receive_timestamps(s)) {
+			return receive_timestamped(s, s->stream.read_iov, s->stream.read_iovcnt);
+		}
+
+		return readv(s->ev.fd, s->stream.read_iov, (int)s->stream.read_iovcnt);
+	}
+
+	if (allocator == NULL) {
+		return read_into(s, s->stream.read_buffer, s->stream.read_count);
+	}
+
+	buffer = allocator->alloc(allocator->context, s->stream.read_count);
+	if (unlikely(buffer.address == NULL)) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	ret = read_into(s, buffer.address, buffer.size);
+	if (ret > 0) {
+		s->stream.read_buffer = buffer.address;
+	} else {
+		int read_errno = errno;
+		allocator->free(allocator->context, buffer.address);
+		errno = read_errno;
+	}
+
+	return ret;
+}
+
+static bool read_pending(const struct cio_socket *s)
+{
+	return (s->stream.read_handler != NULL) || (s->stream.readv_handler != NULL);
+}
+
+/*
+ * Serves read requests as long as the socket is readable. Handlers
+ * issuing a new read from within their callback are served by this loop
+ * instead of recursing. Once the read budget is exhausted, the remaining
+ * data is read in the next event loop iteration, because the edge
+ * triggered notifier won't report it again.
+ */
+static void drain_socket(struct cio_socket *s)
+{
+	size_t transferred = 0;
+
+	s->draining = true;
+	while (s->read_ready && read_pending(s)) {
+		uint64_t start_ns;
+		ssize_t ret;
+
+		if ((s->read_budget != 0) && (transferred >= s->read_budget)) {
+			cio_linux_eventloop_defer(s->loop, &s->read_resume);
+			break;
+		}
+
+		ret = read_request(s);
+		account_read(s, ret);
+		if (ret == -1) {
+			if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+				s->read_ready = false;
+				break;
+			}
+
+			start_ns = handler_started(s);
+			complete_read(s, errno, 0);
+		} else {
+			transferred += (size_t)ret;
+			start_ns = handler_started(s);
+			complete_read(s, cio_success, (size_t)ret);
+		}
+
+		handler_finished(s, start_ns);
+
+		if (unlikely(s->closed)) {
+			if (s->close_hook != NULL) {
+				s->close_hook(s);
+			}
+
+			return;
+		}
+	}
+
+	s->draining = false;
+}
+
+static void read_callback(void *context)
+{
+	struct cio_socket *s = context;
+
+	s->read_ready = true;
+	if (!s->draining) {
+		drain_socket(s);
+	}
+}
+
+static void start_read(struct cio_socket *s)
+{
+	/*
+	 * While the socket owns the read callback, the read event stays
+	 * registered and the readiness is remembered in read_ready. If
+	 * somebody else used the read callback in between, re-registering
+	 * reports data that is already pending.
+	 */
+	if ((s->ev.read_callback != read_callback) || ((s->ev.registered_events & EPOLLIN) == 0)) {
+		enum cio_error err;
+
+		s->ev.context = s;
+		s->ev.read_callback = read_callback;
+		err = cio_linux_eventloop_register_read(s->loop, &s->ev);
+		if (unlikely(err != cio_success)) {
+			complete_read(s, err, 0);
+			return;
+		}
+
+		/*
+		 * Allocated reads wait for the event instead of allocating a
+		 * buffer just to find out there is nothing to read yet.
+		 */
+		s->read_ready = (s->stream.read_allocator == NULL);
+	}
+
+	s->ev.context = s;
+	cio_linux_socket_read_started(s);
+
+	if (!s->draining) {
+		drain_socket(s);
+	}
+}
+
+static void socket_read(void *context, void *buf, size_t count, cio_stream_read_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	s->stream.read_buffer = buf;
+	s->stream.read_count = count;
+	s->stream.read_handler = handler;
+	s->stream.read_handler_context = handler_context;
+	start_read(s);
+}
+
+static void socket_readv(void *context, struct iovec *iov, unsigned int iovcnt, cio_stream_readv_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	s->stream.read_iov = iov;
+	s->stream.read_iovcnt = iovcnt;
+	s->stream.readv_handler = handler;
+	s->stream.read_handler_context = handler_context;
+	start_read(s);
+}
+
+static void socket_read_allocated(void *context, const struct cio_buffer_allocator *allocator, size_t size, cio_stream_read_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	s->stream.read_allocator = allocator;
+	s->stream.read_buffer = NULL;
+	s->stream.read_count = size;
+	s->stream.read_handler = handler;
+	s->stream.read_handler_context = handler_context;
+	start_read(s);
+}
+
+static size_t vector_length(const struct iovec *iov, unsigned int iovcnt)
+{
+	size_t length = 0;
+	unsigned int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		length += iov[i].iov_len;
+	}
+
+	return length;
+}
+
+static ssize_t send_vector(struct cio_socket *s, const struct iovec *iov, unsigned int iovcnt, bool *zerocopy)
+{
+	const struct cio_socket_ext *ext = s->ext;
+	struct msghdr msg;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+	msg.msg_iovlen = iovcnt;
+
+	*zerocopy = (ext != NULL) && ext->zerocopy && (vector_length(iov, iovcnt) >= ext->zerocopy_threshold);
+	if (*zerocopy) {
+		ret = sendmsg(s->ev.fd, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY);
+		account_write(s, ret);
+		if (likely((ret != -1) || (errno != ENOBUFS))) {
+			return ret;
+		}
+
+		/*
+		 * The kernel could not pin the pages (e.g. optmem_max is
+		 * exceeded), so fall back to a copying send.
+		 */
+		*zerocopy = false;
+	}
+
+	ret = sendmsg(s->ev.fd, &msg, MSG_NOSIGNAL);
+	account_write(s, ret);
+	return ret;
+}
+
+static void wait_zerocopy_completion(struct cio_socket *s, size_t bytes_transferred)
+{
+	struct cio_socket_ext *ext = s->ext;
+
+	ext->zerocopy_pending = true;
+	ext->zerocopy_pending_id = ext->zerocopy_next_id++;
+	ext->zerocopy_bytes = bytes_transferred;
+
+	/*
+	 * The data is already owned by the kernel, a write timeout
+	 * must not hand the buffer back to the user.
+	 */
+	if (s->write_expires_ns != 0) {
+		s->write_expires_ns = 0;
+		rearm_deadline(s);
+	}
+}
+
+static void write_callback(void *context)
+{
+	struct cio_socket *s = context;
+	bool zerocopy;
+	ssize_t ret;
+
+	if (unlikely((s->stream.write_handler == NULL) || zerocopy_pending(s))) {
+		return;
+	}
+
+	ret = send_vector(s, s->stream.write_iov, s->stream.write_iovcnt, &zerocopy);
+	if (ret == -1) {
+		if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+			return;
+		} else {
+			complete_write(s, errno, 0);
+		}
+	} else if (zerocopy) {
+		wait_zerocopy_completion(s, (size_t)ret);
+	} else {
+		complete_write(s, cio_success, (size_t)ret);
+	}
+}
+
+static void error_callback(void *context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
+	bool completed = false;
+
+	while (1) {
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+		uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(s->ev.fd, &msg, MSG_ERRQUEUE) == -1) {
+			break;
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			struct sock_extended_err serr;
+
+			if (!(((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) ||
+			      ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)))) {
+				continue;
+			}
+
+			memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+			if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+
+			/*
+			 * The notification covers the range [ee_info, ee_data] of
+			 * send call ids, which might wrap around.
+			 */
+			if ((uint32_t)(ext->zerocopy_pending_id - serr.ee_info) <= (uint32_t)(serr.ee_data - serr.ee_info)) {
+				completed = true;
+			}
+
+			if ((serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0) {
+				ext->zerocopy = false;
+			}
+		}
+	}
+
+	if (completed && ext->zerocopy_pending) {
+		ext->zerocopy_pending = false;
+		complete_write(s, cio_success, ext->zerocopy_bytes);
+	}
+}
+
+static void wait_writable(struct cio_socket *s, const struct iovec *iov, unsigned int iovcnt, cio_stream_write_handler handler, void *handler_context)
+{
+	enum cio_error err;
+
+	s->ev.context = s;
+	s->ev.write_callback = write_callback;
+	err = cio_linux_eventloop_register_write(s->loop, &s->ev);
+	if (unlikely(err != cio_success)) {
+		handler(handler_context, err, 0);
+		return;
+	}
+
+	s->stream.write_iov = iov;
+	s->stream.write_iovcnt = iovcnt;
+	s->stream.write_handler = handler;
+	s->stream.write_handler_context = handler_context;
+	cio_linux_socket_write_started(s);
+}
+
+static void start_write(struct cio_socket *s, const struct iovec *iov, unsigned int iovcnt, cio_stream_write_handler handler, void *handler_context)
+{
+	bool zerocopy;
+
+	ssize_t ret = send_vector(s, iov, iovcnt, &zerocopy);
+	if (likely(ret >= 0)) {
+		if (zerocopy) {
+			s->stream.write_handler = handler;
+			s->stream.write_handler_context = handler_context;
+			wait_zerocopy_completion(s, (size_t)ret);
+			return;
+		}
+
+		if (ret > 0) {
+			touch_idle_deadline(s);
+		}
+
+		handler(handler_context, cio_success, (size_t)ret);
+	} else {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+			wait_writable(s, iov, iovcnt, handler, handler_context);
+		} else {
+			handler(handler_context, errno, 0);
+		}
+	}
+}
+
+static void socket_write(void *context, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+
+	s->stream.write_buffer.iov_base = (void *)(uintptr_t)buf;
+	s->stream.write_buffer.iov_len = count;
+	start_write(s, &s->stream.write_buffer, 1, handler, handler_context);
+}
+
+static void socket_writev(void *context, const struct iovec *iov, unsigned int iovcnt, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	start_write(s, iov, iovcnt, handler, handler_context);
+}
+
+static void sendfile_callback(void *context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
+
+	if (unlikely(s->stream.write_handler == NULL)) {
+		return;
+	}
+
+	while (ext->file_remaining > 0) {
+		off_t offset = (off_t)ext->file_offset;
+		ssize_t ret = sendfile(s->ev.fd, ext->file_fd, &offset, ext->file_remaining);
+		if (ret == -1) {
+			if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+				enum cio_error err;
+				if ((s->ev.registered_events & EPOLLOUT) == 0) {
+					err = cio_linux_eventloop_register_write(s->loop, &s->ev);
+					if (unlikely(err != cio_success)) {
+						complete_write(s, err, ext->file_transferred);
+						return;
+					}
+				}
+
+				if (s->write_timeout_ns != 0) {
+					s->write_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + s->write_timeout_ns;
+					rearm_deadline(s);
+				}
+
+				return;
+			}
+
+			complete_write(s, errno, ext->file_transferred);
+			return;
+		}
+
+		if (ret == 0) {
+			break;
+		}
+
+		ext->file_offset = (uint64_t)offset;
+		ext->file_remaining -= (size_t)ret;
+		ext->file_transferred += (size_t)ret;
+		touch_idle_deadline(s);
+	}
+
+	complete_write(s, cio_success, ext->file_transferred);
+}
+
+static void socket_sendfile(void *context, int file_fd, uint64_t offset, size_t count, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = get_ext(s);
+
+	if (unlikely(ext == NULL)) {
+		handler(handler_context, cio_not_enough_memory, 0);
+		return;
+	}
+
+	ext->file_fd = file_fd;
+	ext->file_offset = offset;
+	ext->file_remaining = count;
+	ext->file_transferred = 0;
+	s->stream.write_handler = handler;
+	s->stream.write_handler_context = handler_context;
+	s->ev.context = s;
+	s->ev.write_callback = sendfile_callback;
+	sendfile_callback(s);
+}
+
+/*
+ * The writeback of the received data was started while receiving, so
+ * the final flush only waits for the part that is not on disk yet.
+ * It still blocks the event loop for that time.
+ */
+static enum cio_error flush_received(const struct cio_socket_ext *ext)
+{
+	off_t length = (off_t)(ext->receive_offset - ext->receive_start);
+
+	switch (ext->receive_sync) {
+	case cio_file_sync_data:
+		if (unlikely(fdatasync(ext->receive_fd) < 0)) {
+			return errno;
+		}
+		break;
+
+	case cio_file_sync_all:
+		if (unlikely(fsync(ext->receive_fd) < 0)) {
+			return errno;
+		}
+		break;
+
+	case cio_file_sync_none:
+	default:
+		return cio_success;
+	}
+
+	/*
+	 * The data is on disk now, so the pages can be dropped without
+	 * another writeback. This keeps large uploads from evicting more
+	 * useful data from the page cache. Dirty pages can't be dropped,
+	 * so this only works after flushing.
+	 */
+	(void)posix_fadvise(ext->receive_fd, (off_t)ext->receive_start, length, POSIX_FADV_DONTNEED);
+	return cio_success;
+}
+
+static void receive_file_callback(void *context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
+	enum cio_error err;
+
+	if (unlikely(ext->receive_handler == NULL)) {
+		return;
+	}
+
+	while (ext->receive_remaining > 0) {
+		uint64_t chunk_start;
+		size_t pipe_fill;
+		ssize_t ret = splice(s->ev.fd, NULL, ext->pipe_fds[1], NULL, ext->receive_remaining, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == -1) {
+			if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+				if (s->read_timeout_ns != 0) {
+					s->read_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + s->read_timeout_ns;
+					rearm_deadline(s);
+				}
+
+				return;
+			}
+
+			complete_receive(s, errno, (size_t)(ext->receive_offset - ext->receive_start));
+			return;
+		}
+
+		if (ret == 0) {
+			break;
+		}
+
+		/*
+		 * Writing to a regular file never returns EAGAIN, so the pipe
+		 * is always drained before waiting on the socket again.
+		 */
+		chunk_start = ext->receive_offset;
+		pipe_fill = (size_t)ret;
+		while (pipe_fill > 0) {
+			loff_t offset = (loff_t)ext->receive_offset;
+			ssize_t written = splice(ext->pipe_fds[0], NULL, ext->receive_fd, &offset, pipe_fill, SPLICE_F_MOVE);
+			if (unlikely(written <= 0)) {
+				err = (written == 0) ? cio_input_output_error : (enum cio_error)errno;
+				close_pipe(ext);
+				complete_receive(s, err, (size_t)(ext->receive_offset - ext->receive_start));
+				return;
+			}
+
+			ext->receive_offset = (uint64_t)offset;
+			pipe_fill -= (size_t)written;
+		}
+
+		/*
+		 * Starting the writeback right away doesn't wait for the disk,
+		 * but leaves less data for the flush at the end of the transfer.
+		 */
+		if (ext->receive_sync != cio_file_sync_none) {
+			(void)sync_file_range(ext->receive_fd, (loff_t)chunk_start, (loff_t)ret, SYNC_FILE_RANGE_WRITE);
+		}
+
+		ext->receive_remaining -= (size_t)ret;
+		touch_idle_deadline(s);
+	}
+
+	err = flush_received(ext);
+	complete_receive(s, err, (size_t)(ext->receive_offset - ext->receive_start));
+}
+
+static void socket_receive_file(void *context, int file_fd, uint64_t offset, size_t count, enum cio_file_sync sync, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = get_ext(s);
+	enum cio_error err;
+
+	if (unlikely(ext == NULL)) {
+		handler(handler_context, cio_not_enough_memory, 0);
+		return;
+	}
+
+	ext->receive_handler = handler;
+	ext->receive_handler_context = handler_context;
+	ext->receive_fd = file_fd;
+	ext->receive_start = offset;
+	ext->receive_offset = offset;
+	ext->receive_remaining = count;
+	ext->receive_sync = sync;
+
+	if (ext->pipe_fds[0] == -1) {
+		if (unlikely(pipe2(ext->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0)) {
+			ext->pipe_fds[0] = -1;
+			ext->pipe_fds[1] = -1;
+			complete_receive(s, errno, 0);
+			return;
+		}
+	}
+
+	s->ev.context = s;
+	s->ev.read_callback = receive_file_callback;
+	err = cio_linux_eventloop_register_read(s->loop, &s->ev);
+	if (unlikely(err != cio_success)) {
+		complete_receive(s, err, 0);
+		return;
+	}
 
-static void socket_close(void *context)
+	if (s->read_timeout_ns != 0) {
+		s->read_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + s->read_timeout_ns;
+		rearm_deadline(s);
+	}
+
+	receive_file_callback(s);
+}
+
+static void output_queue_writable(void *context);
+
+static enum cio_error wait_output_writable(struct cio_socket *s)
 {
-	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
 
-	cio_linux_eventloop_remove(s->loop, &s->ev);
+	s->ev.context = s;
+	s->ev.write_callback = output_queue_writable;
+	if ((s->ev.registered_events & EPOLLOUT) == 0) {
+		enum cio_error err = cio_linux_eventloop_register_write(s->loop, &s->ev);
+		if (unlikely(err != cio_success)) {
+			return err;
+		}
+	}
 
-	close(s->ev.fd);
-	if (s->close_hook != NULL) {
-		s->close_hook(s);
+	ext->output_waiting = true;
+	if (s->write_timeout_ns != 0) {
+		s->write_expires_ns = cio_linux_eventloop_get_time_ns(s->loop) + s->write_timeout_ns;
+		rearm_deadline(s);
 	}
+
+	return cio_success;
 }
 
-static enum cio_error socket_tcp_no_delay(void *context, bool on)
+/*
+ * Removes all requests covered by @p sent bytes from the head of the
+ * output queue and appends them to @p done_tail.
+ */
+static struct cio_write_request **consume_output_queue(struct cio_socket_ext *ext, size_t sent, struct cio_write_request **done_tail)
 {
-	struct cio_socket *s = context;
-	int tcp_no_delay;
+	while ((ext->output_head != NULL) && ((ext->output_head->count - ext->output_head->sent) <= sent)) {
+		struct cio_write_request *request = ext->output_head;
+		ext->output_bytes -= request->count - request->sent;
+		sent -= request->count - request->sent;
+		request->sent = request->count;
+		ext->output_head = request->next;
+		request->next = NULL;
+		*done_tail = request;
+		done_tail = &request->next;
+	}
 
-	if (on) {
-		tcp_no_delay = 1;
+	if (ext->output_head == NULL) {
+		ext->output_tail = &ext->output_head;
 	} else {
-		tcp_no_delay = 0;
+		ext->output_head->sent += sent;
+		ext->output_bytes -= sent;
 	}
 
-	if (setsockopt(s->ev.fd, IPPROTO_TCP, TCP_NODELAY, &tcp_no_delay,
-	               sizeof(tcp_no_delay)) < 0) {
-		return errno;
+	return done_tail;
+}
+
+/*
+ * The bytes not yet sent to the peer, i.e. the bytes in the output queue
+ * plus the bytes waiting in the kernel send buffer.
+ */
+static size_t unsent_bytes(const struct cio_socket *s)
+{
+	int kernel_unsent;
+	if (ioctl(s->ev.fd, SIOCOUTQNSD, &kernel_unsent) < 0) {
+		kernel_unsent = 0;
 	}
 
-	return cio_success;
+	return s->ext->output_bytes + (size_t)kernel_unsent;
 }
 
-static enum cio_error socket_keepalive(void *context, bool on, unsigned int keep_idle_s,
-                                       unsigned int keep_intvl_s, unsigned int keep_cnt)
+/*
+ * Returns true if the watermark handler has to be called because the
+ * write_paused state changed or the unsent data can't be watched anymore.
+ */
+static bool update_watermarks(struct cio_socket *s, enum cio_error *err)
+{
+	struct cio_socket_ext *ext = s->ext;
+	size_t unsent;
+
+	*err = cio_success;
+	if (ext->watermark_handler == NULL) {
+		return false;
+	}
+
+	unsent = unsent_bytes(s);
+	if (!ext->write_paused) {
+		if (unsent >= ext->high_watermark) {
+			ext->write_paused = true;
+			return true;
+		}
+
+		return false;
+	}
+
+	if (unsent <= ext->low_watermark) {
+		ext->write_paused = false;
+		return true;
+	}
+
+	/*
+	 * With TCP_NOTSENT_LOWAT set to the low watermark, the socket becomes
+	 * writable as soon as the kernel sent enough data to resume. The
+	 * registration is renewed unconditionally, because the kernel only
+	 * reports the socket becoming writable again if it was polled while
+	 * not being writable. A pending write owns the write callback, its
+	 * completion checks the watermarks again.
+	 */
+	if (!ext->output_waiting && (ext->output_head == NULL) && (s->stream.write_handler == NULL)) {
+		s->ev.context = s;
+		s->ev.write_callback = output_queue_writable;
+		*err = cio_linux_eventloop_register_write(s->loop, &s->ev);
+		if (unlikely(*err != cio_success)) {
+			ext->write_paused = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void notify_watermark(struct cio_socket *s, enum cio_error err)
+{
+	struct cio_socket_ext *ext = s->ext;
+	cio_socket_watermark_handler handler = ext->watermark_handler;
+
+	/*
+	 * Without being able to watch the unsent data, a paused producer
+	 * would never be resumed, so the watermarks are switched off.
+	 */
+	if (unlikely(err != cio_success)) {
+		ext->watermark_handler = NULL;
+	}
+
+	handler(s, ext->watermark_handler_context, err, ext->write_paused);
+}
+
+static void flush_output_queue(void *context)
 {
 	struct cio_socket *s = context;
-	int keep_alive;
+	struct cio_socket_ext *ext = s->ext;
+	struct cio_write_request *done = NULL;
+	struct cio_write_request **done_tail = &done;
+	struct cio_write_request *failed = NULL;
+	enum cio_error err = cio_success;
+	enum cio_error watermark_err;
 
-	if (on) {
-		keep_alive = 1;
-		if (setsockopt(s->ev.fd, SOL_TCP, TCP_KEEPIDLE, &keep_idle_s, sizeof(keep_idle_s)) == -1) {
-			return errno;
+	while (ext->output_head != NULL) {
+		struct iovec iov[CONFIG_OUTPUT_QUEUE_MAX_IOV];
+		struct msghdr msg;
+		struct cio_write_request *request = ext->output_head;
+		unsigned int iovcnt = 0;
+		int flags = MSG_NOSIGNAL;
+		ssize_t ret;
+
+		while ((request != NULL) && (iovcnt < CONFIG_OUTPUT_QUEUE_MAX_IOV)) {
+			iov[iovcnt].iov_base = (void *)((uintptr_t)request->buf + request->sent);
+			iov[iovcnt].iov_len = request->count - request->sent;
+			iovcnt++;
+			request = request->next;
 		}
 
-		if (setsockopt(s->ev.fd, SOL_TCP, TCP_KEEPINTVL, &keep_intvl_s, sizeof(keep_intvl_s)) == -1) {
-			return errno;
+		/*
+		 * If the queue doesn't fit into one call, the remaining requests
+		 * follow immediately, so let the kernel fill up the segments.
+		 */
+		if (request != NULL) {
+			flags |= MSG_MORE;
 		}
 
-		if (setsockopt(s->ev.fd, SOL_TCP, TCP_KEEPCNT, &keep_cnt, sizeof(keep_cnt)) == -1) {
-			return errno;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		ret = sendmsg(s->ev.fd, &msg, flags);
+		account_write(s, ret);
+		if (ret == -1) {
+			if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+				err = wait_output_writable(s);
+			} else {
+				err = errno;
+			}
+
+			break;
 		}
-	} else {
-		keep_alive = 0;
+
+		done_tail = consume_output_queue(ext, (size_t)ret, done_tail);
+		touch_idle_deadline(s);
 	}
 
-	if (setsockopt(s->ev.fd, SOL_SOCKET, SO_KEEPALIVE, &keep_alive, sizeof(keep_alive)) == -1) {
-		return errno;
+	if (unlikely(err != cio_success)) {
+		failed = take_output_queue(s);
 	}
 
-	return cio_success;
+	if (!ext->output_waiting && (s->stream.write_handler == NULL)) {
+		s->write_expires_ns = 0;
+		if ((s->deadline.pprev != NULL) || (s->idle_expires_ns != 0)) {
+			rearm_deadline(s);
+		}
+	}
+
+	if (update_watermarks(s, &watermark_err)) {
+		notify_watermark(s, watermark_err);
+	}
+
+	complete_requests(done, cio_success);
+	complete_requests(failed, err);
 }
 
-static struct cio_io_stream *socket_get_io_stream(void *context)
+static void output_queue_writable(void *context)
 {
 	struct cio_socket *s = context;
-	return &s->stream;
+	struct cio_socket_ext *ext = s->ext;
+	enum cio_error err;
+
+	if (ext->output_waiting) {
+		ext->output_waiting = false;
+		flush_output_queue(s);
+	} else if (ext->write_paused && update_watermarks(s, &err)) {
+		notify_watermark(s, err);
+	}
 }
 
-static void read_callback(void *context)
+static void enqueue_request(struct cio_socket_ext *ext, struct cio_write_request *request)
+{
+	request->next = NULL;
+	*ext->output_tail = request;
+	ext->output_tail = &request->next;
+	ext->output_bytes += request->count;
+}
+
+static void output_queue_grown(struct cio_socket *s)
+{
+	struct cio_socket_ext *ext = s->ext;
+
+	if (!ext->output_waiting) {
+		cio_linux_eventloop_defer(s->loop, &ext->output_flush);
+	}
+
+	if ((ext->watermark_handler != NULL) && !ext->write_paused && (ext->output_bytes >= ext->high_watermark)) {
+		ext->write_paused = true;
+		notify_watermark(s, cio_success);
+	}
+}
+
+static void socket_queue_write(void *context, struct cio_write_request *request, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context)
 {
 	struct cio_socket *s = context;
-	ssize_t ret = read(s->ev.fd, s->stream.read_buffer, s->stream.read_count);
-	if (ret == -1) {
-		if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
-			return;
-		} else {
-			s->stream.read_handler(s->stream.read_handler_context, errno, s->stream.read_buffer, 0);
+	struct cio_socket_ext *ext = get_ext(s);
+
+	if (unlikely(ext == NULL)) {
+		handler(handler_context, cio_not_enough_memory, 0);
+		return;
+	}
+
+	request->buf = buf;
+	request->count = count;
+	request->sent = 0;
+	request->handler = handler;
+	request->handler_context = handler_context;
+	enqueue_request(ext, request);
+	output_queue_grown(s);
+}
+
+static void posted_writes_arrived(void *context)
+{
+	struct cio_socket *s = context;
+	struct cio_write_request *request = take_posted_writes(s);
+
+	while (request != NULL) {
+		struct cio_write_request *next = request->next;
+		enqueue_request(s->ext, request);
+		request = next;
+	}
+
+	output_queue_grown(s);
+}
+
+static enum cio_error socket_enable_post_write(void *context)
+{
+	struct cio_socket *s = context;
+
+	if (unlikely(get_ext(s) == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	return cio_linux_eventloop_enable_remote(s->loop);
+}
+
+static void socket_post_write(void *context, struct cio_write_request *request, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
+	struct cio_write_request *head;
+
+	request->buf = buf;
+	request->count = count;
+	request->sent = 0;
+	request->handler = handler;
+	request->handler_context = handler_context;
+
+	head = __atomic_load_n(&ext->posted, __ATOMIC_RELAXED);
+	do {
+		request->next = head;
+	} while (!__atomic_compare_exchange_n(&ext->posted, &head, request, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/*
+	 * The loop takes all writes posted until it runs, so only the first
+	 * write of a batch needs to wake it up.
+	 */
+	if (head == NULL) {
+		cio_linux_eventloop_post(s->loop, &ext->post_remote);
+	}
+}
+
+static enum cio_error socket_set_write_watermarks(void *context, size_t low, size_t high, cio_socket_watermark_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext;
+	int lowat;
+
+	if (handler == NULL) {
+		if (s->ext != NULL) {
+			s->ext->watermark_handler = NULL;
+			s->ext->write_paused = false;
 		}
-	} else {
-		s->stream.read_handler(s->stream.read_handler_context, cio_success, s->stream.read_buffer, (size_t)ret);
+
+		return cio_success;
+	}
+
+	if (unlikely((low >= high) || (low > INT_MAX))) {
+		return cio_invalid_argument;
 	}
+
+	ext = get_ext(s);
+	if (unlikely(ext == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	/*
+	 * Keeps the data in the kernel send buffer bounded. Not all socket
+	 * types support the option, for them only the output queue counts.
+	 */
+	lowat = (int)low;
+	if (setsockopt(s->ev.fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0) {
+		if ((errno != EOPNOTSUPP) && (errno != ENOPROTOOPT)) {
+			return errno;
+		}
+	}
+
+	ext->low_watermark = low;
+	ext->high_watermark = high;
+	ext->watermark_handler = handler;
+	ext->watermark_handler_context = handler_context;
+	ext->write_paused = false;
+	return cio_success;
 }
 
-static void socket_read(void *context, void *buf, size_t count, cio_stream_read_handler handler, void *handler_context)
+static enum cio_error socket_use_uring(void *context, struct cio_uring *ring)
 {
-	enum cio_error err;
 	struct cio_socket *s = context;
-	s->ev.context = s;
-	s->ev.read_callback = read_callback;
-	s->stream.read_buffer = buf;
-	s->stream.read_count = count;
-	s->stream.read_handler = handler;
-	s->stream.read_handler_context = handler_context;
-	err = cio_linux_eventloop_register_read(s->loop, &s->ev);
+	struct cio_socket_ext *ext;
+
+	if (read_pending(s) || (s->stream.write_handler != NULL)) {
+		return cio_invalid_argument;
+	}
+
+	ext = get_ext(s);
+	if (unlikely(ext == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	if ((ext->uring != NULL) || ext->receive_timestamps) {
+		return cio_invalid_argument;
+	}
+
+	cio_linux_eventloop_cancel_deferred(s->loop, &s->read_resume);
+	return cio_linux_uring_attach(ring, s);
+}
+
+static enum cio_error socket_set_buffer_sizes(void *context, size_t receive_size, size_t send_size)
+{
+	struct cio_socket *s = context;
+	enum cio_error err;
+
+	if ((s->ext != NULL) && (s->ext->tuner != NULL)) {
+		cio_linux_buffer_tuner_detach(s);
+	}
+
+	err = set_buffer_size(s->ev.fd, SO_RCVBUF, receive_size);
 	if (unlikely(err != cio_success)) {
-		handler(handler_context, err, buf, 0);
-		return;
+		return err;
 	}
 
-	read_callback(s);
+	return set_buffer_size(s->ev.fd, SO_SNDBUF, send_size);
 }
 
-static void write_callback(void *context)
+static enum cio_error socket_use_buffer_tuner(void *context, struct cio_buffer_tuner *tuner)
 {
 	struct cio_socket *s = context;
-	s->stream.write_handler(s->stream.write_handler_context, cio_success, 0);
+
+	if ((s->ext != NULL) && (s->ext->tuner != NULL)) {
+		cio_linux_buffer_tuner_detach(s);
+	}
+
+	if (tuner == NULL) {
+		return cio_success;
+	}
+
+	if (unlikely(get_ext(s) == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	return cio_linux_buffer_tuner_attach(tuner, s);
 }
 
-static void socket_write(void *context, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context)
+static enum cio_error socket_get_stats(void *context, struct cio_socket_stats *stats)
+{
+#ifdef CONFIG_IO_ACCOUNTING
+	const struct cio_socket *s = context;
+	if (unlikely(s->ext == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	*stats = s->ext->stats;
+	return cio_success;
+#else
+	(void)context;
+	(void)stats;
+	return cio_protocol_not_supported;
+#endif
+}
+
+static enum cio_error socket_set_receive_timestamps(void *context, bool on)
 {
 	struct cio_socket *s = context;
+	struct cio_socket_ext *ext;
+	int flags = 0;
 
-	ssize_t ret = send(s->ev.fd, buf, count, MSG_NOSIGNAL);
-	if (likely(ret >= 0)) {
-		handler(handler_context, cio_success, (size_t)ret);
-	} else {
-		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
-			enum cio_error err;
-			s->stream.write_handler = handler;
-			s->stream.write_handler_context = handler_context;
-			s->ev.context = s;
-			s->ev.write_callback = write_callback;
-			err = cio_linux_eventloop_register_write(s->loop, &s->ev);
-			if (unlikely(err != cio_success)) {
-				handler(handler_context, err, 0);
-			}
-		} else {
-			handler(handler_context, errno, 0);
+	if (!on && (s->ext == NULL)) {
+		return cio_success;
+	}
+
+	ext = get_ext(s);
+	if (unlikely(ext == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	if (unlikely(ext->uring != NULL)) {
+		return cio_invalid_argument;
+	}
+
+	if (on) {
+		flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	}
+
+	if (setsockopt(s->ev.fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+		return errno;
+	}
+
+	ext->receive_timestamps = on;
+	ext->receive_timestamp_ns = 0;
+	return cio_success;
+}
+
+static uint64_t socket_get_receive_timestamp(void *context)
+{
+	const struct cio_socket *s = context;
+
+	if (s->ext == NULL) {
+		return 0;
+	}
+
+	return s->ext->receive_timestamp_ns;
+}
+
+static void socket_set_read_budget(void *context, size_t budget)
+{
+	struct cio_socket *s = context;
+	s->read_budget = budget;
+}
+
+static void read_resumed(void *context)
+{
+	struct cio_socket *s = context;
+	drain_socket(s);
+}
+
+static enum cio_error socket_set_zerocopy(void *context, bool on, size_t threshold)
+{
+	struct cio_socket *s = context;
+	struct cio_socket_ext *ext = s->ext;
+	int zerocopy;
+
+	if (on) {
+		zerocopy = 1;
+		ext = get_ext(s);
+		if (unlikely(ext == NULL)) {
+			return cio_not_enough_memory;
 		}
+	} else {
+		zerocopy = 0;
+	}
+
+	if (setsockopt(s->ev.fd, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, sizeof(zerocopy)) < 0) {
+		return errno;
+	}
+
+	if (ext == NULL) {
+		return cio_success;
 	}
+
+	if (threshold == 0) {
+		threshold = CONFIG_ZEROCOPY_THRESHOLD;
+	}
+
+	ext->zerocopy = on;
+	ext->zerocopy_threshold = threshold;
+	s->ev.error_callback = error_callback;
+	return cio_success;
 }
 
+static const struct cio_io_stream_ops stream_ops = {
+	.read_some = socket_read,
+	.write_some = socket_write,
+	.readv_some = socket_readv,
+	.read_some_allocated = socket_read_allocated,
+	.writev_some = socket_writev,
+	.close = socket_close,
+};
+
+static const struct cio_socket_ops socket_ops = {
+	.get_io_stream = socket_get_io_stream,
+	.close = socket_close,
+	.set_tcp_no_delay = socket_tcp_no_delay,
+	.set_keep_alive = socket_keepalive,
+	.get_peer_credentials = socket_get_peer_credentials,
+	.set_read_timeout = socket_set_read_timeout,
+	.set_write_timeout = socket_set_write_timeout,
+	.set_idle_timeout = socket_set_idle_timeout,
+	.set_zerocopy = socket_set_zerocopy,
+	.sendfile = socket_sendfile,
+	.receive_file = socket_receive_file,
+	.queue_write = socket_queue_write,
+	.set_read_budget = socket_set_read_budget,
+	.set_tcp_quick_ack = socket_tcp_quick_ack,
+	.set_write_watermarks = socket_set_write_watermarks,
+	.use_uring = socket_use_uring,
+	.enable_post_write = socket_enable_post_write,
+	.post_write = socket_post_write,
+	.set_buffer_sizes = socket_set_buffer_sizes,
+	.use_buffer_tuner = socket_use_buffer_tuner,
+	.get_stats = socket_get_stats,
+	.set_receive_timestamps = socket_set_receive_timestamps,
+	.get_receive_timestamp = socket_get_receive_timestamp,
+};
+
 static void loop_callback(void *context)
 {
 	struct cio_linux_socket *ls = context;
 	(void)ls;
 }
 
-enum cio_error cio_socket_init(struct cio_socket *s, int client_fd,
-                               struct cio_eventloop *loop,
-                               cio_socket_close_hook close_hook)
+void cio_linux_socket_init(struct cio_socket *s, int fd,
+                           struct cio_eventloop *loop,
+                           cio_socket_close_hook close_hook)
 {
-	enum cio_error err = set_fd_non_blocking(client_fd);
-	if (unlikely(err != cio_success)) {
-		return err;
-	}
-
-	s->ev.fd = client_fd;
+	s->ev.fd = fd;
 	s->ev.read_callback = loop_callback;
+	s->ev.error_callback = NULL;
 	s->ev.context = s;
 
 	s->context = s;
-	s->close = socket_close;
-	s->set_tcp_no_delay = socket_tcp_no_delay;
-	s->set_keep_alive = socket_keepalive;
-	s->get_io_stream = socket_get_io_stream;
+	s->ops = &socket_ops;
 
 	s->stream.context = s;
-	s->stream.read_some = socket_read;
-	s->stream.write_some = socket_write;
-	s->stream.close = socket_close;
+	s->stream.ops = &stream_ops;
+	s->stream.read_handler = NULL;
+	s->stream.readv_handler = NULL;
+	s->stream.read_allocator = NULL;
+	s->stream.write_handler = NULL;
+
+	s->read_budget = CONFIG_READ_BUDGET;
+	s->read_ready = false;
+	s->draining = false;
+	s->closed = false;
+	s->read_resume.callback = read_resumed;
+	s->read_resume.context = s;
+	s->read_resume.next = NULL;
+	s->read_resume.pprev = NULL;
 
 	s->loop = loop;
 	s->close_hook = close_hook;
 
+	s->deadline.expired = deadline_expired;
+	s->deadline.context = s;
+	s->deadline.next = NULL;
+	s->deadline.pprev = NULL;
+	s->read_timeout_ns = 0;
+	s->write_timeout_ns = 0;
+	s->idle_timeout_ns = 0;
+	s->read_expires_ns = 0;
+	s->write_expires_ns = 0;
+	s->idle_expires_ns = 0;
+
+	s->ext = NULL;
+
+	link_socket(s);
+
 	cio_linux_eventloop_add(s->loop, &s->ev);
+}
+
+enum cio_error cio_socket_init(struct cio_socket *s, int client_fd,
+                               struct cio_eventloop *loop,
+                               cio_socket_close_hook close_hook)
+{
+	enum cio_error err = set_fd_non_blocking(client_fd);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	cio_linux_socket_init(s, client_fd, loop, close_hook);
 	return cio_success;
 }
+
+unsigned int cio_socket_abi_version(void)
+{
+	return CIO_SOCKET_ABI_VERSION;
+}
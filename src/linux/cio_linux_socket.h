@@ -0,0 +1,140 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef CIO_LINUX_SOCKET_H
+#define CIO_LINUX_SOCKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cio_uring_stream;
+
+/*
+ * The state of socket features most connections never use. It is
+ * allocated when one of the features is used first, so a connection
+ * that uses none of them only pays for the pointer in cio_socket.
+ */
+struct cio_socket_ext {
+	size_t zerocopy_threshold;
+	size_t zerocopy_bytes;
+	uint32_t zerocopy_next_id;
+	uint32_t zerocopy_pending_id;
+	bool zerocopy;
+	bool zerocopy_pending;
+
+	uint64_t file_offset;
+	size_t file_remaining;
+	size_t file_transferred;
+	int file_fd;
+
+	uint64_t receive_start;
+	uint64_t receive_offset;
+	size_t receive_remaining;
+	cio_stream_write_handler receive_handler;
+	void *receive_handler_context;
+	int receive_fd;
+	int pipe_fds[2];
+	enum cio_file_sync receive_sync;
+
+	struct cio_write_request *output_head;
+	struct cio_write_request **output_tail;
+	size_t output_bytes;
+	struct cio_linux_deferred output_flush;
+	bool output_waiting;
+
+	size_t low_watermark;
+	size_t high_watermark;
+	cio_socket_watermark_handler watermark_handler;
+	void *watermark_handler_context;
+	bool write_paused;
+
+	struct cio_uring_stream *uring;
+
+	struct cio_buffer_tuner *tuner;
+	struct cio_socket *tuner_next;
+	struct cio_socket **tuner_pprev;
+	size_t tuned_receive_size;
+	size_t tuned_send_size;
+
+	struct cio_write_request *posted;
+	struct cio_linux_remote post_remote;
+
+	uint64_t receive_timestamp_ns;
+	bool receive_timestamps;
+
+	struct cio_socket_stats stats;
+	struct cio_socket *stats_next;
+	struct cio_socket **stats_pprev;
+	unsigned int handler_calls;
+};
+
+/*
+ * Initializes a cio_socket from a file descriptor that is already
+ * non-blocking, e.g. one created with SOCK_NONBLOCK or accept4().
+ */
+void cio_linux_socket_init(struct cio_socket *s, int fd,
+                           struct cio_eventloop *loop,
+                           cio_socket_close_hook close_hook);
+
+/*
+ * Keep the read, write and idle timeouts of a socket running while its
+ * I/O stream is served by a data path other than epoll, i.e. io_uring.
+ * A read or write is started once its handler was stored and completed
+ * before its handler is called.
+ */
+void cio_linux_socket_read_started(struct cio_socket *s);
+void cio_linux_socket_read_completed(struct cio_socket *s, size_t bytes_transferred);
+void cio_linux_socket_write_started(struct cio_socket *s);
+void cio_linux_socket_write_completed(struct cio_socket *s, size_t bytes_transferred);
+
+/*
+ * Restarts the idle timeout of a socket because data arrived.
+ */
+void cio_linux_socket_touch_idle(struct cio_socket *s);
+
+typedef void (*cio_linux_socket_idle_callback)(void *context);
+
+/*
+ * Lets the owner of an idle socket, e.g. a connection pool, watch it for
+ * readability to notice the peer closing it. @p callback replaces the
+ * read callback of the socket until the next read on its I/O stream.
+ */
+enum cio_error cio_linux_socket_watch_idle(struct cio_socket *s, cio_linux_socket_idle_callback callback, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
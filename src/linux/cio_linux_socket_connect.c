@@ -0,0 +1,485 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cio_compiler.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+#include "linux/cio_linux_alloc.h"
+#include "linux/cio_linux_socket.h"
+#include "linux/cio_linux_socket_utils.h"
+
+/*
+ * The time to wait for a connection attempt before the next address is
+ * tried in parallel, as recommended by RFC 8305.
+ */
+#define CONFIG_CONNECT_ATTEMPT_DELAY_NS 250000000ULL
+
+struct connect_attempt {
+	struct cio_event_notifier ev;
+	struct cio_socket_connect_state *state;
+	const struct addrinfo *address;
+	bool running;
+};
+
+struct cio_socket_connect_state {
+	struct cio_socket *s;
+	struct cio_eventloop *loop;
+	cio_socket_close_hook close_hook;
+	cio_socket_connect_handler handler;
+	void *handler_context;
+	const struct addrinfo *addresses;
+	struct addrinfo *owned_addresses;
+	struct cio_linux_deadline attempt_delay;
+	struct cio_linux_deadline timeout;
+	enum cio_error last_error;
+	unsigned int num_attempts;
+	unsigned int next_attempt;
+	unsigned int running;
+	bool fast_open;
+	bool preallocated;
+	struct connect_attempt attempts[];
+};
+
+static void stop_attempt(struct cio_socket_connect_state *state, struct connect_attempt *attempt, bool close_fd)
+{
+	cio_linux_eventloop_remove(state->loop, &attempt->ev);
+	if (close_fd) {
+		close(attempt->ev.fd);
+	}
+
+	attempt->running = false;
+	state->running--;
+}
+
+/*
+ * Stops all attempts. A state passed to cio_socket_connect_resolved()
+ * stays with the caller, all other states are freed.
+ */
+static void free_state(struct cio_socket_connect_state *state)
+{
+	unsigned int i;
+
+	for (i = 0; i < state->num_attempts; i++) {
+		if (state->attempts[i].running) {
+			stop_attempt(state, &state->attempts[i], true);
+		}
+	}
+
+	cio_linux_eventloop_disarm_deadline(state->loop, &state->attempt_delay);
+	cio_linux_eventloop_disarm_deadline(state->loop, &state->timeout);
+	if (state->preallocated) {
+		return;
+	}
+
+	freeaddrinfo(state->owned_addresses);
+	cio_free(state);
+}
+
+static void finish(struct cio_socket_connect_state *state, struct connect_attempt *winner, enum cio_error err)
+{
+	struct cio_socket *s = state->s;
+	cio_socket_connect_handler handler = state->handler;
+	void *handler_context = state->handler_context;
+
+	if (winner != NULL) {
+		int fd = winner->ev.fd;
+		stop_attempt(state, winner, false);
+		cio_linux_socket_init(s, fd, state->loop, state->close_hook);
+	}
+
+	free_state(state);
+	handler(s, handler_context, err);
+}
+
+static void attempt_writable(void *context);
+
+/*
+ * Starts attempts until one is in progress or no address is left.
+ */
+static void start_next_attempt(struct cio_socket_connect_state *state)
+{
+	while (state->next_attempt < state->num_attempts) {
+		struct connect_attempt *attempt = &state->attempts[state->next_attempt++];
+		const struct addrinfo *address = attempt->address;
+		enum cio_error err;
+
+		int fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+		if (unlikely(fd == -1)) {
+			state->last_error = errno;
+			continue;
+		}
+
+		/*
+		 * With TCP_FASTOPEN_CONNECT, connect() returns at once and the
+		 * SYN is sent together with the data of the first write. Kernels
+		 * not supporting the option simply do a regular connect.
+		 */
+		if (state->fast_open) {
+			int on = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+		}
+
+		if ((connect(fd, address->ai_addr, address->ai_addrlen) < 0) && (errno != EINPROGRESS)) {
+			state->last_error = errno;
+			close(fd);
+			continue;
+		}
+
+		attempt->ev.fd = fd;
+		attempt->ev.context = attempt;
+		attempt->ev.read_callback = NULL;
+		attempt->ev.write_callback = attempt_writable;
+		attempt->ev.error_callback = NULL;
+		err = cio_linux_eventloop_add(state->loop, &attempt->ev);
+		if (unlikely(err != cio_success)) {
+			state->last_error = err;
+			close(fd);
+			continue;
+		}
+
+		attempt->running = true;
+		state->running++;
+		err = cio_linux_eventloop_register_write(state->loop, &attempt->ev);
+		if (unlikely(err != cio_success)) {
+			state->last_error = err;
+			stop_attempt(state, attempt, true);
+			continue;
+		}
+
+		if (state->next_attempt < state->num_attempts) {
+			uint64_t now = cio_linux_eventloop_get_time_ns(state->loop);
+			cio_linux_eventloop_arm_deadline(state->loop, &state->attempt_delay, now + CONFIG_CONNECT_ATTEMPT_DELAY_NS);
+		}
+
+		return;
+	}
+}
+
+static void attempt_writable(void *context)
+{
+	struct connect_attempt *attempt = context;
+	struct cio_socket_connect_state *state = attempt->state;
+	int so_error;
+	socklen_t len = sizeof(so_error);
+
+	if (unlikely(getsockopt(attempt->ev.fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0)) {
+		so_error = errno;
+	}
+
+	if (so_error == 0) {
+		finish(state, attempt, cio_success);
+		return;
+	}
+
+	state->last_error = so_error;
+	stop_attempt(state, attempt, true);
+	cio_linux_eventloop_disarm_deadline(state->loop, &state->attempt_delay);
+	start_next_attempt(state);
+	if (state->running == 0) {
+		finish(state, NULL, state->last_error);
+	}
+}
+
+static void attempt_delay_expired(void *context)
+{
+	struct cio_socket_connect_state *state = context;
+	start_next_attempt(state);
+}
+
+static void connect_timed_out(void *context)
+{
+	struct cio_socket_connect_state *state = context;
+	finish(state, NULL, cio_timed_out);
+}
+
+enum cio_error cio_socket_resolve(const char *address, uint16_t port, struct addrinfo **result)
+{
+	struct addrinfo hints;
+	char port_string[6];
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+
+	snprintf(port_string, sizeof(port_string), "%d", port);
+
+	if (unlikely(address == NULL)) {
+		return cio_invalid_argument;
+	}
+
+	ret = getaddrinfo(address, port_string, &hints, result);
+	if (ret != 0) {
+		switch (ret) {
+		case EAI_SYSTEM:
+			return errno;
+		case EAI_MEMORY:
+			return cio_not_enough_memory;
+		default:
+			return cio_invalid_argument;
+		}
+	}
+
+	return cio_success;
+}
+
+/*
+ * Orders the addresses so that address families alternate, starting
+ * with the family of the first address returned by the resolver.
+ */
+static void order_attempts(struct cio_socket_connect_state *state)
+{
+	int family = state->addresses->ai_family;
+	const struct addrinfo *primary = state->addresses;
+	const struct addrinfo *secondary = state->addresses;
+	unsigned int i = 0;
+
+	while (i < state->num_attempts) {
+		while ((primary != NULL) && (primary->ai_family != family)) {
+			primary = primary->ai_next;
+		}
+
+		while ((secondary != NULL) && (secondary->ai_family == family)) {
+			secondary = secondary->ai_next;
+		}
+
+		if (primary != NULL) {
+			state->attempts[i++].address = primary;
+			primary = primary->ai_next;
+		}
+
+		if (secondary != NULL) {
+			state->attempts[i++].address = secondary;
+			secondary = secondary->ai_next;
+		}
+	}
+}
+
+static struct cio_socket_connect_state *alloc_state(const struct addrinfo *addresses)
+{
+	const struct addrinfo *rp;
+	struct cio_socket_connect_state *state;
+	unsigned int num_attempts = 0;
+	unsigned int i;
+
+	for (rp = addresses; rp != NULL; rp = rp->ai_next) {
+		num_attempts++;
+	}
+
+	state = cio_malloc(sizeof(*state) + num_attempts * sizeof(state->attempts[0]));
+	if (unlikely(state == NULL)) {
+		return NULL;
+	}
+
+	memset(state, 0, sizeof(*state));
+	state->addresses = addresses;
+	state->attempt_delay.expired = attempt_delay_expired;
+	state->attempt_delay.context = state;
+	state->timeout.expired = connect_timed_out;
+	state->timeout.context = state;
+	state->num_attempts = num_attempts;
+	for (i = 0; i < num_attempts; i++) {
+		state->attempts[i].state = state;
+		state->attempts[i].running = false;
+	}
+
+	order_attempts(state);
+	return state;
+}
+
+static enum cio_error run_connect(struct cio_socket_connect_state *state, struct cio_socket *s, struct cio_eventloop *loop,
+                                  uint64_t timeout_ns, cio_socket_close_hook close_hook,
+                                  cio_socket_connect_handler handler, void *handler_context,
+                                  bool fast_open)
+{
+	enum cio_error err;
+
+	state->s = s;
+	state->loop = loop;
+	state->close_hook = close_hook;
+	state->handler = handler;
+	state->handler_context = handler_context;
+	state->last_error = cio_invalid_argument;
+	state->next_attempt = 0;
+	state->running = 0;
+	state->fast_open = fast_open;
+
+	start_next_attempt(state);
+	if (unlikely(state->running == 0)) {
+		err = state->last_error;
+		free_state(state);
+		return err;
+	}
+
+	if (timeout_ns != 0) {
+		cio_linux_eventloop_arm_deadline(loop, &state->timeout, cio_linux_eventloop_get_time_ns(loop) + timeout_ns);
+	}
+
+	return cio_success;
+}
+
+static enum cio_error start_connect(struct cio_socket *s, struct cio_eventloop *loop,
+                                    const char *address, uint16_t port, uint64_t timeout_ns,
+                                    cio_socket_close_hook close_hook,
+                                    cio_socket_connect_handler handler, void *handler_context,
+                                    bool fast_open)
+{
+	struct addrinfo *addresses;
+	struct cio_socket_connect_state *state;
+	enum cio_error err;
+
+	if (unlikely(handler == NULL)) {
+		return cio_invalid_argument;
+	}
+
+	err = cio_socket_resolve(address, port, &addresses);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	state = alloc_state(addresses);
+	if (unlikely(state == NULL)) {
+		freeaddrinfo(addresses);
+		return cio_not_enough_memory;
+	}
+
+	state->owned_addresses = addresses;
+	return run_connect(state, s, loop, timeout_ns, close_hook, handler, handler_context, fast_open);
+}
+
+enum cio_error cio_socket_connect(struct cio_socket *s, struct cio_eventloop *loop,
+                                  const char *address, uint16_t port, uint64_t timeout_ns,
+                                  cio_socket_close_hook close_hook,
+                                  cio_socket_connect_handler handler, void *handler_context)
+{
+	return start_connect(s, loop, address, port, timeout_ns, close_hook, handler, handler_context, false);
+}
+
+enum cio_error cio_socket_connect_fast_open(struct cio_socket *s, struct cio_eventloop *loop,
+                                            const char *address, uint16_t port, uint64_t timeout_ns,
+                                            cio_socket_close_hook close_hook,
+                                            cio_socket_connect_handler handler, void *handler_context)
+{
+	return start_connect(s, loop, address, port, timeout_ns, close_hook, handler, handler_context, true);
+}
+
+struct cio_socket_connect_state *cio_socket_connect_state_alloc(const struct addrinfo *addresses)
+{
+	struct cio_socket_connect_state *state;
+
+	if (unlikely(addresses == NULL)) {
+		return NULL;
+	}
+
+	state = alloc_state(addresses);
+	if (likely(state != NULL)) {
+		state->preallocated = true;
+	}
+
+	return state;
+}
+
+void cio_socket_connect_state_free(struct cio_socket_connect_state *connect_state)
+{
+	cio_free(connect_state);
+}
+
+enum cio_error cio_socket_connect_resolved(struct cio_socket *s, struct cio_eventloop *loop,
+                                           struct cio_socket_connect_state *connect_state, uint64_t timeout_ns,
+                                           cio_socket_close_hook close_hook,
+                                           cio_socket_connect_handler handler, void *handler_context)
+{
+	if (unlikely((connect_state == NULL) || (handler == NULL))) {
+		return cio_invalid_argument;
+	}
+
+	return run_connect(connect_state, s, loop, timeout_ns, close_hook, handler, handler_context, false);
+}
+
+enum cio_error cio_socket_connect_unix(struct cio_socket *s, struct cio_eventloop *loop,
+                                       const char *path, enum cio_unix_socket_type type,
+                                       cio_socket_close_hook close_hook)
+{
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	int socket_type;
+	int fd;
+	enum cio_error err;
+
+	switch (type) {
+	case cio_unix_stream:
+		socket_type = SOCK_STREAM;
+		break;
+	case cio_unix_seqpacket:
+		socket_type = SOCK_SEQPACKET;
+		break;
+	case cio_unix_datagram:
+		socket_type = SOCK_DGRAM;
+		break;
+	default:
+		return cio_invalid_argument;
+	}
+
+	err = fill_unix_address(&addr, &addrlen, path);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	fd = socket(AF_UNIX, socket_type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (unlikely(fd == -1)) {
+		return errno;
+	}
+
+	/*
+	 * Unix domain sockets never report EINPROGRESS, a non-blocking
+	 * connect either succeeds or fails with EAGAIN if the backlog of the
+	 * peer is full.
+	 */
+	if (unlikely(connect(fd, (struct sockaddr *)&addr, addrlen) < 0)) {
+		err = errno;
+		close(fd);
+		return err;
+	}
+
+	cio_linux_socket_init(s, fd, loop, close_hook);
+	return cio_success;
+}
@@ -0,0 +1,153 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_socket.h"
+#include "linux/cio_linux_socket.h"
+
+enum cio_error cio_socket_for_each(struct cio_eventloop *loop, cio_socket_visitor visitor, void *context)
+{
+	struct cio_socket *s;
+
+	for (s = loop->sockets; s != NULL; s = s->ext->stats_next) {
+		visitor(s, context);
+	}
+
+	return cio_success;
+}
+
+#ifdef CONFIG_IO_ACCOUNTING
+static uint64_t stats_value(const struct cio_socket *s, enum cio_socket_stats_key key)
+{
+	switch (key) {
+	case cio_stats_bytes_read:
+		return s->ext->stats.bytes_read;
+	case cio_stats_bytes_written:
+		return s->ext->stats.bytes_written;
+	case cio_stats_read_calls:
+		return s->ext->stats.read_calls;
+	case cio_stats_write_calls:
+		return s->ext->stats.write_calls;
+	case cio_stats_would_block:
+		return s->ext->stats.would_block;
+	case cio_stats_handler_time:
+		return s->ext->stats.handler_time_ns;
+	}
+
+	return 0;
+}
+
+/*
+ * Restores the min-heap property of top[0..n) below position i, with the
+ * socket with the lowest value at top[0].
+ */
+static void sift_down(struct cio_socket **top, unsigned int n, unsigned int i, enum cio_socket_stats_key key)
+{
+	for (;;) {
+		unsigned int smallest = i;
+		unsigned int left = (2 * i) + 1;
+		unsigned int right = left + 1;
+		struct cio_socket *tmp;
+
+		if ((left < n) && (stats_value(top[left], key) < stats_value(top[smallest], key))) {
+			smallest = left;
+		}
+
+		if ((right < n) && (stats_value(top[right], key) < stats_value(top[smallest], key))) {
+			smallest = right;
+		}
+
+		if (smallest == i) {
+			return;
+		}
+
+		tmp = top[i];
+		top[i] = top[smallest];
+		top[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+/*
+ * Keeps the n largest sockets seen so far in a min-heap, so a single pass
+ * over all sockets costs O(sockets * log(n)) and no memory.
+ */
+unsigned int cio_socket_top(struct cio_eventloop *loop, enum cio_socket_stats_key key, struct cio_socket **top, unsigned int n)
+{
+	struct cio_socket *s;
+	unsigned int count = 0;
+	unsigned int i;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	for (s = loop->sockets; s != NULL; s = s->ext->stats_next) {
+		if (count < n) {
+			top[count] = s;
+			count++;
+			if (count == n) {
+				for (i = n / 2; i-- > 0;) {
+					sift_down(top, n, i, key);
+				}
+			}
+		} else if (stats_value(s, key) > stats_value(top[0], key)) {
+			top[0] = s;
+			sift_down(top, n, 0, key);
+		}
+	}
+
+	if (count < n) {
+		for (i = count / 2; i-- > 0;) {
+			sift_down(top, count, i, key);
+		}
+	}
+
+	/*
+	 * Sorting the heap in place moves the largest value to the front.
+	 */
+	for (i = count; i > 1; i--) {
+		struct cio_socket *tmp = top[0];
+		top[0] = top[i - 1];
+		top[i - 1] = tmp;
+		sift_down(top, i - 1, 0, key);
+	}
+
+	return count;
+}
+#else
+unsigned int cio_socket_top(struct cio_eventloop *loop, enum cio_socket_stats_key key, struct cio_socket **top, unsigned int n)
+{
+	(void)loop;
+	(void)key;
+	(void)top;
+	(void)n;
+	return 0;
+}
+#endif
@@ -24,7 +24,16 @@
  * SOFTWARE.
  */
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "cio_compiler.h"
@@ -44,3 +53,105 @@ enum cio_error set_fd_non_blocking(int fd)
 
 	return cio_success;
 }
+
+/*
+ * A path starting with '@' denotes an address in the abstract namespace,
+ * which is not bound to the file system and vanishes with its socket.
+ */
+enum cio_error fill_unix_address(struct sockaddr_un *addr, socklen_t *addrlen, const char *path)
+{
+	size_t path_length;
+
+	if (unlikely(path == NULL)) {
+		return cio_invalid_argument;
+	}
+
+	path_length = strlen(path);
+	if (unlikely(path_length == 0)) {
+		return cio_invalid_argument;
+	}
+
+	if (unlikely(path_length >= sizeof(addr->sun_path))) {
+		return cio_filename_too_long;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, path, path_length);
+	if (path[0] == '@') {
+		addr->sun_path[0] = '\0';
+		*addrlen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_length);
+	} else {
+		*addrlen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_length + 1);
+	}
+
+	return cio_success;
+}
+
+enum cio_error set_tcp_no_delay(int fd, bool on)
+{
+	int tcp_no_delay;
+
+	if (on) {
+		tcp_no_delay = 1;
+	} else {
+		tcp_no_delay = 0;
+	}
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &tcp_no_delay,
+	               sizeof(tcp_no_delay)) < 0) {
+		return errno;
+	}
+
+	return cio_success;
+}
+
+enum cio_error set_keep_alive(int fd, bool on, unsigned int keep_idle_s,
+                              unsigned int keep_intvl_s, unsigned int keep_cnt)
+{
+	int keep_alive;
+
+	if (on) {
+		keep_alive = 1;
+		if (setsockopt(fd, SOL_TCP, TCP_KEEPIDLE, &keep_idle_s, sizeof(keep_idle_s)) == -1) {
+			return errno;
+		}
+
+		if (setsockopt(fd, SOL_TCP, TCP_KEEPINTVL, &keep_intvl_s, sizeof(keep_intvl_s)) == -1) {
+			return errno;
+		}
+
+		if (setsockopt(fd, SOL_TCP, TCP_KEEPCNT, &keep_cnt, sizeof(keep_cnt)) == -1) {
+			return errno;
+		}
+	} else {
+		keep_alive = 0;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &keep_alive, sizeof(keep_alive)) == -1) {
+		return errno;
+	}
+
+	return cio_success;
+}
+
+enum cio_error set_buffer_size(int fd, int option, size_t size)
+{
+	int buffer_size;
+
+	if (size == 0) {
+		return cio_success;
+	}
+
+	if (unlikely(size > INT_MAX)) {
+		return cio_invalid_argument;
+	}
+
+	buffer_size = (int)size;
+	if (unlikely(setsockopt(fd, SOL_SOCKET, option, &buffer_size,
+	                        sizeof(buffer_size)) < 0)) {
+		return errno;
+	}
+
+	return cio_success;
+}
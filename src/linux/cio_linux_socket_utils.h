@@ -27,6 +27,11 @@
 #ifndef CIO_LINUX_SOCKET_UTILS_H
 #define CIO_LINUX_SOCKET_UTILS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 #include "cio_error_code.h"
 
 #ifdef __cplusplus
@@ -34,6 +39,10 @@ extern "C" {
 #endif
 
 enum cio_error set_fd_non_blocking(int fd);
+enum cio_error fill_unix_address(struct sockaddr_un *addr, socklen_t *addrlen, const char *path);
+enum cio_error set_tcp_no_delay(int fd, bool on);
+enum cio_error set_keep_alive(int fd, bool on, unsigned int keep_idle_s, unsigned int keep_intvl_s, unsigned int keep_cnt);
+enum cio_error set_buffer_size(int fd, int option, size_t size);
 
 #ifdef __cplusplus
 }
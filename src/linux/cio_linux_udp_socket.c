@@ -0,0 +1,529 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cio_buffer_allocator.h"
+#include "cio_compiler.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_udp_socket.h"
+#include "linux/cio_linux_socket_utils.h"
+
+static void free_receive_batch(struct cio_udp_socket *s)
+{
+	unsigned int i;
+
+	if (s->allocator == NULL) {
+		return;
+	}
+
+	for (i = 0; i < CONFIG_UDP_BATCH_SIZE; i++) {
+		if (s->receive_batch[i].buffer.address != NULL) {
+			s->allocator->free(s->allocator->context, s->receive_batch[i].buffer.address);
+			s->receive_batch[i].buffer.address = NULL;
+		}
+	}
+
+	s->allocator = NULL;
+}
+
+static void release_socket(struct cio_udp_socket *s)
+{
+	free_receive_batch(s);
+	if (s->close_hook != NULL) {
+		s->close_hook(s);
+	}
+}
+
+static void socket_close(void *context)
+{
+	struct cio_udp_socket *s = context;
+
+	cio_linux_eventloop_remove(s->loop, &s->ev);
+	close(s->ev.fd);
+	s->closed = true;
+
+	/*
+	 * If the socket is closed from within a handler, the memory of the
+	 * socket is released only after the handler returned.
+	 */
+	if (s->handler_depth == 0) {
+		release_socket(s);
+	}
+}
+
+/*
+ * Returns false if the socket was closed by the handler and must not be
+ * touched anymore.
+ */
+static bool call_receive_handler(struct cio_udp_socket *s, enum cio_error err, struct cio_datagram *datagrams, unsigned int count)
+{
+	s->handler_depth++;
+	s->receive_handler(s, s->receive_handler_context, err, datagrams, count);
+	s->handler_depth--;
+	if (unlikely(s->closed)) {
+		if (s->handler_depth == 0) {
+			release_socket(s);
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+static void complete_send(struct cio_udp_socket *s, enum cio_error err)
+{
+	cio_udp_send_handler handler = s->send_handler;
+	s->send_handler = NULL;
+
+	s->handler_depth++;
+	handler(s, s->send_handler_context, err, s->send_done);
+	s->handler_depth--;
+	if (unlikely(s->closed && (s->handler_depth == 0))) {
+		release_socket(s);
+	}
+}
+
+static uint16_t get_gro_size(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+			int gso_size;
+			memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+			return (uint16_t)gso_size;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Splits datagrams the kernel coalesced into the segments array and hands
+ * them to the receive handler. The segments point into the receive buffers.
+ */
+static bool deliver_segments(struct cio_udp_socket *s, struct mmsghdr *msgs, unsigned int received)
+{
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < received; i++) {
+		struct cio_datagram *datagram = &s->receive_batch[i];
+		size_t segment_size = get_gro_size(&msgs[i].msg_hdr);
+		size_t offset = 0;
+
+		if (segment_size == 0) {
+			segment_size = datagram->length;
+		}
+
+		do {
+			struct cio_datagram *segment = &s->segments[count];
+			size_t length = datagram->length - offset;
+			if (length > segment_size) {
+				length = segment_size;
+			}
+
+			segment->buffer.address = (uint8_t *)datagram->buffer.address + offset;
+			segment->buffer.size = length;
+			segment->length = length;
+			memcpy(&segment->peer, &datagram->peer, datagram->peer_length);
+			segment->peer_length = datagram->peer_length;
+			segment->truncated = datagram->truncated;
+			segment->segment_size = 0;
+			offset += length;
+			count++;
+
+			if (count == CONFIG_UDP_BATCH_SIZE) {
+				if (!call_receive_handler(s, cio_success, s->segments, count)) {
+					return false;
+				}
+
+				if (s->receive_handler == NULL) {
+					return true;
+				}
+
+				count = 0;
+			}
+		} while (offset < datagram->length);
+	}
+
+	if (count > 0) {
+		return call_receive_handler(s, cio_success, s->segments, count);
+	}
+
+	return true;
+}
+
+static void receive_callback(void *context)
+{
+	struct cio_udp_socket *s = context;
+	struct mmsghdr msgs[CONFIG_UDP_BATCH_SIZE];
+	struct iovec iov[CONFIG_UDP_BATCH_SIZE];
+	uint8_t control[CONFIG_UDP_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+
+	if (unlikely(s->receive_handler == NULL)) {
+		return;
+	}
+
+	while (true) {
+		unsigned int i;
+		int ret;
+
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < CONFIG_UDP_BATCH_SIZE; i++) {
+			struct cio_datagram *datagram = &s->receive_batch[i];
+			iov[i].iov_base = datagram->buffer.address;
+			iov[i].iov_len = datagram->buffer.size;
+			msgs[i].msg_hdr.msg_name = &datagram->peer;
+			msgs[i].msg_hdr.msg_namelen = sizeof(datagram->peer);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			if (s->gro) {
+				msgs[i].msg_hdr.msg_control = control[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+			}
+		}
+
+		ret = recvmmsg(s->ev.fd, msgs, CONFIG_UDP_BATCH_SIZE, 0, NULL);
+		if (ret == -1) {
+			if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+				return;
+			}
+
+			call_receive_handler(s, errno, s->receive_batch, 0);
+			return;
+		}
+
+		for (i = 0; i < (unsigned int)ret; i++) {
+			struct cio_datagram *datagram = &s->receive_batch[i];
+			datagram->length = msgs[i].msg_len;
+			datagram->peer_length = msgs[i].msg_hdr.msg_namelen;
+			datagram->truncated = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+			datagram->segment_size = 0;
+		}
+
+		if (s->gro) {
+			if (!deliver_segments(s, msgs, (unsigned int)ret)) {
+				return;
+			}
+		} else if (!call_receive_handler(s, cio_success, s->receive_batch, (unsigned int)ret)) {
+			return;
+		}
+
+		/*
+		 * A partial batch means the receive queue is drained. Datagrams
+		 * arriving later trigger a new edge.
+		 */
+		if ((ret < CONFIG_UDP_BATCH_SIZE) || (s->receive_handler == NULL)) {
+			return;
+		}
+	}
+}
+
+static void send_callback(void *context)
+{
+	struct cio_udp_socket *s = context;
+	struct mmsghdr msgs[CONFIG_UDP_BATCH_SIZE];
+	struct iovec iov[CONFIG_UDP_BATCH_SIZE];
+	uint8_t control[CONFIG_UDP_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+
+	if (unlikely(s->send_handler == NULL)) {
+		return;
+	}
+
+	while (s->send_done < s->send_count) {
+		unsigned int count = s->send_count - s->send_done;
+		unsigned int i;
+		int ret;
+
+		if (count > CONFIG_UDP_BATCH_SIZE) {
+			count = CONFIG_UDP_BATCH_SIZE;
+		}
+
+		memset(msgs, 0, count * sizeof(msgs[0]));
+		for (i = 0; i < count; i++) {
+			const struct cio_datagram *datagram = &s->send_datagrams[s->send_done + i];
+			iov[i].iov_base = datagram->buffer.address;
+			iov[i].iov_len = datagram->length;
+			if (datagram->peer_length != 0) {
+				msgs[i].msg_hdr.msg_name = (void *)(uintptr_t)&datagram->peer;
+				msgs[i].msg_hdr.msg_namelen = datagram->peer_length;
+			}
+
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+
+			if (datagram->segment_size != 0) {
+				struct cmsghdr *cmsg;
+
+				memset(control[i], 0, sizeof(control[i]));
+				msgs[i].msg_hdr.msg_control = control[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+				cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+				cmsg->cmsg_level = SOL_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				memcpy(CMSG_DATA(cmsg), &datagram->segment_size, sizeof(uint16_t));
+			}
+		}
+
+		ret = sendmmsg(s->ev.fd, msgs, count, 0);
+		if (ret == -1) {
+			if (likely((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+				if ((s->ev.registered_events & EPOLLOUT) == 0) {
+					enum cio_error err = cio_linux_eventloop_register_write(s->loop, &s->ev);
+					if (unlikely(err != cio_success)) {
+						complete_send(s, err);
+					}
+				}
+
+				return;
+			}
+
+			complete_send(s, errno);
+			return;
+		}
+
+		s->send_done += (unsigned int)ret;
+	}
+
+	complete_send(s, cio_success);
+}
+
+static enum cio_error socket_receive(void *context, const struct cio_buffer_allocator *allocator, size_t buffer_size, cio_udp_receive_handler handler, void *handler_context)
+{
+	struct cio_udp_socket *s = context;
+	enum cio_error err;
+	unsigned int i;
+
+	if (unlikely((handler == NULL) || (allocator == NULL) || (s->allocator != NULL))) {
+		return cio_invalid_argument;
+	}
+
+	if (unlikely(s->gro && (buffer_size < CONFIG_UDP_GRO_BUFFER_SIZE))) {
+		return cio_invalid_argument;
+	}
+
+	s->allocator = allocator;
+	for (i = 0; i < CONFIG_UDP_BATCH_SIZE; i++) {
+		s->receive_batch[i].buffer = allocator->alloc(allocator->context, buffer_size);
+		if (unlikely(s->receive_batch[i].buffer.address == NULL)) {
+			free_receive_batch(s);
+			return cio_not_enough_memory;
+		}
+	}
+
+	s->receive_buffer_size = buffer_size;
+	s->receive_handler = handler;
+	s->receive_handler_context = handler_context;
+	s->ev.read_callback = receive_callback;
+
+	/*
+	 * Registering the read event reports datagrams that are already
+	 * queued, so there is no need to try a receive right now.
+	 */
+	err = cio_linux_eventloop_register_read(s->loop, &s->ev);
+	if (unlikely(err != cio_success)) {
+		s->receive_handler = NULL;
+		free_receive_batch(s);
+		return err;
+	}
+
+	return cio_success;
+}
+
+static void socket_send(void *context, const struct cio_datagram *datagrams, unsigned int count, cio_udp_send_handler handler, void *handler_context)
+{
+	struct cio_udp_socket *s = context;
+
+	s->send_datagrams = datagrams;
+	s->send_count = count;
+	s->send_done = 0;
+	s->send_handler = handler;
+	s->send_handler_context = handler_context;
+	send_callback(s);
+}
+
+static enum cio_error socket_set_gro(void *context, bool on)
+{
+	struct cio_udp_socket *s = context;
+	int gro;
+	if (on) {
+		gro = 1;
+	} else {
+		gro = 0;
+	}
+
+	if (unlikely(on && (s->allocator != NULL) && (s->receive_buffer_size < CONFIG_UDP_GRO_BUFFER_SIZE))) {
+		return cio_invalid_argument;
+	}
+
+	if (unlikely(setsockopt(s->ev.fd, SOL_UDP, UDP_GRO, &gro, sizeof(gro)) < 0)) {
+		return errno;
+	}
+
+	s->gro = on;
+	return cio_success;
+}
+
+static enum cio_error socket_bind(void *context, const char *bind_address, uint16_t port)
+{
+	struct cio_udp_socket *s = context;
+	struct addrinfo hints;
+	char port_string[6];
+	struct addrinfo *servinfo;
+	struct addrinfo *rp;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE | AI_V4MAPPED | AI_NUMERICHOST;
+
+	snprintf(port_string, sizeof(port_string), "%d", port);
+
+	if (bind_address == NULL) {
+		bind_address = "::";
+	}
+
+	ret = getaddrinfo(bind_address, port_string, &hints, &servinfo);
+	if (ret != 0) {
+		switch (ret) {
+		case EAI_SYSTEM:
+			return errno;
+		default:
+			return cio_invalid_argument;
+		}
+	}
+
+	for (rp = servinfo; rp != NULL; rp = rp->ai_next) {
+		if (likely(bind(s->ev.fd, rp->ai_addr, rp->ai_addrlen) == 0)) {
+			break;
+		}
+	}
+
+	freeaddrinfo(servinfo);
+
+	if (rp == NULL) {
+		return cio_invalid_argument;
+	}
+
+	return cio_success;
+}
+
+static enum cio_error socket_bind_unix(void *context, const char *path)
+{
+	struct cio_udp_socket *s = context;
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+
+	enum cio_error err = fill_unix_address(&addr, &addrlen, path);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	if (unlikely(bind(s->ev.fd, (struct sockaddr *)&addr, addrlen) < 0)) {
+		return errno;
+	}
+
+	return cio_success;
+}
+
+static enum cio_error init_socket(struct cio_udp_socket *s, struct cio_eventloop *loop,
+                                  cio_udp_socket_close_hook close_hook, int domain)
+{
+	enum cio_error err;
+	unsigned int i;
+
+	int fd = socket(domain, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (unlikely(fd == -1)) {
+		return errno;
+	}
+
+	s->context = s;
+	s->bind = socket_bind;
+	s->bind_unix = socket_bind_unix;
+	s->receive = socket_receive;
+	s->send = socket_send;
+	s->set_gro = socket_set_gro;
+	s->close = socket_close;
+
+	s->loop = loop;
+	s->close_hook = close_hook;
+	s->allocator = NULL;
+	s->receive_handler = NULL;
+	s->receive_buffer_size = 0;
+	s->send_handler = NULL;
+	s->handler_depth = 0;
+	s->closed = false;
+	s->gro = false;
+	for (i = 0; i < CONFIG_UDP_BATCH_SIZE; i++) {
+		s->receive_batch[i].buffer.address = NULL;
+		s->receive_batch[i].buffer.size = 0;
+	}
+
+	s->ev.fd = fd;
+	s->ev.context = s;
+	s->ev.read_callback = receive_callback;
+	s->ev.write_callback = send_callback;
+	s->ev.error_callback = NULL;
+	err = cio_linux_eventloop_add(loop, &s->ev);
+	if (unlikely(err != cio_success)) {
+		close(fd);
+		return err;
+	}
+
+	return cio_success;
+}
+
+enum cio_error cio_udp_socket_init(struct cio_udp_socket *s, struct cio_eventloop *loop,
+                                   cio_udp_socket_close_hook close_hook)
+{
+	return init_socket(s, loop, close_hook, AF_INET6);
+}
+
+enum cio_error cio_udp_socket_init_unix(struct cio_udp_socket *s, struct cio_eventloop *loop,
+                                        cio_udp_socket_close_hook close_hook)
+{
+	return init_socket(s, loop, close_hook, AF_UNIX);
+}
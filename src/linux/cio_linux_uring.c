@@ -0,0 +1,1000 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include "cio_compiler.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_io_stream.h"
+#include "cio_socket.h"
+#include "cio_uring.h"
+#include "linux/cio_linux_alloc.h"
+#include "linux/cio_linux_socket.h"
+#include "linux/cio_linux_uring.h"
+
+/**
+ * @private
+ */
+#define CONFIG_URING_ENTRIES 256
+
+/**
+ * @private
+ */
+#define CONFIG_URING_BUFFER_SIZE 4096
+
+/**
+ * @private
+ * Must be a power of two.
+ */
+#define CONFIG_URING_BUFFER_COUNT 1024
+
+/*
+ * All receive buffers of a ring form a single buffer group.
+ */
+#define URING_BUFFER_GROUP 0
+#define URING_NO_BUFFER 0xffff
+
+/*
+ * The low bits of the user data of an operation tell which operation
+ * of a stream completed. Cancel operations carry no user data, their
+ * completions are ignored.
+ */
+#define URING_OP_RECEIVE 1U
+#define URING_OP_SEND 2U
+#define URING_OP_MASK 3U
+
+/*
+ * The state of a socket that uses the data path of a ring. It is
+ * allocated separately, because it must outlive the socket until the
+ * kernel completed all operations referring to it.
+ */
+struct cio_uring_stream {
+	struct cio_socket *s;
+	struct cio_uring *ring;
+	struct cio_uring_stream *next_stalled;
+	struct msghdr msg;
+	enum cio_error error;
+	uint32_t offset;
+	unsigned int in_flight;
+	uint16_t head;
+	uint16_t tail;
+	bool receiving;
+	bool stalled;
+	bool eof;
+	bool delivering;
+	bool closing;
+	bool send_timed_out;
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static bool reap(struct cio_uring *ring);
+
+static bool cq_overflowed(const struct cio_uring *ring)
+{
+	return (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) != 0;
+}
+
+static void submit_entries(struct cio_uring *ring)
+{
+	unsigned int to_submit;
+	int ret;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (to_submit == 0) {
+		return;
+	}
+
+	ret = io_uring_enter(ring->ev.fd, to_submit, 0);
+	if (unlikely(ret < 0)) {
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+			cio_linux_eventloop_defer(ring->loop, &ring->submit);
+		}
+
+		return;
+	}
+
+	if ((unsigned int)ret < to_submit) {
+		cio_linux_eventloop_defer(ring->loop, &ring->submit);
+	}
+}
+
+/*
+ * The kernel refuses new submissions with EBUSY as long as completions
+ * wait in its overflow list, so they are reaped first. This is only done
+ * here, at the end of a loop iteration, and not when the submission queue
+ * ran full, to not call handlers from within a read or write request.
+ */
+static void submit(void *context)
+{
+	struct cio_uring *ring = context;
+
+	if (unlikely(cq_overflowed(ring) && !ring->reaping)) {
+		if (!reap(ring)) {
+			return;
+		}
+	}
+
+	submit_entries(ring);
+}
+
+/*
+ * Entries are submitted at the end of the loop iteration. Only if the
+ * submission queue is full, the queued entries are submitted right away.
+ */
+static struct io_uring_sqe *get_sqe(struct cio_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int index;
+
+	if ((ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->sq_entries) {
+		submit_entries(ring);
+		if ((ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->sq_entries) {
+			return NULL;
+		}
+	}
+
+	index = ring->sqe_tail & ring->sq_mask;
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	ring->sqe_tail++;
+	cio_linux_eventloop_defer(ring->loop, &ring->submit);
+	return sqe;
+}
+
+static uint8_t *buffer_address(const struct cio_uring *ring, uint16_t bid)
+{
+	return ring->buffers + ((size_t)bid * ring->buffer_size);
+}
+
+static void recycle_buffer(struct cio_uring *ring, uint16_t bid)
+{
+	struct io_uring_buf *buf = &ring->buffer_ring->bufs[ring->buffer_tail & (ring->buffer_count - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)buffer_address(ring, bid);
+	buf->len = (uint32_t)ring->buffer_size;
+	buf->bid = bid;
+	ring->buffers_held--;
+	ring->buffer_tail++;
+	__atomic_store_n(&ring->buffer_ring->tail, ring->buffer_tail, __ATOMIC_RELEASE);
+}
+
+static void recycle_received(struct cio_uring_stream *st)
+{
+	while (st->head != URING_NO_BUFFER) {
+		uint16_t bid = st->head;
+		st->head = st->ring->buffer_next[bid];
+		recycle_buffer(st->ring, bid);
+	}
+
+	st->tail = URING_NO_BUFFER;
+	st->offset = 0;
+}
+
+static void prepare_receive(struct cio_uring_stream *st, struct io_uring_sqe *sqe)
+{
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = st->s->ev.fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = (uint64_t)(uintptr_t)st | URING_OP_RECEIVE;
+	st->receiving = true;
+	st->in_flight++;
+}
+
+static void start_receive(struct cio_uring_stream *st)
+{
+	struct io_uring_sqe *sqe = get_sqe(st->ring);
+	if (unlikely(sqe == NULL)) {
+		st->error = cio_no_buffer_space;
+		return;
+	}
+
+	prepare_receive(st, sqe);
+}
+
+/*
+ * A receive that ran out of buffers is restarted as soon as any stream
+ * of the ring returned buffers.
+ */
+static void resume_stalled(struct cio_uring *ring)
+{
+	struct cio_uring_stream *st = ring->stalled;
+
+	ring->stalled = NULL;
+	while (st != NULL) {
+		struct cio_uring_stream *next = st->next_stalled;
+		st->next_stalled = NULL;
+		st->stalled = false;
+		start_receive(st);
+		st = next;
+	}
+}
+
+static void remove_stalled(struct cio_uring_stream *st)
+{
+	struct cio_uring_stream **pp = &st->ring->stalled;
+
+	while (*pp != NULL) {
+		if (*pp == st) {
+			*pp = st->next_stalled;
+			break;
+		}
+
+		pp = &(*pp)->next_stalled;
+	}
+
+	st->next_stalled = NULL;
+	st->stalled = false;
+}
+
+static size_t copy_received(struct cio_uring_stream *st, const struct iovec *iov, unsigned int iovcnt)
+{
+	struct cio_uring *ring = st->ring;
+	size_t copied = 0;
+	size_t iov_offset = 0;
+	unsigned int i = 0;
+	bool recycled = false;
+
+	while ((st->head != URING_NO_BUFFER) && (i < iovcnt)) {
+		uint16_t bid = st->head;
+		size_t available = ring->buffer_lengths[bid] - st->offset;
+		size_t n = iov[i].iov_len - iov_offset;
+
+		if (n > available) {
+			n = available;
+		}
+
+		memcpy((uint8_t *)iov[i].iov_base + iov_offset, buffer_address(ring, bid) + st->offset, n);
+		copied += n;
+		iov_offset += n;
+		st->offset += (uint32_t)n;
+		if (st->offset == ring->buffer_lengths[bid]) {
+			st->head = ring->buffer_next[bid];
+			st->offset = 0;
+			if (st->head == URING_NO_BUFFER) {
+				st->tail = URING_NO_BUFFER;
+			}
+
+			recycle_buffer(ring, bid);
+			recycled = true;
+		}
+
+		if (iov_offset == iov[i].iov_len) {
+			i++;
+			iov_offset = 0;
+		}
+	}
+
+	if (recycled && (ring->stalled != NULL)) {
+		resume_stalled(ring);
+	}
+
+	return copied;
+}
+
+static bool read_pending(const struct cio_socket *s)
+{
+	return (s->stream.read_handler != NULL) || (s->stream.readv_handler != NULL);
+}
+
+static void complete_read(struct cio_socket *s, enum cio_error err, size_t bytes_transferred)
+{
+	cio_stream_read_handler handler = s->stream.read_handler;
+	cio_stream_readv_handler readv_handler = s->stream.readv_handler;
+	s->stream.read_handler = NULL;
+	s->stream.readv_handler = NULL;
+	s->stream.read_allocator = NULL;
+	cio_linux_socket_read_completed(s, bytes_transferred);
+
+	if (readv_handler != NULL) {
+		readv_handler(s->stream.read_handler_context, err, s->stream.read_iov, s->stream.read_iovcnt, bytes_transferred);
+	} else {
+		handler(s->stream.read_handler_context, err, s->stream.read_buffer, bytes_transferred);
+	}
+}
+
+static void serve_read(struct cio_uring_stream *st)
+{
+	struct cio_socket *s = st->s;
+	const struct cio_buffer_allocator *allocator = s->stream.read_allocator;
+	struct iovec iov;
+
+	if (s->stream.readv_handler != NULL) {
+		complete_read(s, cio_success, copy_received(st, s->stream.read_iov, s->stream.read_iovcnt));
+		return;
+	}
+
+	if (allocator == NULL) {
+		iov.iov_base = s->stream.read_buffer;
+		iov.iov_len = s->stream.read_count;
+	} else {
+		struct cio_buffer buffer = allocator->alloc(allocator->context, s->stream.read_count);
+		if (unlikely(buffer.address == NULL)) {
+			complete_read(s, cio_not_enough_memory, 0);
+			return;
+		}
+
+		s->stream.read_buffer = buffer.address;
+		iov.iov_base = buffer.address;
+		iov.iov_len = buffer.size;
+	}
+
+	complete_read(s, cio_success, copy_received(st, &iov, 1));
+}
+
+static void release_stream(struct cio_uring_stream *st)
+{
+	struct cio_socket *s = st->s;
+
+	recycle_received(st);
+	cio_free(st);
+	if (s->close_hook != NULL) {
+		s->close_hook(s);
+	}
+}
+
+/*
+ * Serves read requests from the received buffers. Handlers issuing a
+ * new read from within their callback are served by this loop instead
+ * of recursing.
+ */
+static void deliver(struct cio_uring_stream *st)
+{
+	struct cio_socket *s = st->s;
+
+	if (st->delivering) {
+		return;
+	}
+
+	st->delivering = true;
+	while (read_pending(s) && ((st->head != URING_NO_BUFFER) || st->eof || (st->error != cio_success))) {
+		if (st->head != URING_NO_BUFFER) {
+			serve_read(st);
+		} else {
+			complete_read(s, st->error, 0);
+		}
+
+		if (unlikely(st->closing)) {
+			st->delivering = false;
+			if (st->in_flight == 0) {
+				release_stream(st);
+			}
+
+			return;
+		}
+	}
+
+	st->delivering = false;
+}
+
+static void handle_receive(struct cio_uring_stream *st, int res, uint32_t flags)
+{
+	if ((flags & IORING_CQE_F_MORE) == 0) {
+		st->receiving = false;
+		st->in_flight--;
+	}
+
+	if (unlikely(st->closing)) {
+		if ((flags & IORING_CQE_F_BUFFER) != 0) {
+			st->ring->buffers_held++;
+			recycle_buffer(st->ring, (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT));
+		}
+
+		if ((st->in_flight == 0) && !st->delivering) {
+			release_stream(st);
+		}
+
+		return;
+	}
+
+	if (res > 0) {
+		uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+		cio_linux_socket_touch_idle(st->s);
+		st->ring->buffers_held++;
+		st->ring->buffer_lengths[bid] = (uint32_t)res;
+		st->ring->buffer_next[bid] = URING_NO_BUFFER;
+		if (st->tail == URING_NO_BUFFER) {
+			st->head = bid;
+		} else {
+			st->ring->buffer_next[st->tail] = bid;
+		}
+
+		st->tail = bid;
+	} else if (res == 0) {
+		st->eof = true;
+	} else if (res == -ENOBUFS) {
+		/*
+		 * If buffers were returned in the meantime, the receive is
+		 * restarted right away. Otherwise it waits until a stream of
+		 * the ring returns a buffer.
+		 */
+		if (st->ring->buffers_held == st->ring->buffer_count) {
+			st->stalled = true;
+			st->next_stalled = st->ring->stalled;
+			st->ring->stalled = st;
+		}
+	} else {
+		st->error = (enum cio_error)(-res);
+	}
+
+	if (!st->receiving && !st->stalled && !st->eof && (st->error == cio_success)) {
+		start_receive(st);
+	}
+
+	deliver(st);
+}
+
+static void handle_send(struct cio_uring_stream *st, int res)
+{
+	struct cio_socket *s = st->s;
+	cio_stream_write_handler handler;
+	bool timed_out = st->send_timed_out;
+	enum cio_error err = cio_success;
+	size_t sent = 0;
+
+	st->in_flight--;
+	st->send_timed_out = false;
+	if (unlikely(st->closing)) {
+		if ((st->in_flight == 0) && !st->delivering) {
+			release_stream(st);
+		}
+
+		return;
+	}
+
+	handler = s->stream.write_handler;
+	if (unlikely(handler == NULL)) {
+		return;
+	}
+
+	s->stream.write_handler = NULL;
+	if (res >= 0) {
+		sent = (size_t)res;
+	} else if (timed_out) {
+		err = cio_timed_out;
+	} else {
+		err = (enum cio_error)(-res);
+	}
+
+	cio_linux_socket_write_completed(s, sent);
+	handler(s->stream.write_handler_context, err, sent);
+}
+
+static void release_ring(struct cio_uring *ring);
+
+/*
+ * Completions are handled until the completion queue is empty. If the
+ * queue overflowed, the kernel keeps the surplus completions in a list
+ * and moves them to the queue when asked to, then they are handled as
+ * well. If a handler closes the ring, it is released only after the
+ * loop was left. Returns false in this case.
+ */
+static bool reap(struct cio_uring *ring)
+{
+	unsigned int head = *ring->cq_head;
+
+	ring->reaping = true;
+	while (!ring->closed) {
+		const struct io_uring_cqe *cqe;
+		uint64_t user_data;
+		int res;
+		uint32_t flags;
+		struct cio_uring_stream *st;
+
+		if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			if (likely(!cq_overflowed(ring))) {
+				break;
+			}
+
+			if (unlikely((io_uring_enter(ring->ev.fd, 0, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR))) {
+				break;
+			}
+
+			continue;
+		}
+
+		cqe = &ring->cqes[head & ring->cq_mask];
+		user_data = cqe->user_data;
+		res = cqe->res;
+		flags = cqe->flags;
+		st = (struct cio_uring_stream *)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+
+		head++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+		switch (user_data & URING_OP_MASK) {
+		case URING_OP_RECEIVE:
+			handle_receive(st, res, flags);
+			break;
+
+		case URING_OP_SEND:
+			handle_send(st, res);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	ring->reaping = false;
+	if (unlikely(ring->closed)) {
+		release_ring(ring);
+		return false;
+	}
+
+	return true;
+}
+
+static void ring_readable(void *context)
+{
+	struct cio_uring *ring = context;
+	reap(ring);
+}
+
+static void start_send(struct cio_socket *s, const struct iovec *iov, unsigned int iovcnt, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_uring_stream *st = s->ext->uring;
+	struct io_uring_sqe *sqe = get_sqe(st->ring);
+
+	if (unlikely(sqe == NULL)) {
+		handler(handler_context, cio_no_buffer_space, 0);
+		return;
+	}
+
+	s->stream.write_handler = handler;
+	s->stream.write_handler_context = handler_context;
+
+	sqe->fd = s->ev.fd;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uint64_t)(uintptr_t)st | URING_OP_SEND;
+	if (iovcnt == 1) {
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (uint64_t)(uintptr_t)iov->iov_base;
+		sqe->len = (uint32_t)iov->iov_len;
+	} else {
+		memset(&st->msg, 0, sizeof(st->msg));
+		st->msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+		st->msg.msg_iovlen = iovcnt;
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = (uint64_t)(uintptr_t)&st->msg;
+		sqe->len = 1;
+	}
+
+	st->in_flight++;
+	cio_linux_socket_write_started(s);
+}
+
+static void stream_read(void *context, void *buf, size_t count, cio_stream_read_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	s->stream.read_buffer = buf;
+	s->stream.read_count = count;
+	s->stream.read_handler = handler;
+	s->stream.read_handler_context = handler_context;
+	cio_linux_socket_read_started(s);
+	deliver(s->ext->uring);
+}
+
+static void stream_readv(void *context, struct iovec *iov, unsigned int iovcnt, cio_stream_readv_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	s->stream.read_iov = iov;
+	s->stream.read_iovcnt = iovcnt;
+	s->stream.readv_handler = handler;
+	s->stream.read_handler_context = handler_context;
+	cio_linux_socket_read_started(s);
+	deliver(s->ext->uring);
+}
+
+static void stream_read_allocated(void *context, const struct cio_buffer_allocator *allocator, size_t size, cio_stream_read_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	s->stream.read_allocator = allocator;
+	s->stream.read_buffer = NULL;
+	s->stream.read_count = size;
+	s->stream.read_handler = handler;
+	s->stream.read_handler_context = handler_context;
+	cio_linux_socket_read_started(s);
+	deliver(s->ext->uring);
+}
+
+static void stream_write(void *context, const void *buf, size_t count, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	s->stream.write_buffer.iov_base = (void *)(uintptr_t)buf;
+	s->stream.write_buffer.iov_len = count;
+	start_send(s, &s->stream.write_buffer, 1, handler, handler_context);
+}
+
+static void stream_writev(void *context, const struct iovec *iov, unsigned int iovcnt, cio_stream_write_handler handler, void *handler_context)
+{
+	struct cio_socket *s = context;
+	start_send(s, iov, iovcnt, handler, handler_context);
+}
+
+static void stream_close(void *context)
+{
+	struct cio_socket *s = context;
+	s->ops->close(s);
+}
+
+static const struct cio_io_stream_ops uring_stream_ops = {
+	.read_some = stream_read,
+	.write_some = stream_write,
+	.readv_some = stream_readv,
+	.read_some_allocated = stream_read_allocated,
+	.writev_some = stream_writev,
+	.close = stream_close,
+};
+
+enum cio_error cio_linux_uring_attach(struct cio_uring *ring, struct cio_socket *s)
+{
+	struct io_uring_sqe *sqe;
+	struct cio_uring_stream *st = cio_malloc(sizeof(*st));
+	if (unlikely(st == NULL)) {
+		return cio_not_enough_memory;
+	}
+
+	/*
+	 * The socket is switched only once the receive is certain to be
+	 * submitted, otherwise it stays on the epoll data path.
+	 */
+	sqe = get_sqe(ring);
+	if (unlikely(sqe == NULL)) {
+		cio_free(st);
+		return cio_no_buffer_space;
+	}
+
+	st->s = s;
+	st->ring = ring;
+	st->next_stalled = NULL;
+	st->error = cio_success;
+	st->offset = 0;
+	st->in_flight = 0;
+	st->head = URING_NO_BUFFER;
+	st->tail = URING_NO_BUFFER;
+	st->receiving = false;
+	st->stalled = false;
+	st->eof = false;
+	st->delivering = false;
+	st->closing = false;
+	st->send_timed_out = false;
+
+	/*
+	 * The epoll notifier of the socket stays in place for everything
+	 * else, it just doesn't report incoming data anymore.
+	 */
+	cio_linux_eventloop_unregister_read(s->loop, &s->ev);
+	s->ext->uring = st;
+	s->stream.ops = &uring_stream_ops;
+	prepare_receive(st, sqe);
+	return cio_success;
+}
+
+bool cio_linux_uring_detach(struct cio_uring_stream *st)
+{
+	struct io_uring_sqe *sqe;
+
+	st->closing = true;
+	recycle_received(st);
+	if (st->stalled) {
+		remove_stalled(st);
+	}
+
+	if (st->receiving) {
+		sqe = get_sqe(st->ring);
+		if (likely(sqe != NULL)) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = (uint64_t)(uintptr_t)st | URING_OP_RECEIVE;
+		}
+	}
+
+	if ((st->in_flight > 0) || st->delivering) {
+		return true;
+	}
+
+	cio_free(st);
+	return false;
+}
+
+void cio_linux_uring_cancel_send(struct cio_uring_stream *st)
+{
+	struct io_uring_sqe *sqe = get_sqe(st->ring);
+
+	st->send_timed_out = true;
+	if (likely(sqe != NULL)) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uint64_t)(uintptr_t)st | URING_OP_SEND;
+	}
+}
+
+static void unmap_rings(const struct cio_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+
+	munmap(ring->sq_ring, ring->sq_ring_size);
+}
+
+static void free_buffers(const struct cio_uring *ring)
+{
+	cio_free(ring->buffers);
+	cio_free(ring->buffer_next);
+	cio_free(ring->buffer_lengths);
+	munmap(ring->buffer_ring, ring->buffer_ring_size);
+}
+
+static void release_ring(struct cio_uring *ring)
+{
+	close(ring->ev.fd);
+	unmap_rings(ring);
+	free_buffers(ring);
+
+	if (ring->close_hook != NULL) {
+		ring->close_hook(ring);
+	}
+}
+
+static void uring_close(void *context)
+{
+	struct cio_uring *ring = context;
+
+	cio_linux_eventloop_cancel_deferred(ring->loop, &ring->submit);
+	cio_linux_eventloop_remove(ring->loop, &ring->ev);
+	ring->closed = true;
+	if (!ring->reaping) {
+		release_ring(ring);
+	}
+}
+
+static enum cio_error map_rings(struct cio_uring *ring, const struct io_uring_params *params)
+{
+	uint8_t *sq;
+	uint8_t *cq;
+
+	ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+	if ((params->features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ev.fd, IORING_OFF_SQ_RING);
+	if (unlikely(ring->sq_ring == MAP_FAILED)) {
+		return (enum cio_error)errno;
+	}
+
+	ring->cq_ring = ring->sq_ring;
+	if ((params->features & IORING_FEAT_SINGLE_MMAP) == 0) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ev.fd, IORING_OFF_CQ_RING);
+		if (unlikely(ring->cq_ring == MAP_FAILED)) {
+			enum cio_error err = (enum cio_error)errno;
+			munmap(ring->sq_ring, ring->sq_ring_size);
+			return err;
+		}
+	}
+
+	ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ev.fd, IORING_OFF_SQES);
+	if (unlikely(ring->sqes == MAP_FAILED)) {
+		enum cio_error err = (enum cio_error)errno;
+		if (ring->cq_ring != ring->sq_ring) {
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		return err;
+	}
+
+	sq = ring->sq_ring;
+	cq = ring->cq_ring;
+	ring->sq_head = (unsigned int *)(void *)(sq + params->sq_off.head);
+	ring->sq_tail = (unsigned int *)(void *)(sq + params->sq_off.tail);
+	ring->sq_array = (unsigned int *)(void *)(sq + params->sq_off.array);
+	ring->sq_flags = (unsigned int *)(void *)(sq + params->sq_off.flags);
+	ring->sq_mask = *(unsigned int *)(void *)(sq + params->sq_off.ring_mask);
+	ring->sq_entries = params->sq_entries;
+	ring->sqe_tail = *ring->sq_tail;
+	ring->cq_head = (unsigned int *)(void *)(cq + params->cq_off.head);
+	ring->cq_tail = (unsigned int *)(void *)(cq + params->cq_off.tail);
+	ring->cq_mask = *(unsigned int *)(void *)(cq + params->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(void *)(cq + params->cq_off.cqes);
+	return cio_success;
+}
+
+/*
+ * Registers the receive buffers with the kernel. The kernel picks a
+ * buffer only when data arrived, so idle connections don't hold one.
+ */
+static enum cio_error setup_buffers(struct cio_uring *ring)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+
+	ring->buffer_ring_size = ring->buffer_count * sizeof(struct io_uring_buf);
+	ring->buffer_ring = mmap(NULL, ring->buffer_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (unlikely(ring->buffer_ring == MAP_FAILED)) {
+		return (enum cio_error)errno;
+	}
+
+	ring->buffers = cio_malloc(ring->buffer_count * ring->buffer_size);
+	ring->buffer_next = cio_malloc(ring->buffer_count * sizeof(*ring->buffer_next));
+	ring->buffer_lengths = cio_malloc(ring->buffer_count * sizeof(*ring->buffer_lengths));
+	if (unlikely((ring->buffers == NULL) || (ring->buffer_next == NULL) || (ring->buffer_lengths == NULL))) {
+		free_buffers(ring);
+		return cio_not_enough_memory;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->buffer_ring;
+	reg.ring_entries = ring->buffer_count;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (unlikely(io_uring_register(ring->ev.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)) {
+		enum cio_error err = (enum cio_error)errno;
+		free_buffers(ring);
+		return err;
+	}
+
+	/*
+	 * Initially, all buffers are handed over to the kernel as if they
+	 * were returned by a stream.
+	 */
+	ring->buffers_held = ring->buffer_count;
+	ring->buffer_tail = 0;
+	for (i = 0; i < ring->buffer_count; i++) {
+		recycle_buffer(ring, (uint16_t)i);
+	}
+
+	return cio_success;
+}
+
+static enum cio_error setup_ring(struct cio_uring *ring, const struct io_uring_params *params)
+{
+	enum cio_error err = map_rings(ring, params);
+	if (unlikely(err != cio_success)) {
+		return err;
+	}
+
+	err = setup_buffers(ring);
+	if (unlikely(err != cio_success)) {
+		unmap_rings(ring);
+		return err;
+	}
+
+	err = cio_linux_eventloop_add(ring->loop, &ring->ev);
+	if (unlikely(err != cio_success)) {
+		free_buffers(ring);
+		unmap_rings(ring);
+		return err;
+	}
+
+	err = cio_linux_eventloop_register_read(ring->loop, &ring->ev);
+	if (unlikely(err != cio_success)) {
+		cio_linux_eventloop_remove(ring->loop, &ring->ev);
+		free_buffers(ring);
+		unmap_rings(ring);
+		return err;
+	}
+
+	return cio_success;
+}
+
+enum cio_error cio_uring_init(struct cio_uring *ring, struct cio_eventloop *loop,
+                              unsigned int entries, size_t buffer_size, unsigned int buffer_count,
+                              cio_uring_close_hook close_hook)
+{
+	struct io_uring_params params;
+	enum cio_error err;
+	int fd;
+
+	if (entries == 0) {
+		entries = CONFIG_URING_ENTRIES;
+	}
+
+	if (buffer_size == 0) {
+		buffer_size = CONFIG_URING_BUFFER_SIZE;
+	}
+
+	if (buffer_count == 0) {
+		buffer_count = CONFIG_URING_BUFFER_COUNT;
+	}
+
+	if (((buffer_count & (buffer_count - 1)) != 0) || (buffer_count > 32768) || (buffer_size > UINT32_MAX)) {
+		return cio_invalid_argument;
+	}
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CLAMP;
+	fd = io_uring_setup(entries, &params);
+	if (unlikely(fd == -1)) {
+		return (enum cio_error)errno;
+	}
+
+	ring->context = ring;
+	ring->close = uring_close;
+	ring->close_hook = close_hook;
+	ring->loop = loop;
+	ring->stalled = NULL;
+	ring->reaping = false;
+	ring->closed = false;
+	ring->buffer_size = buffer_size;
+	ring->buffer_count = buffer_count;
+
+	ring->submit.callback = submit;
+	ring->submit.context = ring;
+	ring->submit.next = NULL;
+	ring->submit.pprev = NULL;
+
+	ring->ev.fd = fd;
+	ring->ev.read_callback = ring_readable;
+	ring->ev.write_callback = NULL;
+	ring->ev.error_callback = NULL;
+	ring->ev.context = ring;
+
+	err = setup_ring(ring, &params);
+	if (unlikely(err != cio_success)) {
+		close(fd);
+	}
+
+	return err;
+}
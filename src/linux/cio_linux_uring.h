@@ -0,0 +1,64 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef CIO_LINUX_URING_H
+#define CIO_LINUX_URING_H
+
+#include <stdbool.h>
+
+#include "cio_error_code.h"
+#include "cio_socket.h"
+#include "cio_uring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Switches the I/O stream of a socket to the data path of the ring.
+ */
+enum cio_error cio_linux_uring_attach(struct cio_uring *ring, struct cio_socket *s);
+
+/*
+ * Detaches the stream of a closing socket from its ring. Returns true if
+ * operations are still in flight. The ring calls the close hook of the
+ * socket once the kernel released them.
+ */
+bool cio_linux_uring_detach(struct cio_uring_stream *st);
+
+/*
+ * Cancels the send of a timed out write. The write handler is called
+ * with cio_timed_out once the kernel returned the buffer, or with the
+ * result of the send if it completed in the meantime.
+ */
+void cio_linux_uring_cancel_send(struct cio_uring_stream *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
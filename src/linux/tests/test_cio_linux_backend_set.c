@@ -0,0 +1,260 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_backend_set.h"
+#include "cio_eventloop.h"
+#include "cio_linux_alloc.h"
+#include "cio_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+FAKE_VALUE_FUNC(uint64_t, cio_linux_eventloop_get_time_ns, const struct cio_eventloop *)
+
+FAKE_VALUE_FUNC(void *, cio_malloc, size_t)
+FAKE_VOID_FUNC(cio_free, void *)
+
+static uint64_t now_ns;
+
+static uint64_t get_now(const struct cio_eventloop *loop)
+{
+	(void)loop;
+	return now_ns;
+}
+
+static struct cio_eventloop loop;
+static struct cio_backend_set set;
+static struct cio_backend backends[3];
+static struct cio_socket sockets[3];
+
+void setUp(void)
+{
+	FFF_RESET_HISTORY();
+	RESET_FAKE(cio_linux_eventloop_get_time_ns);
+	cio_linux_eventloop_get_time_ns_fake.custom_fake = get_now;
+	RESET_FAKE(cio_malloc);
+	cio_malloc_fake.custom_fake = malloc;
+	RESET_FAKE(cio_free);
+	cio_free_fake.custom_fake = free;
+	now_ns = 1000000000ULL;
+
+	TEST_ASSERT_EQUAL(cio_success, cio_backend_set_init(&set, &loop, 3, 5000000000ULL));
+}
+
+void tearDown(void)
+{
+	set.close(set.context);
+}
+
+static void add_members(unsigned int num)
+{
+	unsigned int i;
+	for (i = 0; i < num; i++) {
+		TEST_ASSERT_EQUAL(cio_success, set.add(set.context, &backends[i], &sockets[i]));
+	}
+}
+
+static void complete_after(struct cio_backend_request *request, uint64_t latency_ns, enum cio_error err)
+{
+	now_ns += latency_ns;
+	set.complete(set.context, request, err);
+}
+
+static void test_init_without_members(void)
+{
+	struct cio_backend_set s;
+	TEST_ASSERT_EQUAL(cio_invalid_argument, cio_backend_set_init(&s, &loop, 0, 0));
+}
+
+static void test_init_no_memory(void)
+{
+	struct cio_backend_set s;
+	cio_malloc_fake.custom_fake = NULL;
+	cio_malloc_fake.return_val = NULL;
+	TEST_ASSERT_EQUAL(cio_not_enough_memory, cio_backend_set_init(&s, &loop, 3, 0));
+}
+
+static void test_select_from_empty_set(void)
+{
+	struct cio_backend_request request;
+	TEST_ASSERT_EQUAL(cio_address_not_available, set.select(set.context, &request));
+}
+
+static void test_add_too_many_members(void)
+{
+	struct cio_backend extra;
+	struct cio_socket extra_socket;
+
+	add_members(3);
+	TEST_ASSERT_EQUAL(cio_no_buffer_space, set.add(set.context, &extra, &extra_socket));
+}
+
+static void test_select_single_member(void)
+{
+	struct cio_backend_request request;
+
+	add_members(1);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &request));
+	TEST_ASSERT_EQUAL_PTR(&backends[0], request.backend);
+	TEST_ASSERT_EQUAL_PTR(&sockets[0], request.socket);
+}
+
+static void test_select_least_outstanding(void)
+{
+	struct cio_backend_request first;
+	struct cio_backend_request second;
+	struct cio_backend_request third;
+
+	add_members(2);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &first));
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &second));
+	TEST_ASSERT_NOT_EQUAL(first.backend, second.backend);
+
+	complete_after(&first, 1000000, cio_success);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &third));
+	TEST_ASSERT_EQUAL_PTR(first.backend, third.backend);
+}
+
+static void test_select_lowest_latency(void)
+{
+	unsigned int i;
+
+	add_members(2);
+	for (i = 0; i < 20; i++) {
+		struct cio_backend_request r;
+		TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &r));
+		complete_after(&r, (r.backend == &backends[0]) ? 100000000 : 1000000, cio_success);
+	}
+
+	for (i = 0; i < 10; i++) {
+		struct cio_backend_request r;
+		TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &r));
+		TEST_ASSERT_EQUAL_PTR(&backends[1], r.backend);
+		complete_after(&r, 1000000, cio_success);
+	}
+}
+
+static void test_failed_member_ejected(void)
+{
+	struct cio_backend_request request;
+	struct cio_backend *failed;
+	unsigned int i;
+
+	add_members(3);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &request));
+	failed = request.backend;
+	complete_after(&request, 1000000, cio_input_output_error);
+
+	for (i = 0; i < 20; i++) {
+		struct cio_backend_request r;
+		TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &r));
+		TEST_ASSERT_NOT_EQUAL(failed, r.backend);
+		complete_after(&r, 1000, cio_success);
+	}
+
+	now_ns += 5000000000ULL;
+	for (i = 0; i < 20; i++) {
+		struct cio_backend_request r;
+		TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &r));
+		if (r.backend == failed) {
+			complete_after(&r, 0, cio_success);
+			return;
+		}
+
+		complete_after(&r, 0, cio_success);
+	}
+
+	TEST_FAIL_MESSAGE("Reinstated member was never selected!");
+}
+
+static void test_aborted_request_does_not_eject(void)
+{
+	struct cio_backend_request request;
+
+	add_members(2);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &request));
+	complete_after(&request, 0, cio_operation_aborted);
+	TEST_ASSERT_EQUAL(2, set.num_healthy);
+	TEST_ASSERT_EQUAL(0, request.backend->outstanding);
+}
+
+static void test_all_members_ejected(void)
+{
+	struct cio_backend_request request;
+
+	add_members(2);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &request));
+	complete_after(&request, 0, cio_timed_out);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &request));
+	complete_after(&request, 0, cio_timed_out);
+	TEST_ASSERT_EQUAL(0, set.num_healthy);
+
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &request));
+	TEST_ASSERT_NOT_NULL(request.backend);
+}
+
+static void test_removed_member_not_selected(void)
+{
+	struct cio_backend_request pending;
+	unsigned int i;
+
+	add_members(3);
+	TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &pending));
+	set.remove(set.context, pending.backend);
+
+	for (i = 0; i < 20; i++) {
+		struct cio_backend_request r;
+		TEST_ASSERT_EQUAL(cio_success, set.select(set.context, &r));
+		TEST_ASSERT_NOT_EQUAL(pending.backend, r.backend);
+		complete_after(&r, 1000, cio_success);
+	}
+
+	complete_after(&pending, 1000, cio_input_output_error);
+	TEST_ASSERT_EQUAL(0, pending.backend->outstanding);
+	TEST_ASSERT_EQUAL(2, set.num_healthy);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_init_without_members);
+	RUN_TEST(test_init_no_memory);
+	RUN_TEST(test_select_from_empty_set);
+	RUN_TEST(test_add_too_many_members);
+	RUN_TEST(test_select_single_member);
+	RUN_TEST(test_select_least_outstanding);
+	RUN_TEST(test_select_lowest_latency);
+	RUN_TEST(test_failed_member_ejected);
+	RUN_TEST(test_aborted_request_does_not_eject);
+	RUN_TEST(test_all_members_ejected);
+	RUN_TEST(test_removed_member_not_selected);
+	return UNITY_END();
+}
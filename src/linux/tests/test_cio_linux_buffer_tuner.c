@@ -0,0 +1,321 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <linux/tcp.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_buffer_tuner.h"
+#include "cio_eventloop.h"
+#include "cio_linux_buffer_tuner.h"
+#include "cio_linux_socket.h"
+#include "cio_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+FAKE_VALUE_FUNC(uint64_t, cio_linux_eventloop_get_time_ns, const struct cio_eventloop *)
+FAKE_VOID_FUNC(cio_linux_eventloop_arm_deadline, struct cio_eventloop *, struct cio_linux_deadline *, uint64_t)
+FAKE_VOID_FUNC(cio_linux_eventloop_disarm_deadline, struct cio_eventloop *, struct cio_linux_deadline *)
+FAKE_VALUE_FUNC(int, getsockopt, int, int, int, void *, socklen_t *)
+FAKE_VALUE_FUNC(enum cio_error, set_buffer_size, int, int, size_t)
+
+#define MIN_BUFFER_SIZE 4096
+#define MAX_BUFFER_SIZE (4 * 1024 * 1024)
+
+static struct tcp_info tcp_info;
+static size_t receive_size;
+static size_t send_size;
+static size_t kernel_max_size;
+static size_t kernel_min_size;
+
+static struct cio_eventloop loop;
+static struct cio_buffer_tuner tuner;
+static struct cio_socket sockets[2];
+static struct cio_socket_ext exts[2];
+
+static int getsockopt_fake_kernel(int fd, int level, int option_name, void *option_value, socklen_t *option_len)
+{
+	(void)fd;
+	if (level == SOL_SOCKET) {
+		int size;
+		if (option_name == SO_RCVBUF) {
+			size = (int)receive_size;
+		} else {
+			size = (int)send_size;
+		}
+
+		memcpy(option_value, &size, sizeof(size));
+		*option_len = sizeof(size);
+		return 0;
+	}
+
+	memcpy(option_value, &tcp_info, sizeof(tcp_info));
+	*option_len = sizeof(tcp_info);
+	return 0;
+}
+
+/*
+ * Behaves like the kernel, which doubles the requested size, caps it and
+ * rounds it up to its minimum. receive_size and send_size are the sizes
+ * the kernel reserved.
+ */
+static enum cio_error set_buffer_size_capture(int fd, int option, size_t size)
+{
+	(void)fd;
+	size *= 2;
+	if ((kernel_max_size != 0) && (size > kernel_max_size)) {
+		size = kernel_max_size;
+	}
+
+	if (size < kernel_min_size) {
+		size = kernel_min_size;
+	}
+
+	if (option == SO_RCVBUF) {
+		receive_size = size;
+	} else if (option == SO_SNDBUF) {
+		send_size = size;
+	}
+
+	return cio_success;
+}
+
+void setUp(void)
+{
+	FFF_RESET_HISTORY();
+	RESET_FAKE(cio_linux_eventloop_get_time_ns);
+	RESET_FAKE(cio_linux_eventloop_arm_deadline);
+	RESET_FAKE(cio_linux_eventloop_disarm_deadline);
+	RESET_FAKE(getsockopt);
+	RESET_FAKE(set_buffer_size);
+
+	getsockopt_fake.custom_fake = getsockopt_fake_kernel;
+	set_buffer_size_fake.custom_fake = set_buffer_size_capture;
+
+	memset(&tcp_info, 0, sizeof(tcp_info));
+	receive_size = 0;
+	send_size = 0;
+	kernel_max_size = 0;
+	kernel_min_size = 0;
+	memset(sockets, 0, sizeof(sockets));
+	memset(exts, 0, sizeof(exts));
+	sockets[0].ev.fd = 5;
+	sockets[0].ext = &exts[0];
+	sockets[1].ev.fd = 6;
+	sockets[1].ext = &exts[1];
+
+	TEST_ASSERT_EQUAL(cio_success, cio_buffer_tuner_init(&tuner, &loop, 0, MIN_BUFFER_SIZE, MAX_BUFFER_SIZE, 1024 * 1024));
+}
+
+static void tick(void)
+{
+	tuner.tick.expired(tuner.tick.context);
+}
+
+static void test_init_invalid_sizes(void)
+{
+	struct cio_buffer_tuner t;
+	TEST_ASSERT_EQUAL(cio_invalid_argument, cio_buffer_tuner_init(&t, &loop, 0, 0, MAX_BUFFER_SIZE, 1024));
+	TEST_ASSERT_EQUAL(cio_invalid_argument, cio_buffer_tuner_init(&t, &loop, 0, MAX_BUFFER_SIZE, MIN_BUFFER_SIZE, 1024));
+}
+
+static void test_attach_sets_min_buffers(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[0]));
+	TEST_ASSERT_EQUAL(MIN_BUFFER_SIZE / 2, set_buffer_size_fake.arg2_val);
+	TEST_ASSERT_EQUAL(MIN_BUFFER_SIZE, receive_size);
+	TEST_ASSERT_EQUAL(MIN_BUFFER_SIZE, send_size);
+	TEST_ASSERT_EQUAL(2 * MIN_BUFFER_SIZE, tuner.memory_used);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_arm_deadline_fake.call_count);
+
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[1]));
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_arm_deadline_fake.call_count);
+	TEST_ASSERT_EQUAL(4 * MIN_BUFFER_SIZE, tuner.memory_used);
+}
+
+static void test_attach_memory_limit_reached(void)
+{
+	struct cio_buffer_tuner t;
+
+	TEST_ASSERT_EQUAL(cio_success, cio_buffer_tuner_init(&t, &loop, 0, MIN_BUFFER_SIZE, MAX_BUFFER_SIZE, 3 * MIN_BUFFER_SIZE));
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&t, &sockets[0]));
+	TEST_ASSERT_EQUAL(cio_no_buffer_space, cio_linux_buffer_tuner_attach(&t, &sockets[1]));
+	TEST_ASSERT_NULL(exts[1].tuner);
+	TEST_ASSERT_EQUAL(2 * MIN_BUFFER_SIZE, t.memory_used);
+}
+
+static void test_tick_sizes_towards_bdp(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[0]));
+
+	tcp_info.tcpi_rtt = 20000;
+	tcp_info.tcpi_snd_cwnd = 10;
+	tcp_info.tcpi_snd_mss = 1448;
+	tcp_info.tcpi_delivery_rate = 10000000;
+	tcp_info.tcpi_rcv_space = 50000;
+	tick();
+
+	TEST_ASSERT_EQUAL(2 * 200000, send_size);
+	TEST_ASSERT_EQUAL(2 * 50000, receive_size);
+	TEST_ASSERT_EQUAL(2 * 200000 + 2 * 50000, tuner.memory_used);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_arm_deadline_fake.call_count);
+
+	tcp_info.tcpi_delivery_rate = 1000000000;
+	tick();
+	TEST_ASSERT_EQUAL(1024 * 1024 - 2 * 50000, send_size);
+	TEST_ASSERT_EQUAL(1024 * 1024, tuner.memory_used);
+}
+
+static void test_tick_without_rtt(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[0]));
+	unsigned int calls = set_buffer_size_fake.call_count;
+	tick();
+	TEST_ASSERT_EQUAL(calls, set_buffer_size_fake.call_count);
+}
+
+static void test_small_changes_ignored(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[0]));
+
+	tcp_info.tcpi_rtt = 1000;
+	tcp_info.tcpi_snd_cwnd = 100;
+	tcp_info.tcpi_snd_mss = 1000;
+	tcp_info.tcpi_rcv_space = 100000;
+	tick();
+	TEST_ASSERT_EQUAL(200000, send_size);
+
+	unsigned int calls = set_buffer_size_fake.call_count;
+	tcp_info.tcpi_snd_cwnd = 110;
+	tcp_info.tcpi_rcv_space = 90000;
+	tick();
+	TEST_ASSERT_EQUAL(calls, set_buffer_size_fake.call_count);
+
+	tcp_info.tcpi_snd_cwnd = 10;
+	tick();
+	TEST_ASSERT_EQUAL(20000, send_size);
+}
+
+static void test_shrink_when_slow(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[0]));
+
+	tcp_info.tcpi_rtt = 1000;
+	tcp_info.tcpi_snd_cwnd = 100;
+	tcp_info.tcpi_snd_mss = 1000;
+	tick();
+	TEST_ASSERT_EQUAL(200000, send_size);
+
+	tcp_info.tcpi_snd_cwnd = 1;
+	tick();
+	TEST_ASSERT_EQUAL(MIN_BUFFER_SIZE, send_size);
+	TEST_ASSERT_EQUAL(2 * MIN_BUFFER_SIZE, tuner.memory_used);
+}
+
+static void test_kernel_cap_is_accounted(void)
+{
+	kernel_max_size = 100000;
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[0]));
+
+	tcp_info.tcpi_rtt = 1000;
+	tcp_info.tcpi_snd_cwnd = 100;
+	tcp_info.tcpi_snd_mss = 1000;
+	tick();
+	TEST_ASSERT_EQUAL(100000, send_size);
+	TEST_ASSERT_EQUAL(100000, exts[0].tuned_send_size);
+	TEST_ASSERT_EQUAL(100000 + MIN_BUFFER_SIZE, tuner.memory_used);
+
+	cio_linux_buffer_tuner_detach(&sockets[0]);
+	TEST_ASSERT_EQUAL(0, tuner.memory_used);
+}
+
+static void test_kernel_round_up_exceeds_limit(void)
+{
+	struct cio_buffer_tuner t;
+
+	kernel_min_size = 2 * MIN_BUFFER_SIZE;
+	TEST_ASSERT_EQUAL(cio_success, cio_buffer_tuner_init(&t, &loop, 0, MIN_BUFFER_SIZE, MAX_BUFFER_SIZE, 3 * MIN_BUFFER_SIZE));
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&t, &sockets[0]));
+	TEST_ASSERT_EQUAL(4 * MIN_BUFFER_SIZE, t.memory_used);
+
+	TEST_ASSERT_EQUAL(cio_no_buffer_space, cio_linux_buffer_tuner_attach(&t, &sockets[1]));
+	TEST_ASSERT_NULL(exts[1].tuner);
+	TEST_ASSERT_EQUAL(4 * MIN_BUFFER_SIZE, t.memory_used);
+
+	unsigned int calls = set_buffer_size_fake.call_count;
+	tcp_info.tcpi_rtt = 1000;
+	tcp_info.tcpi_snd_cwnd = 100;
+	tcp_info.tcpi_snd_mss = 1000;
+	tcp_info.tcpi_rcv_space = MIN_BUFFER_SIZE;
+	t.tick.expired(t.tick.context);
+	TEST_ASSERT_EQUAL(calls, set_buffer_size_fake.call_count);
+	TEST_ASSERT_EQUAL(2 * MIN_BUFFER_SIZE, exts[0].tuned_send_size);
+	TEST_ASSERT_EQUAL(4 * MIN_BUFFER_SIZE, t.memory_used);
+
+	cio_linux_buffer_tuner_detach(&sockets[0]);
+	TEST_ASSERT_EQUAL(0, t.memory_used);
+}
+
+static void test_detach_returns_memory(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[0]));
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_buffer_tuner_attach(&tuner, &sockets[1]));
+
+	cio_linux_buffer_tuner_detach(&sockets[0]);
+	TEST_ASSERT_EQUAL(2 * MIN_BUFFER_SIZE, tuner.memory_used);
+	TEST_ASSERT_EQUAL(0, cio_linux_eventloop_disarm_deadline_fake.call_count);
+	unsigned int calls = getsockopt_fake.call_count;
+	tick();
+	TEST_ASSERT_EQUAL(calls + 1, getsockopt_fake.call_count);
+	TEST_ASSERT_EQUAL(6, getsockopt_fake.arg0_val);
+
+	tuner.close(tuner.context);
+	TEST_ASSERT_EQUAL(0, tuner.memory_used);
+	TEST_ASSERT_NULL(exts[1].tuner);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_disarm_deadline_fake.call_count);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_init_invalid_sizes);
+	RUN_TEST(test_attach_sets_min_buffers);
+	RUN_TEST(test_attach_memory_limit_reached);
+	RUN_TEST(test_tick_sizes_towards_bdp);
+	RUN_TEST(test_tick_without_rtt);
+	RUN_TEST(test_small_changes_ignored);
+	RUN_TEST(test_shrink_when_slow);
+	RUN_TEST(test_kernel_cap_is_accounted);
+	RUN_TEST(test_kernel_round_up_exceeds_limit);
+	RUN_TEST(test_detach_returns_memory);
+	return UNITY_END();
+}
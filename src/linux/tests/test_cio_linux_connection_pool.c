@@ -0,0 +1,466 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_connection_pool.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_linux_socket.h"
+#include "cio_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+struct addrinfo;
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_socket_watch_idle, struct cio_socket *, cio_linux_socket_idle_callback, void *)
+
+FAKE_VALUE_FUNC(enum cio_error, cio_socket_resolve, const char *, uint16_t, struct addrinfo **)
+FAKE_VALUE_FUNC(struct cio_socket_connect_state *, cio_socket_connect_state_alloc, const struct addrinfo *)
+FAKE_VOID_FUNC(cio_socket_connect_state_free, struct cio_socket_connect_state *)
+FAKE_VALUE_FUNC(enum cio_error, cio_socket_connect_resolved, struct cio_socket *, struct cio_eventloop *, struct cio_socket_connect_state *, uint64_t, cio_socket_close_hook, cio_socket_connect_handler, void *)
+FAKE_VOID_FUNC(freeaddrinfo, struct addrinfo *)
+FAKE_VALUE_FUNC(ssize_t, recv, int, void *, size_t, int)
+
+void socket_close(void *context);
+FAKE_VOID_FUNC(socket_close, void *)
+void socket_set_idle_timeout(void *context, uint64_t timeout_ns);
+FAKE_VOID_FUNC(socket_set_idle_timeout, void *, uint64_t)
+
+void borrow_handler(struct cio_pool_endpoint *endpoint, void *handler_context, enum cio_error err, struct cio_socket *socket);
+FAKE_VOID_FUNC(borrow_handler, struct cio_pool_endpoint *, void *, enum cio_error, struct cio_socket *)
+
+#define MAX_CONNECTS 8
+
+struct pending_connect {
+	struct cio_socket *s;
+	cio_socket_close_hook close_hook;
+	cio_socket_connect_handler handler;
+	void *handler_context;
+};
+
+static const uint64_t idle_timeout = 5000000000ULL;
+
+static const struct cio_socket_ops socket_ops = {
+	.close = socket_close,
+	.set_idle_timeout = socket_set_idle_timeout,
+};
+
+static struct cio_eventloop loop;
+static struct cio_connection_pool pool;
+static struct cio_pool_endpoint endpoint;
+static struct cio_pool_request requests[4];
+static struct pending_connect connects[MAX_CONNECTS];
+static unsigned int num_connects;
+static uint8_t connect_states[MAX_CONNECTS];
+static unsigned int num_connect_states;
+static struct addrinfo *addresses = (struct addrinfo *)(void *)&connect_states;
+static bool endpoint_added;
+
+static enum cio_error resolve(const char *address, uint16_t port, struct addrinfo **result)
+{
+	(void)address;
+	(void)port;
+	*result = addresses;
+	return cio_success;
+}
+
+static struct cio_socket_connect_state *alloc_connect_state(const struct addrinfo *addrs)
+{
+	(void)addrs;
+	return (struct cio_socket_connect_state *)(void *)&connect_states[num_connect_states++];
+}
+
+static enum cio_error connect_resolved(struct cio_socket *s, struct cio_eventloop *l, struct cio_socket_connect_state *connect_state, uint64_t timeout_ns,
+                                       cio_socket_close_hook close_hook, cio_socket_connect_handler handler, void *handler_context)
+{
+	struct pending_connect *c = &connects[num_connects++];
+
+	(void)l;
+	(void)connect_state;
+	(void)timeout_ns;
+	c->s = s;
+	c->close_hook = close_hook;
+	c->handler = handler;
+	c->handler_context = handler_context;
+	return cio_success;
+}
+
+static void close_socket(void *context)
+{
+	struct cio_socket *s = context;
+	s->close_hook(s);
+}
+
+static ssize_t peer_closed(int fd, void *buf, size_t len, int flags)
+{
+	(void)fd;
+	(void)buf;
+	(void)len;
+	(void)flags;
+	return 0;
+}
+
+static ssize_t nothing_received(int fd, void *buf, size_t len, int flags)
+{
+	(void)fd;
+	(void)buf;
+	(void)len;
+	(void)flags;
+	errno = EAGAIN;
+	return -1;
+}
+
+static struct cio_socket *complete_connect(unsigned int index, enum cio_error err)
+{
+	struct pending_connect *c = &connects[index];
+
+	if (err == cio_success) {
+		memset(c->s, 0, sizeof(*c->s));
+		c->s->context = c->s;
+		c->s->ops = &socket_ops;
+		c->s->close_hook = c->close_hook;
+		c->s->ev.fd = 100 + (int)index;
+		c->s->loop = &loop;
+	}
+
+	c->handler(c->s, c->handler_context, err);
+	return c->s;
+}
+
+static void init_pool(unsigned int max_total, unsigned int max_idle)
+{
+	cio_connection_pool_init(&pool, &loop, max_total, max_idle, idle_timeout, 0);
+	TEST_ASSERT_EQUAL(cio_success, pool.add_endpoint(pool.context, &endpoint, "upstream.example", 8080));
+	endpoint_added = true;
+}
+
+static void borrow(unsigned int index)
+{
+	pool.borrow(pool.context, &endpoint, &requests[index], borrow_handler, &requests[index]);
+}
+
+static struct cio_socket *borrowed(void)
+{
+	return borrow_handler_fake.arg3_val;
+}
+
+static enum cio_error watch_idle(struct cio_socket *s, cio_linux_socket_idle_callback callback, void *context)
+{
+	s->ev.read_callback = callback;
+	s->ev.context = context;
+	return cio_success;
+}
+
+void setUp(void)
+{
+	FFF_RESET_HISTORY();
+
+	RESET_FAKE(cio_linux_socket_watch_idle);
+	RESET_FAKE(cio_socket_resolve);
+	RESET_FAKE(cio_socket_connect_state_alloc);
+	RESET_FAKE(cio_socket_connect_state_free);
+	RESET_FAKE(cio_socket_connect_resolved);
+	RESET_FAKE(freeaddrinfo);
+	RESET_FAKE(recv);
+	RESET_FAKE(socket_close);
+	RESET_FAKE(socket_set_idle_timeout);
+	RESET_FAKE(borrow_handler);
+
+	num_connects = 0;
+	num_connect_states = 0;
+	endpoint_added = false;
+
+	cio_socket_resolve_fake.custom_fake = resolve;
+	cio_socket_connect_state_alloc_fake.custom_fake = alloc_connect_state;
+	cio_socket_connect_resolved_fake.custom_fake = connect_resolved;
+	socket_close_fake.custom_fake = close_socket;
+	cio_linux_socket_watch_idle_fake.custom_fake = watch_idle;
+	recv_fake.custom_fake = peer_closed;
+}
+
+void tearDown(void)
+{
+	if (endpoint_added) {
+		pool.remove_endpoint(pool.context, &endpoint);
+	}
+}
+
+static void test_add_endpoint_resolves_once(void)
+{
+	init_pool(2, 2);
+	TEST_ASSERT_EQUAL(1, cio_socket_resolve_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_state_alloc_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(addresses, cio_socket_connect_state_alloc_fake.arg0_val);
+
+	borrow(0);
+	borrow(1);
+	TEST_ASSERT_EQUAL(1, cio_socket_resolve_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_resolved_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&connect_states[1], cio_socket_connect_resolved_fake.arg2_history[0]);
+	TEST_ASSERT_EQUAL_PTR(&connect_states[0], cio_socket_connect_resolved_fake.arg2_history[1]);
+
+	complete_connect(0, cio_success);
+	complete_connect(1, cio_success);
+	pool.release(pool.context, borrow_handler_fake.arg3_history[0], false);
+	pool.release(pool.context, borrow_handler_fake.arg3_history[1], false);
+
+	pool.remove_endpoint(pool.context, &endpoint);
+	endpoint_added = false;
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_state_free_fake.call_count);
+	TEST_ASSERT_EQUAL(1, freeaddrinfo_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(addresses, freeaddrinfo_fake.arg0_val);
+}
+
+static void test_add_endpoint_resolve_fails(void)
+{
+	cio_socket_resolve_fake.custom_fake = NULL;
+	cio_socket_resolve_fake.return_val = cio_invalid_argument;
+
+	cio_connection_pool_init(&pool, &loop, 2, 2, idle_timeout, 0);
+	TEST_ASSERT_EQUAL(cio_invalid_argument, pool.add_endpoint(pool.context, &endpoint, "unknown.example", 8080));
+	TEST_ASSERT_EQUAL(0, cio_socket_connect_state_alloc_fake.call_count);
+}
+
+static void test_add_endpoint_without_memory_for_connect_state(void)
+{
+	struct cio_socket_connect_state *states[2];
+
+	states[0] = (struct cio_socket_connect_state *)(void *)&connect_states[0];
+	states[1] = NULL;
+	cio_socket_connect_state_alloc_fake.custom_fake = NULL;
+	SET_RETURN_SEQ(cio_socket_connect_state_alloc, states, 2);
+
+	cio_connection_pool_init(&pool, &loop, 2, 2, idle_timeout, 0);
+	TEST_ASSERT_EQUAL(cio_not_enough_memory, pool.add_endpoint(pool.context, &endpoint, "upstream.example", 8080));
+	TEST_ASSERT_EQUAL(1, cio_socket_connect_state_free_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(states[0], cio_socket_connect_state_free_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1, freeaddrinfo_fake.call_count);
+}
+
+static void test_lifo_reuse(void)
+{
+	struct cio_socket *first;
+	struct cio_socket *second;
+
+	init_pool(2, 2);
+	borrow(0);
+	borrow(1);
+	first = complete_connect(0, cio_success);
+	second = complete_connect(1, cio_success);
+
+	pool.release(pool.context, first, true);
+	pool.release(pool.context, second, true);
+	TEST_ASSERT_EQUAL(2, endpoint.num_idle);
+	TEST_ASSERT_EQUAL(2, socket_set_idle_timeout_fake.call_count);
+	TEST_ASSERT_EQUAL(idle_timeout, socket_set_idle_timeout_fake.arg1_val);
+
+	borrow(2);
+	TEST_ASSERT_EQUAL(3, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, borrow_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL_PTR(second, borrowed());
+	TEST_ASSERT_EQUAL(0, socket_set_idle_timeout_fake.arg1_val);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_resolved_fake.call_count);
+
+	borrow(3);
+	TEST_ASSERT_EQUAL_PTR(first, borrowed());
+	TEST_ASSERT_EQUAL(0, endpoint.num_idle);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_resolved_fake.call_count);
+
+	pool.release(pool.context, first, false);
+	pool.release(pool.context, second, false);
+}
+
+static void test_max_idle(void)
+{
+	struct cio_socket *first;
+	struct cio_socket *second;
+
+	init_pool(2, 1);
+	borrow(0);
+	borrow(1);
+	first = complete_connect(0, cio_success);
+	second = complete_connect(1, cio_success);
+
+	pool.release(pool.context, first, true);
+	TEST_ASSERT_EQUAL(0, socket_close_fake.call_count);
+	pool.release(pool.context, second, true);
+	TEST_ASSERT_EQUAL(1, socket_close_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(second, socket_close_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1, endpoint.num_idle);
+	TEST_ASSERT_EQUAL(1, endpoint.num_open);
+}
+
+static void test_max_total_with_fifo_waiters(void)
+{
+	struct cio_socket *s;
+
+	init_pool(1, 1);
+	borrow(0);
+	borrow(1);
+	borrow(2);
+	TEST_ASSERT_EQUAL(1, cio_socket_connect_resolved_fake.call_count);
+	TEST_ASSERT_EQUAL(0, borrow_handler_fake.call_count);
+
+	s = complete_connect(0, cio_success);
+	TEST_ASSERT_EQUAL(1, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&requests[0], borrow_handler_fake.arg1_val);
+
+	pool.release(pool.context, s, true);
+	TEST_ASSERT_EQUAL(2, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&requests[1], borrow_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL_PTR(s, borrowed());
+
+	pool.release(pool.context, s, true);
+	TEST_ASSERT_EQUAL(3, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&requests[2], borrow_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL_PTR(s, borrowed());
+	TEST_ASSERT_EQUAL(0, endpoint.num_idle);
+	TEST_ASSERT_EQUAL(1, cio_socket_connect_resolved_fake.call_count);
+
+	pool.release(pool.context, s, false);
+}
+
+static void test_waiter_connects_when_connection_closed(void)
+{
+	struct cio_socket *s;
+
+	init_pool(1, 1);
+	borrow(0);
+	borrow(1);
+	s = complete_connect(0, cio_success);
+
+	pool.release(pool.context, s, false);
+	TEST_ASSERT_EQUAL(1, socket_close_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_resolved_fake.call_count);
+
+	s = complete_connect(1, cio_success);
+	TEST_ASSERT_EQUAL(2, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&requests[1], borrow_handler_fake.arg1_val);
+	pool.release(pool.context, s, false);
+}
+
+static void test_idle_close_via_idle_readable(void)
+{
+	struct cio_socket *s;
+
+	init_pool(1, 1);
+	borrow(0);
+	s = complete_connect(0, cio_success);
+	pool.release(pool.context, s, true);
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_watch_idle_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(s, cio_linux_socket_watch_idle_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1, endpoint.num_idle);
+
+	recv_fake.custom_fake = nothing_received;
+	s->ev.read_callback(s->ev.context);
+	TEST_ASSERT_EQUAL(0, socket_close_fake.call_count);
+	TEST_ASSERT_EQUAL(1, endpoint.num_idle);
+
+	recv_fake.custom_fake = peer_closed;
+	s->ev.read_callback(s->ev.context);
+	TEST_ASSERT_EQUAL(1, socket_close_fake.call_count);
+	TEST_ASSERT_EQUAL(0, endpoint.num_idle);
+	TEST_ASSERT_EQUAL(0, endpoint.num_open);
+	TEST_ASSERT_NULL(endpoint.idle_connections);
+
+	borrow(1);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_resolved_fake.call_count);
+	pool.release(pool.context, complete_connect(1, cio_success), false);
+}
+
+static void test_release_watch_idle_fails(void)
+{
+	struct cio_socket *s;
+
+	cio_linux_socket_watch_idle_fake.custom_fake = NULL;
+	cio_linux_socket_watch_idle_fake.return_val = cio_not_enough_memory;
+
+	init_pool(1, 1);
+	borrow(0);
+	s = complete_connect(0, cio_success);
+	pool.release(pool.context, s, true);
+	TEST_ASSERT_EQUAL(1, socket_close_fake.call_count);
+	TEST_ASSERT_EQUAL(0, endpoint.num_idle);
+	TEST_ASSERT_EQUAL(0, endpoint.num_open);
+}
+
+static void test_remove_endpoint_with_connects_in_flight(void)
+{
+	init_pool(2, 2);
+	borrow(0);
+	borrow(1);
+	borrow(2);
+
+	pool.remove_endpoint(pool.context, &endpoint);
+	endpoint_added = false;
+	TEST_ASSERT_EQUAL(1, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&requests[2], borrow_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(cio_operation_aborted, borrow_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, cio_socket_connect_state_free_fake.call_count);
+	TEST_ASSERT_EQUAL(0, freeaddrinfo_fake.call_count);
+
+	complete_connect(0, cio_success);
+	TEST_ASSERT_EQUAL(1, socket_close_fake.call_count);
+	TEST_ASSERT_EQUAL(2, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&requests[0], borrow_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(cio_operation_aborted, borrow_handler_fake.arg2_val);
+	TEST_ASSERT_NULL(borrowed());
+	TEST_ASSERT_EQUAL(0, cio_socket_connect_state_free_fake.call_count);
+
+	complete_connect(1, cio_timed_out);
+	TEST_ASSERT_EQUAL(3, borrow_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&requests[1], borrow_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(cio_timed_out, borrow_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_state_free_fake.call_count);
+	TEST_ASSERT_EQUAL(1, freeaddrinfo_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_socket_connect_resolved_fake.call_count);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_add_endpoint_resolves_once);
+	RUN_TEST(test_add_endpoint_resolve_fails);
+	RUN_TEST(test_add_endpoint_without_memory_for_connect_state);
+	RUN_TEST(test_lifo_reuse);
+	RUN_TEST(test_max_idle);
+	RUN_TEST(test_max_total_with_fifo_waiters);
+	RUN_TEST(test_waiter_connects_when_connection_closed);
+	RUN_TEST(test_idle_close_via_idle_readable);
+	RUN_TEST(test_release_watch_idle_fails);
+	RUN_TEST(test_remove_endpoint_with_connects_in_flight);
+	return UNITY_END();
+}
@@ -25,6 +25,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 
@@ -54,6 +55,14 @@ void epoll_callback_remove_loop(void *);
 FAKE_VOID_FUNC(epoll_callback_remove_loop, void *)
 void epoll_callback_unregister_read_second_fd(void *);
 FAKE_VOID_FUNC(epoll_callback_unregister_read_second_fd, void *)
+void deadline_callback(void *);
+FAKE_VOID_FUNC(deadline_callback, void *)
+
+void deferred_callback(void *);
+FAKE_VOID_FUNC(deferred_callback, void *)
+
+void remote_callback(void *);
+FAKE_VOID_FUNC(remote_callback, void *)
 
 static unsigned int events_in_list = 0;
 static struct cio_event_notifier *(event_list[100]);
@@ -73,6 +82,9 @@ void setUp(void)
 	RESET_FAKE(epoll_callback_remove_third_fd);
 	RESET_FAKE(epoll_callback_remove_loop);
 	RESET_FAKE(epoll_callback_unregister_read_second_fd)
+	RESET_FAKE(deadline_callback);
+	RESET_FAKE(deferred_callback);
+	RESET_FAKE(remote_callback);
 	events_in_list = 0;
 }
 
@@ -184,6 +196,41 @@ static int notify_no_fd_interrupt(int epfd, struct epoll_event *events,
 	}
 }
 
+static int notify_nothing(int epfd, struct epoll_event *events,
+                          int maxevents, int timeout)
+{
+	(void)epfd;
+	(void)events;
+	(void)maxevents;
+	(void)timeout;
+
+	if (epoll_wait_fake.call_count == 1) {
+		return 0;
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static struct cio_eventloop *wakeup_loop;
+
+static int notify_wakeup(int epfd, struct epoll_event *events,
+                         int maxevents, int timeout)
+{
+	(void)epfd;
+	(void)maxevents;
+	(void)timeout;
+
+	if (epoll_wait_fake.call_count == 1) {
+		events[0].events = EPOLLIN;
+		events[0].data.ptr = &wakeup_loop->wakeup;
+		return 1;
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+}
+
 static int notify_single_fd_multiple_events(int epfd, struct epoll_event *events,
                                             int maxevents, int timeout)
 {
@@ -701,6 +748,253 @@ static void test_notify_three_event_and_remove(void)
 	TEST_ASSERT_EQUAL(1, close_fake.call_count);
 }
 
+static void test_deadline_expires(void)
+{
+	epoll_wait_fake.custom_fake = notify_nothing;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	struct cio_linux_deadline deadline;
+	memset(&deadline, 0, sizeof(deadline));
+	deadline.expired = deadline_callback;
+	deadline.context = &loop;
+	cio_linux_eventloop_arm_deadline(&loop, &deadline, cio_linux_eventloop_get_time_ns(&loop));
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(1, deadline_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(&loop, deadline_callback_fake.arg0_val);
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_deadline_disarmed(void)
+{
+	epoll_wait_fake.custom_fake = notify_nothing;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	struct cio_linux_deadline deadline;
+	memset(&deadline, 0, sizeof(deadline));
+	deadline.expired = deadline_callback;
+	deadline.context = &loop;
+	cio_linux_eventloop_arm_deadline(&loop, &deadline, cio_linux_eventloop_get_time_ns(&loop));
+	cio_linux_eventloop_disarm_deadline(&loop, &deadline);
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(0, deadline_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(-1, epoll_wait_fake.arg3_val);
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_deadline_sleeps_until_expiry(void)
+{
+	epoll_wait_fake.custom_fake = notify_nothing;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	struct cio_linux_deadline now_deadline;
+	memset(&now_deadline, 0, sizeof(now_deadline));
+	now_deadline.expired = deadline_callback;
+	now_deadline.context = &loop;
+	cio_linux_eventloop_arm_deadline(&loop, &now_deadline, cio_linux_eventloop_get_time_ns(&loop));
+
+	struct cio_linux_deadline later_deadline;
+	memset(&later_deadline, 0, sizeof(later_deadline));
+	later_deadline.expired = deadline_callback;
+	later_deadline.context = &loop;
+	cio_linux_eventloop_arm_deadline(&loop, &later_deadline, cio_linux_eventloop_get_time_ns(&loop) + 2000000000ULL);
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(1, deadline_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(2, epoll_wait_fake.call_count);
+	TEST_ASSERT_EQUAL(0, epoll_wait_fake.arg3_history[0]);
+	TEST_ASSERT_TRUE(epoll_wait_fake.arg3_history[1] > 1900);
+	TEST_ASSERT_TRUE(epoll_wait_fake.arg3_history[1] <= 2000);
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_deadline_far_away_sleeps_one_lap(void)
+{
+	epoll_wait_fake.custom_fake = notify_nothing;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	struct cio_linux_deadline now_deadline;
+	memset(&now_deadline, 0, sizeof(now_deadline));
+	now_deadline.expired = deadline_callback;
+	now_deadline.context = &loop;
+	cio_linux_eventloop_arm_deadline(&loop, &now_deadline, cio_linux_eventloop_get_time_ns(&loop));
+
+	struct cio_linux_deadline far_deadline;
+	memset(&far_deadline, 0, sizeof(far_deadline));
+	far_deadline.expired = deadline_callback;
+	far_deadline.context = &loop;
+	cio_linux_eventloop_arm_deadline(&loop, &far_deadline, cio_linux_eventloop_get_time_ns(&loop) + 60000000000ULL);
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(1, deadline_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(2, epoll_wait_fake.call_count);
+	TEST_ASSERT_EQUAL(0, epoll_wait_fake.arg3_history[0]);
+	TEST_ASSERT_TRUE(epoll_wait_fake.arg3_history[1] > (int)((CONFIG_DEADLINE_WHEEL_SLOTS - 1) * CONFIG_DEADLINE_WHEEL_TICK_NS / 1000000));
+	TEST_ASSERT_TRUE(epoll_wait_fake.arg3_history[1] <= (int)(CONFIG_DEADLINE_WHEEL_SLOTS * CONFIG_DEADLINE_WHEEL_TICK_NS / 1000000));
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_deferred_runs_once(void)
+{
+	epoll_wait_fake.custom_fake = notify_nothing;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	struct cio_linux_deferred deferred;
+	memset(&deferred, 0, sizeof(deferred));
+	deferred.callback = deferred_callback;
+	deferred.context = &loop;
+	cio_linux_eventloop_defer(&loop, &deferred);
+	cio_linux_eventloop_defer(&loop, &deferred);
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(1, deferred_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(&loop, deferred_callback_fake.arg0_val);
+	TEST_ASSERT_EQUAL(0, epoll_wait_fake.arg3_history[0]);
+	TEST_ASSERT_EQUAL(-1, epoll_wait_fake.arg3_val);
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_deferred_cancelled(void)
+{
+	epoll_wait_fake.custom_fake = notify_nothing;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	struct cio_linux_deferred deferred;
+	memset(&deferred, 0, sizeof(deferred));
+	deferred.callback = deferred_callback;
+	deferred.context = &loop;
+	cio_linux_eventloop_defer(&loop, &deferred);
+	cio_linux_eventloop_cancel_deferred(&loop, &deferred);
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(0, deferred_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(-1, epoll_wait_fake.arg3_history[0]);
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_remote_runs_once_in_order(void)
+{
+	epoll_wait_fake.custom_fake = notify_wakeup;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	err = cio_linux_eventloop_enable_remote(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	wakeup_loop = &loop;
+
+	int first_context;
+	int second_context;
+	struct cio_linux_remote first;
+	struct cio_linux_remote second;
+	memset(&first, 0, sizeof(first));
+	memset(&second, 0, sizeof(second));
+	first.callback = remote_callback;
+	first.context = &first_context;
+	second.callback = remote_callback;
+	second.context = &second_context;
+	cio_linux_eventloop_post(&loop, &first);
+	cio_linux_eventloop_post(&loop, &second);
+	cio_linux_eventloop_post(&loop, &first);
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(2, remote_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(&first_context, remote_callback_fake.arg0_history[0]);
+	TEST_ASSERT_EQUAL(&second_context, remote_callback_fake.arg0_history[1]);
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_remote_cancelled(void)
+{
+	epoll_wait_fake.custom_fake = notify_wakeup;
+
+	struct cio_eventloop loop;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	err = cio_linux_eventloop_enable_remote(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	wakeup_loop = &loop;
+
+	int first_context;
+	int second_context;
+	struct cio_linux_remote first;
+	struct cio_linux_remote second;
+	memset(&first, 0, sizeof(first));
+	memset(&second, 0, sizeof(second));
+	first.callback = remote_callback;
+	first.context = &first_context;
+	second.callback = remote_callback;
+	second.context = &second_context;
+	cio_linux_eventloop_post(&loop, &first);
+	cio_linux_eventloop_post(&loop, &second);
+	cio_linux_eventloop_cancel_remote(&loop, &first);
+
+	cio_eventloop_run(&loop);
+	TEST_ASSERT_EQUAL(1, remote_callback_fake.call_count);
+	TEST_ASSERT_EQUAL(&second_context, remote_callback_fake.arg0_val);
+
+	cio_eventloop_destroy(&loop);
+}
+
+static void test_receive_delay_histogram(void)
+{
+	struct cio_eventloop loop;
+	struct cio_delay_histogram histogram;
+	enum cio_error err = cio_eventloop_init(&loop);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	cio_eventloop_get_receive_delays(&loop, &histogram, false);
+	TEST_ASSERT_EQUAL(0, histogram.count);
+	TEST_ASSERT_EQUAL(0, cio_delay_histogram_percentile(&histogram, 500));
+
+	for (unsigned int i = 0; i < 98; i++) {
+		cio_linux_eventloop_record_receive_delay(&loop, 1000);
+	}
+
+	cio_linux_eventloop_record_receive_delay(&loop, 0);
+	cio_linux_eventloop_record_receive_delay(&loop, 5000000);
+
+	cio_eventloop_get_receive_delays(&loop, &histogram, true);
+	TEST_ASSERT_EQUAL(100, histogram.count);
+	TEST_ASSERT_EQUAL(1, histogram.buckets[0]);
+	TEST_ASSERT_EQUAL(98, histogram.buckets[9]);
+	TEST_ASSERT_EQUAL(1, histogram.buckets[22]);
+	TEST_ASSERT_EQUAL(1023, cio_delay_histogram_percentile(&histogram, 500));
+	TEST_ASSERT_EQUAL(1023, cio_delay_histogram_percentile(&histogram, 990));
+	TEST_ASSERT_EQUAL(8388607, cio_delay_histogram_percentile(&histogram, 1000));
+
+	cio_eventloop_get_receive_delays(&loop, &histogram, false);
+	TEST_ASSERT_EQUAL(0, histogram.count);
+
+	cio_eventloop_destroy(&loop);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -717,5 +1011,14 @@ int main(void)
 	RUN_TEST(test_notify_single_fd_multiple_events_unregister_write_event);
 	RUN_TEST(test_notify_two_fds_unregister_read);
 	RUN_TEST(test_epoll_wait_interrupted);
+	RUN_TEST(test_deadline_expires);
+	RUN_TEST(test_deadline_disarmed);
+	RUN_TEST(test_deadline_sleeps_until_expiry);
+	RUN_TEST(test_deadline_far_away_sleeps_one_lap);
+	RUN_TEST(test_deferred_runs_once);
+	RUN_TEST(test_deferred_cancelled);
+	RUN_TEST(test_remote_runs_once_in_order);
+	RUN_TEST(test_remote_cancelled);
+	RUN_TEST(test_receive_delay_histogram);
 	return UNITY_END();
 }
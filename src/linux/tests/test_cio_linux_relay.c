@@ -0,0 +1,343 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_linux_socket.h"
+#include "cio_relay.h"
+#include "cio_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_read, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_unregister_read, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_write, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_unregister_write, const struct cio_eventloop *, struct cio_event_notifier *)
+
+FAKE_VALUE_FUNC(int, close, int)
+FAKE_VALUE_FUNC(int, pipe2, int *, int)
+FAKE_VALUE_FUNC_VARARG(int, fcntl, int, int, ...)
+FAKE_VALUE_FUNC(ssize_t, splice, int, loff_t *, int, loff_t *, size_t, unsigned int)
+FAKE_VALUE_FUNC(int, shutdown, int, int)
+FAKE_VALUE_FUNC(int, getsockopt, int, int, int, void *, socklen_t *)
+
+void relay_handler(struct cio_relay *relay, void *handler_context, enum cio_error err);
+FAKE_VOID_FUNC(relay_handler, struct cio_relay *, void *, enum cio_error)
+
+void socket_read_callback(void *context);
+FAKE_VOID_FUNC(socket_read_callback, void *)
+void socket_error_callback(void *context);
+FAKE_VOID_FUNC(socket_error_callback, void *)
+
+static const int a_fd = 42;
+static const int b_fd = 43;
+static const int pipe_size = 4096;
+
+struct peer {
+	int fd;
+	size_t available;
+	size_t space;
+	bool eof;
+};
+
+static struct peer peer_a;
+static struct peer peer_b;
+static int next_pipe_fd;
+
+static struct cio_eventloop loop;
+static struct cio_socket a;
+static struct cio_socket b;
+static struct cio_relay relay;
+
+static int pipe_fds(int *fds, int flags)
+{
+	(void)flags;
+	fds[0] = next_pipe_fd++;
+	fds[1] = next_pipe_fd++;
+	return 0;
+}
+
+static struct peer *get_peer(int fd)
+{
+	if (fd == a_fd) {
+		return &peer_a;
+	}
+
+	if (fd == b_fd) {
+		return &peer_b;
+	}
+
+	return NULL;
+}
+
+static ssize_t transfer(size_t *bytes, size_t len)
+{
+	if (*bytes == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (len > *bytes) {
+		len = *bytes;
+	}
+
+	*bytes -= len;
+	return (ssize_t)len;
+}
+
+static ssize_t splice_peers(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+{
+	struct peer *from = get_peer(fd_in);
+
+	(void)off_in;
+	(void)off_out;
+	(void)flags;
+
+	if (from != NULL) {
+		if ((from->available == 0) && from->eof) {
+			return 0;
+		}
+
+		return transfer(&from->available, len);
+	}
+
+	return transfer(&get_peer(fd_out)->space, len);
+}
+
+static int no_socket_error(int fd, int level, int optname, void *optval, socklen_t *optlen)
+{
+	(void)fd;
+	(void)level;
+	(void)optname;
+	(void)optlen;
+	memset(optval, 0, sizeof(int));
+	return 0;
+}
+
+static int connection_reset(int fd, int level, int optname, void *optval, socklen_t *optlen)
+{
+	int err = ECONNRESET;
+
+	(void)fd;
+	(void)level;
+	(void)optname;
+	(void)optlen;
+	memcpy(optval, &err, sizeof(err));
+	return 0;
+}
+
+static void init_peer_socket(struct cio_socket *s, int fd)
+{
+	memset(s, 0, sizeof(*s));
+	s->ev.fd = fd;
+	s->ev.read_callback = socket_read_callback;
+	s->ev.error_callback = socket_error_callback;
+	s->ev.context = s;
+	s->loop = &loop;
+}
+
+void setUp(void)
+{
+	FFF_RESET_HISTORY();
+
+	RESET_FAKE(cio_linux_eventloop_register_read);
+	RESET_FAKE(cio_linux_eventloop_unregister_read);
+	RESET_FAKE(cio_linux_eventloop_register_write);
+	RESET_FAKE(cio_linux_eventloop_unregister_write);
+
+	RESET_FAKE(close);
+	RESET_FAKE(pipe2);
+	RESET_FAKE(fcntl);
+	RESET_FAKE(splice);
+	RESET_FAKE(shutdown);
+	RESET_FAKE(getsockopt);
+
+	RESET_FAKE(relay_handler);
+	RESET_FAKE(socket_read_callback);
+	RESET_FAKE(socket_error_callback);
+
+	memset(&peer_a, 0, sizeof(peer_a));
+	peer_a.fd = a_fd;
+	memset(&peer_b, 0, sizeof(peer_b));
+	peer_b.fd = b_fd;
+	next_pipe_fd = 10;
+
+	pipe2_fake.custom_fake = pipe_fds;
+	fcntl_fake.return_val = pipe_size;
+	splice_fake.custom_fake = splice_peers;
+	getsockopt_fake.custom_fake = no_socket_error;
+
+	init_peer_socket(&a, a_fd);
+	init_peer_socket(&b, b_fd);
+	TEST_ASSERT_EQUAL(cio_success, cio_relay_init(&relay, &a, &b, NULL));
+}
+
+void tearDown(void)
+{
+	relay.close(relay.context);
+}
+
+static void test_start_and_close_restores_callbacks(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, relay.start(relay.context, relay_handler, NULL));
+	TEST_ASSERT_NOT_EQUAL(socket_read_callback, a.ev.read_callback);
+	TEST_ASSERT_NOT_EQUAL(socket_error_callback, a.ev.error_callback);
+	TEST_ASSERT_NOT_EQUAL((void *)&a, a.ev.context);
+
+	relay.close(relay.context);
+	TEST_ASSERT_EQUAL(0, relay_handler_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(socket_read_callback, a.ev.read_callback);
+	TEST_ASSERT_EQUAL_PTR(socket_error_callback, a.ev.error_callback);
+	TEST_ASSERT_EQUAL_PTR(&a, a.ev.context);
+	TEST_ASSERT_EQUAL_PTR(socket_read_callback, b.ev.read_callback);
+	TEST_ASSERT_EQUAL_PTR(socket_error_callback, b.ev.error_callback);
+	TEST_ASSERT_EQUAL_PTR(&b, b.ev.context);
+}
+
+static void test_socket_error_finishes_relay(void)
+{
+	TEST_ASSERT_EQUAL(cio_success, relay.start(relay.context, relay_handler, NULL));
+
+	getsockopt_fake.custom_fake = connection_reset;
+	b.ev.error_callback(b.ev.context);
+
+	TEST_ASSERT_EQUAL(1, relay_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(ECONNRESET, relay_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, socket_error_callback_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(socket_error_callback, b.ev.error_callback);
+	TEST_ASSERT_EQUAL_PTR(&b, b.ev.context);
+}
+
+static void test_start_rejects_zerocopy(void)
+{
+	struct cio_socket_ext ext;
+
+	memset(&ext, 0, sizeof(ext));
+	ext.zerocopy = true;
+	b.ext = &ext;
+
+	TEST_ASSERT_EQUAL(cio_invalid_argument, relay.start(relay.context, relay_handler, NULL));
+	TEST_ASSERT_EQUAL(0, cio_linux_eventloop_register_read_fake.call_count);
+	TEST_ASSERT_EQUAL(0, splice_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(socket_read_callback, b.ev.read_callback);
+	TEST_ASSERT_EQUAL_PTR(&b, b.ev.context);
+}
+
+static void test_backpressure(void)
+{
+	unsigned int splice_calls;
+
+	peer_a.available = 10000;
+
+	TEST_ASSERT_EQUAL(cio_success, relay.start(relay.context, relay_handler, NULL));
+	TEST_ASSERT_EQUAL(pipe_size, relay.endpoints[0].pipe_fill);
+	TEST_ASSERT_EQUAL(10000 - pipe_size, peer_a.available);
+	TEST_ASSERT_EQUAL(0, relay.get_bytes_forwarded(relay.context, &a));
+
+	splice_calls = splice_fake.call_count;
+	a.ev.read_callback(a.ev.context);
+	TEST_ASSERT_EQUAL(10000 - pipe_size, peer_a.available);
+	TEST_ASSERT_EQUAL(splice_calls + 1, splice_fake.call_count);
+	TEST_ASSERT_EQUAL(b_fd, splice_fake.arg2_val);
+
+	peer_b.space = 100000;
+	b.ev.write_callback(b.ev.context);
+	TEST_ASSERT_EQUAL(0, peer_a.available);
+	TEST_ASSERT_EQUAL(0, relay.endpoints[0].pipe_fill);
+	TEST_ASSERT_EQUAL(10000, relay.get_bytes_forwarded(relay.context, &a));
+	TEST_ASSERT_EQUAL(0, shutdown_fake.call_count);
+	TEST_ASSERT_EQUAL(0, relay_handler_fake.call_count);
+}
+
+static void test_eof_shuts_down_peer(void)
+{
+	peer_a.available = 100;
+	peer_a.eof = true;
+	peer_b.space = 100000;
+
+	TEST_ASSERT_EQUAL(cio_success, relay.start(relay.context, relay_handler, NULL));
+	TEST_ASSERT_EQUAL(100, relay.get_bytes_forwarded(relay.context, &a));
+	TEST_ASSERT_EQUAL(1, shutdown_fake.call_count);
+	TEST_ASSERT_EQUAL(b_fd, shutdown_fake.arg0_val);
+	TEST_ASSERT_EQUAL(SHUT_WR, shutdown_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, relay_handler_fake.call_count);
+
+	peer_b.eof = true;
+	peer_a.space = 100000;
+	b.ev.read_callback(b.ev.context);
+	TEST_ASSERT_EQUAL(2, shutdown_fake.call_count);
+	TEST_ASSERT_EQUAL(a_fd, shutdown_fake.arg0_val);
+	TEST_ASSERT_EQUAL(SHUT_WR, shutdown_fake.arg1_val);
+	TEST_ASSERT_EQUAL(1, relay_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, relay_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL_PTR(socket_read_callback, b.ev.read_callback);
+	TEST_ASSERT_EQUAL_PTR(&b, b.ev.context);
+}
+
+static void test_eof_waits_for_pipe_to_drain(void)
+{
+	peer_a.available = 100;
+	peer_a.eof = true;
+
+	TEST_ASSERT_EQUAL(cio_success, relay.start(relay.context, relay_handler, NULL));
+	TEST_ASSERT_EQUAL(100, relay.endpoints[0].pipe_fill);
+	TEST_ASSERT_EQUAL(0, shutdown_fake.call_count);
+
+	peer_b.space = 60;
+	b.ev.write_callback(b.ev.context);
+	TEST_ASSERT_EQUAL(40, relay.endpoints[0].pipe_fill);
+	TEST_ASSERT_EQUAL(0, shutdown_fake.call_count);
+
+	peer_b.space = 100000;
+	b.ev.write_callback(b.ev.context);
+	TEST_ASSERT_EQUAL(0, relay.endpoints[0].pipe_fill);
+	TEST_ASSERT_EQUAL(1, shutdown_fake.call_count);
+	TEST_ASSERT_EQUAL(b_fd, shutdown_fake.arg0_val);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_start_and_close_restores_callbacks);
+	RUN_TEST(test_socket_error_finishes_relay);
+	RUN_TEST(test_start_rejects_zerocopy);
+	RUN_TEST(test_backpressure);
+	RUN_TEST(test_eof_shuts_down_peer);
+	RUN_TEST(test_eof_waits_for_pipe_to_drain);
+	return UNITY_END();
+}
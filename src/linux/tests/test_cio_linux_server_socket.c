@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "fff.h"
@@ -36,19 +37,32 @@
 
 #include "cio_eventloop.h"
 #include "cio_linux_alloc.h"
+#include "cio_linux_buffer_tuner.h"
+#include "cio_linux_uring.h"
 #include "cio_server_socket.h"
 #include "cio_socket.h"
 
 DEFINE_FFF_GLOBALS
 
-FAKE_VALUE_FUNC(int, accept, int, struct sockaddr *, socklen_t *)
+FAKE_VALUE_FUNC(int, accept4, int, struct sockaddr *, socklen_t *, int)
 void accept_handler(struct cio_server_socket *ss, void *handler_context, enum cio_error err, struct cio_socket *socket);
 FAKE_VOID_FUNC(accept_handler, struct cio_server_socket *, void *, enum cio_error, struct cio_socket *)
+void accept_batch_handler(struct cio_server_socket *ss, void *handler_context, enum cio_error err, struct cio_socket **sockets, unsigned int count);
+FAKE_VOID_FUNC(accept_batch_handler, struct cio_server_socket *, void *, enum cio_error, struct cio_socket **, unsigned int)
 
 FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_add, const struct cio_eventloop *, struct cio_event_notifier *)
 FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_read, const struct cio_eventloop *, struct cio_event_notifier *)
 FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_write, const struct cio_eventloop *, struct cio_event_notifier *)
 FAKE_VOID_FUNC(cio_linux_eventloop_remove, struct cio_eventloop *, const struct cio_event_notifier *)
+FAKE_VALUE_FUNC(uint64_t, cio_linux_eventloop_get_time_ns, const struct cio_eventloop *)
+FAKE_VOID_FUNC(cio_linux_eventloop_arm_deadline, struct cio_eventloop *, struct cio_linux_deadline *, uint64_t)
+FAKE_VOID_FUNC(cio_linux_eventloop_disarm_deadline, struct cio_eventloop *, struct cio_linux_deadline *)
+FAKE_VOID_FUNC(cio_linux_eventloop_defer, struct cio_eventloop *, struct cio_linux_deferred *)
+FAKE_VOID_FUNC(cio_linux_eventloop_cancel_deferred, struct cio_eventloop *, struct cio_linux_deferred *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_enable_remote, struct cio_eventloop *)
+FAKE_VOID_FUNC(cio_linux_eventloop_post, struct cio_eventloop *, struct cio_linux_remote *)
+FAKE_VOID_FUNC(cio_linux_eventloop_cancel_remote, struct cio_eventloop *, struct cio_linux_remote *)
+FAKE_VOID_FUNC(cio_linux_eventloop_record_receive_delay, struct cio_eventloop *, uint64_t)
 
 void on_close(struct cio_server_socket *ss);
 FAKE_VOID_FUNC(on_close, struct cio_server_socket *)
@@ -61,22 +75,44 @@ FAKE_VALUE_FUNC(int, listen, int, int)
 FAKE_VALUE_FUNC(int, close, int)
 enum cio_error set_fd_non_blocking(int);
 FAKE_VALUE_FUNC(enum cio_error, set_fd_non_blocking, int)
+enum cio_error fill_unix_address(struct sockaddr_un *, socklen_t *, const char *);
+FAKE_VALUE_FUNC(enum cio_error, fill_unix_address, struct sockaddr_un *, socklen_t *, const char *)
+FAKE_VALUE_FUNC(enum cio_error, set_tcp_no_delay, int, bool)
+FAKE_VALUE_FUNC(enum cio_error, set_keep_alive, int, bool, unsigned int, unsigned int, unsigned int)
+FAKE_VALUE_FUNC(enum cio_error, set_buffer_size, int, int, size_t)
 
 FAKE_VALUE_FUNC(void *, cio_malloc, size_t)
 FAKE_VOID_FUNC(cio_free, void *)
 
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_uring_attach, struct cio_uring *, struct cio_socket *)
+FAKE_VALUE_FUNC(bool, cio_linux_uring_detach, struct cio_uring_stream *)
+FAKE_VOID_FUNC(cio_linux_uring_cancel_send, struct cio_uring_stream *)
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_buffer_tuner_attach, struct cio_buffer_tuner *, struct cio_socket *)
+FAKE_VOID_FUNC(cio_linux_buffer_tuner_detach, struct cio_socket *)
+
 static int optval;
 
 void setUp(void)
 {
 	FFF_RESET_HISTORY();
-	RESET_FAKE(accept);
+	RESET_FAKE(accept4);
 	RESET_FAKE(accept_handler);
+	RESET_FAKE(accept_batch_handler);
 
 	RESET_FAKE(cio_linux_eventloop_add);
 	RESET_FAKE(cio_linux_eventloop_remove);
 	RESET_FAKE(cio_linux_eventloop_register_read);
 	RESET_FAKE(cio_linux_eventloop_register_write);
+	RESET_FAKE(cio_linux_eventloop_get_time_ns);
+	RESET_FAKE(cio_linux_eventloop_arm_deadline);
+	RESET_FAKE(cio_linux_eventloop_disarm_deadline);
+	RESET_FAKE(cio_linux_eventloop_defer);
+	RESET_FAKE(cio_linux_eventloop_cancel_deferred);
+	RESET_FAKE(cio_linux_eventloop_enable_remote);
+	RESET_FAKE(cio_linux_eventloop_post);
+	RESET_FAKE(cio_linux_eventloop_cancel_remote);
+	RESET_FAKE(cio_linux_eventloop_record_receive_delay);
 
 	RESET_FAKE(on_close);
 
@@ -87,8 +123,17 @@ void setUp(void)
 	RESET_FAKE(listen);
 	RESET_FAKE(close);
 	RESET_FAKE(set_fd_non_blocking);
+	RESET_FAKE(fill_unix_address);
+	RESET_FAKE(set_tcp_no_delay);
+	RESET_FAKE(set_keep_alive);
+	RESET_FAKE(set_buffer_size);
 	RESET_FAKE(cio_malloc);
 	RESET_FAKE(cio_free);
+	RESET_FAKE(cio_linux_uring_attach);
+	RESET_FAKE(cio_linux_uring_detach);
+	RESET_FAKE(cio_linux_uring_cancel_send);
+	RESET_FAKE(cio_linux_buffer_tuner_attach);
+	RESET_FAKE(cio_linux_buffer_tuner_detach);
 }
 
 static int listen_fails(int sockfd, int backlog)
@@ -136,12 +181,13 @@ static int bind_fails(int sockfd, const struct sockaddr *addr,
 	return -1;
 }
 
-static int custom_accept_fake(int fd, struct sockaddr *addr, socklen_t *addrlen)
+static int custom_accept_fake(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
 {
 	(void)fd;
 	(void)addr;
 	(void)addrlen;
-	if (accept_fake.call_count == 1) {
+	(void)flags;
+	if (accept4_fake.call_count == 1) {
 		return 42;
 	} else {
 		errno = EBADF;
@@ -149,23 +195,25 @@ static int custom_accept_fake(int fd, struct sockaddr *addr, socklen_t *addrlen)
 	}
 }
 
-static int accept_wouldblock(int fd, struct sockaddr *addr, socklen_t *addrlen)
+static int accept_wouldblock(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
 {
 	(void)fd;
 	(void)addr;
 	(void)addrlen;
+	(void)flags;
 
 	errno = EWOULDBLOCK;
 	return -1;
 }
 
-static int accept_wouldblock_second(int fd, struct sockaddr *addr, socklen_t *addrlen)
+static int accept_wouldblock_second(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
 {
 	(void)fd;
 	(void)addr;
 	(void)addrlen;
+	(void)flags;
 
-	if (accept_fake.call_count == 1) {
+	if (accept4_fake.call_count == 1) {
 		return 42;
 	} else {
 		errno = EWOULDBLOCK;
@@ -173,11 +221,12 @@ static int accept_wouldblock_second(int fd, struct sockaddr *addr, socklen_t *ad
 	}
 }
 
-static int accept_fails(int fd, struct sockaddr *addr, socklen_t *addrlen)
+static int accept_fails(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
 {
 	(void)fd;
 	(void)addr;
 	(void)addrlen;
+	(void)flags;
 
 	errno = EINVAL;
 	return -1;
@@ -188,19 +237,19 @@ static void accept_handler_close_server_socket(struct cio_server_socket *ss, voi
 	(void)handler_context;
 	(void)err;
 	if (err == cio_success) {
-		sock->close(sock);
+		sock->ops->close(sock);
 	}
 	ss->close(ss);
 }
 
 static void test_accept_bind_address(void)
 {
-	accept_fake.custom_fake = custom_accept_fake;
+	accept4_fake.custom_fake = custom_accept_fake;
 	accept_handler_fake.custom_fake = accept_handler_close_server_socket;
 	cio_malloc_fake.custom_fake = malloc;
 	cio_free_fake.custom_fake = free;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, on_close);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -219,12 +268,12 @@ static void test_accept_bind_address(void)
 
 static void test_accept_close_in_accept_handler(void)
 {
-	accept_fake.custom_fake = custom_accept_fake;
+	accept4_fake.custom_fake = custom_accept_fake;
 	accept_handler_fake.custom_fake = accept_handler_close_server_socket;
 	cio_malloc_fake.custom_fake = malloc;
 	cio_free_fake.custom_fake = free;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, on_close);
 	ss.init(ss.context, 5);
@@ -238,10 +287,10 @@ static void test_accept_close_in_accept_handler(void)
 
 static void test_accept_wouldblock(void)
 {
-	accept_fake.custom_fake = accept_wouldblock;
+	accept4_fake.custom_fake = accept_wouldblock;
 	accept_handler_fake.custom_fake = accept_handler_close_server_socket;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, on_close);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -259,10 +308,10 @@ static void test_accept_wouldblock(void)
 
 static void test_accept_fails(void)
 {
-	accept_fake.custom_fake = accept_fails;
+	accept4_fake.custom_fake = accept_fails;
 	accept_handler_fake.custom_fake = accept_handler_close_server_socket;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, on_close);
 	ss.init(ss.context, 5);
@@ -278,7 +327,7 @@ static void test_set_nonblocking_fails(void)
 {
 	set_fd_non_blocking_fake.return_val = cio_bad_file_descriptor;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, on_close);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -289,7 +338,7 @@ static void test_set_nonblocking_fails(void)
 
 static void test_accept_no_handler(void)
 {
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, on_close);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -307,7 +356,7 @@ static void test_accept_eventloop_add_fails(void)
 {
 	cio_linux_eventloop_add_fake.return_val = cio_invalid_argument;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -324,7 +373,7 @@ static void test_init_fails_no_socket(void)
 {
 	socket_fake.return_val = -1;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -336,7 +385,7 @@ static void test_init_listen_fails(void)
 {
 	listen_fake.custom_fake = listen_fails;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -352,7 +401,7 @@ static void test_init_setsockopt_fails(void)
 {
 	setsockopt_fake.custom_fake = setsockopt_fails;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -368,7 +417,7 @@ static void test_init_register_read_fails(void)
 {
 	cio_linux_eventloop_register_read_fake.return_val = cio_no_space_left_on_device;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -386,7 +435,7 @@ static void test_enable_reuse_address(void)
 {
 	setsockopt_fake.custom_fake = setsockopt_capture;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -404,7 +453,7 @@ static void test_disable_reuse_address(void)
 {
 	setsockopt_fake.custom_fake = setsockopt_capture;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -422,7 +471,7 @@ static void test_init_bind_fails(void)
 {
 	bind_fake.custom_fake = bind_fails;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, NULL);
 	enum cio_error err = ss.init(ss.context, 5);
@@ -436,9 +485,9 @@ static void test_init_bind_fails(void)
 
 static void test_accept_malloc_fails(void)
 {
-	accept_fake.custom_fake = accept_wouldblock_second;
+	accept4_fake.custom_fake = accept_wouldblock_second;
 
-	struct cio_eventloop loop;
+	struct cio_eventloop loop = {0};
 	struct cio_server_socket ss;
 	cio_server_socket_init(&ss, &loop, on_close);
 	ss.init(ss.context, 5);
@@ -449,6 +498,317 @@ static void test_accept_malloc_fails(void)
 	TEST_ASSERT_EQUAL(1, close_fake.call_count);
 }
 
+static int accept_always(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+	(void)fd;
+	(void)addr;
+	(void)addrlen;
+	(void)flags;
+
+	return 42;
+}
+
+static int accept_three(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+	(void)fd;
+	(void)addr;
+	(void)addrlen;
+	(void)flags;
+
+	if (accept4_fake.call_count <= 3) {
+		return 42;
+	} else {
+		errno = EWOULDBLOCK;
+		return -1;
+	}
+}
+
+static void accept_handler_close_socket(struct cio_server_socket *ss, void *handler_context, enum cio_error err, struct cio_socket *sock)
+{
+	(void)ss;
+	(void)handler_context;
+	if (err == cio_success) {
+		sock->ops->close(sock);
+	}
+}
+
+static void accept_batch_handler_close_sockets(struct cio_server_socket *ss, void *handler_context, enum cio_error err, struct cio_socket **sockets, unsigned int count)
+{
+	unsigned int i;
+	(void)ss;
+	(void)handler_context;
+	(void)err;
+	for (i = 0; i < count; i++) {
+		sockets[i]->ops->close(sockets[i]);
+	}
+}
+
+static void test_accept_budget(void)
+{
+	accept4_fake.custom_fake = accept_always;
+	accept_handler_fake.custom_fake = accept_handler_close_socket;
+	cio_malloc_fake.custom_fake = malloc;
+	cio_free_fake.custom_fake = free;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, on_close);
+	ss.init(ss.context, 5);
+	ss.bind(ss.context, NULL, 12345);
+	ss.set_accept_budget(ss.context, 2);
+	enum cio_error err = ss.accept(ss.context, accept_handler, NULL);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	TEST_ASSERT_EQUAL(2, accept4_fake.call_count);
+	TEST_ASSERT_EQUAL(SOCK_NONBLOCK | SOCK_CLOEXEC, accept4_fake.arg3_val);
+	TEST_ASSERT_EQUAL(2, accept_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_defer_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&ss.accept_resume, cio_linux_eventloop_defer_fake.arg1_val);
+	TEST_ASSERT_EQUAL(1, set_fd_non_blocking_fake.call_count);
+
+	ss.close(ss.context);
+	TEST_ASSERT_EQUAL_PTR(&ss.accept_resume, cio_linux_eventloop_cancel_deferred_fake.arg1_val);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+}
+
+static void test_accept_batch(void)
+{
+	accept4_fake.custom_fake = accept_three;
+	accept_batch_handler_fake.custom_fake = accept_batch_handler_close_sockets;
+	cio_malloc_fake.custom_fake = malloc;
+	cio_free_fake.custom_fake = free;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, on_close);
+	ss.init(ss.context, 5);
+	ss.bind(ss.context, NULL, 12345);
+	enum cio_error err = ss.accept_batch(ss.context, accept_batch_handler, NULL);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	TEST_ASSERT_EQUAL(4, accept4_fake.call_count);
+	TEST_ASSERT_EQUAL(1, accept_batch_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, accept_batch_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(3, accept_batch_handler_fake.arg4_val);
+	TEST_ASSERT_EQUAL(0, cio_linux_eventloop_defer_fake.call_count);
+
+	ss.close(ss.context);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+}
+
+static void free_server_socket(struct cio_server_socket *ss)
+{
+	free(ss);
+}
+
+static void accept_batch_handler_close_server_socket(struct cio_server_socket *ss, void *handler_context, enum cio_error err, struct cio_socket **sockets, unsigned int count)
+{
+	accept_batch_handler_close_sockets(ss, handler_context, err, sockets, count);
+	ss->close(ss);
+}
+
+static void test_accept_close_and_free_in_accept_handler(void)
+{
+	accept4_fake.custom_fake = accept_always;
+	accept_handler_fake.custom_fake = accept_handler_close_server_socket;
+	on_close_fake.custom_fake = free_server_socket;
+	cio_malloc_fake.custom_fake = malloc;
+	cio_free_fake.custom_fake = free;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket *ss = malloc(sizeof(*ss));
+	cio_server_socket_init(ss, &loop, on_close);
+	ss->init(ss->context, 5);
+	ss->bind(ss->context, NULL, 12345);
+	ss->set_accept_budget(ss->context, 0);
+	enum cio_error err = ss->accept(ss->context, accept_handler, NULL);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	TEST_ASSERT_EQUAL(1, accept4_fake.call_count);
+	TEST_ASSERT_EQUAL(1, accept_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+}
+
+static void test_accept_batch_close_and_free_in_accept_handler(void)
+{
+	accept4_fake.custom_fake = accept_always;
+	accept_batch_handler_fake.custom_fake = accept_batch_handler_close_server_socket;
+	on_close_fake.custom_fake = free_server_socket;
+	cio_malloc_fake.custom_fake = malloc;
+	cio_free_fake.custom_fake = free;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket *ss = malloc(sizeof(*ss));
+	cio_server_socket_init(ss, &loop, on_close);
+	ss->init(ss->context, 5);
+	ss->bind(ss->context, NULL, 12345);
+	ss->set_accept_budget(ss->context, 0);
+	enum cio_error err = ss->accept_batch(ss->context, accept_batch_handler, NULL);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	TEST_ASSERT_EQUAL(1, accept_batch_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(accept4_fake.call_count, accept_batch_handler_fake.arg4_val);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+}
+
+static enum cio_error set_buffer_size_capture_receive_buffer(int fd, int option, size_t size)
+{
+	(void)fd;
+	if (option == SO_RCVBUF) {
+		optval = (int)size;
+	}
+
+	return cio_success;
+}
+
+static void test_set_socket_options(void)
+{
+	accept4_fake.custom_fake = accept_wouldblock_second;
+	accept_handler_fake.custom_fake = accept_handler_close_socket;
+	set_buffer_size_fake.custom_fake = set_buffer_size_capture_receive_buffer;
+	socket_fake.return_val = 5;
+	cio_malloc_fake.custom_fake = malloc;
+	cio_free_fake.custom_fake = free;
+
+	struct cio_socket_options options;
+	memset(&options, 0, sizeof(options));
+	options.tcp_no_delay = true;
+	options.keep_alive = true;
+	options.keep_idle_s = 60;
+	options.keep_intvl_s = 10;
+	options.keep_cnt = 5;
+	options.receive_buffer_size = 65536;
+	options.idle_timeout_ns = 1000;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, on_close);
+	ss.init(ss.context, 5);
+	enum cio_error err = ss.set_socket_options(ss.context, &options);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	TEST_ASSERT_EQUAL(1, set_tcp_no_delay_fake.call_count);
+	TEST_ASSERT_EQUAL(5, set_tcp_no_delay_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1, set_keep_alive_fake.call_count);
+	TEST_ASSERT_EQUAL(5, set_keep_alive_fake.arg0_val);
+	TEST_ASSERT_EQUAL(60, set_keep_alive_fake.arg2_val);
+	TEST_ASSERT_EQUAL(65536, optval);
+
+	ss.bind(ss.context, NULL, 12345);
+	unsigned int setsockopt_calls = setsockopt_fake.call_count;
+	unsigned int set_buffer_size_calls = set_buffer_size_fake.call_count;
+	err = ss.accept(ss.context, accept_handler, NULL);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	TEST_ASSERT_EQUAL(1, accept_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, set_tcp_no_delay_fake.call_count);
+	TEST_ASSERT_EQUAL(1, set_keep_alive_fake.call_count);
+	TEST_ASSERT_EQUAL(setsockopt_calls, setsockopt_fake.call_count);
+	TEST_ASSERT_EQUAL(set_buffer_size_calls, set_buffer_size_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_arm_deadline_fake.call_count);
+
+	ss.close(ss.context);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+}
+
+static void test_set_socket_options_switch_off(void)
+{
+	struct cio_socket_options options;
+	memset(&options, 0, sizeof(options));
+	options.tcp_no_delay = true;
+	options.keep_alive = true;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, NULL);
+	ss.init(ss.context, 5);
+	enum cio_error err = ss.set_socket_options(ss.context, &options);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	TEST_ASSERT_TRUE(set_tcp_no_delay_fake.arg1_val);
+	TEST_ASSERT_TRUE(set_keep_alive_fake.arg1_val);
+
+	memset(&options, 0, sizeof(options));
+	err = ss.set_socket_options(ss.context, &options);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	TEST_ASSERT_EQUAL(2, set_tcp_no_delay_fake.call_count);
+	TEST_ASSERT_FALSE(set_tcp_no_delay_fake.arg1_val);
+	TEST_ASSERT_EQUAL(2, set_keep_alive_fake.call_count);
+	TEST_ASSERT_FALSE(set_keep_alive_fake.arg1_val);
+	TEST_ASSERT_FALSE(ss.per_socket_options);
+	ss.close(ss.context);
+}
+
+static void test_set_socket_options_fails(void)
+{
+	set_tcp_no_delay_fake.return_val = cio_protocol_not_supported;
+
+	struct cio_socket_options options;
+	memset(&options, 0, sizeof(options));
+	options.tcp_no_delay = true;
+	options.tcp_quick_ack = true;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, NULL);
+	ss.init(ss.context, 5);
+	enum cio_error err = ss.set_socket_options(ss.context, &options);
+	TEST_ASSERT_EQUAL(cio_protocol_not_supported, err);
+	TEST_ASSERT_FALSE(ss.per_socket_options);
+	ss.close(ss.context);
+}
+
+static void test_init_unix_stream(void)
+{
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, NULL);
+	enum cio_error err = ss.init_unix(ss.context, 5, cio_unix_stream);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	TEST_ASSERT_EQUAL(AF_UNIX, socket_fake.arg0_val);
+	TEST_ASSERT_EQUAL(SOCK_STREAM, socket_fake.arg1_val);
+	err = ss.bind_unix(ss.context, "@cio");
+	TEST_ASSERT_EQUAL(cio_success, err);
+	TEST_ASSERT_EQUAL(1, fill_unix_address_fake.call_count);
+	TEST_ASSERT_EQUAL(1, bind_fake.call_count);
+	ss.close(ss.context);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+}
+
+static void test_init_unix_seqpacket(void)
+{
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, NULL);
+	enum cio_error err = ss.init_unix(ss.context, 5, cio_unix_seqpacket);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	TEST_ASSERT_EQUAL(AF_UNIX, socket_fake.arg0_val);
+	TEST_ASSERT_EQUAL(SOCK_SEQPACKET, socket_fake.arg1_val);
+	ss.close(ss.context);
+}
+
+static void test_init_unix_datagram_fails(void)
+{
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, NULL);
+	enum cio_error err = ss.init_unix(ss.context, 5, cio_unix_datagram);
+	TEST_ASSERT_EQUAL(cio_invalid_argument, err);
+	TEST_ASSERT_EQUAL(0, socket_fake.call_count);
+}
+
+static void test_bind_unix_invalid_path(void)
+{
+	fill_unix_address_fake.return_val = cio_filename_too_long;
+
+	struct cio_eventloop loop = {0};
+	struct cio_server_socket ss;
+	cio_server_socket_init(&ss, &loop, NULL);
+	enum cio_error err = ss.init_unix(ss.context, 5, cio_unix_stream);
+	TEST_ASSERT_EQUAL(cio_success, err);
+	err = ss.bind_unix(ss.context, "/very/long/path");
+	TEST_ASSERT_EQUAL(cio_filename_too_long, err);
+	TEST_ASSERT_EQUAL(0, bind_fake.call_count);
+	ss.close(ss.context);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -464,6 +824,17 @@ int main(void)
 	RUN_TEST(test_init_bind_fails);
 	RUN_TEST(test_set_nonblocking_fails);
 	RUN_TEST(test_accept_malloc_fails);
+	RUN_TEST(test_accept_budget);
+	RUN_TEST(test_accept_batch);
+	RUN_TEST(test_accept_close_and_free_in_accept_handler);
+	RUN_TEST(test_accept_batch_close_and_free_in_accept_handler);
+	RUN_TEST(test_set_socket_options);
+	RUN_TEST(test_set_socket_options_switch_off);
+	RUN_TEST(test_set_socket_options_fails);
+	RUN_TEST(test_init_unix_stream);
+	RUN_TEST(test_init_unix_seqpacket);
+	RUN_TEST(test_init_unix_datagram_fails);
+	RUN_TEST(test_bind_unix_invalid_path);
 	RUN_TEST(test_enable_reuse_address);
 	RUN_TEST(test_disable_reuse_address);
 	RUN_TEST(test_init_register_read_fails);
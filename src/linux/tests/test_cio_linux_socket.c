@@ -0,0 +1,1334 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/errqueue.h>
+#include <linux/fs.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_buffer_allocator.h"
+#include "cio_eventloop.h"
+#include "cio_linux_alloc.h"
+#include "cio_linux_buffer_tuner.h"
+#include "cio_linux_socket.h"
+#include "cio_linux_socket_utils.h"
+#include "cio_linux_uring.h"
+#include "cio_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_add, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_read, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_write, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VOID_FUNC(cio_linux_eventloop_remove, struct cio_eventloop *, const struct cio_event_notifier *)
+FAKE_VALUE_FUNC(uint64_t, cio_linux_eventloop_get_time_ns, const struct cio_eventloop *)
+FAKE_VOID_FUNC(cio_linux_eventloop_arm_deadline, struct cio_eventloop *, struct cio_linux_deadline *, uint64_t)
+FAKE_VOID_FUNC(cio_linux_eventloop_disarm_deadline, struct cio_eventloop *, struct cio_linux_deadline *)
+FAKE_VOID_FUNC(cio_linux_eventloop_defer, struct cio_eventloop *, struct cio_linux_deferred *)
+FAKE_VOID_FUNC(cio_linux_eventloop_cancel_deferred, struct cio_eventloop *, struct cio_linux_deferred *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_enable_remote, struct cio_eventloop *)
+FAKE_VOID_FUNC(cio_linux_eventloop_post, struct cio_eventloop *, struct cio_linux_remote *)
+FAKE_VOID_FUNC(cio_linux_eventloop_cancel_remote, struct cio_eventloop *, struct cio_linux_remote *)
+FAKE_VOID_FUNC(cio_linux_eventloop_record_receive_delay, struct cio_eventloop *, uint64_t)
+
+FAKE_VALUE_FUNC(enum cio_error, set_fd_non_blocking, int)
+FAKE_VALUE_FUNC(enum cio_error, set_tcp_no_delay, int, bool)
+FAKE_VALUE_FUNC(enum cio_error, set_keep_alive, int, bool, unsigned int, unsigned int, unsigned int)
+FAKE_VALUE_FUNC(enum cio_error, set_buffer_size, int, int, size_t)
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_uring_attach, struct cio_uring *, struct cio_socket *)
+FAKE_VALUE_FUNC(bool, cio_linux_uring_detach, struct cio_uring_stream *)
+FAKE_VOID_FUNC(cio_linux_uring_cancel_send, struct cio_uring_stream *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_buffer_tuner_attach, struct cio_buffer_tuner *, struct cio_socket *)
+FAKE_VOID_FUNC(cio_linux_buffer_tuner_detach, struct cio_socket *)
+
+FAKE_VALUE_FUNC(void *, cio_malloc, size_t)
+FAKE_VOID_FUNC(cio_free, void *)
+
+FAKE_VALUE_FUNC(int, close, int)
+FAKE_VALUE_FUNC(ssize_t, read, int, void *, size_t)
+FAKE_VALUE_FUNC(ssize_t, readv, int, const struct iovec *, int)
+FAKE_VALUE_FUNC(ssize_t, recvmsg, int, struct msghdr *, int)
+FAKE_VALUE_FUNC(ssize_t, sendmsg, int, const struct msghdr *, int)
+FAKE_VALUE_FUNC(ssize_t, sendfile, int, int, off_t *, size_t)
+FAKE_VALUE_FUNC(ssize_t, splice, int, loff_t *, int, loff_t *, size_t, unsigned int)
+FAKE_VALUE_FUNC(int, pipe2, int *, int)
+FAKE_VALUE_FUNC(int, sync_file_range, int, loff_t, loff_t, unsigned int)
+FAKE_VALUE_FUNC(int, fdatasync, int)
+FAKE_VALUE_FUNC(int, fsync, int)
+FAKE_VALUE_FUNC(int, posix_fadvise, int, off_t, off_t, int)
+FAKE_VALUE_FUNC(int, setsockopt, int, int, int, const void *, socklen_t)
+FAKE_VALUE_FUNC(int, getsockopt, int, int, int, void *, socklen_t *)
+FAKE_VALUE_FUNC_VARARG(int, ioctl, int, unsigned long, ...)
+
+void on_close(struct cio_socket *s);
+FAKE_VOID_FUNC(on_close, struct cio_socket *)
+void read_handler(void *handler_context, enum cio_error err, uint8_t *buf, size_t bytes_transferred);
+FAKE_VOID_FUNC(read_handler, void *, enum cio_error, uint8_t *, size_t)
+void readv_handler(void *handler_context, enum cio_error err, struct iovec *iov, unsigned int iovcnt, size_t bytes_transferred);
+FAKE_VOID_FUNC(readv_handler, void *, enum cio_error, struct iovec *, unsigned int, size_t)
+void write_handler(void *handler_context, enum cio_error err, size_t bytes_transferred);
+FAKE_VOID_FUNC(write_handler, void *, enum cio_error, size_t)
+void watermark_handler(struct cio_socket *s, void *handler_context, enum cio_error err, bool paused);
+FAKE_VOID_FUNC(watermark_handler, struct cio_socket *, void *, enum cio_error, bool)
+
+static const int client_fd = 42;
+
+void setUp(void)
+{
+	FFF_RESET_HISTORY();
+
+	RESET_FAKE(cio_linux_eventloop_add);
+	RESET_FAKE(cio_linux_eventloop_register_read);
+	RESET_FAKE(cio_linux_eventloop_register_write);
+	RESET_FAKE(cio_linux_eventloop_remove);
+	RESET_FAKE(cio_linux_eventloop_get_time_ns);
+	RESET_FAKE(cio_linux_eventloop_arm_deadline);
+	RESET_FAKE(cio_linux_eventloop_disarm_deadline);
+	RESET_FAKE(cio_linux_eventloop_defer);
+	RESET_FAKE(cio_linux_eventloop_cancel_deferred);
+	RESET_FAKE(cio_linux_eventloop_enable_remote);
+	RESET_FAKE(cio_linux_eventloop_post);
+	RESET_FAKE(cio_linux_eventloop_cancel_remote);
+	RESET_FAKE(cio_linux_eventloop_record_receive_delay);
+
+	RESET_FAKE(set_fd_non_blocking);
+	RESET_FAKE(set_tcp_no_delay);
+	RESET_FAKE(set_keep_alive);
+	RESET_FAKE(set_buffer_size);
+
+	RESET_FAKE(cio_linux_uring_attach);
+	RESET_FAKE(cio_linux_uring_detach);
+	RESET_FAKE(cio_linux_uring_cancel_send);
+	RESET_FAKE(cio_linux_buffer_tuner_attach);
+	RESET_FAKE(cio_linux_buffer_tuner_detach);
+
+	RESET_FAKE(cio_malloc);
+	RESET_FAKE(cio_free);
+	cio_malloc_fake.custom_fake = malloc;
+	cio_free_fake.custom_fake = free;
+
+	RESET_FAKE(close);
+	RESET_FAKE(read);
+	RESET_FAKE(readv);
+	RESET_FAKE(recvmsg);
+	RESET_FAKE(sendmsg);
+	RESET_FAKE(sendfile);
+	RESET_FAKE(splice);
+	RESET_FAKE(pipe2);
+	RESET_FAKE(sync_file_range);
+	RESET_FAKE(fdatasync);
+	RESET_FAKE(fsync);
+	RESET_FAKE(posix_fadvise);
+	RESET_FAKE(setsockopt);
+	RESET_FAKE(getsockopt);
+	RESET_FAKE(ioctl);
+
+	RESET_FAKE(on_close);
+	RESET_FAKE(read_handler);
+	RESET_FAKE(readv_handler);
+	RESET_FAKE(write_handler);
+	RESET_FAKE(watermark_handler);
+}
+
+static ssize_t read_wouldblock(int fd, void *buf, size_t count)
+{
+	(void)fd;
+	(void)buf;
+	(void)count;
+
+	errno = EAGAIN;
+	return -1;
+}
+
+static ssize_t sendmsg_wouldblock(int fd, const struct msghdr *msg, int flags)
+{
+	(void)fd;
+	(void)msg;
+	(void)flags;
+
+	errno = EAGAIN;
+	return -1;
+}
+
+static ssize_t sendfile_partly(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	(void)out_fd;
+	(void)in_fd;
+	(void)count;
+
+	if (sendfile_fake.call_count == 1) {
+		*offset += 100;
+		return 100;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+static int kernel_unsent;
+
+static int ioctl_unsent(int fd, unsigned long request, va_list args)
+{
+	int *value = va_arg(args, int *);
+	(void)fd;
+	(void)request;
+
+	*value = kernel_unsent;
+	return 0;
+}
+
+static ssize_t sendmsg_all(int fd, const struct msghdr *msg, int flags)
+{
+	ssize_t sent = 0;
+	size_t i;
+	(void)fd;
+	(void)flags;
+
+	for (i = 0; i < msg->msg_iovlen; i++) {
+		sent += (ssize_t)msg->msg_iov[i].iov_len;
+	}
+
+	return sent;
+}
+
+static ssize_t sendmsg_wouldblock_first(int fd, const struct msghdr *msg, int flags)
+{
+	if (sendmsg_fake.call_count == 1) {
+		return sendmsg_all(fd, msg, flags);
+	}
+
+	if (sendmsg_fake.call_count == 2) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return sendmsg_all(fd, msg, flags);
+}
+
+static ssize_t sendmsg_zerocopy_nobufs(int fd, const struct msghdr *msg, int flags)
+{
+	if ((flags & MSG_ZEROCOPY) != 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	return sendmsg_all(fd, msg, flags);
+}
+
+static unsigned int zerocopy_notifications;
+static uint8_t zerocopy_code;
+
+static ssize_t recvmsg_zerocopy_notification(int fd, struct msghdr *msg, int flags)
+{
+	struct sock_extended_err serr;
+	struct cmsghdr *cmsg;
+	(void)fd;
+	(void)flags;
+
+	if (zerocopy_notifications == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	zerocopy_notifications--;
+	memset(&serr, 0, sizeof(serr));
+	serr.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr.ee_code = zerocopy_code;
+	serr.ee_info = 0;
+	serr.ee_data = 0;
+
+	cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = SOL_IP;
+	cmsg->cmsg_type = IP_RECVERR;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(serr));
+	memcpy(CMSG_DATA(cmsg), &serr, sizeof(serr));
+	msg->msg_controllen = CMSG_SPACE(sizeof(serr));
+	return 0;
+}
+
+static ssize_t read_chunk(int fd, void *buf, size_t count)
+{
+	(void)fd;
+	(void)buf;
+
+	if (count > 10) {
+		count = 10;
+	}
+
+	return (ssize_t)count;
+}
+
+static unsigned int readable_chunks;
+
+static ssize_t read_chunks_then_wouldblock(int fd, void *buf, size_t count)
+{
+	if (readable_chunks == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	readable_chunks--;
+	return read_chunk(fd, buf, count);
+}
+
+static enum cio_error register_read(const struct cio_eventloop *loop, struct cio_event_notifier *ev)
+{
+	(void)loop;
+	ev->registered_events |= EPOLLIN;
+	return cio_success;
+}
+
+static struct cio_socket *reading_socket;
+static uint8_t read_buffer[100];
+
+static void read_again(void *handler_context, enum cio_error err, uint8_t *buf, size_t bytes_transferred)
+{
+	struct cio_io_stream *stream = reading_socket->ops->get_io_stream(reading_socket->context);
+	(void)handler_context;
+	(void)err;
+	(void)buf;
+	(void)bytes_transferred;
+
+	stream->ops->read_some(stream->context, read_buffer, sizeof(read_buffer), read_handler, NULL);
+}
+
+static unsigned int closes_seen_in_handler;
+
+static void close_in_read_handler(void *handler_context, enum cio_error err, uint8_t *buf, size_t bytes_transferred)
+{
+	(void)handler_context;
+	(void)err;
+	(void)buf;
+	(void)bytes_transferred;
+
+	reading_socket->ops->close(reading_socket->context);
+	closes_seen_in_handler = on_close_fake.call_count;
+}
+
+static void start_reading(struct cio_socket *s)
+{
+	struct cio_io_stream *stream = s->ops->get_io_stream(s->context);
+	reading_socket = s;
+	stream->ops->read_some(stream->context, read_buffer, sizeof(read_buffer), read_handler, NULL);
+}
+
+static ssize_t readv_partly(int fd, const struct iovec *iov, int iovcnt)
+{
+	(void)fd;
+	(void)iovcnt;
+
+	return (ssize_t)iov[0].iov_len + 5;
+}
+
+static ssize_t readv_fails(int fd, const struct iovec *iov, int iovcnt)
+{
+	(void)fd;
+	(void)iov;
+	(void)iovcnt;
+
+	errno = EBADF;
+	return -1;
+}
+
+static size_t sent_iovlen;
+
+static ssize_t sendmsg_vector(int fd, const struct msghdr *msg, int flags)
+{
+	sent_iovlen = msg->msg_iovlen;
+	return sendmsg_all(fd, msg, flags);
+}
+
+static ssize_t sendmsg_vector_wouldblock_first(int fd, const struct msghdr *msg, int flags)
+{
+	if (sendmsg_fake.call_count == 1) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return sendmsg_vector(fd, msg, flags);
+}
+
+static unsigned int buffers_allocated;
+static unsigned int buffers_freed;
+
+static struct cio_buffer alloc_buffer(void *context, size_t size)
+{
+	struct cio_buffer buffer;
+	(void)context;
+
+	buffer.address = malloc(size);
+	buffer.size = size;
+	buffers_allocated++;
+	return buffer;
+}
+
+static void free_buffer(void *context, void *ptr)
+{
+	(void)context;
+	free(ptr);
+	buffers_freed++;
+}
+
+static const struct cio_buffer_allocator allocator = {
+	.context = NULL,
+	.alloc = alloc_buffer,
+	.free = free_buffer,
+};
+
+static ssize_t read_fails(int fd, void *buf, size_t count)
+{
+	(void)fd;
+	(void)buf;
+	(void)count;
+
+	errno = EBADF;
+	return -1;
+}
+
+static void run_deferred(void)
+{
+	struct cio_linux_deferred *deferred = cio_linux_eventloop_defer_fake.arg1_val;
+	TEST_ASSERT_NOT_NULL(deferred);
+	deferred->callback(deferred->context);
+}
+
+static int pipe_fds(int *fds, int flags)
+{
+	(void)flags;
+	fds[0] = 10;
+	fds[1] = 11;
+	return 0;
+}
+
+static ssize_t splice_chunk(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+{
+	(void)off_in;
+	(void)fd_out;
+	(void)flags;
+
+	if (fd_in == client_fd) {
+		return (ssize_t)len;
+	}
+
+	*off_out += (loff_t)len;
+	return (ssize_t)len;
+}
+
+static void expire_deadline(struct cio_socket *s, uint64_t now)
+{
+	cio_linux_eventloop_get_time_ns_fake.return_val = now;
+	TEST_ASSERT_NOT_NULL(s->deadline.expired);
+	s->deadline.expired(s->deadline.context);
+}
+
+static void init_socket(struct cio_eventloop *loop, struct cio_socket *s)
+{
+	memset(loop, 0, sizeof(*loop));
+	enum cio_error err = cio_socket_init(s, client_fd, loop, on_close);
+	TEST_ASSERT_EQUAL(cio_success, err);
+}
+
+static void test_read_timeout(void)
+{
+	read_fake.custom_fake = read_wouldblock;
+	cio_linux_eventloop_get_time_ns_fake.return_val = 1000;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_read_timeout(s.context, 100);
+
+	uint8_t buffer[10];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->read_some(stream->context, buffer, sizeof(buffer), read_handler, NULL);
+	TEST_ASSERT_EQUAL(0, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1100, cio_linux_eventloop_arm_deadline_fake.arg2_val);
+
+	expire_deadline(&s, 1100);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_timed_out, read_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, read_handler_fake.arg3_val);
+	TEST_ASSERT_EQUAL(0, on_close_fake.call_count);
+}
+
+static void test_read_timeout_not_expired(void)
+{
+	read_fake.custom_fake = read_wouldblock;
+	cio_linux_eventloop_get_time_ns_fake.return_val = 1000;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_read_timeout(s.context, 100);
+
+	uint8_t buffer[10];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->read_some(stream->context, buffer, sizeof(buffer), read_handler, NULL);
+
+	unsigned int armed = cio_linux_eventloop_arm_deadline_fake.call_count;
+	expire_deadline(&s, 1050);
+	TEST_ASSERT_EQUAL(0, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(armed + 1, cio_linux_eventloop_arm_deadline_fake.call_count);
+	TEST_ASSERT_EQUAL(1100, cio_linux_eventloop_arm_deadline_fake.arg2_val);
+}
+
+static void test_write_timeout(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_wouldblock;
+	cio_linux_eventloop_get_time_ns_fake.return_val = 1000;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_write_timeout(s.context, 200);
+
+	static const uint8_t buffer[10];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_write_fake.call_count);
+	TEST_ASSERT_EQUAL(1200, cio_linux_eventloop_arm_deadline_fake.arg2_val);
+
+	expire_deadline(&s, 1200);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_timed_out, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, on_close_fake.call_count);
+}
+
+static enum cio_error attach_uring(struct cio_uring *ring, struct cio_socket *s)
+{
+	s->ext->uring = (struct cio_uring_stream *)(void *)ring;
+	return cio_success;
+}
+
+static void test_write_timeout_cancels_uring_send(void)
+{
+	static int ring;
+	sendmsg_fake.custom_fake = sendmsg_wouldblock;
+	cio_linux_uring_attach_fake.custom_fake = attach_uring;
+	cio_linux_eventloop_get_time_ns_fake.return_val = 1000;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_write_timeout(s.context, 200);
+	TEST_ASSERT_EQUAL(cio_success, s.ops->use_uring(s.context, (struct cio_uring *)(void *)&ring));
+
+	static const uint8_t buffer[10];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+
+	/*
+	 * The kernel still owns the buffer, so the write completes only once
+	 * the cancelled send returned it.
+	 */
+	expire_deadline(&s, 1200);
+	TEST_ASSERT_EQUAL(1, cio_linux_uring_cancel_send_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(s.ext->uring, cio_linux_uring_cancel_send_fake.arg0_val);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+	TEST_ASSERT_NOT_NULL(s.stream.write_handler);
+	TEST_ASSERT_EQUAL(0, s.write_expires_ns);
+
+	s.ops->close(s.context);
+	TEST_ASSERT_EQUAL(1, cio_linux_uring_detach_fake.call_count);
+}
+
+static void test_idle_timeout_closes_socket(void)
+{
+	cio_linux_eventloop_get_time_ns_fake.return_val = 1000;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_idle_timeout(s.context, 500);
+	TEST_ASSERT_EQUAL(1500, cio_linux_eventloop_arm_deadline_fake.arg2_val);
+
+	expire_deadline(&s, 1500);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+	TEST_ASSERT_EQUAL(&s, on_close_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+	TEST_ASSERT_EQUAL(client_fd, close_fake.arg0_val);
+}
+
+static void test_idle_timeout_completes_pending_read(void)
+{
+	read_fake.custom_fake = read_wouldblock;
+	cio_linux_eventloop_get_time_ns_fake.return_val = 1000;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_idle_timeout(s.context, 500);
+
+	uint8_t buffer[10];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->read_some(stream->context, buffer, sizeof(buffer), read_handler, NULL);
+
+	expire_deadline(&s, 1500);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_timed_out, read_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, on_close_fake.call_count);
+	TEST_ASSERT_EQUAL(2000, cio_linux_eventloop_arm_deadline_fake.arg2_val);
+}
+
+static void test_sendfile_timeout_reports_transferred_bytes(void)
+{
+	sendfile_fake.custom_fake = sendfile_partly;
+	cio_linux_eventloop_get_time_ns_fake.return_val = 1000;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_write_timeout(s.context, 200);
+
+	static const int file_fd = 7;
+	s.ops->sendfile(s.context, file_fd, 0, 1000, write_handler, NULL);
+	TEST_ASSERT_EQUAL(2, sendfile_fake.call_count);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+
+	expire_deadline(&s, 1200);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_timed_out, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(100, write_handler_fake.arg2_val);
+
+	s.ops->close(s.context);
+}
+
+static void pause_producer(struct cio_socket *s, struct cio_write_request *request, const uint8_t *buffer, size_t count)
+{
+	ioctl_fake.custom_fake = ioctl_unsent;
+	enum cio_error err = s->ops->set_write_watermarks(s->context, 100, 1000, watermark_handler, NULL);
+	TEST_ASSERT_EQUAL(cio_success, err);
+
+	s->ops->queue_write(s->context, request, buffer, count, write_handler, NULL);
+	TEST_ASSERT_EQUAL(1, watermark_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, watermark_handler_fake.arg2_val);
+	TEST_ASSERT_TRUE(watermark_handler_fake.arg3_val);
+
+	/*
+	 * The queue is flushed, but the kernel still holds more than the
+	 * low watermark.
+	 */
+	kernel_unsent = 800;
+	run_deferred();
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, watermark_handler_fake.call_count);
+}
+
+static void test_watermarks_pause_and_resume(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_all;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static uint8_t buffer[1200];
+	struct cio_write_request request;
+	pause_producer(&s, &request, buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_write_fake.call_count);
+
+	kernel_unsent = 500;
+	s.ev.write_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(1, watermark_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_register_write_fake.call_count);
+
+	kernel_unsent = 100;
+	s.ev.write_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(2, watermark_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, watermark_handler_fake.arg2_val);
+	TEST_ASSERT_FALSE(watermark_handler_fake.arg3_val);
+
+	s.ops->close(s.context);
+}
+
+static void test_watermarks_register_write_fails(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_all;
+	cio_linux_eventloop_register_write_fake.return_val = cio_bad_file_descriptor;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static uint8_t buffer[1200];
+	struct cio_write_request request;
+	ioctl_fake.custom_fake = ioctl_unsent;
+	s.ops->set_write_watermarks(s.context, 100, 1000, watermark_handler, NULL);
+	s.ops->queue_write(s.context, &request, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_EQUAL(1, watermark_handler_fake.call_count);
+
+	kernel_unsent = 800;
+	run_deferred();
+	TEST_ASSERT_EQUAL(2, watermark_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_bad_file_descriptor, watermark_handler_fake.arg2_val);
+	TEST_ASSERT_FALSE(watermark_handler_fake.arg3_val);
+
+	/*
+	 * The watermarks are disabled now.
+	 */
+	s.ops->queue_write(s.context, &request, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_EQUAL(2, watermark_handler_fake.call_count);
+
+	s.ops->close(s.context);
+}
+
+static void test_watermarks_keep_pending_write(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_wouldblock_first;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static uint8_t buffer[1200];
+	struct cio_write_request request;
+	pause_producer(&s, &request, buffer, sizeof(buffer));
+
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->write_some(stream->context, buffer, 10, write_handler, NULL);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+
+	/*
+	 * Checking the watermarks while the write waits must not take away
+	 * the write callback from the write.
+	 */
+	run_deferred();
+	s.ev.write_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(2, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(10, write_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(1, watermark_handler_fake.call_count);
+
+	/*
+	 * The completed write hands the watermarks back to the output queue.
+	 */
+	kernel_unsent = 50;
+	run_deferred();
+	TEST_ASSERT_EQUAL(2, watermark_handler_fake.call_count);
+	TEST_ASSERT_FALSE(watermark_handler_fake.arg3_val);
+
+	s.ops->close(s.context);
+}
+
+static void test_receive_file_starts_writeback(void)
+{
+	pipe2_fake.custom_fake = pipe_fds;
+	splice_fake.custom_fake = splice_chunk;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static const int file_fd = 7;
+	s.ops->receive_file(s.context, file_fd, 1000, 100, cio_file_sync_data, write_handler, NULL);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(100, write_handler_fake.arg2_val);
+
+	TEST_ASSERT_EQUAL(1, sync_file_range_fake.call_count);
+	TEST_ASSERT_EQUAL(file_fd, sync_file_range_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1000, sync_file_range_fake.arg1_val);
+	TEST_ASSERT_EQUAL(100, sync_file_range_fake.arg2_val);
+	TEST_ASSERT_EQUAL(SYNC_FILE_RANGE_WRITE, sync_file_range_fake.arg3_val);
+	TEST_ASSERT_EQUAL(1, fdatasync_fake.call_count);
+	TEST_ASSERT_EQUAL(1, posix_fadvise_fake.call_count);
+	TEST_ASSERT_EQUAL(POSIX_FADV_DONTNEED, posix_fadvise_fake.arg3_val);
+
+	s.ops->close(s.context);
+}
+
+static void test_receive_file_without_sync(void)
+{
+	pipe2_fake.custom_fake = pipe_fds;
+	splice_fake.custom_fake = splice_chunk;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static const int file_fd = 7;
+	s.ops->receive_file(s.context, file_fd, 0, 100, cio_file_sync_none, write_handler, NULL);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(100, write_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, sync_file_range_fake.call_count);
+	TEST_ASSERT_EQUAL(0, fdatasync_fake.call_count);
+	TEST_ASSERT_EQUAL(0, posix_fadvise_fake.call_count);
+
+	s.ops->close(s.context);
+}
+
+static void enable_zerocopy(struct cio_eventloop *loop, struct cio_socket *s)
+{
+	init_socket(loop, s);
+	TEST_ASSERT_EQUAL(cio_success, s->ops->set_zerocopy(s->context, true, 100));
+	TEST_ASSERT_EQUAL(SO_ZEROCOPY, setsockopt_fake.arg2_val);
+}
+
+static void test_zerocopy_write_completed_by_error_queue(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_all;
+	recvmsg_fake.custom_fake = recvmsg_zerocopy_notification;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	enable_zerocopy(&loop, &s);
+
+	static uint8_t buffer[200];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_TRUE((sendmsg_fake.arg2_val & MSG_ZEROCOPY) != 0);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+
+	zerocopy_notifications = 1;
+	zerocopy_code = 0;
+	s.ev.error_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(sizeof(buffer), write_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(MSG_ERRQUEUE, recvmsg_fake.arg2_val);
+
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_TRUE((sendmsg_fake.arg2_val & MSG_ZEROCOPY) != 0);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+
+	s.ops->close(s.context);
+}
+
+static void test_zerocopy_switched_off_if_kernel_copied(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_all;
+	recvmsg_fake.custom_fake = recvmsg_zerocopy_notification;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	enable_zerocopy(&loop, &s);
+
+	static uint8_t buffer[200];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+
+	zerocopy_notifications = 1;
+	zerocopy_code = SO_EE_CODE_ZEROCOPY_COPIED;
+	s.ev.error_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_EQUAL(0, sendmsg_fake.arg2_val & MSG_ZEROCOPY);
+	TEST_ASSERT_EQUAL(2, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(sizeof(buffer), write_handler_fake.arg2_val);
+
+	s.ops->close(s.context);
+}
+
+static void test_zerocopy_falls_back_to_copy_without_buffers(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_zerocopy_nobufs;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	enable_zerocopy(&loop, &s);
+
+	static uint8_t buffer[200];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_EQUAL(2, sendmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(0, sendmsg_fake.arg2_val & MSG_ZEROCOPY);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(sizeof(buffer), write_handler_fake.arg2_val);
+
+	s.ops->close(s.context);
+}
+
+static void test_close_aborts_pending_zerocopy_write(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_all;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	enable_zerocopy(&loop, &s);
+
+	static uint8_t buffer[200];
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->write_some(stream->context, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+
+	s.ops->close(s.context);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_operation_aborted, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+}
+
+static void test_drain_reads_until_wouldblock(void)
+{
+	readable_chunks = 3;
+	read_fake.custom_fake = read_chunks_then_wouldblock;
+	read_handler_fake.custom_fake = read_again;
+	cio_linux_eventloop_register_read_fake.custom_fake = register_read;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	start_reading(&s);
+	TEST_ASSERT_EQUAL(3, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, read_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(10, read_handler_fake.arg3_val);
+	TEST_ASSERT_EQUAL(4, read_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_read_fake.call_count);
+	TEST_ASSERT_EQUAL(0, cio_linux_eventloop_defer_fake.call_count);
+	TEST_ASSERT_FALSE(s.read_ready);
+
+	/*
+	 * The read issued by the last handler waits for the next event.
+	 */
+	readable_chunks = 1;
+	read_handler_fake.custom_fake = NULL;
+	s.ev.read_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(4, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(5, read_fake.call_count);
+
+	s.ops->close(s.context);
+}
+
+static void test_drain_budget_defers_to_read_resume(void)
+{
+	read_fake.custom_fake = read_chunk;
+	read_handler_fake.custom_fake = read_again;
+	cio_linux_eventloop_register_read_fake.custom_fake = register_read;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+	s.ops->set_read_budget(s.context, 20);
+
+	start_reading(&s);
+	TEST_ASSERT_EQUAL(2, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(2, read_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_defer_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&s.read_resume, cio_linux_eventloop_defer_fake.arg1_val);
+	TEST_ASSERT_TRUE(s.read_ready);
+	TEST_ASSERT_FALSE(s.draining);
+
+	/*
+	 * The next iteration continues with a fresh budget, although the
+	 * edge triggered notifier doesn't report the data again.
+	 */
+	run_deferred();
+	TEST_ASSERT_EQUAL(4, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(4, read_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_defer_fake.call_count);
+
+	s.ops->close(s.context);
+}
+
+static void test_drain_read_ready_carried_over(void)
+{
+	read_fake.custom_fake = read_chunk;
+	cio_linux_eventloop_register_read_fake.custom_fake = register_read;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	start_reading(&s);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_TRUE(s.read_ready);
+
+	/*
+	 * The socket didn't report EAGAIN, so the next read is served
+	 * right away without waiting for a new event.
+	 */
+	start_reading(&s);
+	TEST_ASSERT_EQUAL(2, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(2, read_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_read_fake.call_count);
+
+	s.ops->close(s.context);
+}
+
+static void test_drain_close_in_read_handler(void)
+{
+	read_fake.custom_fake = read_chunk;
+	read_handler_fake.custom_fake = close_in_read_handler;
+	cio_linux_eventloop_register_read_fake.custom_fake = register_read;
+	closes_seen_in_handler = 0;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	start_reading(&s);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, read_fake.call_count);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+
+	/*
+	 * The close hook may free the socket, so it's called only after
+	 * the drain loop was left.
+	 */
+	TEST_ASSERT_EQUAL(0, closes_seen_in_handler);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&s, on_close_fake.arg0_val);
+}
+
+static void test_readv_some(void)
+{
+	readv_fake.custom_fake = readv_partly;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	uint8_t header[10];
+	uint8_t body[20];
+	struct iovec iov[2] = {{header, sizeof(header)}, {body, sizeof(body)}};
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->readv_some(stream->context, iov, 2, readv_handler, NULL);
+	TEST_ASSERT_EQUAL(1, readv_fake.call_count);
+	TEST_ASSERT_EQUAL(client_fd, readv_fake.arg0_val);
+	TEST_ASSERT_EQUAL_PTR(iov, readv_fake.arg1_val);
+	TEST_ASSERT_EQUAL(2, readv_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, read_fake.call_count);
+
+	TEST_ASSERT_EQUAL(1, readv_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, readv_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL_PTR(iov, readv_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(2, readv_handler_fake.arg3_val);
+	TEST_ASSERT_EQUAL(sizeof(header) + 5, readv_handler_fake.arg4_val);
+	TEST_ASSERT_EQUAL(0, read_handler_fake.call_count);
+
+	s.ops->close(s.context);
+}
+
+static void test_readv_some_error(void)
+{
+	readv_fake.custom_fake = readv_fails;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	uint8_t buffer[10];
+	struct iovec iov[1] = {{buffer, sizeof(buffer)}};
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->readv_some(stream->context, iov, 1, readv_handler, NULL);
+	TEST_ASSERT_EQUAL(1, readv_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_bad_file_descriptor, readv_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, readv_handler_fake.arg4_val);
+
+	s.ops->close(s.context);
+}
+
+static void test_writev_some(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_vector;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static uint8_t header[10];
+	static uint8_t body[20];
+	const struct iovec iov[2] = {{header, sizeof(header)}, {body, sizeof(body)}};
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->writev_some(stream->context, iov, 2, write_handler, NULL);
+	TEST_ASSERT_EQUAL(1, sendmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(2, sent_iovlen);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(sizeof(header) + sizeof(body), write_handler_fake.arg2_val);
+
+	s.ops->close(s.context);
+}
+
+static void test_writev_some_waits_for_writable(void)
+{
+	sendmsg_fake.custom_fake = sendmsg_vector_wouldblock_first;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static uint8_t header[10];
+	static uint8_t body[20];
+	const struct iovec iov[2] = {{header, sizeof(header)}, {body, sizeof(body)}};
+	struct cio_io_stream *stream = s.ops->get_io_stream(s.context);
+	stream->ops->writev_some(stream->context, iov, 2, write_handler, NULL);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_write_fake.call_count);
+
+	s.ev.write_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(2, sendmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(2, sent_iovlen);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(sizeof(header) + sizeof(body), write_handler_fake.arg2_val);
+
+	s.ops->close(s.context);
+}
+
+static void start_allocated_read(struct cio_socket *s)
+{
+	struct cio_io_stream *stream = s->ops->get_io_stream(s->context);
+	buffers_allocated = 0;
+	buffers_freed = 0;
+	stream->ops->read_some_allocated(stream->context, &allocator, 100, read_handler, NULL);
+}
+
+static void test_read_allocated_waits_for_data(void)
+{
+	read_fake.custom_fake = read_chunk;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	start_allocated_read(&s);
+	TEST_ASSERT_EQUAL(0, buffers_allocated);
+	TEST_ASSERT_EQUAL(0, read_fake.call_count);
+
+	s.ev.read_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(1, buffers_allocated);
+	TEST_ASSERT_EQUAL(0, buffers_freed);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, read_handler_fake.arg1_val);
+	TEST_ASSERT_NOT_NULL(read_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL_PTR(read_handler_fake.arg2_val, read_fake.arg1_val);
+	TEST_ASSERT_EQUAL(10, read_handler_fake.arg3_val);
+
+	/*
+	 * The handler owns the buffer.
+	 */
+	free_buffer(NULL, read_handler_fake.arg2_val);
+	s.ops->close(s.context);
+}
+
+static void test_read_allocated_frees_buffer_on_wouldblock(void)
+{
+	read_fake.custom_fake = read_wouldblock;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	start_allocated_read(&s);
+	s.ev.read_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(1, read_fake.call_count);
+	TEST_ASSERT_EQUAL(1, buffers_allocated);
+	TEST_ASSERT_EQUAL(1, buffers_freed);
+	TEST_ASSERT_EQUAL(0, read_handler_fake.call_count);
+
+	/*
+	 * The read stays pending and gets a new buffer once data arrives.
+	 */
+	read_fake.custom_fake = read_chunk;
+	s.ev.read_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(2, buffers_allocated);
+	TEST_ASSERT_EQUAL(1, buffers_freed);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, read_handler_fake.arg1_val);
+
+	free_buffer(NULL, read_handler_fake.arg2_val);
+	s.ops->close(s.context);
+}
+
+static void test_read_allocated_frees_buffer_on_error(void)
+{
+	read_fake.custom_fake = read_fails;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	start_allocated_read(&s);
+	s.ev.read_callback(s.ev.context);
+	TEST_ASSERT_EQUAL(1, buffers_allocated);
+	TEST_ASSERT_EQUAL(1, buffers_freed);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_bad_file_descriptor, read_handler_fake.arg1_val);
+	TEST_ASSERT_NULL(read_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, read_handler_fake.arg3_val);
+
+	s.ops->close(s.context);
+}
+
+static void idle_readable(void *context)
+{
+	(void)context;
+}
+
+static void test_watch_idle_hands_back_read_callback(void)
+{
+	read_fake.custom_fake = read_chunk;
+	cio_linux_eventloop_register_read_fake.custom_fake = register_read;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	int owner;
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_socket_watch_idle(&s, idle_readable, &owner));
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_read_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(idle_readable, s.ev.read_callback);
+	TEST_ASSERT_EQUAL_PTR(&owner, s.ev.context);
+
+	start_reading(&s);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_register_read_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&s, s.ev.context);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+
+	/*
+	 * The read event is still registered, so watching again only swaps
+	 * the callback.
+	 */
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_socket_watch_idle(&s, idle_readable, &owner));
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_register_read_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(idle_readable, s.ev.read_callback);
+
+	s.ops->close(s.context);
+}
+
+static void test_idle_socket_has_no_extension(void)
+{
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	TEST_ASSERT_EQUAL(CIO_SOCKET_ABI_VERSION, cio_socket_abi_version());
+	TEST_ASSERT_NULL(s.ext);
+	TEST_ASSERT_EQUAL(0, s.ops->get_receive_timestamp(s.context));
+	TEST_ASSERT_EQUAL(cio_success, s.ops->set_write_watermarks(s.context, 0, 0, NULL, NULL));
+	TEST_ASSERT_EQUAL(cio_success, s.ops->set_receive_timestamps(s.context, false));
+	TEST_ASSERT_EQUAL(cio_success, s.ops->set_zerocopy(s.context, false, 0));
+	TEST_ASSERT_NULL(s.ext);
+	TEST_ASSERT_EQUAL(0, cio_malloc_fake.call_count);
+
+	s.ops->close(s.context);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+	TEST_ASSERT_EQUAL(0, cio_free_fake.call_count);
+}
+
+static void test_extension_freed_on_close(void)
+{
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static uint8_t buffer[10];
+	struct cio_write_request request;
+	s.ops->queue_write(s.context, &request, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_NOT_NULL(s.ext);
+	TEST_ASSERT_EQUAL(1, cio_malloc_fake.call_count);
+
+	s.ops->close(s.context);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_operation_aborted, write_handler_fake.arg1_val);
+	TEST_ASSERT_NULL(s.ext);
+	TEST_ASSERT_EQUAL(1, cio_free_fake.call_count);
+}
+
+static void test_extension_not_enough_memory(void)
+{
+	cio_malloc_fake.custom_fake = NULL;
+	cio_malloc_fake.return_val = NULL;
+
+	struct cio_eventloop loop;
+	struct cio_socket s;
+	init_socket(&loop, &s);
+
+	static uint8_t buffer[10];
+	struct cio_write_request request;
+	s.ops->queue_write(s.context, &request, buffer, sizeof(buffer), write_handler, NULL);
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_not_enough_memory, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(cio_not_enough_memory, s.ops->set_write_watermarks(s.context, 100, 1000, watermark_handler, NULL));
+	TEST_ASSERT_EQUAL(cio_not_enough_memory, s.ops->set_zerocopy(s.context, true, 0));
+	TEST_ASSERT_NULL(s.ext);
+
+	s.ops->close(s.context);
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_read_timeout);
+	RUN_TEST(test_read_timeout_not_expired);
+	RUN_TEST(test_write_timeout);
+	RUN_TEST(test_write_timeout_cancels_uring_send);
+	RUN_TEST(test_idle_timeout_closes_socket);
+	RUN_TEST(test_idle_timeout_completes_pending_read);
+	RUN_TEST(test_sendfile_timeout_reports_transferred_bytes);
+	RUN_TEST(test_watermarks_pause_and_resume);
+	RUN_TEST(test_watermarks_register_write_fails);
+	RUN_TEST(test_watermarks_keep_pending_write);
+	RUN_TEST(test_receive_file_starts_writeback);
+	RUN_TEST(test_receive_file_without_sync);
+	RUN_TEST(test_zerocopy_write_completed_by_error_queue);
+	RUN_TEST(test_zerocopy_switched_off_if_kernel_copied);
+	RUN_TEST(test_zerocopy_falls_back_to_copy_without_buffers);
+	RUN_TEST(test_close_aborts_pending_zerocopy_write);
+	RUN_TEST(test_drain_reads_until_wouldblock);
+	RUN_TEST(test_drain_budget_defers_to_read_resume);
+	RUN_TEST(test_drain_read_ready_carried_over);
+	RUN_TEST(test_drain_close_in_read_handler);
+	RUN_TEST(test_readv_some);
+	RUN_TEST(test_readv_some_error);
+	RUN_TEST(test_writev_some);
+	RUN_TEST(test_writev_some_waits_for_writable);
+	RUN_TEST(test_read_allocated_waits_for_data);
+	RUN_TEST(test_read_allocated_frees_buffer_on_wouldblock);
+	RUN_TEST(test_read_allocated_frees_buffer_on_error);
+	RUN_TEST(test_watch_idle_hands_back_read_callback);
+	RUN_TEST(test_idle_socket_has_no_extension);
+	RUN_TEST(test_extension_freed_on_close);
+	RUN_TEST(test_extension_not_enough_memory);
+	return UNITY_END();
+}
@@ -0,0 +1,444 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_linux_alloc.h"
+#include "cio_linux_socket.h"
+#include "cio_linux_socket_utils.h"
+#include "cio_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_add, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VOID_FUNC(cio_linux_eventloop_remove, struct cio_eventloop *, const struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_write, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(uint64_t, cio_linux_eventloop_get_time_ns, const struct cio_eventloop *)
+FAKE_VOID_FUNC(cio_linux_eventloop_arm_deadline, struct cio_eventloop *, struct cio_linux_deadline *, uint64_t)
+FAKE_VOID_FUNC(cio_linux_eventloop_disarm_deadline, struct cio_eventloop *, struct cio_linux_deadline *)
+
+FAKE_VOID_FUNC(cio_linux_socket_init, struct cio_socket *, int, struct cio_eventloop *, cio_socket_close_hook)
+FAKE_VALUE_FUNC(enum cio_error, fill_unix_address, struct sockaddr_un *, socklen_t *, const char *)
+
+FAKE_VALUE_FUNC(void *, cio_malloc, size_t)
+FAKE_VOID_FUNC(cio_free, void *)
+
+FAKE_VALUE_FUNC(int, getaddrinfo, const char *, const char *, const struct addrinfo *, struct addrinfo **)
+FAKE_VOID_FUNC(freeaddrinfo, struct addrinfo *)
+FAKE_VALUE_FUNC(int, socket, int, int, int)
+FAKE_VALUE_FUNC(int, connect, int, const struct sockaddr *, socklen_t)
+FAKE_VALUE_FUNC(int, setsockopt, int, int, int, const void *, socklen_t)
+FAKE_VALUE_FUNC(int, getsockopt, int, int, int, void *, socklen_t *)
+FAKE_VALUE_FUNC(int, close, int)
+
+void on_close(struct cio_socket *s);
+FAKE_VOID_FUNC(on_close, struct cio_socket *)
+void connect_handler(struct cio_socket *s, void *handler_context, enum cio_error err);
+FAKE_VOID_FUNC(connect_handler, struct cio_socket *, void *, enum cio_error)
+
+#define MAX_ADDRESSES 4
+#define FIRST_FD 10
+
+static const uint64_t now_ns = 1000;
+static const uint64_t attempt_delay_ns = 250000000ULL;
+static const uint64_t timeout_ns = 1000000000ULL;
+
+static struct addrinfo addresses[MAX_ADDRESSES];
+static struct sockaddr_storage socket_addresses[MAX_ADDRESSES];
+static int connect_errors[MAX_ADDRESSES];
+static int so_errors[MAX_ADDRESSES];
+static int next_fd;
+
+static struct cio_eventloop loop;
+static struct cio_socket s;
+
+static void init_addresses(const int *families, unsigned int num)
+{
+	unsigned int i;
+
+	memset(addresses, 0, sizeof(addresses));
+	memset(socket_addresses, 0, sizeof(socket_addresses));
+	for (i = 0; i < num; i++) {
+		addresses[i].ai_family = families[i];
+		addresses[i].ai_socktype = SOCK_STREAM;
+		addresses[i].ai_addr = (struct sockaddr *)&socket_addresses[i];
+		addresses[i].ai_addrlen = (families[i] == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		socket_addresses[i].ss_family = (sa_family_t)families[i];
+		if (i + 1 < num) {
+			addresses[i].ai_next = &addresses[i + 1];
+		}
+	}
+}
+
+static int create_socket(int domain, int type, int protocol)
+{
+	(void)domain;
+	(void)type;
+	(void)protocol;
+
+	return next_fd++;
+}
+
+static int connect_address(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	(void)addr;
+	(void)addrlen;
+
+	if (connect_errors[fd - FIRST_FD] != 0) {
+		errno = connect_errors[fd - FIRST_FD];
+		return -1;
+	}
+
+	return 0;
+}
+
+static int get_so_error(int fd, int level, int optname, void *optval, socklen_t *optlen)
+{
+	(void)level;
+	(void)optname;
+	(void)optlen;
+
+	memcpy(optval, &so_errors[fd - FIRST_FD], sizeof(int));
+	return 0;
+}
+
+static int resolve(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res)
+{
+	(void)node;
+	(void)service;
+	(void)hints;
+
+	*res = addresses;
+	return 0;
+}
+
+void setUp(void)
+{
+	unsigned int i;
+
+	FFF_RESET_HISTORY();
+
+	RESET_FAKE(cio_linux_eventloop_add);
+	RESET_FAKE(cio_linux_eventloop_remove);
+	RESET_FAKE(cio_linux_eventloop_register_write);
+	RESET_FAKE(cio_linux_eventloop_get_time_ns);
+	RESET_FAKE(cio_linux_eventloop_arm_deadline);
+	RESET_FAKE(cio_linux_eventloop_disarm_deadline);
+
+	RESET_FAKE(cio_linux_socket_init);
+	RESET_FAKE(fill_unix_address);
+
+	RESET_FAKE(cio_malloc);
+	RESET_FAKE(cio_free);
+
+	RESET_FAKE(getaddrinfo);
+	RESET_FAKE(freeaddrinfo);
+	RESET_FAKE(socket);
+	RESET_FAKE(connect);
+	RESET_FAKE(setsockopt);
+	RESET_FAKE(getsockopt);
+	RESET_FAKE(close);
+
+	RESET_FAKE(on_close);
+	RESET_FAKE(connect_handler);
+
+	cio_malloc_fake.custom_fake = malloc;
+	cio_free_fake.custom_fake = free;
+	cio_linux_eventloop_get_time_ns_fake.return_val = now_ns;
+	getaddrinfo_fake.custom_fake = resolve;
+	socket_fake.custom_fake = create_socket;
+	connect_fake.custom_fake = connect_address;
+	getsockopt_fake.custom_fake = get_so_error;
+
+	for (i = 0; i < MAX_ADDRESSES; i++) {
+		connect_errors[i] = EINPROGRESS;
+		so_errors[i] = 0;
+	}
+
+	next_fd = FIRST_FD;
+	memset(&loop, 0, sizeof(loop));
+	memset(&s, 0, sizeof(s));
+}
+
+void tearDown(void)
+{
+}
+
+static struct cio_event_notifier *attempt(unsigned int i)
+{
+	TEST_ASSERT_TRUE(i < cio_linux_eventloop_add_fake.call_count);
+	return cio_linux_eventloop_add_fake.arg1_history[i];
+}
+
+static void attempt_writable(unsigned int i)
+{
+	struct cio_event_notifier *ev = attempt(i);
+	ev->write_callback(ev->context);
+}
+
+static struct cio_linux_deadline *armed_deadline(unsigned int i)
+{
+	TEST_ASSERT_TRUE(i < cio_linux_eventloop_arm_deadline_fake.call_count);
+	return cio_linux_eventloop_arm_deadline_fake.arg1_history[i];
+}
+
+static void expire(struct cio_linux_deadline *deadline)
+{
+	deadline->expired(deadline->context);
+}
+
+static struct cio_socket_connect_state *connect_resolved(uint64_t timeout)
+{
+	struct cio_socket_connect_state *state = cio_socket_connect_state_alloc(addresses);
+	TEST_ASSERT_NOT_NULL(state);
+	TEST_ASSERT_EQUAL(cio_success, cio_socket_connect_resolved(&s, &loop, state, timeout, on_close, connect_handler, NULL));
+	return state;
+}
+
+static void test_first_attempt_wins(void)
+{
+	static const int families[] = {AF_INET6, AF_INET};
+	init_addresses(families, 2);
+
+	struct cio_socket_connect_state *state = connect_resolved(0);
+	TEST_ASSERT_EQUAL(1, socket_fake.call_count);
+	TEST_ASSERT_EQUAL(AF_INET6, socket_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_write_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_arm_deadline_fake.call_count);
+	TEST_ASSERT_EQUAL(now_ns + attempt_delay_ns, cio_linux_eventloop_arm_deadline_fake.arg2_val);
+
+	attempt_writable(0);
+	TEST_ASSERT_EQUAL(1, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, connect_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL_PTR(&s, connect_handler_fake.arg0_val);
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_init_fake.call_count);
+	TEST_ASSERT_EQUAL(FIRST_FD, cio_linux_socket_init_fake.arg1_val);
+	TEST_ASSERT_EQUAL_PTR(on_close, cio_linux_socket_init_fake.arg3_val);
+	TEST_ASSERT_EQUAL(1, socket_fake.call_count);
+	TEST_ASSERT_EQUAL(0, close_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_disarm_deadline_fake.call_count);
+
+	cio_socket_connect_state_free(state);
+}
+
+static void test_second_family_wins_after_delay(void)
+{
+	static const int families[] = {AF_INET6, AF_INET6, AF_INET};
+	init_addresses(families, 3);
+
+	struct cio_socket_connect_state *state = connect_resolved(timeout_ns);
+	TEST_ASSERT_EQUAL(1, socket_fake.call_count);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_arm_deadline_fake.call_count);
+	TEST_ASSERT_EQUAL(now_ns + timeout_ns, cio_linux_eventloop_arm_deadline_fake.arg2_val);
+
+	/*
+	 * The second attempt uses the other address family.
+	 */
+	expire(armed_deadline(0));
+	TEST_ASSERT_EQUAL(2, socket_fake.call_count);
+	TEST_ASSERT_EQUAL(AF_INET, socket_fake.arg0_val);
+	TEST_ASSERT_EQUAL_PTR(addresses[2].ai_addr, connect_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, connect_handler_fake.call_count);
+
+	attempt_writable(1);
+	TEST_ASSERT_EQUAL(1, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, connect_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(FIRST_FD + 1, cio_linux_socket_init_fake.arg1_val);
+
+	/*
+	 * The losing attempt is cancelled.
+	 */
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+	TEST_ASSERT_EQUAL(FIRST_FD, close_fake.arg0_val);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_remove_fake.call_count);
+	TEST_ASSERT_EQUAL(2, socket_fake.call_count);
+
+	cio_socket_connect_state_free(state);
+}
+
+static void test_failed_attempt_starts_next_one(void)
+{
+	static const int families[] = {AF_INET6, AF_INET};
+	init_addresses(families, 2);
+	so_errors[0] = ECONNREFUSED;
+
+	struct cio_socket_connect_state *state = connect_resolved(0);
+	attempt_writable(0);
+	TEST_ASSERT_EQUAL(0, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(2, socket_fake.call_count);
+	TEST_ASSERT_EQUAL(FIRST_FD, close_fake.arg0_val);
+
+	attempt_writable(1);
+	TEST_ASSERT_EQUAL(1, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, connect_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(FIRST_FD + 1, cio_linux_socket_init_fake.arg1_val);
+
+	cio_socket_connect_state_free(state);
+}
+
+static void test_all_attempts_fail(void)
+{
+	static const int families[] = {AF_INET6, AF_INET};
+	init_addresses(families, 2);
+	connect_errors[0] = ENETUNREACH;
+	so_errors[1] = ECONNREFUSED;
+
+	struct cio_socket_connect_state *state = connect_resolved(0);
+	TEST_ASSERT_EQUAL(2, socket_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_add_fake.call_count);
+
+	attempt_writable(0);
+	TEST_ASSERT_EQUAL(1, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(ECONNREFUSED, connect_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, cio_linux_socket_init_fake.call_count);
+	TEST_ASSERT_EQUAL(2, close_fake.call_count);
+
+	cio_socket_connect_state_free(state);
+}
+
+static void test_all_attempts_fail_immediately(void)
+{
+	static const int families[] = {AF_INET6, AF_INET};
+	init_addresses(families, 2);
+	connect_errors[0] = ENETUNREACH;
+	connect_errors[1] = ECONNREFUSED;
+
+	struct cio_socket_connect_state *state = cio_socket_connect_state_alloc(addresses);
+	TEST_ASSERT_EQUAL(ECONNREFUSED, cio_socket_connect_resolved(&s, &loop, state, 0, on_close, connect_handler, NULL));
+	TEST_ASSERT_EQUAL(0, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(2, close_fake.call_count);
+
+	cio_socket_connect_state_free(state);
+}
+
+static void test_timeout_with_attempts_in_flight(void)
+{
+	static const int families[] = {AF_INET6, AF_INET};
+	init_addresses(families, 2);
+
+	struct cio_socket_connect_state *state = connect_resolved(timeout_ns);
+	expire(armed_deadline(0));
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_add_fake.call_count);
+
+	expire(armed_deadline(1));
+	TEST_ASSERT_EQUAL(1, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_timed_out, connect_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, cio_linux_socket_init_fake.call_count);
+	TEST_ASSERT_EQUAL(2, close_fake.call_count);
+	TEST_ASSERT_EQUAL(FIRST_FD, close_fake.arg0_history[0]);
+	TEST_ASSERT_EQUAL(FIRST_FD + 1, close_fake.arg0_history[1]);
+	TEST_ASSERT_EQUAL(2, cio_linux_eventloop_remove_fake.call_count);
+
+	cio_socket_connect_state_free(state);
+}
+
+static void test_fast_open(void)
+{
+	static const int families[] = {AF_INET};
+	init_addresses(families, 1);
+
+	TEST_ASSERT_EQUAL(cio_success, cio_socket_connect_fast_open(&s, &loop, "localhost", 80, 0, on_close, connect_handler, NULL));
+	TEST_ASSERT_EQUAL(1, setsockopt_fake.call_count);
+	TEST_ASSERT_EQUAL(IPPROTO_TCP, setsockopt_fake.arg1_val);
+	TEST_ASSERT_EQUAL(TCP_FASTOPEN_CONNECT, setsockopt_fake.arg2_val);
+
+	/*
+	 * A single address needs no attempt delay.
+	 */
+	TEST_ASSERT_EQUAL(0, cio_linux_eventloop_arm_deadline_fake.call_count);
+
+	attempt_writable(0);
+	TEST_ASSERT_EQUAL(1, connect_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, connect_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(1, freeaddrinfo_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_free_fake.call_count);
+}
+
+static void test_connect_without_fast_open(void)
+{
+	static const int families[] = {AF_INET};
+	init_addresses(families, 1);
+
+	TEST_ASSERT_EQUAL(cio_success, cio_socket_connect(&s, &loop, "localhost", 80, 0, on_close, connect_handler, NULL));
+	TEST_ASSERT_EQUAL(0, setsockopt_fake.call_count);
+
+	attempt_writable(0);
+	TEST_ASSERT_EQUAL(cio_success, connect_handler_fake.arg2_val);
+}
+
+static void test_connect_unix(void)
+{
+	connect_errors[0] = 0;
+
+	TEST_ASSERT_EQUAL(cio_success, cio_socket_connect_unix(&s, &loop, "/tmp/cio.sock", cio_unix_seqpacket, on_close));
+	TEST_ASSERT_EQUAL(AF_UNIX, socket_fake.arg0_val);
+	TEST_ASSERT_EQUAL(SOCK_SEQPACKET, socket_fake.arg1_val & SOCK_SEQPACKET);
+	TEST_ASSERT_TRUE((socket_fake.arg1_val & SOCK_NONBLOCK) != 0);
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_init_fake.call_count);
+	TEST_ASSERT_EQUAL(FIRST_FD, cio_linux_socket_init_fake.arg1_val);
+}
+
+static void test_connect_unix_backlog_full(void)
+{
+	connect_errors[0] = EAGAIN;
+
+	TEST_ASSERT_EQUAL(EAGAIN, cio_socket_connect_unix(&s, &loop, "/tmp/cio.sock", cio_unix_stream, on_close));
+	TEST_ASSERT_EQUAL(0, cio_linux_socket_init_fake.call_count);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+	TEST_ASSERT_EQUAL(FIRST_FD, close_fake.arg0_val);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_first_attempt_wins);
+	RUN_TEST(test_second_family_wins_after_delay);
+	RUN_TEST(test_failed_attempt_starts_next_one);
+	RUN_TEST(test_all_attempts_fail);
+	RUN_TEST(test_all_attempts_fail_immediately);
+	RUN_TEST(test_timeout_with_attempts_in_flight);
+	RUN_TEST(test_fast_open);
+	RUN_TEST(test_connect_without_fast_open);
+	RUN_TEST(test_connect_unix);
+	RUN_TEST(test_connect_unix_backlog_full);
+	return UNITY_END();
+}
@@ -0,0 +1,119 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_eventloop.h"
+#include "cio_linux_socket.h"
+#include "cio_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+void visitor(struct cio_socket *, void *);
+FAKE_VOID_FUNC(visitor, struct cio_socket *, void *)
+
+#define NUM_SOCKETS 10
+
+static struct cio_eventloop loop;
+static struct cio_socket sockets[NUM_SOCKETS];
+static struct cio_socket_ext exts[NUM_SOCKETS];
+
+static const uint64_t bytes_read[NUM_SOCKETS] = {50, 10, 90, 30, 70, 20, 100, 60, 40, 80};
+
+void setUp(void)
+{
+	unsigned int i;
+
+	FFF_RESET_HISTORY();
+	RESET_FAKE(visitor);
+
+	memset(sockets, 0, sizeof(sockets));
+	memset(exts, 0, sizeof(exts));
+	loop.sockets = NULL;
+	for (i = 0; i < NUM_SOCKETS; i++) {
+		sockets[i].ext = &exts[i];
+		exts[i].stats.bytes_read = bytes_read[i];
+		exts[i].stats.write_calls = NUM_SOCKETS - i;
+		exts[i].stats_next = loop.sockets;
+		loop.sockets = &sockets[i];
+	}
+}
+
+static void test_for_each(void)
+{
+	int context;
+
+	TEST_ASSERT_EQUAL(cio_success, cio_socket_for_each(&loop, visitor, &context));
+	TEST_ASSERT_EQUAL(NUM_SOCKETS, visitor_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(&context, visitor_fake.arg1_val);
+}
+
+static void test_top_n(void)
+{
+	struct cio_socket *top[3];
+
+	TEST_ASSERT_EQUAL(3, cio_socket_top(&loop, cio_stats_bytes_read, top, 3));
+	TEST_ASSERT_EQUAL_PTR(&sockets[6], top[0]);
+	TEST_ASSERT_EQUAL_PTR(&sockets[2], top[1]);
+	TEST_ASSERT_EQUAL_PTR(&sockets[9], top[2]);
+
+	TEST_ASSERT_EQUAL(1, cio_socket_top(&loop, cio_stats_write_calls, top, 1));
+	TEST_ASSERT_EQUAL_PTR(&sockets[0], top[0]);
+}
+
+static void test_top_more_than_sockets(void)
+{
+	struct cio_socket *top[NUM_SOCKETS + 5];
+	unsigned int i;
+
+	TEST_ASSERT_EQUAL(NUM_SOCKETS, cio_socket_top(&loop, cio_stats_bytes_read, top, NUM_SOCKETS + 5));
+	for (i = 1; i < NUM_SOCKETS; i++) {
+		TEST_ASSERT_TRUE(top[i - 1]->ext->stats.bytes_read >= top[i]->ext->stats.bytes_read);
+	}
+}
+
+static void test_top_empty(void)
+{
+	struct cio_socket *top[3];
+
+	loop.sockets = NULL;
+	TEST_ASSERT_EQUAL(0, cio_socket_top(&loop, cio_stats_bytes_read, top, 3));
+	TEST_ASSERT_EQUAL(0, cio_socket_top(&loop, cio_stats_bytes_read, top, 0));
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_for_each);
+	RUN_TEST(test_top_n);
+	RUN_TEST(test_top_more_than_sockets);
+	RUN_TEST(test_top_empty);
+	return UNITY_END();
+}
@@ -0,0 +1,583 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netinet/udp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_buffer_allocator.h"
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_linux_socket_utils.h"
+#include "cio_udp_socket.h"
+
+DEFINE_FFF_GLOBALS
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_add, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VOID_FUNC(cio_linux_eventloop_remove, struct cio_eventloop *, const struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_read, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_write, const struct cio_eventloop *, struct cio_event_notifier *)
+
+FAKE_VALUE_FUNC(int, socket, int, int, int)
+FAKE_VALUE_FUNC(int, close, int)
+FAKE_VALUE_FUNC(int, setsockopt, int, int, int, const void *, socklen_t)
+FAKE_VALUE_FUNC(int, bind, int, const struct sockaddr *, socklen_t)
+FAKE_VALUE_FUNC(int, recvmmsg, int, struct mmsghdr *, unsigned int, int, struct timespec *)
+FAKE_VALUE_FUNC(int, sendmmsg, int, struct mmsghdr *, unsigned int, int)
+
+FAKE_VALUE_FUNC(enum cio_error, fill_unix_address, struct sockaddr_un *, socklen_t *, const char *)
+
+void receive_handler(struct cio_udp_socket *s, void *handler_context, enum cio_error err, struct cio_datagram *datagrams, unsigned int count);
+FAKE_VOID_FUNC(receive_handler, struct cio_udp_socket *, void *, enum cio_error, struct cio_datagram *, unsigned int)
+void send_handler(struct cio_udp_socket *s, void *handler_context, enum cio_error err, unsigned int count);
+FAKE_VOID_FUNC(send_handler, struct cio_udp_socket *, void *, enum cio_error, unsigned int)
+void on_close(struct cio_udp_socket *s);
+FAKE_VOID_FUNC(on_close, struct cio_udp_socket *)
+
+#define MAX_INCOMING 200
+#define MAX_CALLS 10
+
+static const int udp_fd = 5;
+
+struct incoming {
+	size_t length;
+	int segment_size;
+};
+
+static struct incoming incoming[MAX_INCOMING];
+static unsigned int num_incoming;
+static unsigned int next_incoming;
+
+/*
+ * The receive handler gets pointers into the receive buffers that are
+ * only valid during the call, so the fakes copy what the tests check.
+ */
+static size_t received_lengths[MAX_CALLS][CONFIG_UDP_BATCH_SIZE];
+static const void *received_addresses[MAX_CALLS][CONFIG_UDP_BATCH_SIZE];
+static const void *sent_addresses[MAX_CALLS];
+static unsigned int sent_counts[MAX_CALLS];
+
+static struct cio_eventloop loop;
+
+static enum cio_error add_notifier(const struct cio_eventloop *l, struct cio_event_notifier *ev)
+{
+	(void)l;
+	ev->registered_events = EPOLLET;
+	return cio_success;
+}
+
+static enum cio_error register_write(const struct cio_eventloop *l, struct cio_event_notifier *ev)
+{
+	(void)l;
+	ev->registered_events |= EPOLLOUT;
+	return cio_success;
+}
+
+static struct cio_buffer alloc_buffer(void *context, size_t size)
+{
+	struct cio_buffer buffer;
+
+	(void)context;
+	buffer.address = malloc(size);
+	buffer.size = size;
+	return buffer;
+}
+
+static void free_buffer(void *context, void *ptr)
+{
+	(void)context;
+	free(ptr);
+}
+
+static const struct cio_buffer_allocator allocator = {
+	.context = NULL,
+	.alloc = alloc_buffer,
+	.free = free_buffer,
+};
+
+static void queue_datagrams(unsigned int count, size_t length, int segment_size)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		incoming[num_incoming].length = length;
+		incoming[num_incoming].segment_size = segment_size;
+		num_incoming++;
+	}
+}
+
+static int receive_queued(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout)
+{
+	unsigned int i;
+
+	(void)fd;
+	(void)flags;
+	(void)timeout;
+
+	if (next_incoming == num_incoming) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	for (i = 0; (i < vlen) && (next_incoming < num_incoming); i++, next_incoming++) {
+		const struct incoming *datagram = &incoming[next_incoming];
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+
+		msgs[i].msg_len = (unsigned int)datagram->length;
+		if (datagram->length > hdr->msg_iov[0].iov_len) {
+			msgs[i].msg_len = (unsigned int)hdr->msg_iov[0].iov_len;
+			hdr->msg_flags |= MSG_TRUNC;
+		}
+
+		if ((datagram->segment_size != 0) && (hdr->msg_control != NULL)) {
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_GRO;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &datagram->segment_size, sizeof(int));
+		} else {
+			hdr->msg_controllen = 0;
+		}
+	}
+
+	return (int)i;
+}
+
+static void record_datagrams(struct cio_udp_socket *s, void *handler_context, enum cio_error err, struct cio_datagram *datagrams, unsigned int count)
+{
+	unsigned int call = receive_handler_fake.call_count - 1;
+	unsigned int i;
+
+	(void)s;
+	(void)handler_context;
+	(void)err;
+
+	if (call >= MAX_CALLS) {
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		received_lengths[call][i] = datagrams[i].length;
+		received_addresses[call][i] = datagrams[i].buffer.address;
+	}
+}
+
+static void close_in_receive_handler(struct cio_udp_socket *s, void *handler_context, enum cio_error err, struct cio_datagram *datagrams, unsigned int count)
+{
+	(void)handler_context;
+	(void)err;
+	(void)datagrams;
+	(void)count;
+	s->close(s->context);
+}
+
+static int send_partly(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+	unsigned int call = sendmmsg_fake.call_count - 1;
+
+	(void)fd;
+	(void)flags;
+
+	sent_addresses[call] = msgs[0].msg_hdr.msg_iov[0].iov_base;
+	sent_counts[call] = vlen;
+
+	switch (call) {
+	case 0:
+		return 2;
+	case 1:
+		errno = EAGAIN;
+		return -1;
+	default:
+		return (int)vlen;
+	}
+}
+
+static int send_all(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+	(void)fd;
+	(void)msgs;
+	(void)flags;
+	return (int)vlen;
+}
+
+static void close_in_send_handler(struct cio_udp_socket *s, void *handler_context, enum cio_error err, unsigned int count)
+{
+	(void)handler_context;
+	(void)err;
+	(void)count;
+	s->close(s->context);
+}
+
+static void free_socket(struct cio_udp_socket *s)
+{
+	free(s);
+}
+
+static struct cio_udp_socket *create_socket(void)
+{
+	struct cio_udp_socket *s = malloc(sizeof(*s));
+	TEST_ASSERT_NOT_NULL(s);
+	TEST_ASSERT_EQUAL(cio_success, cio_udp_socket_init(s, &loop, free_socket));
+	return s;
+}
+
+static void start_receive(struct cio_udp_socket *s, size_t buffer_size)
+{
+	TEST_ASSERT_EQUAL(cio_success, s->receive(s->context, &allocator, buffer_size, receive_handler, NULL));
+}
+
+static void readable(struct cio_udp_socket *s)
+{
+	s->ev.read_callback(s->ev.context);
+}
+
+void setUp(void)
+{
+	FFF_RESET_HISTORY();
+
+	RESET_FAKE(cio_linux_eventloop_add);
+	RESET_FAKE(cio_linux_eventloop_remove);
+	RESET_FAKE(cio_linux_eventloop_register_read);
+	RESET_FAKE(cio_linux_eventloop_register_write);
+
+	RESET_FAKE(socket);
+	RESET_FAKE(close);
+	RESET_FAKE(setsockopt);
+	RESET_FAKE(bind);
+	RESET_FAKE(recvmmsg);
+	RESET_FAKE(sendmmsg);
+	RESET_FAKE(fill_unix_address);
+
+	RESET_FAKE(receive_handler);
+	RESET_FAKE(send_handler);
+	RESET_FAKE(on_close);
+
+	cio_linux_eventloop_add_fake.custom_fake = add_notifier;
+	cio_linux_eventloop_register_write_fake.custom_fake = register_write;
+	socket_fake.return_val = udp_fd;
+	recvmmsg_fake.custom_fake = receive_queued;
+	receive_handler_fake.custom_fake = record_datagrams;
+	sendmmsg_fake.custom_fake = send_all;
+
+	num_incoming = 0;
+	next_incoming = 0;
+	memset(received_lengths, 0, sizeof(received_lengths));
+	memset(received_addresses, 0, sizeof(received_addresses));
+	memset(sent_addresses, 0, sizeof(sent_addresses));
+	memset(sent_counts, 0, sizeof(sent_counts));
+}
+
+void tearDown(void)
+{
+}
+
+static void test_receive_batch(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	start_receive(s, 1500);
+
+	queue_datagrams(3, 100, 0);
+	readable(s);
+
+	TEST_ASSERT_EQUAL(1, recvmmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(1, receive_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, receive_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(3, receive_handler_fake.arg4_val);
+	TEST_ASSERT_EQUAL(100, received_lengths[0][0]);
+	TEST_ASSERT_EQUAL(100, received_lengths[0][2]);
+
+	s->close(s->context);
+}
+
+static void test_receive_full_batch_reads_again(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	start_receive(s, 1500);
+
+	queue_datagrams(CONFIG_UDP_BATCH_SIZE + 2, 100, 0);
+	readable(s);
+
+	TEST_ASSERT_EQUAL(2, recvmmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(2, receive_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(CONFIG_UDP_BATCH_SIZE, receive_handler_fake.arg4_history[0]);
+	TEST_ASSERT_EQUAL(2, receive_handler_fake.arg4_history[1]);
+
+	s->close(s->context);
+}
+
+static void test_receive_error(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	start_receive(s, 1500);
+
+	recvmmsg_fake.custom_fake = NULL;
+	recvmmsg_fake.return_val = -1;
+	errno = ENOBUFS;
+	readable(s);
+
+	TEST_ASSERT_EQUAL(1, receive_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_no_buffer_space, receive_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(0, receive_handler_fake.arg4_val);
+
+	s->close(s->context);
+}
+
+static void test_close_in_receive_handler(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	start_receive(s, 1500);
+
+	receive_handler_fake.custom_fake = close_in_receive_handler;
+	queue_datagrams(CONFIG_UDP_BATCH_SIZE + 2, 100, 0);
+	readable(s);
+
+	TEST_ASSERT_EQUAL(1, recvmmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(1, receive_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+}
+
+static void test_gro_splits_segments(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	TEST_ASSERT_EQUAL(cio_success, s->set_gro(s->context, true));
+	start_receive(s, CONFIG_UDP_GRO_BUFFER_SIZE);
+
+	queue_datagrams(1, 2500, 1000);
+	readable(s);
+
+	TEST_ASSERT_EQUAL(1, receive_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(3, receive_handler_fake.arg4_val);
+	TEST_ASSERT_EQUAL(1000, received_lengths[0][0]);
+	TEST_ASSERT_EQUAL(1000, received_lengths[0][1]);
+	TEST_ASSERT_EQUAL(500, received_lengths[0][2]);
+	TEST_ASSERT_EQUAL_PTR((const uint8_t *)received_addresses[0][0] + 1000, received_addresses[0][1]);
+	TEST_ASSERT_EQUAL_PTR((const uint8_t *)received_addresses[0][0] + 2000, received_addresses[0][2]);
+
+	s->close(s->context);
+}
+
+static void test_gro_flushes_full_batch_of_segments(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	TEST_ASSERT_EQUAL(cio_success, s->set_gro(s->context, true));
+	start_receive(s, CONFIG_UDP_GRO_BUFFER_SIZE);
+
+	queue_datagrams(2, 40 * 1000, 1000);
+	readable(s);
+
+	TEST_ASSERT_EQUAL(2, receive_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(CONFIG_UDP_BATCH_SIZE, receive_handler_fake.arg4_history[0]);
+	TEST_ASSERT_EQUAL(80 - CONFIG_UDP_BATCH_SIZE, receive_handler_fake.arg4_history[1]);
+
+	/*
+	 * The second datagram was split across both calls.
+	 */
+	TEST_ASSERT_EQUAL_PTR((const uint8_t *)received_addresses[0][40] + (CONFIG_UDP_BATCH_SIZE - 40) * 1000, received_addresses[1][0]);
+	TEST_ASSERT_EQUAL(1000, received_lengths[1][80 - CONFIG_UDP_BATCH_SIZE - 1]);
+
+	s->close(s->context);
+}
+
+static void test_gro_close_in_receive_handler(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	TEST_ASSERT_EQUAL(cio_success, s->set_gro(s->context, true));
+	start_receive(s, CONFIG_UDP_GRO_BUFFER_SIZE);
+
+	receive_handler_fake.custom_fake = close_in_receive_handler;
+	queue_datagrams(2, 40 * 1000, 1000);
+	readable(s);
+
+	TEST_ASSERT_EQUAL(1, receive_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(CONFIG_UDP_BATCH_SIZE, receive_handler_fake.arg4_val);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+}
+
+static void test_gro_rejects_small_buffers(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	TEST_ASSERT_EQUAL(cio_success, s->set_gro(s->context, true));
+	TEST_ASSERT_EQUAL(cio_invalid_argument, s->receive(s->context, &allocator, 1500, receive_handler, NULL));
+	s->close(s->context);
+}
+
+static void test_gro_rejected_after_receive_with_small_buffers(void)
+{
+	struct cio_udp_socket *s = create_socket();
+	start_receive(s, 1500);
+
+	TEST_ASSERT_EQUAL(cio_invalid_argument, s->set_gro(s->context, true));
+	TEST_ASSERT_EQUAL(0, setsockopt_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, s->set_gro(s->context, false));
+
+	s->close(s->context);
+}
+
+static void test_send_partly_then_resume(void)
+{
+	struct cio_datagram datagrams[5];
+	uint8_t payload[5][10];
+	unsigned int i;
+	struct cio_udp_socket *s = create_socket();
+
+	memset(datagrams, 0, sizeof(datagrams));
+	for (i = 0; i < 5; i++) {
+		datagrams[i].buffer.address = payload[i];
+		datagrams[i].buffer.size = sizeof(payload[i]);
+		datagrams[i].length = sizeof(payload[i]);
+	}
+
+	sendmmsg_fake.custom_fake = send_partly;
+	s->send(s->context, datagrams, 5, send_handler, NULL);
+
+	TEST_ASSERT_EQUAL(2, sendmmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(5, sent_counts[0]);
+	TEST_ASSERT_EQUAL(3, sent_counts[1]);
+	TEST_ASSERT_EQUAL_PTR(payload[2], sent_addresses[1]);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_register_write_fake.call_count);
+	TEST_ASSERT_EQUAL(0, send_handler_fake.call_count);
+
+	s->ev.write_callback(s->ev.context);
+
+	TEST_ASSERT_EQUAL(3, sendmmsg_fake.call_count);
+	TEST_ASSERT_EQUAL_PTR(payload[2], sent_addresses[2]);
+	TEST_ASSERT_EQUAL(1, send_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, send_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(5, send_handler_fake.arg3_val);
+
+	s->ev.write_callback(s->ev.context);
+	TEST_ASSERT_EQUAL(3, sendmmsg_fake.call_count);
+	TEST_ASSERT_EQUAL(1, send_handler_fake.call_count);
+
+	s->close(s->context);
+}
+
+static void test_close_in_send_handler(void)
+{
+	struct cio_datagram datagram;
+	uint8_t payload[10];
+	struct cio_udp_socket *s = create_socket();
+
+	memset(&datagram, 0, sizeof(datagram));
+	datagram.buffer.address = payload;
+	datagram.buffer.size = sizeof(payload);
+	datagram.length = sizeof(payload);
+
+	send_handler_fake.custom_fake = close_in_send_handler;
+	s->send(s->context, &datagram, 1, send_handler, NULL);
+
+	TEST_ASSERT_EQUAL(1, send_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+}
+
+static int bind_address_in_use(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	(void)fd;
+	(void)addr;
+	(void)addrlen;
+
+	errno = EADDRINUSE;
+	return -1;
+}
+
+static void test_init_unix(void)
+{
+	struct cio_udp_socket *s = malloc(sizeof(*s));
+	TEST_ASSERT_NOT_NULL(s);
+	TEST_ASSERT_EQUAL(cio_success, cio_udp_socket_init_unix(s, &loop, free_socket));
+	TEST_ASSERT_EQUAL(AF_UNIX, socket_fake.arg0_val);
+	TEST_ASSERT_EQUAL(SOCK_DGRAM, socket_fake.arg1_val & SOCK_DGRAM);
+	TEST_ASSERT_EQUAL(1, cio_linux_eventloop_add_fake.call_count);
+
+	TEST_ASSERT_EQUAL(cio_success, s->bind_unix(s->context, "/tmp/cio.sock"));
+	TEST_ASSERT_EQUAL(1, fill_unix_address_fake.call_count);
+	TEST_ASSERT_EQUAL_STRING("/tmp/cio.sock", fill_unix_address_fake.arg2_val);
+	TEST_ASSERT_EQUAL(1, bind_fake.call_count);
+	TEST_ASSERT_EQUAL(udp_fd, bind_fake.arg0_val);
+	TEST_ASSERT_EQUAL_PTR(fill_unix_address_fake.arg0_val, bind_fake.arg1_val);
+
+	s->close(s->context);
+	TEST_ASSERT_EQUAL(1, close_fake.call_count);
+}
+
+static void test_bind_unix_invalid_path(void)
+{
+	fill_unix_address_fake.return_val = cio_filename_too_long;
+
+	struct cio_udp_socket *s = malloc(sizeof(*s));
+	TEST_ASSERT_NOT_NULL(s);
+	TEST_ASSERT_EQUAL(cio_success, cio_udp_socket_init_unix(s, &loop, free_socket));
+	TEST_ASSERT_EQUAL(cio_filename_too_long, s->bind_unix(s->context, "/tmp/cio.sock"));
+	TEST_ASSERT_EQUAL(0, bind_fake.call_count);
+
+	s->close(s->context);
+}
+
+static void test_bind_unix_fails(void)
+{
+	bind_fake.custom_fake = bind_address_in_use;
+
+	struct cio_udp_socket *s = malloc(sizeof(*s));
+	TEST_ASSERT_NOT_NULL(s);
+	TEST_ASSERT_EQUAL(cio_success, cio_udp_socket_init_unix(s, &loop, free_socket));
+	TEST_ASSERT_EQUAL(cio_address_in_use, s->bind_unix(s->context, "/tmp/cio.sock"));
+
+	s->close(s->context);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_receive_batch);
+	RUN_TEST(test_receive_full_batch_reads_again);
+	RUN_TEST(test_receive_error);
+	RUN_TEST(test_close_in_receive_handler);
+	RUN_TEST(test_gro_splits_segments);
+	RUN_TEST(test_gro_flushes_full_batch_of_segments);
+	RUN_TEST(test_gro_close_in_receive_handler);
+	RUN_TEST(test_gro_rejects_small_buffers);
+	RUN_TEST(test_gro_rejected_after_receive_with_small_buffers);
+	RUN_TEST(test_send_partly_then_resume);
+	RUN_TEST(test_close_in_send_handler);
+	RUN_TEST(test_init_unix);
+	RUN_TEST(test_bind_unix_invalid_path);
+	RUN_TEST(test_bind_unix_fails);
+	return UNITY_END();
+}
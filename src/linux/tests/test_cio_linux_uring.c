@@ -0,0 +1,800 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) <2017> <Stephan Gatzka>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include "fff.h"
+#include "unity.h"
+
+#include "cio_error_code.h"
+#include "cio_eventloop.h"
+#include "cio_linux_socket.h"
+#include "cio_linux_uring.h"
+#include "cio_socket.h"
+#include "cio_uring.h"
+
+DEFINE_FFF_GLOBALS
+
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_add, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VOID_FUNC(cio_linux_eventloop_remove, struct cio_eventloop *, const struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_register_read, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VALUE_FUNC(enum cio_error, cio_linux_eventloop_unregister_read, const struct cio_eventloop *, struct cio_event_notifier *)
+FAKE_VOID_FUNC(cio_linux_eventloop_defer, struct cio_eventloop *, struct cio_linux_deferred *)
+FAKE_VOID_FUNC(cio_linux_eventloop_cancel_deferred, struct cio_eventloop *, struct cio_linux_deferred *)
+
+FAKE_VALUE_FUNC_VARARG(long, syscall, long, ...)
+
+FAKE_VOID_FUNC(cio_linux_socket_read_started, struct cio_socket *)
+FAKE_VOID_FUNC(cio_linux_socket_read_completed, struct cio_socket *, size_t)
+FAKE_VOID_FUNC(cio_linux_socket_write_started, struct cio_socket *)
+FAKE_VOID_FUNC(cio_linux_socket_write_completed, struct cio_socket *, size_t)
+FAKE_VOID_FUNC(cio_linux_socket_touch_idle, struct cio_socket *)
+
+void on_close(struct cio_socket *s);
+FAKE_VOID_FUNC(on_close, struct cio_socket *)
+void read_handler(void *handler_context, enum cio_error err, uint8_t *buf, size_t bytes_transferred);
+FAKE_VOID_FUNC(read_handler, void *, enum cio_error, uint8_t *, size_t)
+void readv_handler(void *handler_context, enum cio_error err, struct iovec *iov, unsigned int iovcnt, size_t bytes_transferred);
+FAKE_VOID_FUNC(readv_handler, void *, enum cio_error, struct iovec *, unsigned int, size_t)
+void write_handler(void *handler_context, enum cio_error err, size_t bytes_transferred);
+FAKE_VOID_FUNC(write_handler, void *, enum cio_error, size_t)
+
+#define SQ_ENTRIES 8
+#define CQ_ENTRIES 16
+#define BUFFER_COUNT 4
+#define BUFFER_SIZE 16
+#define MAX_SUBMITTED 32
+#define MAX_OVERFLOW 8
+#define MAX_ENTER 16
+
+static const int socket_fd = 33;
+
+/*
+ * Layout of the fake memory shared by the submission and the completion
+ * queue, the kernel reports it with IORING_FEAT_SINGLE_MMAP. The ring
+ * file descriptor is a memfd, so the library maps the queues as usual.
+ */
+enum {
+	sq_head_offset = 0,
+	sq_tail_offset = 4,
+	sq_ring_mask_offset = 8,
+	sq_ring_entries_offset = 12,
+	sq_flags_offset = 16,
+	sq_dropped_offset = 20,
+	sq_array_offset = 64,
+	cq_head_offset = 128,
+	cq_tail_offset = 132,
+	cq_ring_mask_offset = 136,
+	cq_ring_entries_offset = 140,
+	cq_overflow_offset = 144,
+	cqes_offset = 192,
+};
+
+static struct io_uring_sqe submitted[MAX_SUBMITTED];
+static unsigned int num_submitted;
+static struct io_uring_cqe overflow[MAX_OVERFLOW];
+static unsigned int num_overflow;
+static unsigned int enter_flags[MAX_ENTER];
+static unsigned int num_enter;
+static uint16_t kernel_buffer_head;
+static bool kernel_busy;
+static uint64_t completed_user_data;
+
+static uint8_t read_data[64];
+static size_t read_length;
+
+static struct cio_eventloop loop;
+static struct cio_uring ring;
+static struct cio_socket s;
+static struct cio_socket_ext ext;
+
+static unsigned int *ring_field(size_t offset)
+{
+	return (unsigned int *)(void *)((uint8_t *)ring.sq_ring + offset);
+}
+
+static struct io_uring_cqe *cqes(void)
+{
+	return ring.cqes;
+}
+
+static void post_cqe(uint64_t user_data, int res, uint32_t flags)
+{
+	unsigned int tail = *ring_field(cq_tail_offset);
+
+	if ((tail - *ring_field(cq_head_offset)) == CQ_ENTRIES) {
+		TEST_ASSERT_TRUE(num_overflow < MAX_OVERFLOW);
+		overflow[num_overflow].user_data = user_data;
+		overflow[num_overflow].res = res;
+		overflow[num_overflow].flags = flags;
+		num_overflow++;
+		*ring_field(sq_flags_offset) |= IORING_SQ_CQ_OVERFLOW;
+		return;
+	}
+
+	cqes()[tail & (CQ_ENTRIES - 1)].user_data = user_data;
+	cqes()[tail & (CQ_ENTRIES - 1)].res = res;
+	cqes()[tail & (CQ_ENTRIES - 1)].flags = flags;
+	*ring_field(cq_tail_offset) = tail + 1;
+}
+
+static void flush_overflow(void)
+{
+	unsigned int i = 0;
+
+	while ((i < num_overflow) && ((*ring_field(cq_tail_offset) - *ring_field(cq_head_offset)) < CQ_ENTRIES)) {
+		post_cqe(overflow[i].user_data, overflow[i].res, overflow[i].flags);
+		i++;
+	}
+
+	memmove(overflow, &overflow[i], (num_overflow - i) * sizeof(overflow[0]));
+	num_overflow -= i;
+	if (num_overflow == 0) {
+		*ring_field(sq_flags_offset) &= ~IORING_SQ_CQ_OVERFLOW;
+	}
+}
+
+static void write_ring_field(int fd, size_t offset, unsigned int value)
+{
+	TEST_ASSERT_EQUAL(sizeof(value), pwrite(fd, &value, sizeof(value), (off_t)offset));
+}
+
+static int setup_ring(struct io_uring_params *params)
+{
+	int fd = memfd_create("ring", MFD_CLOEXEC);
+	TEST_ASSERT_TRUE(fd >= 0);
+	TEST_ASSERT_EQUAL(0, ftruncate(fd, (off_t)(IORING_OFF_SQES + SQ_ENTRIES * sizeof(struct io_uring_sqe))));
+
+	params->sq_entries = SQ_ENTRIES;
+	params->cq_entries = CQ_ENTRIES;
+	params->features = IORING_FEAT_SINGLE_MMAP;
+	params->sq_off.head = sq_head_offset;
+	params->sq_off.tail = sq_tail_offset;
+	params->sq_off.ring_mask = sq_ring_mask_offset;
+	params->sq_off.ring_entries = sq_ring_entries_offset;
+	params->sq_off.flags = sq_flags_offset;
+	params->sq_off.dropped = sq_dropped_offset;
+	params->sq_off.array = sq_array_offset;
+	params->cq_off.head = cq_head_offset;
+	params->cq_off.tail = cq_tail_offset;
+	params->cq_off.ring_mask = cq_ring_mask_offset;
+	params->cq_off.ring_entries = cq_ring_entries_offset;
+	params->cq_off.overflow = cq_overflow_offset;
+	params->cq_off.cqes = cqes_offset;
+
+	write_ring_field(fd, sq_ring_mask_offset, SQ_ENTRIES - 1);
+	write_ring_field(fd, sq_ring_entries_offset, SQ_ENTRIES);
+	write_ring_field(fd, cq_ring_mask_offset, CQ_ENTRIES - 1);
+	write_ring_field(fd, cq_ring_entries_offset, CQ_ENTRIES);
+	return fd;
+}
+
+/*
+ * Consumes the submitted entries like the kernel does. Cancel requests
+ * complete the cancelled operation right away, unless it completed
+ * already.
+ */
+static int enter(unsigned int to_submit, unsigned int flags)
+{
+	unsigned int i;
+
+	TEST_ASSERT_TRUE(num_enter < MAX_ENTER);
+	enter_flags[num_enter++] = flags;
+
+	if (kernel_busy) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	for (i = 0; i < to_submit; i++) {
+		unsigned int *head = ring_field(sq_head_offset);
+		unsigned int index = ring_field(sq_array_offset)[*head & (SQ_ENTRIES - 1)];
+		const struct io_uring_sqe *sqe = &ring.sqes[index];
+
+		TEST_ASSERT_TRUE(num_submitted < MAX_SUBMITTED);
+		submitted[num_submitted++] = *sqe;
+		(*head)++;
+
+		if (sqe->opcode == IORING_OP_ASYNC_CANCEL) {
+			if (sqe->addr == completed_user_data) {
+				post_cqe(sqe->user_data, -ENOENT, 0);
+			} else {
+				post_cqe(sqe->addr, -ECANCELED, 0);
+				post_cqe(sqe->user_data, 0, 0);
+			}
+		}
+	}
+
+	if ((flags & IORING_ENTER_GETEVENTS) != 0) {
+		flush_overflow();
+	}
+
+	return (int)to_submit;
+}
+
+static long fake_syscall(long number, va_list ap)
+{
+	if (number == __NR_io_uring_setup) {
+		(void)va_arg(ap, unsigned int);
+		return setup_ring(va_arg(ap, struct io_uring_params *));
+	}
+
+	if (number == __NR_io_uring_enter) {
+		unsigned int to_submit;
+		unsigned int flags;
+
+		(void)va_arg(ap, int);
+		to_submit = va_arg(ap, unsigned int);
+		(void)va_arg(ap, unsigned int);
+		flags = va_arg(ap, unsigned int);
+		return enter(to_submit, flags);
+	}
+
+	if (number == __NR_io_uring_register) {
+		return 0;
+	}
+
+	errno = ENOSYS;
+	return -1;
+}
+
+static unsigned int count_submitted(uint8_t opcode)
+{
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_submitted; i++) {
+		if (submitted[i].opcode == opcode) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+static const struct io_uring_sqe *last_submitted(uint8_t opcode)
+{
+	unsigned int i = num_submitted;
+
+	while (i > 0) {
+		i--;
+		if (submitted[i].opcode == opcode) {
+			return &submitted[i];
+		}
+	}
+
+	TEST_FAIL_MESSAGE("operation was not submitted");
+	return NULL;
+}
+
+/*
+ * Lets the kernel pick the next receive buffer for data arriving on the
+ * socket. Without a buffer, the multishot receive ends with ENOBUFS.
+ */
+static void kernel_receive(const char *data)
+{
+	const struct io_uring_buf_ring *br = ring.buffer_ring;
+	uint64_t user_data = last_submitted(IORING_OP_RECV)->user_data;
+	const struct io_uring_buf *buf;
+	size_t length = strlen(data);
+
+	if (kernel_buffer_head == __atomic_load_n(&br->tail, __ATOMIC_ACQUIRE)) {
+		post_cqe(user_data, -ENOBUFS, 0);
+		return;
+	}
+
+	buf = &br->bufs[kernel_buffer_head & (BUFFER_COUNT - 1)];
+	kernel_buffer_head++;
+	TEST_ASSERT_TRUE(length <= buf->len);
+	memcpy((void *)(uintptr_t)buf->addr, data, length);
+	post_cqe(user_data, (int)length, IORING_CQE_F_BUFFER | IORING_CQE_F_MORE | ((uint32_t)buf->bid << IORING_CQE_BUFFER_SHIFT));
+}
+
+static void run_deferred(void)
+{
+	if (cio_linux_eventloop_defer_fake.call_count > 0) {
+		struct cio_linux_deferred *deferred = cio_linux_eventloop_defer_fake.arg1_val;
+		deferred->callback(deferred->context);
+	}
+}
+
+static void ring_readable(void)
+{
+	ring.ev.read_callback(ring.ev.context);
+}
+
+static void save_read(void *handler_context, enum cio_error err, uint8_t *buf, size_t bytes_transferred)
+{
+	(void)handler_context;
+	(void)err;
+	memcpy(read_data, buf, bytes_transferred);
+	read_length = bytes_transferred;
+}
+
+static void read_some(size_t count)
+{
+	static uint8_t buffer[64];
+
+	s.stream.ops->read_some(s.stream.context, buffer, count, read_handler, NULL);
+}
+
+void setUp(void)
+{
+	FFF_RESET_HISTORY();
+
+	RESET_FAKE(cio_linux_eventloop_add);
+	RESET_FAKE(cio_linux_eventloop_remove);
+	RESET_FAKE(cio_linux_eventloop_register_read);
+	RESET_FAKE(cio_linux_eventloop_unregister_read);
+	RESET_FAKE(cio_linux_eventloop_defer);
+	RESET_FAKE(cio_linux_eventloop_cancel_deferred);
+
+	RESET_FAKE(syscall);
+
+	RESET_FAKE(cio_linux_socket_read_started);
+	RESET_FAKE(cio_linux_socket_read_completed);
+	RESET_FAKE(cio_linux_socket_write_started);
+	RESET_FAKE(cio_linux_socket_write_completed);
+	RESET_FAKE(cio_linux_socket_touch_idle);
+
+	RESET_FAKE(on_close);
+	RESET_FAKE(read_handler);
+	RESET_FAKE(readv_handler);
+	RESET_FAKE(write_handler);
+
+	syscall_fake.custom_fake = fake_syscall;
+	read_handler_fake.custom_fake = save_read;
+
+	num_submitted = 0;
+	num_overflow = 0;
+	num_enter = 0;
+	kernel_buffer_head = 0;
+	kernel_busy = false;
+	completed_user_data = 0;
+	memset(read_data, 0, sizeof(read_data));
+	read_length = 0;
+
+	TEST_ASSERT_EQUAL(cio_success, cio_uring_init(&ring, &loop, SQ_ENTRIES, BUFFER_SIZE, BUFFER_COUNT, NULL));
+
+	memset(&s, 0, sizeof(s));
+	memset(&ext, 0, sizeof(ext));
+	s.ev.fd = socket_fd;
+	s.ext = &ext;
+	s.loop = &loop;
+	s.close_hook = on_close;
+	s.stream.context = &s;
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_uring_attach(&ring, &s));
+	run_deferred();
+	TEST_ASSERT_EQUAL(1, count_submitted(IORING_OP_RECV));
+}
+
+void tearDown(void)
+{
+	if ((ext.uring != NULL) && cio_linux_uring_detach(ext.uring)) {
+		run_deferred();
+		ring_readable();
+	}
+
+	ring.close(ring.context);
+}
+
+static void test_receive_is_multishot(void)
+{
+	const struct io_uring_sqe *sqe = last_submitted(IORING_OP_RECV);
+
+	TEST_ASSERT_EQUAL(socket_fd, sqe->fd);
+	TEST_ASSERT_EQUAL(IORING_RECV_MULTISHOT, sqe->ioprio);
+	TEST_ASSERT_EQUAL(IOSQE_BUFFER_SELECT, sqe->flags);
+}
+
+static void test_read_across_buffers(void)
+{
+	kernel_receive("0123456789abcdef");
+	kernel_receive("ghij");
+	ring_readable();
+	TEST_ASSERT_EQUAL(2, ring.buffers_held);
+
+	read_some(20);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, read_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(20, read_length);
+	TEST_ASSERT_EQUAL_MEMORY("0123456789abcdefghij", read_data, 20);
+	TEST_ASSERT_EQUAL(0, ring.buffers_held);
+}
+
+static void test_read_parts_of_buffers(void)
+{
+	kernel_receive("0123456789abcdef");
+	kernel_receive("ghij");
+	ring_readable();
+
+	read_some(10);
+	TEST_ASSERT_EQUAL(10, read_length);
+	TEST_ASSERT_EQUAL_MEMORY("0123456789", read_data, 10);
+	TEST_ASSERT_EQUAL(2, ring.buffers_held);
+
+	read_some(8);
+	TEST_ASSERT_EQUAL(8, read_length);
+	TEST_ASSERT_EQUAL_MEMORY("abcdefgh", read_data, 8);
+	TEST_ASSERT_EQUAL(1, ring.buffers_held);
+
+	read_some(8);
+	TEST_ASSERT_EQUAL(3, read_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(2, read_length);
+	TEST_ASSERT_EQUAL_MEMORY("ij", read_data, 2);
+	TEST_ASSERT_EQUAL(0, ring.buffers_held);
+}
+
+static void test_readv_across_buffers(void)
+{
+	uint8_t first[7];
+	uint8_t second[13];
+	struct iovec iov[2];
+
+	iov[0].iov_base = first;
+	iov[0].iov_len = sizeof(first);
+	iov[1].iov_base = second;
+	iov[1].iov_len = sizeof(second);
+
+	kernel_receive("0123456789abcdef");
+	kernel_receive("ghij");
+	ring_readable();
+
+	s.stream.ops->readv_some(s.stream.context, iov, 2, readv_handler, NULL);
+	TEST_ASSERT_EQUAL(1, readv_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, readv_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(20, readv_handler_fake.arg4_val);
+	TEST_ASSERT_EQUAL_MEMORY("0123456", first, sizeof(first));
+	TEST_ASSERT_EQUAL_MEMORY("789abcdefghij", second, sizeof(second));
+}
+
+static void test_enobufs_restarts_after_buffer_returned(void)
+{
+	kernel_receive("0123456789abcdef");
+	kernel_receive("0123456789abcdef");
+	kernel_receive("0123456789abcdef");
+	kernel_receive("0123456789abcdef");
+	kernel_receive("lost");
+	ring_readable();
+	run_deferred();
+
+	TEST_ASSERT_EQUAL(BUFFER_COUNT, ring.buffers_held);
+	TEST_ASSERT_EQUAL(1, count_submitted(IORING_OP_RECV));
+
+	read_some(16);
+	run_deferred();
+	TEST_ASSERT_EQUAL(BUFFER_COUNT - 1, ring.buffers_held);
+	TEST_ASSERT_EQUAL(2, count_submitted(IORING_OP_RECV));
+	TEST_ASSERT_EQUAL(IORING_RECV_MULTISHOT, last_submitted(IORING_OP_RECV)->ioprio);
+
+	kernel_receive("more");
+	ring_readable();
+	TEST_ASSERT_EQUAL(BUFFER_COUNT, ring.buffers_held);
+}
+
+static void test_enobufs_restarts_right_away(void)
+{
+	kernel_receive("0123456789abcdef");
+	kernel_receive("0123456789abcdef");
+	kernel_receive("0123456789abcdef");
+	kernel_receive("0123456789abcdef");
+
+	/*
+	 * A read served before the ENOBUFS completion is reaped returns a
+	 * buffer, so the receive doesn't need to wait.
+	 */
+	read_handler_fake.custom_fake = NULL;
+	ring_readable();
+	TEST_ASSERT_EQUAL(BUFFER_COUNT, ring.buffers_held);
+	read_some(16);
+	TEST_ASSERT_EQUAL(BUFFER_COUNT - 1, ring.buffers_held);
+
+	post_cqe(last_submitted(IORING_OP_RECV)->user_data, -ENOBUFS, 0);
+	ring_readable();
+	run_deferred();
+	TEST_ASSERT_EQUAL(2, count_submitted(IORING_OP_RECV));
+}
+
+static void test_partial_send(void)
+{
+	static const uint8_t data[100];
+	const struct io_uring_sqe *sqe;
+
+	s.stream.ops->write_some(s.stream.context, data, sizeof(data), write_handler, NULL);
+	run_deferred();
+	sqe = last_submitted(IORING_OP_SEND);
+	TEST_ASSERT_EQUAL(socket_fd, sqe->fd);
+	TEST_ASSERT_EQUAL(sizeof(data), sqe->len);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+
+	post_cqe(sqe->user_data, 40, 0);
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(40, write_handler_fake.arg2_val);
+}
+
+static void test_timeouts_follow_reads(void)
+{
+	read_some(4);
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_read_started_fake.call_count);
+	TEST_ASSERT_EQUAL(0, cio_linux_socket_read_completed_fake.call_count);
+
+	kernel_receive("data");
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_touch_idle_fake.call_count);
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_read_completed_fake.call_count);
+	TEST_ASSERT_EQUAL(4, cio_linux_socket_read_completed_fake.arg1_val);
+	TEST_ASSERT_EQUAL(1, read_handler_fake.call_count);
+}
+
+static void test_timed_out_send_is_cancelled(void)
+{
+	static const uint8_t data[100];
+	uint64_t send_user_data;
+
+	s.stream.ops->write_some(s.stream.context, data, sizeof(data), write_handler, NULL);
+	run_deferred();
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_write_started_fake.call_count);
+	send_user_data = last_submitted(IORING_OP_SEND)->user_data;
+
+	cio_linux_uring_cancel_send(ext.uring);
+	run_deferred();
+	TEST_ASSERT_EQUAL(send_user_data, last_submitted(IORING_OP_ASYNC_CANCEL)->addr);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_timed_out, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.arg2_val);
+	TEST_ASSERT_EQUAL(1, cio_linux_socket_write_completed_fake.call_count);
+	TEST_ASSERT_NULL(s.stream.write_handler);
+}
+
+static void test_send_completed_before_cancel(void)
+{
+	static const uint8_t data[100];
+	uint64_t send_user_data;
+
+	s.stream.ops->write_some(s.stream.context, data, sizeof(data), write_handler, NULL);
+	run_deferred();
+	send_user_data = last_submitted(IORING_OP_SEND)->user_data;
+
+	post_cqe(send_user_data, sizeof(data), 0);
+	completed_user_data = send_user_data;
+	cio_linux_uring_cancel_send(ext.uring);
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(cio_success, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(sizeof(data), write_handler_fake.arg2_val);
+
+	/*
+	 * The cancel finds nothing anymore and doesn't time out the next
+	 * write.
+	 */
+	run_deferred();
+	ring_readable();
+	s.stream.ops->write_some(s.stream.context, data, sizeof(data), write_handler, NULL);
+	run_deferred();
+	post_cqe(last_submitted(IORING_OP_SEND)->user_data, -EPIPE, 0);
+	ring_readable();
+	TEST_ASSERT_EQUAL(2, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(EPIPE, write_handler_fake.arg1_val);
+}
+
+static void test_writev_error(void)
+{
+	static const uint8_t data[100];
+	struct iovec iov[2];
+	const struct io_uring_sqe *sqe;
+
+	iov[0].iov_base = (void *)(uintptr_t)data;
+	iov[0].iov_len = 50;
+	iov[1].iov_base = (void *)(uintptr_t)(data + 50);
+	iov[1].iov_len = 50;
+
+	s.stream.ops->writev_some(s.stream.context, iov, 2, write_handler, NULL);
+	run_deferred();
+	sqe = last_submitted(IORING_OP_SENDMSG);
+
+	post_cqe(sqe->user_data, -EPIPE, 0);
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+	TEST_ASSERT_EQUAL(EPIPE, write_handler_fake.arg1_val);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.arg2_val);
+}
+
+static void test_detach_with_operations_in_flight(void)
+{
+	static const uint8_t data[10];
+	uint64_t send_user_data;
+
+	kernel_receive("held");
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, ring.buffers_held);
+
+	s.stream.ops->write_some(s.stream.context, data, sizeof(data), write_handler, NULL);
+	run_deferred();
+	send_user_data = last_submitted(IORING_OP_SEND)->user_data;
+
+	TEST_ASSERT_TRUE(cio_linux_uring_detach(ext.uring));
+	ext.uring = NULL;
+	TEST_ASSERT_EQUAL(0, ring.buffers_held);
+
+	/*
+	 * Data arriving before the cancel was processed is dropped.
+	 */
+	kernel_receive("late");
+	run_deferred();
+	TEST_ASSERT_EQUAL(1, count_submitted(IORING_OP_ASYNC_CANCEL));
+	TEST_ASSERT_EQUAL(last_submitted(IORING_OP_RECV)->user_data, last_submitted(IORING_OP_ASYNC_CANCEL)->addr);
+
+	ring_readable();
+	TEST_ASSERT_EQUAL(0, ring.buffers_held);
+	TEST_ASSERT_EQUAL(0, on_close_fake.call_count);
+
+	post_cqe(send_user_data, sizeof(data), 0);
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, on_close_fake.call_count);
+	TEST_ASSERT_EQUAL(0, write_handler_fake.call_count);
+}
+
+static void fill_completion_queue(void)
+{
+	unsigned int i;
+
+	/*
+	 * Completions of cancel requests carry no user data and are ignored.
+	 */
+	for (i = 0; i < CQ_ENTRIES; i++) {
+		post_cqe(0, 0, 0);
+	}
+}
+
+static void test_overflowed_completions_are_reaped(void)
+{
+	fill_completion_queue();
+	kernel_receive("overflow");
+	TEST_ASSERT_EQUAL(1, num_overflow);
+
+	ring_readable();
+	TEST_ASSERT_EQUAL(0, num_overflow);
+	TEST_ASSERT_EQUAL(0, *ring_field(sq_flags_offset) & IORING_SQ_CQ_OVERFLOW);
+	TEST_ASSERT_EQUAL(IORING_ENTER_GETEVENTS, enter_flags[num_enter - 1]);
+	TEST_ASSERT_EQUAL(1, ring.buffers_held);
+
+	read_some(8);
+	TEST_ASSERT_EQUAL(8, read_length);
+	TEST_ASSERT_EQUAL_MEMORY("overflow", read_data, 8);
+}
+
+static void test_submit_reaps_overflowed_completions(void)
+{
+	static const uint8_t data[10];
+	unsigned int enters = num_enter;
+
+	fill_completion_queue();
+	kernel_receive("overflow");
+
+	s.stream.ops->write_some(s.stream.context, data, sizeof(data), write_handler, NULL);
+	run_deferred();
+
+	TEST_ASSERT_EQUAL(enters + 2, num_enter);
+	TEST_ASSERT_EQUAL(IORING_ENTER_GETEVENTS, enter_flags[enters]);
+	TEST_ASSERT_EQUAL(0, enter_flags[enters + 1]);
+	TEST_ASSERT_EQUAL(1, count_submitted(IORING_OP_SEND));
+	TEST_ASSERT_EQUAL(1, ring.buffers_held);
+
+	post_cqe(last_submitted(IORING_OP_SEND)->user_data, sizeof(data), 0);
+	ring_readable();
+	TEST_ASSERT_EQUAL(1, write_handler_fake.call_count);
+}
+
+static void init_other_socket(struct cio_socket *other, struct cio_socket_ext *other_ext)
+{
+	memset(other, 0, sizeof(*other));
+	memset(other_ext, 0, sizeof(*other_ext));
+	other->ev.fd = socket_fd + 1;
+	other->loop = &loop;
+	other->close_hook = on_close;
+	other->stream.context = other;
+	other->ext = other_ext;
+}
+
+static void test_attach_without_submission_entry(void)
+{
+	static struct cio_socket others[SQ_ENTRIES];
+	static struct cio_socket_ext other_exts[SQ_ENTRIES];
+	struct cio_socket other;
+	struct cio_socket_ext other_ext;
+	unsigned int unregistered;
+	unsigned int i;
+
+	/*
+	 * While the kernel takes no entries, the other sockets fill the
+	 * submission queue.
+	 */
+	kernel_busy = true;
+	for (i = 0; i < SQ_ENTRIES; i++) {
+		init_other_socket(&others[i], &other_exts[i]);
+		TEST_ASSERT_EQUAL(cio_success, cio_linux_uring_attach(&ring, &others[i]));
+	}
+
+	init_other_socket(&other, &other_ext);
+	unregistered = cio_linux_eventloop_unregister_read_fake.call_count;
+	TEST_ASSERT_EQUAL(cio_no_buffer_space, cio_linux_uring_attach(&ring, &other));
+	TEST_ASSERT_EQUAL(unregistered, cio_linux_eventloop_unregister_read_fake.call_count);
+	TEST_ASSERT_NULL(other_ext.uring);
+	TEST_ASSERT_NULL(other.stream.ops);
+
+	kernel_busy = false;
+	run_deferred();
+	TEST_ASSERT_EQUAL(cio_success, cio_linux_uring_attach(&ring, &other));
+	TEST_ASSERT_NOT_NULL(other_ext.uring);
+
+	TEST_ASSERT_TRUE(cio_linux_uring_detach(other_ext.uring));
+	for (i = 0; i < SQ_ENTRIES; i++) {
+		TEST_ASSERT_TRUE(cio_linux_uring_detach(other_exts[i].uring));
+	}
+
+	run_deferred();
+	ring_readable();
+	TEST_ASSERT_EQUAL(SQ_ENTRIES + 1, on_close_fake.call_count);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_receive_is_multishot);
+	RUN_TEST(test_read_across_buffers);
+	RUN_TEST(test_read_parts_of_buffers);
+	RUN_TEST(test_readv_across_buffers);
+	RUN_TEST(test_enobufs_restarts_after_buffer_returned);
+	RUN_TEST(test_enobufs_restarts_right_away);
+	RUN_TEST(test_partial_send);
+	RUN_TEST(test_writev_error);
+	RUN_TEST(test_timeouts_follow_reads);
+	RUN_TEST(test_timed_out_send_is_cancelled);
+	RUN_TEST(test_send_completed_before_cancel);
+	RUN_TEST(test_detach_with_operations_in_flight);
+	RUN_TEST(test_overflowed_completions_are_reaped);
+	RUN_TEST(test_submit_reaps_overflowed_completions);
+	RUN_TEST(test_attach_without_submission_entry);
+	return UNITY_END();
+}